@@ -20,7 +20,7 @@ LOCAL_SRC_FILES := $(SDL_PATH)/src/main/android/SDL_android_main.c \
 	zlib/gzwrite.c zlib/infback.c zlib/inffast.c zlib/inflate.c \
 	zlib/inftrees.c zlib/trees.c zlib/uncompr.c zlib/zutil.c \
 	nuklear_ui/font_android.c nuklear_ui/blastem_nuklear.c nuklear_ui/sfnt.c \
-	ppm.c controller_info.c png.c system.c genesis.c sms.c serialize.c \
+	ppm.c controller_info.c png.c capture.c system.c genesis.c sms.c serialize.c rewind.c runahead.c netplay.c \
 	saves.c hash.c xband.c zip.c bindings.c jcart.c paths.c megawifi.c \
 	nor.c i2c.c sega_mapper.c realtec.c multi_game.c net.c
 
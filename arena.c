@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include "arena.h"
+#include "util.h"
 
 struct arena {
 	void **used_blocks;
@@ -19,7 +20,7 @@ struct arena {
 
 #define DEFAULT_STORAGE_SIZE 8
 
-static arena *current_arena;
+static INSTANCE_LOCAL arena *current_arena;
 
 arena *get_current_arena()
 {
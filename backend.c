@@ -340,3 +340,34 @@ uint32_t ram_size(cpu_options *opts)
 	}
 	return size;
 }
+
+void init_mem_pages(cpu_options *opts, void **mem_pointers, mem_page *pages)
+{
+	uint32_t page_size = 1 << opts->mem_page_shift;
+	uint32_t num_pages = (opts->address_mask >> opts->mem_page_shift) + 1;
+	for (uint32_t page = 0; page < num_pages; page++)
+	{
+		uint32_t start = page << opts->mem_page_shift;
+		//a NULL base sends the access to the regular dispatcher, the mask is chosen to leave the address alone
+		pages[page].base = NULL;
+		pages[page].mask = opts->address_mask;
+		for (memmap_chunk const *cur = opts->memmap, *end = opts->memmap + opts->memmap_chunks; cur != end; cur++)
+		{
+			if (cur->end <= start || cur->start >= start + page_size) {
+				continue;
+			}
+			//the first overlapping chunk wins, just like in the dispatcher, and it needs to cover the whole page
+			if (
+				cur->start <= start && cur->end >= start + page_size && (cur->flags & MMAP_READ) && !cur->shift
+				&& !(cur->flags & (MMAP_ONLY_ODD|MMAP_ONLY_EVEN|MMAP_FUNC_NULL|MMAP_AUX_BUFF))
+				&& (opts->byte_swap || !(cur->flags & MMAP_BYTESWAP))
+			) {
+				pages[page].base = cur->flags & MMAP_PTR_IDX
+					? (uint8_t **)(mem_pointers + cur->ptr_index)
+					: (uint8_t **)&cur->buffer;
+				pages[page].mask = cur->mask;
+			}
+			break;
+		}
+	}
+}
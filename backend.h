@@ -34,6 +34,13 @@ typedef struct {
 	int32_t  *offsets;
 } native_map_slot;
 
+//Page table entry for fast memory reads. base points at the live buffer pointer for the chunk
+//that covers the page so bank switches through mem_pointers are picked up without any update
+typedef struct {
+	uint8_t  **base;
+	uint32_t mask;
+} mem_page;
+
 typedef struct deferred_addr {
 	struct deferred_addr *next;
 	code_ptr             dest;
@@ -46,11 +53,14 @@ typedef struct deferred_addr {
 typedef void * (*watchpoint16_fun)(uint32_t address, void * context, uint16_t);
 typedef void * (*watchpoint8_fun)(uint32_t address, void * context, uint8_t);
 
+typedef struct jit_cache jit_cache;
+
 typedef struct {
 	uint32_t flags;
 	native_map_slot    *native_code_map;
 	deferred_addr      *deferred;
 	code_info          code;
+	jit_cache          *jit_cache; //persistent translation cache, NULL when disabled
 	uint8_t            **ram_inst_sizes;
 	memmap_chunk const *memmap;
 	code_ptr           save_context;
@@ -68,12 +78,15 @@ typedef struct {
 	uint32_t           max_address;
 	uint32_t           bus_cycles;
 	uint32_t           clock_divider;
+	uint32_t           cycle_tally; //running total of cycles emitted by cycles(), lets a translator measure static costs
 	uint32_t           move_pc_off;
 	uint32_t           move_pc_size;
 	int32_t            watchpoint_range_off;
 	int32_t            mem_ptr_off;
+	int32_t            mem_pages_off;
 	int32_t            ram_flags_off;
 	uint8_t            ram_flags_shift;
+	uint8_t            mem_page_shift; //log2 of the page size for mem_pages, 0 if there is no page table
 	uint8_t            address_size;
 	uint8_t            byte_swap;
 	int8_t             context_reg;
@@ -109,6 +122,7 @@ uint8_t read_byte(uint32_t address, void **mem_pointers, cpu_options *opts, void
 void write_byte(uint32_t address, uint8_t value, void **mem_pointers, cpu_options *opts, void *context);
 memmap_chunk const *find_map_chunk(uint32_t address, cpu_options *opts, uint16_t flags, uint32_t *size_sum);
 uint32_t chunk_size(cpu_options *opts, memmap_chunk const *chunk);
+void init_mem_pages(cpu_options *opts, void **mem_pointers, mem_page *pages);
 uint32_t ram_size(cpu_options *opts);
 
 #endif //BACKEND_H_
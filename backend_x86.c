@@ -1,9 +1,11 @@
 #include "backend.h"
 #include "gen_x86.h"
 #include <string.h>
+#include <stddef.h>
 
 void cycles(cpu_options *opts, uint32_t num)
 {
+	opts->cycle_tally += num*opts->clock_divider;
 	if (opts->limit < 0) {
 		sub_ir(&opts->code, num*opts->clock_divider, opts->cycles, SZ_D);
 	} else {
@@ -130,6 +132,31 @@ code_ptr gen_mem_fun(cpu_options * opts, memmap_chunk const * memmap, uint32_t n
 		and_ir(code, opts->address_mask, adr_reg, SZ_W);
 	}
 
+	if (!is_write && opts->mem_page_shift && memmap == opts->memmap) {
+		//RAM and ROM reads are resolved with a single lookup in the page table in the context
+		uint32_t stack_off = code->stack_off;
+		push_r(code, opts->scratch2);
+		mov_rr(code, adr_reg, opts->scratch2, SZ_D);
+		shr_ir(code, opts->mem_page_shift, opts->scratch2, SZ_D);
+		shl_ir(code, sizeof(mem_page) == 16 ? 4 : 3, opts->scratch2, SZ_PTR);
+		add_rr(code, opts->context_reg, opts->scratch2, SZ_PTR);
+		and_rdispr(code, opts->scratch2, opts->mem_pages_off + offsetof(mem_page, mask), adr_reg, SZ_D);
+		mov_rdispr(code, opts->scratch2, opts->mem_pages_off + offsetof(mem_page, base), opts->scratch2, SZ_PTR);
+		test_rr(code, opts->scratch2, opts->scratch2, SZ_PTR);
+		code_ptr not_paged = code->cur + 1;
+		jcc(code, CC_Z, code->cur + 2);
+		mov_rindr(code, opts->scratch2, opts->scratch2, SZ_PTR);
+		if (size == SZ_B && opts->byte_swap) {
+			xor_ir(code, 1, adr_reg, SZ_D);
+		}
+		mov_rindexr(code, opts->scratch2, adr_reg, 1, opts->scratch1, size);
+		pop_r(code, opts->scratch2);
+		retn(code);
+		*not_paged = code->cur - (not_paged + 1);
+		code->stack_off = stack_off + sizeof(void *);
+		pop_r(code, opts->scratch2);
+	}
+
 	code_ptr check_watchpoints = size == SZ_W ? (code_ptr)opts->check_watchpoints_16 : (code_ptr)opts->check_watchpoints_8;
 	if (is_write && check_watchpoints) {
 		//watchpoints are enabled, check if the address is within the watchpoint range
@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "libretro.h"
+#include "system.h"
+#include "blastem.h"
+#include "util.h"
+#include "benchmark.h"
+
+#define DEFAULT_FRAMES 600
+
+#define FNV_OFFSET 0xCBF29CE484222325ULL
+#define FNV_PRIME  0x100000001B3ULL
+
+typedef struct {
+	char     *rom;
+	char     *state;
+	char     *error;
+	uint64_t video_hash;
+	uint64_t audio_hash;
+	uint64_t ns;
+} batch_job;
+
+static batch_job *jobs;
+static uint32_t num_jobs;
+static uint32_t next_job;
+static uint32_t frames = DEFAULT_FRAMES;
+
+static INSTANCE_LOCAL batch_job *current_job;
+static INSTANCE_LOCAL uint32_t current_frame;
+
+static uint64_t fnv1a(uint64_t hash, const uint8_t *data, size_t size)
+{
+	for (const uint8_t *end = data + size; data < end; data++)
+	{
+		hash = (hash ^ *data) * FNV_PRIME;
+	}
+	return hash;
+}
+
+static bool environment(unsigned cmd, void *data)
+{
+	return false;
+}
+
+static void video_refresh(const void *data, unsigned width, unsigned height, size_t pitch)
+{
+	//only the final frame is compared so don't bother hashing the others
+	if (current_frame != frames) {
+		return;
+	}
+	uint64_t hash = FNV_OFFSET;
+	const uint8_t *line = data;
+	for (unsigned y = 0; y < height; y++, line += pitch)
+	{
+		hash = fnv1a(hash, line, width * sizeof(uint32_t));
+	}
+	current_job->video_hash = hash;
+}
+
+static size_t audio_sample_batch(const int16_t *data, size_t num_frames)
+{
+	current_job->audio_hash = fnv1a(current_job->audio_hash, (const uint8_t *)data, num_frames * 2 * sizeof(int16_t));
+	return num_frames;
+}
+
+static void input_poll(void)
+{
+}
+
+static int16_t input_state(unsigned port, unsigned device, unsigned index, unsigned id)
+{
+	return 0;
+}
+
+static void run_job(batch_job *job)
+{
+	current_job = job;
+	job->audio_hash = FNV_OFFSET;
+	FILE *f = fopen(job->rom, "rb");
+	if (!f) {
+		job->error = "Failed to open ROM";
+		return;
+	}
+	long size = file_size(f);
+	uint8_t *data = malloc(size);
+	if (size <= 0 || fread(data, 1, size, f) != size) {
+		fclose(f);
+		free(data);
+		job->error = "Failed to read ROM";
+		return;
+	}
+	fclose(f);
+	if (job->state && !get_modification_time(job->state)) {
+		//a missing state would otherwise be a fatal error that takes down every other run
+		free(data);
+		job->error = "Failed to open save state";
+		return;
+	}
+	struct retro_game_info info = {
+		.path = job->rom,
+		.data = data,
+		.size = size
+	};
+	uint8_t loaded = retro_load_game(&info);
+	free(data);
+	if (!loaded) {
+		job->error = "Failed to configure emulated machine";
+		return;
+	}
+	//each start/resume runs exactly one frame since the library frontend requests an exit after each one
+	uint64_t start = bench_now_ns();
+	current_frame = 1;
+	current_system->start_context(current_system, job->state);
+	for (current_frame = 2; current_frame <= frames; current_frame++)
+	{
+		current_system->resume_context(current_system);
+	}
+	job->ns = bench_now_ns() - start;
+	retro_unload_game();
+}
+
+static void *worker(void *unused)
+{
+	retro_set_environment(environment);
+	retro_set_video_refresh(video_refresh);
+	retro_set_audio_sample_batch(audio_sample_batch);
+	retro_set_input_poll(input_poll);
+	retro_set_input_state(input_state);
+	retro_init();
+	for (;;)
+	{
+		//runs vary wildly in cost so workers just grab the next unclaimed one rather than taking fixed slices
+		uint32_t index = __atomic_fetch_add(&next_job, 1, __ATOMIC_RELAXED);
+		if (index >= num_jobs) {
+			break;
+		}
+		run_job(jobs + index);
+	}
+	retro_deinit();
+	return NULL;
+}
+
+static void load_job_list(char *path)
+{
+	FILE *f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (!f) {
+		fatal_error("Failed to open job list %s\n", path);
+	}
+	uint32_t storage = 0;
+	char line[4096];
+	while (fgets(line, sizeof(line), f))
+	{
+		char *rom = strip_ws(line);
+		if (!*rom || *rom == '#') {
+			continue;
+		}
+		//tab separated so that paths may contain spaces
+		char *state = strchr(rom, '\t');
+		if (state) {
+			*(state++) = 0;
+			state = strip_ws(state);
+		}
+		if (num_jobs == storage) {
+			storage = storage ? storage * 2 : 64;
+			jobs = realloc(jobs, storage * sizeof(batch_job));
+		}
+		batch_job *job = jobs + num_jobs++;
+		memset(job, 0, sizeof(*job));
+		job->rom = strdup(rom);
+		job->state = state && *state ? strdup(state) : NULL;
+	}
+	if (f != stdin) {
+		fclose(f);
+	}
+}
+
+static void write_results(FILE *f)
+{
+	fprintf(f, "{\n\t\"frames\": %u,\n\t\"runs\": [", frames);
+	for (uint32_t i = 0; i < num_jobs; i++)
+	{
+		batch_job *job = jobs + i;
+		fputs(i ? ",\n\t\t{\n" : "\n\t\t{\n", f);
+		fputs("\t\t\t\"rom\": ", f);
+		bench_write_json_string(f, job->rom);
+		fputs(",\n\t\t\t\"state\": ", f);
+		bench_write_json_string(f, job->state);
+		if (job->error) {
+			fputs(",\n\t\t\t\"error\": ", f);
+			bench_write_json_string(f, job->error);
+		} else {
+			double seconds = job->ns / 1000000000.0;
+			fprintf(f, ",\n\t\t\t\"video_hash\": \"%016llX\",\n\t\t\t\"audio_hash\": \"%016llX\",\n\t\t\t\"seconds\": %.6f,\n\t\t\t\"fps\": %.3f",
+				(unsigned long long)job->video_hash, (unsigned long long)job->audio_hash, seconds, seconds > 0 ? frames / seconds : 0.0);
+		}
+		fputs("\n\t\t}", f);
+	}
+	fputs(num_jobs ? "\n\t]\n}\n" : "]\n}\n", f);
+}
+
+int main(int argc, char **argv)
+{
+	long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	char *output = NULL;
+	int i;
+	for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++)
+	{
+		if (i + 1 >= argc) {
+			fatal_error("%s must be followed by a value\n", argv[i]);
+		}
+		switch (argv[i][1])
+		{
+		case 'f':
+			frames = atoi(argv[++i]);
+			break;
+		case 'j':
+			num_threads = atoi(argv[++i]);
+			break;
+		case 'o':
+			output = argv[++i];
+			break;
+		default:
+			fatal_error("Unrecognized switch %s\n", argv[i]);
+		}
+	}
+	if (i >= argc) {
+		fatal_error(
+			"Usage: blastem-batch [OPTIONS] JOBLIST\n"
+			"Runs each ROM listed in JOBLIST headlessly and reports hashes of the final frame and all audio as JSON\n"
+			"Each line of JOBLIST is a ROM path optionally followed by a tab and a save state to start from\n"
+			"Options:\n"
+			"	-f FRAMES   Number of frames to run for each entry (default %d)\n"
+			"	-j THREADS  Number of worker threads (default is the number of CPUs)\n"
+			"	-o FILE     Write results to FILE instead of stdout\n",
+			DEFAULT_FRAMES
+		);
+	}
+	if (!frames) {
+		fatal_error("Frame count must be at least 1\n");
+	}
+	if (num_threads < 1) {
+		num_threads = 1;
+	}
+	load_job_list(argv[i]);
+	FILE *f;
+	if (output) {
+		f = fopen(output, "w");
+		if (!f) {
+			fatal_error("Failed to open %s for writing\n", output);
+		}
+	} else {
+		//the core prints status messages to stdout, send those to stderr so the results can be piped
+		fflush(stdout);
+		f = fdopen(dup(STDOUT_FILENO), "w");
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+	}
+	disable_stdout_messages();
+	if (num_threads > num_jobs) {
+		num_threads = num_jobs ? num_jobs : 1;
+	}
+	pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+	for (long t = 0; t < num_threads; t++)
+	{
+		if (pthread_create(threads + t, NULL, worker, NULL)) {
+			fatal_error("Failed to create worker thread\n");
+		}
+	}
+	for (long t = 0; t < num_threads; t++)
+	{
+		pthread_join(threads[t], NULL);
+	}
+	write_results(f);
+	fclose(f);
+	return 0;
+}
@@ -0,0 +1,126 @@
+#include <string.h>
+#ifdef _WIN32
+#define WINVER 0x501
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include "benchmark.h"
+#include "util.h"
+
+#define MAX_BENCH_DEPTH 16
+
+INSTANCE_LOCAL uint8_t bench_active;
+static INSTANCE_LOCAL bench_subsystem stack[MAX_BENCH_DEPTH];
+static INSTANCE_LOCAL uint32_t depth;
+static INSTANCE_LOCAL uint64_t last_ns, start_ns;
+static INSTANCE_LOCAL uint64_t totals[BENCH_NUM_SUBSYSTEMS];
+
+static const char *subsystem_names[BENCH_NUM_SUBSYSTEMS] = {
+	"m68k", "z80", "sound", "vdp", "io", "scd"
+};
+
+uint64_t bench_now_ns(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER count;
+	if (!freq.QuadPart) {
+		QueryPerformanceFrequency(&freq);
+	}
+	QueryPerformanceCounter(&count);
+	return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000000ULL + (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000000ULL / freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+//charges the time since the last transition to the subsystem on top of the stack
+static void charge(void)
+{
+	uint64_t now = bench_now_ns();
+	totals[stack[depth - 1]] += now - last_ns;
+	last_ns = now;
+}
+
+void bench_push(bench_subsystem sub)
+{
+	charge();
+	if (depth == MAX_BENCH_DEPTH) {
+		fatal_error("Benchmark subsystem nesting is too deep\n");
+	}
+	stack[depth++] = sub;
+}
+
+void bench_pop(void)
+{
+	charge();
+	if (depth > 1) {
+		depth--;
+	}
+}
+
+void bench_begin(void)
+{
+	memset(totals, 0, sizeof(totals));
+	depth = 1;
+	stack[0] = BENCH_M68K;
+	start_ns = last_ns = bench_now_ns();
+	bench_active = 1;
+}
+
+void bench_end(bench_result *result)
+{
+	charge();
+	bench_active = 0;
+	result->total_ns = last_ns - start_ns;
+	memcpy(result->subsystem_ns, totals, sizeof(totals));
+}
+
+void bench_write_json_string(FILE *f, const char *str)
+{
+	if (!str) {
+		fputs("null", f);
+		return;
+	}
+	fputc('"', f);
+	for (; *str; str++)
+	{
+		unsigned char c = *str;
+		if (c == '"' || c == '\\') {
+			fprintf(f, "\\%c", c);
+		} else if (c < 0x20) {
+			fprintf(f, "\\u%04X", c);
+		} else {
+			fputc(c, f);
+		}
+	}
+	fputc('"', f);
+}
+
+void bench_write_json(FILE *f, bench_result *results, uint32_t num_results)
+{
+	fputs("{\n\t\"benchmarks\": [", f);
+	for (uint32_t i = 0; i < num_results; i++)
+	{
+		bench_result *res = results + i;
+		double seconds = res->total_ns / 1000000000.0;
+		fputs(i ? ",\n\t\t{\n" : "\n\t\t{\n", f);
+		fputs("\t\t\t\"name\": ", f);
+		bench_write_json_string(f, res->name);
+		fputs(",\n\t\t\t\"rom\": ", f);
+		bench_write_json_string(f, res->rom);
+		fputs(",\n\t\t\t\"state\": ", f);
+		bench_write_json_string(f, res->state);
+		fprintf(f, ",\n\t\t\t\"frames\": %u,\n\t\t\t\"seconds\": %.6f,\n\t\t\t\"fps\": %.3f,\n\t\t\t\"subsystem_seconds\": {",
+			res->frames, seconds, seconds > 0 ? res->frames / seconds : 0.0);
+		for (int sub = 0; sub < BENCH_NUM_SUBSYSTEMS; sub++)
+		{
+			fprintf(f, "%s\n\t\t\t\t\"%s\": %.6f", sub ? "," : "", subsystem_names[sub], res->subsystem_ns[sub] / 1000000000.0);
+		}
+		fputs("\n\t\t\t}\n\t\t}", f);
+	}
+	fputs(num_results ? "\n\t]\n}\n" : "]\n}\n", f);
+}
@@ -0,0 +1,42 @@
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include "util.h"
+
+typedef enum {
+	BENCH_M68K, //everything not attributed to another subsystem, mostly 68K code
+	BENCH_Z80,
+	BENCH_SOUND,
+	BENCH_VDP,
+	BENCH_IO,
+	BENCH_SCD,
+	BENCH_NUM_SUBSYSTEMS
+} bench_subsystem;
+
+typedef struct {
+	char     *name;
+	char     *rom;
+	char     *state;
+	uint64_t subsystem_ns[BENCH_NUM_SUBSYSTEMS];
+	uint64_t total_ns;
+	uint32_t frames;
+} bench_result;
+
+extern INSTANCE_LOCAL uint8_t bench_active;
+
+void bench_push(bench_subsystem sub);
+void bench_pop(void);
+void bench_begin(void);
+void bench_end(bench_result *result);
+void bench_write_json(FILE *f, bench_result *results, uint32_t num_results);
+uint64_t bench_now_ns(void);
+//writes str as a quoted and escaped JSON string or null if str is NULL
+void bench_write_json_string(FILE *f, const char *str);
+
+//time spent between these is charged to sub rather than whatever subsystem called it
+#define BENCH_ENTER(sub) do { if (bench_active) { bench_push(sub); } } while (0)
+#define BENCH_EXIT() do { if (bench_active) { bench_pop(); } } while (0)
+
+#endif //BENCHMARK_H_
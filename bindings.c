@@ -11,6 +11,7 @@
 #include "menu.h"
 #include "bindings.h"
 #include "controller_info.h"
+#include "capture.h"
 #ifndef DISABLE_NUKLEAR
 #include "nuklear_ui/blastem_nuklear.h"
 #endif
@@ -27,6 +28,7 @@ typedef enum {
 	UI_ENTER_DEBUGGER,
 	UI_SAVE_STATE,
 	UI_LOAD_STATE,
+	UI_REWIND,
 	UI_SET_SPEED,
 	UI_NEXT_SPEED,
 	UI_PREV_SPEED,
@@ -216,6 +218,10 @@ void handle_binding_down(keybinding * binding)
 	{
 		current_system->mouse_down(current_system, binding->subtype_a, binding->subtype_b);
 	}
+	else if (binding->bind_type == BIND_UI && binding->subtype_a == UI_REWIND && current_system->rewind)
+	{
+		current_system->rewinding = 1;
+	}
 }
 
 static uint8_t keyboard_captured;
@@ -337,6 +343,11 @@ void handle_binding_up(keybinding * binding)
 				current_system->load_state(current_system, QUICK_SAVE_SLOT);
 			}
 			break;
+		case UI_REWIND:
+			if (current_system) {
+				current_system->rewinding = 0;
+			}
+			break;
 		case UI_NEXT_SPEED:
 			if (allow_content_binds) {
 				current_speed++;
@@ -410,7 +421,7 @@ void handle_binding_up(keybinding * binding)
 					render_end_video();
 					render_end_audio();
 				} else {
-					char *path = get_content_config_path("ui\0video_path\0", "ui\0video_template\0", "blastem_%c.apng");
+					char *path = get_content_config_path("ui\0video_path\0", "ui\0video_template\0", capture_video_template());
 					render_save_video(path);
 					path = get_content_config_path("ui\0audio_path\0", "ui\0audio_template\0", "blastem_%c.wav");
 					render_save_audio(path);
@@ -661,6 +672,8 @@ int parse_binding_target(int device_num, const char * target, tern_node * padbut
 			*subtype_a = UI_SAVE_STATE;
 		} else if(!strcmp(target + 3, "load_state")) {
 			*subtype_a = UI_LOAD_STATE;
+		} else if(!strcmp(target + 3, "rewind")) {
+			*subtype_a = UI_REWIND;
 		} else if(startswith(target + 3, "set_speed.")) {
 			*subtype_a = UI_SET_SPEED;
 			*subtype_b = atoi(target + 3 + strlen("set_speed."));
@@ -33,6 +33,11 @@
 #include "zip.h"
 #include "cdimage.h"
 #include "event_log.h"
+#include "gen_player.h"
+#include "rewind.h"
+#include "runahead.h"
+#include "netplay.h"
+#include "benchmark.h"
 #ifndef DISABLE_NUKLEAR
 #include "nuklear_ui/blastem_nuklear.h"
 #endif
@@ -184,6 +189,39 @@ uint32_t load_media_zip(const char *filename, system_media *dst)
 	return 0;
 }
 
+static uint32_t map_rom(char *filename, char *ext, system_media *dst)
+{
+	FILE *f = fopen(filename, "rb");
+	if (!f) {
+		return 0;
+	}
+	long size = file_size(f);
+	uint32_t ret = 0;
+	if (size > 0 && size <= 0x80000000) {
+		//match the padding the read path provides, mappers and byteswap_rom assume the buffer covers nearest_pow2(size)
+		size_t buffer_size = nearest_pow2(size);
+		if (buffer_size < 512 * 1024) {
+			buffer_size = 512 * 1024;
+		}
+		dst->buffer = map_file_private(f, size, buffer_size);
+		if (dst->buffer) {
+			ret = size;
+#ifndef BLASTEM_BIG_ENDIAN
+			//Genesis ROMs get byteswapped in place, which would copy every page of the mapping
+			//on top of faulting it in, so they're cheaper to just read
+			system_media probe = {.buffer = dst->buffer, .size = size, .extension = ext};
+			if (detect_system_type(&probe) == SYSTEM_GENESIS) {
+				free_rom_buffer(dst->buffer);
+				dst->buffer = NULL;
+				ret = 0;
+			}
+#endif
+		}
+	}
+	fclose(f);
+	return ret;
+}
+
 uint32_t load_media(char * filename, system_media *dst, system_type *stype)
 {
 	uint8_t header[10];
@@ -229,6 +267,15 @@ uint32_t load_media(char * filename, system_media *dst, system_type *stype)
 			}
 			ret = load_smd_rom(f, &dst->buffer);
 		}
+#ifndef DISABLE_ZLIB
+	uint8_t direct = gzdirect(f);
+#else
+	uint8_t direct = 1;
+#endif
+	//CUE and TOC sheets get parsed and freed so there's no point mapping them
+	if (!ret && direct && (!ext || (strcasecmp(ext, "cue") && strcasecmp(ext, "toc")))) {
+		ret = map_rom(filename, ext, dst);
+	}
 
 	if (!ret) {
 		size_t filesize = 512 * 1024;
@@ -372,11 +419,108 @@ void setup_saves(system_media *media, system_header *context)
 		|| (context->type == SYSTEM_GENESIS && info->wants_cd)
 	) {
 		context->load_save(context);
-		if (!persist_save_registered) {
-			atexit(persist_save);
-			persist_save_registered = 1;
+	} else if (strcmp(tern_find_path_default(config, "system\0jit_cache\0", (tern_val){.ptrval = "off"}, TVAL_PTR).ptrval, "on")) {
+		//nothing to persist, the translation cache is also written out by persist_save
+		return;
+	}
+	if (!persist_save_registered) {
+		atexit(persist_save);
+		persist_save_registered = 1;
+	}
+}
+
+static void setup_rewind(system_header *context)
+{
+	if (context->type != SYSTEM_GENESIS && context->type != SYSTEM_SEGACD && context->type != SYSTEM_SMS) {
+		return;
+	}
+	char *enabled = tern_find_path_default(config, "system\0rewind\0", (tern_val){.ptrval = "off"}, TVAL_PTR).ptrval;
+	if (strcmp(enabled, "on")) {
+		return;
+	}
+	uint32_t megabytes = atoi(tern_find_path_default(config, "system\0rewind_memory\0", (tern_val){.ptrval = "32"}, TVAL_PTR).ptrval);
+	uint32_t interval = atoi(tern_find_path_default(config, "system\0rewind_interval\0", (tern_val){.ptrval = "2"}, TVAL_PTR).ptrval);
+	uint32_t keyframe_interval = atoi(tern_find_path_default(config, "system\0rewind_keyframe_interval\0", (tern_val){.ptrval = "30"}, TVAL_PTR).ptrval);
+	if (!megabytes) {
+		warning("system.rewind_memory must be at least 1, rewind disabled\n");
+		return;
+	}
+	context->rewind = rewind_alloc((size_t)megabytes * 1024 * 1024, interval, keyframe_interval);
+}
+
+static void setup_runahead(system_header *context)
+{
+	if (context->type != SYSTEM_GENESIS && context->type != SYSTEM_SEGACD && context->type != SYSTEM_SMS) {
+		return;
+	}
+	uint32_t frames = atoi(tern_find_path_default(config, "system\0runahead\0", (tern_val){.ptrval = "0"}, TVAL_PTR).ptrval);
+	if (!frames) {
+		return;
+	}
+	context->runahead = runahead_alloc(frames);
+}
+
+static void netplay_connect_progress(uint32_t seconds_left)
+{
+	char caption[64];
+	snprintf(caption, sizeof(caption), "Waiting for netplay peer, %us left - BlastEm", seconds_left);
+	render_update_caption(caption);
+}
+
+static void setup_netplay(system_header *context)
+{
+	if (context->type != SYSTEM_GENESIS && context->type != SYSTEM_SEGACD) {
+		return;
+	}
+	char *mode = tern_find_path_default(config, "system\0netplay\0", (tern_val){.ptrval = "off"}, TVAL_PTR).ptrval;
+	if (!strcmp(mode, "off")) {
+		return;
+	}
+	uint32_t player = atoi(tern_find_path_default(config, "system\0netplay_player\0", (tern_val){.ptrval = "1"}, TVAL_PTR).ptrval);
+	uint32_t input_delay = atoi(tern_find_path_default(config, "system\0netplay_input_delay\0", (tern_val){.ptrval = "1"}, TVAL_PTR).ptrval);
+	if (player != 1 && player != 2) {
+		warning("system.netplay_player must be 1 or 2, netplay disabled\n");
+		return;
+	}
+	if (input_delay > NETPLAY_MAX_INPUT_DELAY) {
+		warning("system.netplay_input_delay can be at most %d, using %d\n", NETPLAY_MAX_INPUT_DELAY, NETPLAY_MAX_INPUT_DELAY);
+	}
+	netplay_session *np = netplay_alloc(player, input_delay);
+	if (!strcmp(mode, "loopback")) {
+		uint32_t delay = atoi(tern_find_path_default(config, "system\0netplay_loopback_delay\0", (tern_val){.ptrval = "4"}, TVAL_PTR).ptrval);
+		np->transport = netplay_loopback(np, delay);
+	} else if (!strcmp(mode, "udp")) {
+		char *local_port = tern_find_path_default(config, "system\0netplay_local_port\0", (tern_val){.ptrval = "5650"}, TVAL_PTR).ptrval;
+		char *peer_address = tern_find_path(config, "system\0netplay_peer_address\0", TVAL_PTR).ptrval;
+		char *peer_port = tern_find_path_default(config, "system\0netplay_peer_port\0", (tern_val){.ptrval = "5650"}, TVAL_PTR).ptrval;
+		if (peer_address && *peer_address) {
+			np->transport = netplay_udp(np, local_port, peer_address, peer_port);
+		} else {
+			warning("system.netplay_peer_address must be set for udp netplay\n");
 		}
+	} else {
+		warning("Unrecognized netplay mode %s\n", mode);
+	}
+	if (!np->transport) {
+		netplay_free(np);
+		return;
+	}
+	//the peer is waited for here rather than by stalling the first frames of emulation
+	uint8_t connected = netplay_connect(np, netplay_connect_progress);
+	if (title) {
+		render_update_caption(title);
+	}
+	if (!connected) {
+		warning("Netplay peer never responded, netplay disabled\n");
+		netplay_free(np);
+		return;
 	}
+	//snapshots of the other features would be invalidated by every rollback
+	runahead_free(context->runahead);
+	context->runahead = NULL;
+	rewind_free(context->rewind);
+	context->rewind = NULL;
+	context->netplay = np;
 }
 
 void apply_updated_config(void)
@@ -501,9 +645,112 @@ void init_system_with_media(char *path, system_type force_stype)
 	}
 	game_system->next_context = menu_system;
 	setup_saves(&cart, game_system);
+	setup_rewind(game_system);
+	setup_runahead(game_system);
+	setup_netplay(game_system);
 	update_title(game_system->info.name);
 }
 
+typedef struct {
+	bench_result *results;
+	uint32_t     num_results;
+	uint32_t     storage;
+} bench_run_state;
+
+static void run_benchmark_entry(char *key, tern_val val, uint8_t valtype, void *data)
+{
+	bench_run_state *state = data;
+	if (valtype != TVAL_NODE) {
+		warning("Benchmark manifest entry %s is not a block, skipping\n", key);
+		return;
+	}
+	char *rom = tern_find_ptr(val.ptrval, "rom");
+	if (!rom) {
+		warning("Benchmark %s has no rom, skipping\n", key);
+		return;
+	}
+	char *statefile = tern_find_ptr(val.ptrval, "state");
+	uint32_t frames = atoi(tern_find_ptr_default(val.ptrval, "frames", "600"));
+	if (!frames) {
+		warning("Benchmark %s has an invalid frame count, skipping\n", key);
+		return;
+	}
+	system_media media = {0};
+	system_type stype = SYSTEM_UNKNOWN;
+	//orig_path is freed along with the rest of media, the manifest's copy is still needed for the results
+	if (!(media.size = load_media(strdup(rom), &media, &stype))) {
+		warning("Failed to open %s for benchmark %s, skipping\n", rom, key);
+		free(media.orig_path);
+		return;
+	}
+	if (stype == SYSTEM_UNKNOWN) {
+		stype = detect_system_type(&media);
+	}
+	if (stype != SYSTEM_GENESIS && stype != SYSTEM_SEGACD) {
+		//subsystem timing is only broken out for the Genesis family
+		warning("Benchmark %s is not a Genesis or Sega CD title, skipping\n", key);
+		free(media.dir);
+		free(media.name);
+		free(media.extension);
+		free(media.orig_path);
+		free_rom_buffer(media.buffer);
+		return;
+	}
+	//saves are deliberately not loaded so that runs are repeatable
+	game_system = current_system = alloc_config_system(stype, &media, opts, force_region);
+	if (!current_system) {
+		fatal_error("Failed to configure emulated machine for benchmark %s\n", key);
+	}
+	if (state->num_results == state->storage) {
+		state->storage = state->storage ? state->storage * 2 : 8;
+		state->results = realloc(state->results, sizeof(bench_result) * state->storage);
+	}
+	bench_result *result = state->results + state->num_results++;
+	memset(result, 0, sizeof(*result));
+	result->name = key;
+	result->rom = rom;
+	result->state = statefile;
+	result->frames = frames;
+	info_message("Running benchmark %s for %u frames\n", key, frames);
+	exit_after = frames;
+	bench_begin();
+	current_system->start_context(current_system, statefile);
+	bench_end(result);
+	exit_after = 0;
+	current_system->free_context(current_system);
+	game_system = current_system = NULL;
+	free(media.dir);
+	free(media.name);
+	free(media.extension);
+	free(media.orig_path);
+}
+
+static void run_benchmarks(char *manifest_path)
+{
+	tern_node *manifest = parse_config_file(manifest_path);
+	if (!manifest) {
+		fatal_error("Failed to load benchmark manifest %s\n", manifest_path);
+	}
+	tern_node *entries = tern_find_node(manifest, "benchmarks");
+	if (!entries) {
+		fatal_error("Benchmark manifest %s has no benchmarks block\n", manifest_path);
+	}
+	bench_run_state state = {0};
+	tern_foreach(entries, run_benchmark_entry, &state);
+	char *output = tern_find_ptr(manifest, "output");
+	FILE *f = output ? fopen(output, "w") : stdout;
+	if (!f) {
+		fatal_error("Failed to open %s for writing benchmark results\n", output);
+	}
+	bench_write_json(f, state.results, state.num_results);
+	if (f != stdout) {
+		fclose(f);
+		info_message("Wrote benchmark results to %s\n", output);
+	}
+	free(state.results);
+	tern_free(manifest);
+}
+
 char *parse_addr_port(char *arg)
 {
 	while (*arg && *arg != ':') {
@@ -539,6 +786,8 @@ int main(int argc, char ** argv)
 	uint8_t fullscreen = FULLSCREEN_DEFAULT, use_gl = 1;
 	uint8_t debug_target = 0;
 	char *port;
+	char *bench_manifest = NULL;
+	uint32_t playback_frame = 0;
 	for (int i = 1; i < argc; i++) {
 		if (argv[i][0] == '-') {
 			switch(argv[i][1]) {
@@ -550,6 +799,14 @@ int main(int argc, char ** argv)
 				headless = 1;
 				exit_after = atoi(argv[i]);
 				break;
+			case 'B':
+				i++;
+				if (i >= argc) {
+					fatal_error("-B must be followed by a benchmark manifest file name\n");
+				}
+				headless = 1;
+				bench_manifest = argv[i];
+				break;
 			case 'd':
 				start_in_debugger = 1;
 				//allow debugging the menu
@@ -577,6 +834,13 @@ int main(int argc, char ** argv)
 			case 'f':
 				fullscreen = !fullscreen;
 				break;
+			case 'p':
+				i++;
+				if (i >= argc) {
+					fatal_error("-p must be followed by a frame number\n");
+				}
+				playback_frame = atoi(argv[i]);
+				break;
 			case 'g':
 				use_gl = 0;
 				break;
@@ -659,8 +923,11 @@ int main(int argc, char ** argv)
 					"	-n          Disable Z80\n"
 					"	-v          Display version number and exit\n"
 					"	-l          Log 68K code addresses (useful for assemblers)\n"
+					"	-b FRAMES   Run headless for FRAMES frames and exit\n"
+					"	-B FILE     Run the benchmarks listed in manifest FILE and report timings as JSON\n"
 					"	-y          Log individual YM-2612 channels to WAVE files\n"
 					"   -e FILE     Write hardware event log to FILE\n"
+					"	-p FRAME    Start playback of an event log at FRAME\n"
 				);
 				return 0;
 			default:
@@ -714,6 +981,10 @@ int main(int argc, char ** argv)
 		render_set_drag_drop_handler(on_drag_drop);
 	}
 	set_bindings();
+	if (bench_manifest) {
+		run_benchmarks(bench_manifest);
+		return 0;
+	}
 
 	uint8_t menu = !loaded;
 	uint8_t use_nuklear = 0;
@@ -769,6 +1040,9 @@ int main(int argc, char ** argv)
 		if (!current_system) {
 			fatal_error("Failed to configure emulated machine for %s\n", romfname);
 		}
+		if (playback_frame && current_system->type == SYSTEM_GENESIS_PLAYER) {
+			gen_player_seek((gen_player *)current_system, playback_frame);
+		}
 
 		setup_saves(&cart, current_system);
 		update_title(current_system->info.name);
@@ -776,6 +1050,9 @@ int main(int argc, char ** argv)
 			menu_system = current_system;
 		} else {
 			game_system = current_system;
+			setup_rewind(game_system);
+			setup_runahead(game_system);
+			setup_netplay(game_system);
 		}
 	}
 
@@ -3,18 +3,19 @@
 
 #include "tern.h"
 #include "system.h"
+#include "util.h"
 
 extern int headless;
-extern int exit_after;
-extern int z80_enabled;
+extern INSTANCE_LOCAL int exit_after;
+extern INSTANCE_LOCAL int z80_enabled;
 extern int frame_limit;
 
-extern tern_node * config;
-extern system_header *current_system;
+extern INSTANCE_LOCAL tern_node * config;
+extern INSTANCE_LOCAL system_header *current_system;
 
 extern char *save_state_path;
-extern char *save_filename;
-extern uint8_t use_native_states;
+extern INSTANCE_LOCAL char *save_filename;
+extern INSTANCE_LOCAL uint8_t use_native_states;
 void reload_media(void);
 void lockon_media(char *lock_on_path);
 void init_system_with_media(char *path, system_type force_stype);
@@ -0,0 +1,437 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+#include <signal.h>
+#endif
+#include "capture.h"
+#include "render.h"
+#include "util.h"
+#include "blastem.h"
+#include "wave.h"
+#ifndef DISABLE_ZLIB
+#include "png.h"
+#endif
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#define PIPE_MODE "wb"
+#else
+#define PIPE_MODE "w"
+#endif
+
+//both must be powers of 2
+#define CAPTURE_FRAMES 16
+#define CAPTURE_SAMPLES (256*1024)
+
+#define DEFAULT_PIPE_COMMAND "ffmpeg -loglevel error -y -f yuv4mpegpipe -i - -c:v libx264 -pix_fmt yuv420p"
+
+static const char *format_names[] = {"apng", "y4m", "pipe"};
+static const char *format_templates[] = {"blastem_%c.apng", "blastem_%c.y4m", "blastem_%c.mkv"};
+
+enum {
+	STREAM_IDLE,
+	STREAM_ACTIVE,
+	STREAM_CLOSING
+};
+
+//Files are only touched by the encoder thread while a stream is active or closing and only
+//by the thread starting or ending a recording while it is idle
+static uint8_t video_state, video_format;
+static FILE *video_file;
+//all frames are cropped or padded to the size of the first one
+static uint32_t canvas_width, canvas_height;
+static float video_frame_rate;
+static uint8_t header_written;
+#ifndef DISABLE_ZLIB
+static apng_state *apng;
+#endif
+static uint8_t *yuv_buffer;
+static uint32_t *frame_slots[CAPTURE_FRAMES];
+static uint32_t frame_read, frame_write, dropped_frames;
+//number of capture_video_frame calls in progress, ending a recording waits for these to finish
+static uint32_t video_producers;
+
+//capture_audio is called from the audio callback, render_audio.c makes sure it isn't running
+//when recording starts or ends
+static uint8_t audio_state;
+static FILE *wav_file;
+static int16_t *sample_ring;
+static uint32_t sample_read, sample_write, dropped_samples;
+
+#ifndef IS_LIB
+static render_thread thread;
+//posted whenever there is new data or a stream is closing
+static render_semaphore encoder_wake;
+static render_semaphore video_closed, audio_closed;
+static uint8_t thread_started, thread_failed;
+#endif
+
+static uint8_t format_from_config(void)
+{
+	char *format = tern_find_path_default(config, "ui\0video_format\0", (tern_val){.ptrval = "apng"}, TVAL_PTR).ptrval;
+	for (uint8_t i = 0; i < sizeof(format_names)/sizeof(*format_names); i++)
+	{
+		if (!strcmp(format, format_names[i])) {
+			return i;
+		}
+	}
+	warning("Unrecognized video format %s, using APNG\n", format);
+	return CAPTURE_APNG;
+}
+
+static void write_y4m_frame(uint32_t *pixels)
+{
+	if (!header_written) {
+		fprintf(video_file, "YUV4MPEG2 W%u H%u F%u:1000 Ip A1:1 C444\n", canvas_width, canvas_height, (uint32_t)(video_frame_rate * 1000.0f + 0.5f));
+		header_written = 1;
+	}
+	size_t plane = canvas_width * canvas_height;
+	uint8_t *y = yuv_buffer, *u = y + plane, *v = u + plane;
+	//BT.601 limited range
+	for (size_t i = 0; i < plane; i++)
+	{
+		int r = pixels[i] >> 16 & 0xFF, g = pixels[i] >> 8 & 0xFF, b = pixels[i] & 0xFF;
+		y[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+		u[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+		v[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+	}
+	fputs("FRAME\n", video_file);
+	fwrite(yuv_buffer, 1, plane * 3, video_file);
+}
+
+//encodes the oldest queued frame, returns 0 if there wasn't one
+static uint8_t encode_video_frame(void)
+{
+	if (frame_read == __atomic_load_n(&frame_write, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+	uint32_t *pixels = frame_slots[frame_read % CAPTURE_FRAMES];
+#ifndef DISABLE_ZLIB
+	if (video_format == CAPTURE_APNG) {
+		if (!apng) {
+			apng = start_apng(video_file, canvas_width, canvas_height, video_frame_rate);
+		}
+		save_png24_frame(video_file, pixels, apng, canvas_width, canvas_height, canvas_width * sizeof(uint32_t));
+	} else {
+#endif
+		write_y4m_frame(pixels);
+#ifndef DISABLE_ZLIB
+	}
+#endif
+	__atomic_store_n(&frame_read, frame_read + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+#ifdef IS_LIB
+static void drain_video(void)
+{
+	while (encode_video_frame())
+	{
+	}
+}
+#endif
+
+static void drain_audio(void)
+{
+	uint32_t write;
+	while (sample_read != (write = __atomic_load_n(&sample_write, __ATOMIC_ACQUIRE)))
+	{
+		uint32_t start = sample_read % CAPTURE_SAMPLES;
+		uint32_t count = write - sample_read;
+		if (count > CAPTURE_SAMPLES - start) {
+			count = CAPTURE_SAMPLES - start;
+		}
+		fwrite(sample_ring + start, sizeof(int16_t), count, wav_file);
+		__atomic_store_n(&sample_read, sample_read + count, __ATOMIC_RELEASE);
+	}
+}
+
+static void finish_video(void)
+{
+#ifndef DISABLE_ZLIB
+	if (apng) {
+		//end_apng closes the file
+		end_apng(video_file, apng);
+		apng = NULL;
+	} else
+#endif
+	if (video_format == CAPTURE_PIPE) {
+		pclose(video_file);
+	} else {
+		fclose(video_file);
+	}
+	video_file = NULL;
+	for (int i = 0; i < CAPTURE_FRAMES; i++)
+	{
+		free(frame_slots[i]);
+		frame_slots[i] = NULL;
+	}
+	free(yuv_buffer);
+	yuv_buffer = NULL;
+}
+
+static void finish_audio(void)
+{
+	//wave_finalize closes the file
+	wave_finalize(wav_file);
+	wav_file = NULL;
+}
+
+#ifndef IS_LIB
+//The encoder thread is started with the first recording and lives for the rest of the process.
+//It sleeps on encoder_wake whenever there is nothing queued
+static int capture_main(void *unused)
+{
+	for (;;)
+	{
+		render_semaphore_wait(encoder_wake);
+		uint8_t state = __atomic_load_n(&video_state, __ATOMIC_ACQUIRE);
+		if (state != STREAM_IDLE) {
+			//audio is drained between frames so a slow frame doesn't starve the sample ring
+			while (encode_video_frame())
+			{
+				if (__atomic_load_n(&audio_state, __ATOMIC_ACQUIRE) != STREAM_IDLE) {
+					drain_audio();
+				}
+			}
+			if (state == STREAM_CLOSING) {
+				finish_video();
+				__atomic_store_n(&video_state, STREAM_IDLE, __ATOMIC_RELEASE);
+				render_semaphore_post(video_closed);
+			}
+		}
+		state = __atomic_load_n(&audio_state, __ATOMIC_ACQUIRE);
+		if (state != STREAM_IDLE) {
+			drain_audio();
+			if (state == STREAM_CLOSING) {
+				finish_audio();
+				__atomic_store_n(&audio_state, STREAM_IDLE, __ATOMIC_RELEASE);
+				render_semaphore_post(audio_closed);
+			}
+		}
+	}
+	return 0;
+}
+
+static uint8_t start_thread(void)
+{
+	if (!thread_started) {
+		thread_started = 1;
+		thread_failed = !render_create_semaphore(&encoder_wake)
+			|| !render_create_semaphore(&video_closed)
+			|| !render_create_semaphore(&audio_closed)
+			|| !render_create_thread(&thread, "Capture encoder", capture_main, NULL);
+	}
+	if (thread_failed) {
+		warning("Failed to create capture encoder thread, recording is unavailable\n");
+		return 0;
+	}
+	return 1;
+}
+#endif
+
+uint8_t capture_start_video(char *path)
+{
+	capture_end_video();
+#ifndef IS_LIB
+	if (!start_thread()) {
+		return 0;
+	}
+#endif
+	uint8_t format = format_from_config();
+#ifdef DISABLE_ZLIB
+	if (format == CAPTURE_APNG) {
+		warning("APNG recording requires zlib, saving Y4M instead\n");
+		format = CAPTURE_Y4M;
+	}
+#else
+	if (format == CAPTURE_APNG) {
+		char *threads = tern_find_path_default(config, "ui\0png_threads\0", (tern_val){.ptrval = "1"}, TVAL_PTR).ptrval;
+		png_set_threads(atoi(threads));
+	}
+#endif
+	FILE *f;
+	if (format == CAPTURE_PIPE) {
+#ifndef _WIN32
+		//an encoder that exits early shouldn't take the emulator down with it
+		signal(SIGPIPE, SIG_IGN);
+#endif
+		char *command = tern_find_path_default(config, "ui\0video_pipe_command\0", (tern_val){.ptrval = DEFAULT_PIPE_COMMAND}, TVAL_PTR).ptrval;
+		char const *parts[] = {command, " \"", path, "\""};
+		char *full_command = alloc_concat_m(4, parts);
+		f = popen(full_command, PIPE_MODE);
+		if (!f) {
+			warning("Failed to start video encoder command %s\n", full_command);
+		}
+		free(full_command);
+	} else {
+		f = fopen(path, "wb");
+		if (!f) {
+			warning("Failed to open %s for writing\n", path);
+		}
+	}
+	if (!f) {
+		return 0;
+	}
+	video_file = f;
+	video_format = format;
+	canvas_width = canvas_height = 0;
+	header_written = 0;
+	frame_read = frame_write = dropped_frames = 0;
+	__atomic_store_n(&video_state, STREAM_ACTIVE, __ATOMIC_SEQ_CST);
+	printf("Saving video to %s\n", path);
+	return 1;
+}
+
+void capture_end_video(void)
+{
+	if (__atomic_load_n(&video_state, __ATOMIC_ACQUIRE) != STREAM_ACTIVE) {
+		return;
+	}
+	__atomic_store_n(&video_state, STREAM_CLOSING, __ATOMIC_SEQ_CST);
+#ifdef IS_LIB
+	drain_video();
+	finish_video();
+	video_state = STREAM_IDLE;
+#else
+	//a frame that saw the stream as active may still be copying into a slot
+	while (__atomic_load_n(&video_producers, __ATOMIC_SEQ_CST))
+	{
+		render_sleep_ms(0);
+	}
+	render_semaphore_post(encoder_wake);
+	render_semaphore_wait(video_closed);
+#endif
+	puts("Ending recording");
+	if (dropped_frames) {
+		warning("Dropped %u frames while recording video\n", dropped_frames);
+	}
+}
+
+uint8_t capture_video_active(void)
+{
+	return __atomic_load_n(&video_state, __ATOMIC_ACQUIRE) == STREAM_ACTIVE;
+}
+
+char *capture_video_template(void)
+{
+	return (char *)format_templates[format_from_config()];
+}
+
+void capture_video_frame(uint32_t *buffer, uint32_t width, uint32_t height, uint32_t pitch, float frame_rate)
+{
+	if (!__atomic_load_n(&video_state, __ATOMIC_RELAXED)) {
+		return;
+	}
+	__atomic_add_fetch(&video_producers, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&video_state, __ATOMIC_SEQ_CST) != STREAM_ACTIVE) {
+		__atomic_sub_fetch(&video_producers, 1, __ATOMIC_SEQ_CST);
+		return;
+	}
+	if (!canvas_width) {
+		canvas_width = width;
+		canvas_height = height;
+		video_frame_rate = frame_rate;
+		for (int i = 0; i < CAPTURE_FRAMES; i++)
+		{
+			frame_slots[i] = malloc(width * height * sizeof(uint32_t));
+		}
+		if (video_format != CAPTURE_APNG) {
+			yuv_buffer = malloc(width * height * 3);
+		}
+	}
+	if (frame_write - __atomic_load_n(&frame_read, __ATOMIC_ACQUIRE) == CAPTURE_FRAMES) {
+		dropped_frames++;
+	} else {
+		uint32_t *dst = frame_slots[frame_write % CAPTURE_FRAMES];
+		uint32_t copy_width = width < canvas_width ? width : canvas_width;
+		for (uint32_t y = 0; y < canvas_height; y++, dst += canvas_width)
+		{
+			uint32_t copied = 0;
+			if (y < height) {
+				memcpy(dst, buffer, copy_width * sizeof(uint32_t));
+				copied = copy_width;
+				buffer += pitch / sizeof(uint32_t);
+			}
+			memset(dst + copied, 0, (canvas_width - copied) * sizeof(uint32_t));
+		}
+		__atomic_store_n(&frame_write, frame_write + 1, __ATOMIC_RELEASE);
+#ifdef IS_LIB
+		drain_video();
+#else
+		render_semaphore_post(encoder_wake);
+#endif
+	}
+	__atomic_sub_fetch(&video_producers, 1, __ATOMIC_SEQ_CST);
+}
+
+uint8_t capture_start_audio(char *path, uint32_t sample_rate, uint8_t channels)
+{
+	capture_end_audio();
+#ifndef IS_LIB
+	if (!start_thread()) {
+		return 0;
+	}
+#endif
+	FILE *f = fopen(path, "wb");
+	if (!f) {
+		warning("Failed to open %s for writing\n", path);
+		return 0;
+	}
+	wave_init(f, sample_rate, 16, channels);
+	if (!sample_ring) {
+		sample_ring = malloc(CAPTURE_SAMPLES * sizeof(int16_t));
+	}
+	wav_file = f;
+	sample_read = sample_write = dropped_samples = 0;
+	__atomic_store_n(&audio_state, STREAM_ACTIVE, __ATOMIC_SEQ_CST);
+	printf("Saving audio to %s\n", path);
+	return 1;
+}
+
+void capture_end_audio(void)
+{
+	if (__atomic_load_n(&audio_state, __ATOMIC_ACQUIRE) != STREAM_ACTIVE) {
+		return;
+	}
+	__atomic_store_n(&audio_state, STREAM_CLOSING, __ATOMIC_SEQ_CST);
+#ifdef IS_LIB
+	drain_audio();
+	finish_audio();
+	audio_state = STREAM_IDLE;
+#else
+	render_semaphore_post(encoder_wake);
+	render_semaphore_wait(audio_closed);
+#endif
+	if (dropped_samples) {
+		warning("Dropped %u audio samples while recording\n", dropped_samples);
+	}
+}
+
+void capture_audio(int16_t *samples, int sample_count)
+{
+	if (__atomic_load_n(&audio_state, __ATOMIC_ACQUIRE) != STREAM_ACTIVE) {
+		return;
+	}
+	uint32_t space = CAPTURE_SAMPLES - (sample_write - __atomic_load_n(&sample_read, __ATOMIC_ACQUIRE));
+	if ((uint32_t)sample_count > space) {
+		dropped_samples += sample_count;
+		return;
+	}
+	uint32_t start = sample_write % CAPTURE_SAMPLES;
+	uint32_t first = sample_count;
+	if (first > CAPTURE_SAMPLES - start) {
+		first = CAPTURE_SAMPLES - start;
+	}
+	memcpy(sample_ring + start, samples, first * sizeof(int16_t));
+	memcpy(sample_ring, samples + first, (sample_count - first) * sizeof(int16_t));
+	__atomic_store_n(&sample_write, sample_write + sample_count, __ATOMIC_RELEASE);
+#ifdef IS_LIB
+	//there is no audio callback in lib builds, this runs on the emulation thread
+	drain_audio();
+#else
+	render_semaphore_post(encoder_wake);
+#endif
+}
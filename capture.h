@@ -0,0 +1,23 @@
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include <stdint.h>
+
+enum {
+	CAPTURE_APNG,
+	CAPTURE_Y4M,
+	CAPTURE_PIPE
+};
+
+//frames are queued and encoded on a background thread, frames and samples that arrive while
+//the queues are full are dropped rather than stalling emulation or audio output
+uint8_t capture_start_video(char *path);
+void capture_end_video(void);
+uint8_t capture_video_active(void);
+char *capture_video_template(void);
+void capture_video_frame(uint32_t *buffer, uint32_t width, uint32_t height, uint32_t pitch, float frame_rate);
+uint8_t capture_start_audio(char *path, uint32_t sample_rate, uint8_t channels);
+void capture_end_audio(void);
+void capture_audio(int16_t *samples, int sample_count);
+
+#endif //CAPTURE_H_
@@ -93,6 +93,164 @@ enum {
 	FAKE_AUDIO,
 };
 
+static uint8_t fake_read(uint32_t sector, uint32_t offset)
+{
+	if (!offset || offset == 11 || (offset >= 16)) {
+		return 0;
+		//TODO: error detection and correction bytes
+	} else if (offset < 11) {
+		return 0xFF;
+	} else if (offset == 12) {
+		uint32_t minute = (sector / 75) / 60;
+		return (minute % 10) | ((minute / 10 ) << 4);
+	} else if (offset == 13) {
+		uint32_t seconds = (sector / 75) % 60;
+		return (seconds % 10) | ((seconds / 10 ) << 4);
+	} else if (offset == 14) {
+		uint32_t frames = sector % 75;
+		return (frames % 10) | ((frames / 10 ) << 4);
+	} else {
+		return 1;
+	}
+}
+
+#define CD_SECTOR_BYTES 2352
+#define SUBCODE_BYTES 96
+#define MAX_SECTOR_BYTES (CD_SECTOR_BYTES + SUBCODE_BYTES)
+//number of raw sectors kept around, enough to cover the BIOS rereading the same few sectors while paused
+#define SECTOR_CACHE_ENTRIES 16
+
+typedef struct {
+	uint32_t track;
+	uint32_t lba;
+	uint32_t last_used;
+	uint8_t  valid;
+	uint8_t  data[MAX_SECTOR_BYTES];
+} cached_sector;
+
+struct sector_cache {
+	cached_sector entries[SECTOR_CACHE_ENTRIES];
+	uint32_t      use_counter;
+	//fully processed sector as seen by the CDD, including fake header bytes, byte swapping and scrambling
+	uint8_t       out[CD_SECTOR_BYTES];
+};
+
+static uint8_t scramble_table[CD_SECTOR_BYTES - 12];
+static uint8_t scramble_table_ready;
+
+static void init_scramble_table(void)
+{
+	uint16_t lsfr = 1;
+	for (uint32_t i = 0; i < sizeof(scramble_table); i++)
+	{
+		scramble_table[i] = cdrom_scramble(&lsfr, 0);
+	}
+}
+
+static uint8_t *cache_fetch(system_media *media, uint32_t track, uint32_t lba)
+{
+	sector_cache *cache = media->sectors;
+	if (!cache) {
+		cache = media->sectors = calloc(1, sizeof(sector_cache));
+	}
+	cache->use_counter++;
+	cached_sector *victim = cache->entries;
+	for (uint32_t i = 0; i < SECTOR_CACHE_ENTRIES; i++)
+	{
+		cached_sector *cur = cache->entries + i;
+		if (cur->valid && cur->track == track && cur->lba == lba) {
+			cur->last_used = cache->use_counter;
+			return cur->data;
+		}
+		if (!cur->valid || (victim->valid && cur->last_used < victim->last_used)) {
+			victim = cur;
+		}
+	}
+	track_info *info = media->tracks + track;
+	uint32_t sector_bytes = info->sector_bytes > MAX_SECTOR_BYTES ? MAX_SECTOR_BYTES : info->sector_bytes;
+	size_t bytes = 0;
+	if (!fseek(info->f, info->file_offset + lba * info->sector_bytes, SEEK_SET)) {
+		bytes = fread(victim->data, 1, sector_bytes, info->f);
+	}
+	if (bytes < sector_bytes) {
+		//match what reading past the end of the file byte by byte with fgetc used to produce
+		memset(victim->data + bytes, 0xFF, sizeof(victim->data) - bytes);
+	}
+	victim->track = track;
+	victim->lba = lba;
+	victim->last_used = cache->use_counter;
+	victim->valid = 1;
+	return victim->data;
+}
+
+void cdimage_free_sectors(system_media *media)
+{
+	free(media->sectors);
+	media->sectors = NULL;
+}
+
+static void fill_fake_sector(system_media *media, uint8_t *out, uint32_t start, uint32_t end)
+{
+	for (uint32_t offset = start; offset < end; offset++)
+	{
+		out[offset] = fake_read(media->cur_sector, offset);
+	}
+}
+
+static void build_sector(system_media *media, uint32_t track, uint32_t lba)
+{
+	if (!media->sectors) {
+		media->sectors = calloc(1, sizeof(sector_cache));
+	}
+	uint8_t *out = media->sectors->out;
+	track_info *info = media->tracks + track;
+	if (media->in_fake_pregap == FAKE_DATA) {
+		fill_fake_sector(media, out, 0, CD_SECTOR_BYTES);
+	} else if (media->in_fake_pregap == FAKE_AUDIO) {
+		memset(out, 0, CD_SECTOR_BYTES);
+	} else if (info->flac) {
+		int16_t samples[CD_SECTOR_BYTES / 2];
+		uint32_t decoded = flac_get_samples(info->flac, samples, CD_SECTOR_BYTES / 4, 2);
+		memset(samples + decoded * 2, 0, sizeof(samples) - decoded * 2 * sizeof(int16_t));
+		for (uint32_t i = 0; i < CD_SECTOR_BYTES / 2; i++)
+		{
+			out[i * 2] = samples[i];
+			out[i * 2 + 1] = samples[i] >> 8;
+		}
+	} else {
+		uint8_t *raw = cache_fetch(media, track, lba);
+		uint32_t start = info->sector_bytes < CD_SECTOR_BYTES ? 16 : 0;
+		uint32_t end = start + info->sector_bytes;
+		if (end > CD_SECTOR_BYTES) {
+			end = CD_SECTOR_BYTES;
+		}
+		fill_fake_sector(media, out, 0, start);
+		if (info->need_swap) {
+			for (uint32_t offset = start; offset + 1 < end; offset += 2)
+			{
+				out[offset] = raw[offset - start + 1];
+				out[offset + 1] = raw[offset - start];
+			}
+		} else {
+			memcpy(out + start, raw, end - start);
+		}
+		fill_fake_sector(media, out, end, CD_SECTOR_BYTES);
+		if (info->has_subcodes) {
+			if (!media->tmp_buffer) {
+				media->tmp_buffer = calloc(1, SUBCODE_BYTES);
+			}
+			memcpy(media->tmp_buffer, raw + info->sector_bytes - SUBCODE_BYTES, SUBCODE_BYTES);
+		}
+	}
+	if (info->type == TRACK_DATA) {
+		run_once(&scramble_table_ready, init_scramble_table);
+		for (uint32_t offset = 12; offset < CD_SECTOR_BYTES; offset++)
+		{
+			out[offset] ^= scramble_table[offset - 12];
+		}
+	}
+}
+
 static uint8_t bin_seek(system_media *media, uint32_t sector)
 {
 	media->cur_sector = sector;
@@ -126,82 +284,16 @@ static uint8_t bin_seek(system_media *media, uint32_t sector)
 			}
 			if (media->tracks[track].flac) {
 				flac_seek(media->tracks[track].flac, (media->tracks[track].file_offset + lba * media->tracks[track].sector_bytes) / 4);
-			} else {
-				if (media->tracks[track].has_subcodes) {
-					if (!media->tmp_buffer) {
-						media->tmp_buffer = calloc(1, 96);
-					}
-					fseek(media->tracks[track].f, media->tracks[track].file_offset + (lba + 1) * media->tracks[track].sector_bytes - 96, SEEK_SET);
-					int bytes = fread(media->tmp_buffer, 1, 96, media->tracks[track].f);
-					if (bytes != 96) {
-						fprintf(stderr, "Only read %d subcode bytes\n", bytes);
-					}
-				}
-				fseek(media->tracks[track].f, media->tracks[track].file_offset + lba * media->tracks[track].sector_bytes, SEEK_SET);
 			}
 		}
-		if (media->tracks[track].type == TRACK_DATA) {
-			media->cdrom_scramble_lsfr = 1;
-		}
+		build_sector(media, track, lba);
 	}
 	return track;
 }
 
-static uint8_t fake_read(uint32_t sector, uint32_t offset)
-{
-	if (!offset || offset == 11 || (offset >= 16)) {
-		return 0;
-		//TODO: error detection and correction bytes
-	} else if (offset < 11) {
-		return 0xFF;
-	} else if (offset == 12) {
-		uint32_t minute = (sector / 75) / 60;
-		return (minute % 10) | ((minute / 10 ) << 4);
-	} else if (offset == 13) {
-		uint32_t seconds = (sector / 75) % 60;
-		return (seconds % 10) | ((seconds / 10 ) << 4);
-	} else if (offset == 14) {
-		uint32_t frames = sector % 75;
-		return (frames % 10) | ((frames / 10 ) << 4);
-	} else {
-		return 1;
-	}
-}
-
 static uint8_t bin_read(system_media *media, uint32_t offset)
 {
-	uint8_t retval;
-	if (media->in_fake_pregap == FAKE_DATA) {
-		retval = fake_read(media->cur_sector, offset);
-	} else if (media->in_fake_pregap == FAKE_AUDIO) {
-		retval = 0;
-	} else if ((media->tracks[media->cur_track].sector_bytes < 2352 && offset < 16) || offset > (media->tracks[media->cur_track].sector_bytes + 16)) {
-		retval = fake_read(media->cur_sector, offset);
-	} else if (media->tracks[media->cur_track].flac) {
-		if (offset & 3) {
-			retval = media->byte_storage[(offset & 3) - 1];
-		} else {
-			int16_t samples[2];
-			flac_get_sample(media->tracks[media->cur_track].flac, samples, 2);
-			media->byte_storage[0] = samples[0] >> 8;
-			media->byte_storage[1] = samples[1];
-			media->byte_storage[2] = samples[1] >> 8;
-			retval = samples[0];
-		}
-	} else {
-		if (media->tracks[media->cur_track].need_swap) {
-			if (offset & 1) {
-				retval = media->byte_storage[0];
-			}
-			media->byte_storage[0] = fgetc(media->tracks[media->cur_track].f);
-		} else {
-			retval = fgetc(media->tracks[media->cur_track].f);
-		}
-	}
-	if (offset >= 12 && media->tracks[media->cur_track].type == TRACK_DATA) {
-		retval = cdrom_scramble(&media->cdrom_scramble_lsfr, retval);
-	}
-	return retval;
+	return media->sectors ? media->sectors->out[offset] : 0;
 }
 
 static uint8_t bin_subcode_read(system_media *media, uint32_t offset)
@@ -419,7 +511,7 @@ uint8_t parse_cue(system_media *media)
 			tracks[track].end_lba += offset;
 		}
 		//replace cue sheet with first sector
-		free(media->buffer);
+		free_rom_buffer(media->buffer);
 		media->buffer = calloc(2048, 1);
 		if (tracks[0].type == TRACK_DATA && tracks[0].sector_bytes == 2352 && !tracks[0].flac) {
 			// if the first track is a data track, don't trust the CUE sheet and look at the MM:SS:FF from first sector
@@ -585,7 +677,7 @@ uint8_t parse_toc(system_media *media)
 	} while (line);
 	if (media->num_tracks > 0 && media->tracks[0].f) {
 		//replace cue sheet with first sector
-		free(media->buffer);
+		free_rom_buffer(media->buffer);
 		media->buffer = calloc(2048, 1);
 		if (tracks[0].type == TRACK_DATA && tracks[0].sector_bytes == 2352) {
 			// if the first track is a data track, don't trust the TOC file and look at the MM:SS:FF from first sector
@@ -645,6 +737,7 @@ void cdimage_serialize(system_media *media, serialize_buffer *buf)
 	save_int32(buf, media->cur_track);
 	save_int32(buf, media->cur_sector);
 	if (media->cur_track < media->num_tracks && media->tracks[media->cur_track].f) {
+		//no longer used on load since sectors are read whole, but kept so the format is unchanged
 		save_int32(buf, ftell(media->tracks[media->cur_track].f));
 	} else {
 		save_int32(buf, 0);
@@ -666,10 +759,7 @@ void cdimage_deserialize(deserialize_buffer *buf, void *vmedia)
 	}
 	media->cur_track = load_int32(buf);
 	media->cur_sector = load_int32(buf);
-	uint32_t seekpos = load_int32(buf);
-	if (media->cur_track < media->num_tracks && media->tracks[media->cur_track].f) {
-		fseek(media->tracks[media->cur_track].f, seekpos, SEEK_SET);
-	}
+	load_int32(buf);//file position, only meaningful for the old byte at a time reader
 	media->in_fake_pregap = load_int8(buf);
 	media->byte_storage[0] = load_int8(buf);
 	if (media->tmp_buffer) {
@@ -679,4 +769,8 @@ void cdimage_deserialize(deserialize_buffer *buf, void *vmedia)
 		media->byte_storage[1] = load_int8(buf);
 		media->byte_storage[2] = load_int8(buf);
 	}
+	if (media->seek == bin_seek && media->cur_track < media->num_tracks) {
+		//regenerate the current sector from the image
+		bin_seek(media, media->cur_sector);
+	}
 }
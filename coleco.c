@@ -180,17 +180,16 @@ static void save_state(coleco_context *coleco, uint8_t slot)
 	serialize_buffer state;
 	init_serialize(&state);
 	coleco_serialize(coleco, &state);
-	save_to_file(&state, save_path);
-	printf("Saved state to %s\n", save_path);
+	//the writer reports success or failure once the file is actually written
+	save_state_async(&state, save_path);
 	free(save_path);
-	free(state.data);
 }
 
 static uint8_t load_state_path(coleco_context *coleco, char *path)
 {
 	deserialize_buffer state;
 	uint8_t ret;
-	if ((ret = load_from_file(&state, path))) {
+	if ((ret = load_state_file(&state, path))) {
 		coleco_deserialize(&state, coleco);
 		free(state.data);
 		printf("Loaded %s\n", path);
@@ -339,7 +338,7 @@ static void free_coleco(system_header *system)
 	z80_options_free(coleco->z80->Z80_OPTS);
 	free(coleco->z80);
 	psg_free(coleco->psg);
-	free(coleco->rom);
+	free_rom_buffer(coleco->rom);
 	free(coleco->header.info.map);
 	free(coleco->header.info.name);
 	free(coleco);
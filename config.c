@@ -316,7 +316,7 @@ static void update_pad_menu_binding(char *key, tern_val val, uint8_t valtype, vo
 	*pads = tern_insert_node(*pads, key, val.ptrval);
 }
 
-#define CONFIG_VERSION 9
+#define CONFIG_VERSION 10
 static tern_node *migrate_config(tern_node *config, int from_version)
 {
 	tern_node *def_config = parse_bundled_config("default.cfg");
@@ -480,6 +480,10 @@ static tern_node *migrate_config(tern_node *config, int from_version)
 		free(exts[0]);//All extensions in this list share an allocation, first one is a pointer to the buffer
 		free(exts);
 	}
+	case 9: {
+		char *binding_bs = tern_find_path_default(config, "bindings\0keys\0backspace\0", (tern_val){.ptrval = "ui.rewind"}, TVAL_PTR).ptrval;
+		config = tern_insert_path(config, "bindings\0keys\0backspace\0", (tern_val){.ptrval = strdup(binding_bs)}, TVAL_PTR);
+	}
 	}
 	char buffer[16];
 	sprintf(buffer, "%d", CONFIG_VERSION);
@@ -581,7 +585,7 @@ uint32_t get_lowpass_cutoff(tern_node *config)
 
 tern_node *get_systems_config(void)
 {
-	static tern_node *systems;
+	static INSTANCE_LOCAL tern_node *systems;
 	if (!systems) {
 		systems = parse_bundled_config("systems.cfg");
 	}
@@ -2,12 +2,26 @@
 #define WINVER 0x501
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#ifndef POLLIN
+//WSAPoll isn't available on the targeted Windows version so only the structure is needed
+struct pollfd {
+	int   fd;
+	short events;
+	short revents;
+};
+#define POLLIN   0x100
+#define POLLOUT  0x10
+#define POLLERR  0x1
+#define POLLHUP  0x2
+#define POLLNVAL 0x4
+#endif
 #else
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <netdb.h>
 #include <netinet/tcp.h>
+#include <poll.h>
 #endif
 
 #include <stdlib.h>
@@ -24,19 +38,19 @@ enum {
 	CMD_GAMEPAD_UP,
 };
 
-static uint8_t active, fully_active;
-static FILE *event_file;
-static serialize_buffer buffer;
-static uint8_t *compressed;
-static size_t compressed_storage;
-static z_stream output_stream;
-static uint32_t last;
+static INSTANCE_LOCAL uint8_t active, fully_active;
+static INSTANCE_LOCAL FILE *event_file;
+static INSTANCE_LOCAL serialize_buffer buffer;
+static INSTANCE_LOCAL uint8_t *compressed;
+static INSTANCE_LOCAL size_t compressed_storage;
+static INSTANCE_LOCAL z_stream output_stream;
+static INSTANCE_LOCAL uint32_t last;
 
-static void event_log_common_init(void)
+static void event_log_common_init(uint8_t *output, size_t storage)
 {
 	init_serialize(&buffer);
-	compressed_storage = 128*1024;
-	compressed = malloc(compressed_storage);
+	compressed_storage = storage;
+	compressed = output;
 	deflateInit(&output_stream, 9);
 	output_stream.avail_out = compressed_storage;
 	output_stream.next_out = compressed;
@@ -46,28 +60,50 @@ static void event_log_common_init(void)
 	active = 1;
 }
 
-static uint8_t multi_count;
-static size_t multi_start;
+static const char el_ident[] = "BLSTEL\x02\x00";
+static const char el_index_ident[] = "BLSTELIX";
+
+static INSTANCE_LOCAL uint8_t multi_count;
+static INSTANCE_LOCAL size_t multi_start;
 static void finish_multi(void)
 {
 	buffer.data[multi_start] |= multi_count - 2;
 	multi_count = 0;
 }
 
-static void file_finish(void)
+//number of frames between keyframes in recordings
+#define KEYFRAME_INTERVAL 300
+//frame, cycle and 64-bit offset of the new zlib stream relative to the start of compressed data
+#define KEYFRAME_ENTRY_SIZE 16
+
+static INSTANCE_LOCAL uint64_t file_offset; //compressed bytes written to event_file
+static INSTANCE_LOCAL serialize_buffer keyframe_index;
+static INSTANCE_LOCAL uint32_t num_keyframes, frame_count, last_keyframe_frame;
+
+static void write_compressed(void)
 {
-	fwrite(compressed, 1, output_stream.next_out - compressed, event_file);
+	size_t size = output_stream.next_out - compressed;
+	fwrite(compressed, 1, size, event_file);
+	file_offset += size;
 	output_stream.next_out = compressed;
 	output_stream.avail_out = compressed_storage;
+}
+
+static void file_finish(void)
+{
+	write_compressed();
 	int result = deflate(&output_stream, Z_FINISH);
 	if (Z_STREAM_END != result) {
 		fatal_error("Final deflate call returned %d\n", result);
 	}
-	fwrite(compressed, 1, output_stream.next_out - compressed, event_file);
+	write_compressed();
+	//keyframe index goes after the compressed data so it can be found from the end of the file
+	save_int32(&keyframe_index, num_keyframes);
+	fwrite(keyframe_index.data, 1, keyframe_index.size, event_file);
+	fwrite(el_index_ident, 1, sizeof(el_index_ident) - 1, event_file);
 	fclose(event_file);
 }
 
-static const char el_ident[] = "BLSTEL\x02\x00";
 void event_log_file(char *fname)
 {
 	event_file = fopen(fname, "wb");
@@ -76,23 +112,107 @@ void event_log_file(char *fname)
 		return;
 	}
 	fwrite(el_ident, 1, sizeof(el_ident) - 1, event_file);
-	event_log_common_init();
+	event_log_common_init(malloc(128*1024), 128*1024);
+	init_serialize(&keyframe_index);
 	fully_active = 1;
 	atexit(file_finish);
 }
 
+//Compressed output for remotes is kept in a list of segments that are never modified once
+//published. Every remote just tracks its own position in the list so any number of them can
+//share the same deflate output and a segment is freed as soon as the slowest remote moves past it
+typedef struct event_segment event_segment;
+struct event_segment {
+	event_segment *next;       //holds a reference
+	uint8_t       *data;
+	uint64_t      start;       //position of the first byte in the overall stream
+	size_t        size;        //bytes published so far
+	size_t        capacity;
+	uint32_t      refcount;
+	uint8_t       sealed;      //no more data will be published
+	uint8_t       stream_end;  //data ends on a zlib stream boundary
+};
+
 typedef struct {
-	uint8_t  *send_progress;
+	event_segment *segment;    //starts at a private copy of the system start header
+	size_t   offset;
 	int      sock;
 	uint8_t  players[1]; //TODO: Expand when support for multiple players per remote is added
 	uint8_t  num_players;
+	uint8_t  lagging;
 } remote;
 
-static int listen_sock;
-static remote remotes[7];
-static int num_remotes;
-static uint8_t available_players[7] = {2,3,4,5,6,7,8};
-static int num_available_players = 7;
+#define SEGMENT_SIZE (64*1024)
+//compressed bytes between zlib stream boundaries, lagging remotes can only skip ahead at one
+#define STREAM_CHUNK (64*1024)
+//backlog at which a remote is skipped ahead to a fresh keyframe
+#define LAG_BYTES (256*1024)
+//backlog at which a remote is dropped
+#define DROP_BYTES (16*1024*1024)
+
+static INSTANCE_LOCAL int listen_sock;
+static INSTANCE_LOCAL remote *remotes;
+static INSTANCE_LOCAL struct pollfd *poll_fds;
+static INSTANCE_LOCAL int num_remotes, remote_storage;
+static INSTANCE_LOCAL event_segment *tail;     //segment deflate is currently writing to
+static INSTANCE_LOCAL event_segment *keyframe; //most recent state, continues into the shared stream
+static INSTANCE_LOCAL uint64_t stream_start;
+static INSTANCE_LOCAL uint8_t keyframe_requested;
+static INSTANCE_LOCAL uint8_t available_players[7] = {2,3,4,5,6,7,8};
+static INSTANCE_LOCAL int num_available_players = 7;
+
+static event_segment *segment_alloc(size_t capacity, uint64_t start)
+{
+	event_segment *seg = calloc(1, sizeof(event_segment));
+	seg->data = malloc(capacity);
+	seg->capacity = capacity;
+	seg->start = start;
+	seg->refcount = 1;
+	return seg;
+}
+
+static void segment_release(event_segment *seg)
+{
+	while (seg && !--seg->refcount)
+	{
+		event_segment *next = seg->next;
+		free(seg->data);
+		free(seg);
+		seg = next;
+	}
+}
+
+static void segment_publish(void)
+{
+	tail->size = output_stream.next_out - tail->data;
+}
+
+static void set_tail(event_segment *seg)
+{
+	tail = seg;
+	compressed = seg->data;
+	compressed_storage = seg->capacity;
+	output_stream.next_out = compressed;
+	output_stream.avail_out = compressed_storage;
+}
+
+//seals the current segment and moves deflate output to a new one
+static void segment_advance(uint8_t stream_end)
+{
+	segment_publish();
+	tail->sealed = 1;
+	tail->stream_end = stream_end;
+	event_segment *old = tail;
+	old->next = segment_alloc(SEGMENT_SIZE, old->start + old->size);
+	//one reference for the link and one for the writer
+	old->next->refcount++;
+	set_tail(old->next);
+	segment_release(old);
+	if (stream_end) {
+		stream_start = tail->start;
+	}
+}
+
 void event_log_tcp(char *address, char *port)
 {
 	struct addrinfo request, *result;
@@ -121,13 +241,15 @@ void event_log_tcp(char *address, char *port)
 		goto cleanup_address;
 	}
 	socket_blocking(listen_sock, 0);
-	event_log_common_init();
+	event_segment *seg = segment_alloc(SEGMENT_SIZE, 0);
+	event_log_common_init(seg->data, seg->capacity);
+	set_tail(seg);
 cleanup_address:
 	freeaddrinfo(result);
 }
 
-static uint8_t *system_start;
-static size_t system_start_size;
+static INSTANCE_LOCAL uint8_t *system_start;
+static INSTANCE_LOCAL size_t system_start_size;
 void event_system_start(system_type stype, vid_std video_std, char *name)
 {
 	if (!active) {
@@ -158,8 +280,8 @@ void event_system_start(system_type stype, vid_std video_std, char *name)
 //Four byte: 8-bit type, 24-bit signed delta
 #define FORMAT_3BYTE 0xE0
 #define FORMAT_4BYTE 0xF0
-static uint8_t last_event_type = 0xFF;
-static uint32_t last_delta;
+static INSTANCE_LOCAL uint8_t last_event_type = 0xFF;
+static INSTANCE_LOCAL uint32_t last_delta;
 static void event_header(uint8_t type, uint32_t cycle)
 {
 	uint32_t delta = cycle - last;
@@ -227,101 +349,255 @@ static uint8_t next_available_player(void)
 	return lowest;
 }
 
-static void flush_socket(void)
+//the system start header has been queued but no keyframe has been prepared to follow it yet
+static uint8_t remote_waiting(remote *r)
+{
+	return r->segment->sealed && !r->segment->next;
+}
+
+//chains a keyframe onto the system start header of a waiting remote
+static void remote_attach(remote *r, event_segment *seg)
+{
+	r->segment->next = seg;
+	r->segment->start = seg->start - r->segment->size;
+	seg->refcount++;
+}
+
+static uint64_t remote_backlog(remote *r)
 {
-	int remote_sock = accept(listen_sock, NULL, NULL);
-	if (remote_sock != -1) {
-		if (num_remotes == 7) {
-			socket_close(remote_sock);
+	return tail->start + tail->size - (r->segment->start + r->offset);
+}
+
+static void drop_remote(int index)
+{
+	remote *r = remotes + index;
+	socket_close(r->sock);
+	for (int j = 0; j < r->num_players; j++) {
+		available_players[num_available_players++] = r->players[j];
+	}
+	segment_release(r->segment);
+	remotes[index] = remotes[--num_remotes];
+	if (!num_remotes) {
+		//last remote disconnected, reset buffers/deflate
+		fully_active = 0;
+		deflateReset(&output_stream);
+		segment_release(keyframe);
+		keyframe = NULL;
+		keyframe_requested = 0;
+		event_segment *old = tail;
+		set_tail(segment_alloc(SEGMENT_SIZE, 0));
+		segment_release(old);
+		stream_start = 0;
+		buffer.size = 0;
+		output_stream.next_in = buffer.data;
+		output_stream.avail_in = 0;
+	}
+}
+
+static void request_keyframe(void)
+{
+	if (!keyframe_requested) {
+		keyframe_requested = 1;
+		current_system->save_state = EVENTLOG_SLOT + 1;
+	}
+}
+
+static void accept_remotes(void)
+{
+	int remote_sock;
+	while ((remote_sock = accept(listen_sock, NULL, NULL)) != -1)
+	{
+		//a slow remote must never stall emulation, so the header goes out with the rest of the stream
+		socket_blocking(remote_sock, 0);
+		int flag = 1;
+		setsockopt(remote_sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&flag, sizeof(flag));
+		if (num_remotes == remote_storage) {
+			remote_storage = remote_storage ? remote_storage * 2 : 8;
+			remotes = realloc(remotes, remote_storage * sizeof(remote));
+			poll_fds = realloc(poll_fds, remote_storage * sizeof(struct pollfd));
+		}
+		printf("remote %d connected\n", num_remotes);
+		uint8_t player = next_available_player();
+		remote *r = remotes + num_remotes++;
+		*r = (remote){
+			.sock = remote_sock,
+			.players = {player},
+			.num_players = player == 0xFF ? 0 : 1
+		};
+		r->segment = segment_alloc(system_start_size, 0);
+		memcpy(r->segment->data, system_start, system_start_size);
+		r->segment->size = system_start_size;
+		r->segment->sealed = 1;
+		if (keyframe && tail->start + tail->size - keyframe->next->start < STREAM_CHUNK) {
+			//recent enough that new remotes can share it rather than waiting for another
+			remote_attach(r, keyframe);
 		} else {
-			printf("remote %d connected\n", num_remotes);
-			uint8_t player = next_available_player();
-			remotes[num_remotes++] = (remote){
-				.sock = remote_sock,
-				.send_progress = NULL,
-				.players = {player},
-				.num_players = player == 0xFF ? 0 : 1
-			};
-			current_system->save_state = EVENTLOG_SLOT + 1;
+			request_keyframe();
 		}
 	}
-	uint8_t *min_progress = compressed;
-	for (int i = 0; i < num_remotes; i++) {
-		if (remotes[i].send_progress) {
-			uint8_t recv_buffer[1500];
-			int bytes = recv(remotes[i].sock, recv_buffer, sizeof(recv_buffer), 0);
-			for (int j = 0; j < bytes; j++)
-			{
-				uint8_t cmd = recv_buffer[j];
-				switch(cmd)
-				{
-				case CMD_GAMEPAD_DOWN:
-				case CMD_GAMEPAD_UP: {
-					++j;
-					if (j < bytes) {
-						uint8_t button = recv_buffer[j];
-						uint8_t pad = (button >> 5) - 1;
-						button &= 0x1F;
-						if (pad <  remotes[i].num_players) {
-							pad = remotes[i].players[pad];
-							if (cmd == CMD_GAMEPAD_DOWN) {
-								current_system->gamepad_down(current_system, pad, button);
-							} else {
-								current_system->gamepad_up(current_system, pad, button);
-							}
-						}
+}
+
+static void handle_commands(remote *r, uint8_t *recv_buffer, int bytes)
+{
+	for (int j = 0; j < bytes; j++)
+	{
+		uint8_t cmd = recv_buffer[j];
+		switch(cmd)
+		{
+		case CMD_GAMEPAD_DOWN:
+		case CMD_GAMEPAD_UP: {
+			++j;
+			if (j < bytes) {
+				uint8_t button = recv_buffer[j];
+				uint8_t pad = (button >> 5) - 1;
+				button &= 0x1F;
+				if (pad <  r->num_players) {
+					pad = r->players[pad];
+					if (cmd == CMD_GAMEPAD_DOWN) {
+						current_system->gamepad_down(current_system, pad, button);
 					} else {
-						warning("Received incomplete command %X\n", cmd);
+						current_system->gamepad_up(current_system, pad, button);
 					}
-					break;
-				}
-				default:
-					warning("Unrecognized remote command %X\n", cmd);
-					j = bytes;
 				}
+			} else {
+				warning("Received incomplete command %X\n", cmd);
 			}
-			int sent = 1;
-			while (sent && output_stream.next_out > remotes[i].send_progress)
-			{
-				sent = send(remotes[i].sock, remotes[i].send_progress, output_stream.next_out - remotes[i].send_progress, 0);
-				if (sent >= 0) {
-					remotes[i].send_progress += sent;
-				} else if (!socket_error_is_wouldblock()) {
-					socket_close(remotes[i].sock);
-					for (int j = 0; j < remotes[i].num_players; j++) {
-						available_players[num_available_players++] = remotes[i].players[j];
-					}
-					remotes[i] = remotes[num_remotes-1];
-					num_remotes--;
-					if (!num_remotes) {
-						//last remote disconnected, reset buffers/deflate
-						fully_active = 0;
-						deflateReset(&output_stream);
-						output_stream.next_out = compressed;
-						output_stream.avail_out = compressed_storage;
-						buffer.size = 0;
-					}
-					i--;
-					break;
-				}
-				if (remotes[i].send_progress > min_progress) {
-					min_progress = remotes[i].send_progress;
-				}
+			break;
+		}
+		default:
+			warning("Unrecognized remote command %X\n", cmd);
+			j = bytes;
+		}
+	}
+}
+
+//sends as much of the stream as the socket will take, returns 0 if the remote should be dropped
+static uint8_t send_remote(remote *r)
+{
+	while (r->segment)
+	{
+		event_segment *seg = r->segment;
+		if (r->offset == seg->size) {
+			if (!seg->next) {
+				//either the live tail or a header still waiting for its keyframe
+				return 1;
 			}
+			event_segment *next = seg->next;
+			if (r->lagging && seg->stream_end && keyframe && keyframe->next->start > seg->start + seg->size) {
+				//the keyframe replaces everything before it so skip straight to it
+				next = keyframe;
+				r->lagging = 0;
+			}
+			next->refcount++;
+			r->segment = next;
+			r->offset = 0;
+			segment_release(seg);
+			continue;
+		}
+		int sent = send(r->sock, (const char *)seg->data + r->offset, seg->size - r->offset, 0);
+		if (sent > 0) {
+			r->offset += sent;
+		} else if (sent < 0 && socket_error_is_wouldblock()) {
+			return 1;
+		} else {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void flush_socket(void)
+{
+	segment_publish();
+	accept_remotes();
+	for (int i = 0; i < num_remotes; i++)
+	{
+		poll_fds[i].fd = remotes[i].sock;
+		poll_fds[i].events = POLLIN;
+		if (remotes[i].offset < remotes[i].segment->size || remotes[i].segment->next) {
+			poll_fds[i].events |= POLLOUT;
 		}
+		poll_fds[i].revents = 0;
+	}
+#ifdef _WIN32
+	//sockets are non-blocking so just try all of them
+	for (int i = 0; i < num_remotes; i++)
+	{
+		poll_fds[i].revents = poll_fds[i].events;
 	}
-	if (min_progress == output_stream.next_out) {
-		output_stream.next_out = compressed;
-		output_stream.avail_out = compressed_storage;
-		for (int i = 0; i < num_remotes; i++) {
-			if (remotes[i].send_progress) {
-				remotes[i].send_progress = compressed;
+#else
+	if (num_remotes && poll(poll_fds, num_remotes, 0) < 0) {
+		return;
+	}
+#endif
+	//walk backwards so dropping a remote doesn't disturb the ones not yet visited
+	for (int i = num_remotes - 1; i >= 0; i--)
+	{
+		remote *r = remotes + i;
+		short revents = poll_fds[i].revents;
+		if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			drop_remote(i);
+			continue;
+		}
+		if (revents & POLLIN) {
+			uint8_t recv_buffer[1500];
+			int bytes = recv(r->sock, (char *)recv_buffer, sizeof(recv_buffer), 0);
+			if (!bytes || (bytes < 0 && !socket_error_is_wouldblock())) {
+				drop_remote(i);
+				continue;
+			}
+			handle_commands(r, recv_buffer, bytes);
+		}
+		if ((revents & POLLOUT) && !send_remote(r)) {
+			drop_remote(i);
+			continue;
+		}
+		if (remote_waiting(r)) {
+			continue;
+		}
+		uint64_t backlog = remote_backlog(r);
+		if (backlog > DROP_BYTES) {
+			warning("Dropping remote %d, it is too far behind\n", i);
+			drop_remote(i);
+		} else if (backlog > LAG_BYTES) {
+			r->lagging = 1;
+			if (!keyframe || keyframe->next->start <= r->segment->start + r->offset) {
+				request_keyframe();
 			}
+		} else if (backlog < LAG_BYTES / 4) {
+			//only consider a remote caught up once it is well under the threshold, otherwise
+			//it can flip back and forth before it reaches a point where it could skip ahead
+			r->lagging = 0;
 		}
 	}
 }
 
-uint8_t wrote_since_last_flush;
+//compresses everything in buffer without flushing
+static void deflate_buffer(void)
+{
+	//buffer may have been reallocated since the last call so always point deflate at it again
+	output_stream.next_in = buffer.data;
+	output_stream.avail_in = buffer.size;
+	do {
+		if (!output_stream.avail_out) {
+			if (listen_sock) {
+				segment_advance(0);
+			} else {
+				write_compressed();
+			}
+		}
+		int result = deflate(&output_stream, Z_NO_FLUSH);
+		//no progress just means the previous call happened to fill the output exactly
+		if (result != Z_OK && result != Z_BUF_ERROR) {
+			fatal_error("deflate returned %d\n", result);
+		}
+	} while (!output_stream.avail_out);
+	//deflate only returns with output space left once all input is consumed
+	buffer.size = 0;
+	output_stream.next_in = buffer.data;
+}
+
+INSTANCE_LOCAL uint8_t wrote_since_last_flush;
 void event_log(uint8_t type, uint32_t cycle, uint8_t size, uint8_t *payload)
 {
 	if (!fully_active) {
@@ -332,29 +608,15 @@ void event_log(uint8_t type, uint32_t cycle, uint8_t size, uint8_t *payload)
 	save_buffer8(&buffer, payload, size);
 	if (!multi_count) {
 		last_event_type = 0xFF;
-		output_stream.avail_in = buffer.size - (output_stream.next_in - buffer.data);
-		int result = deflate(&output_stream, Z_NO_FLUSH);
-		if (result != Z_OK) {
-			fatal_error("deflate returned %d\n", result);
-		}
-		if (listen_sock) {
-			if ((output_stream.next_out - compressed) > 1280 || !output_stream.avail_out) {
-				flush_socket();
-				wrote_since_last_flush = 1;
-			}
-		} else if (!output_stream.avail_out) {
-			fwrite(compressed, 1, compressed_storage, event_file);
-			output_stream.next_out = compressed;
-			output_stream.avail_out = compressed_storage;
-		}
-		if (!output_stream.avail_in) {
-			buffer.size = 0;
-			output_stream.next_in = buffer.data;
+		deflate_buffer();
+		if (listen_sock && (output_stream.next_out - compressed) - tail->size > 1280) {
+			flush_socket();
+			wrote_since_last_flush = 1;
 		}
 	}
 }
 
-static uint32_t last_word_address;
+static INSTANCE_LOCAL uint32_t last_word_address;
 void event_vram_word(uint32_t cycle, uint32_t address, uint16_t value)
 {
 	uint32_t delta = address - last_word_address;
@@ -368,7 +630,7 @@ void event_vram_word(uint32_t cycle, uint32_t address, uint16_t value)
 	last_word_address = address;
 }
 
-static uint32_t last_byte_address;
+static INSTANCE_LOCAL uint32_t last_byte_address;
 void event_vram_byte(uint32_t cycle, uint16_t address, uint8_t byte, uint8_t auto_inc)
 {
 	uint32_t delta = address - last_byte_address;
@@ -401,34 +663,28 @@ static size_t send_all(int sock, uint8_t *data, size_t size, int flags)
 
 void deflate_flush(uint8_t full)
 {
-	output_stream.avail_in = buffer.size - (output_stream.next_in - buffer.data);
-	uint8_t force = full;
-	while (output_stream.avail_in || force)
-	{
+	output_stream.next_in = buffer.data;
+	output_stream.avail_in = buffer.size;
+	int result;
+	do {
 		if (!output_stream.avail_out) {
-			size_t old_storage = compressed_storage;
-			uint8_t *old_compressed = compressed;
-			compressed_storage *= 2;
-			compressed = realloc(compressed, compressed_storage);
-			output_stream.next_out = compressed + old_storage;
-			output_stream.avail_out = old_storage;
-			for (int i = 0; i < num_remotes; i++) {
-				if (remotes[i].send_progress) {
-					remotes[i].send_progress = compressed + (remotes[i].send_progress - old_compressed);
-				}
+			if (listen_sock) {
+				segment_advance(0);
+			} else {
+				write_compressed();
 			}
 		}
-		int result = deflate(&output_stream, full ? Z_FINISH : Z_SYNC_FLUSH);
-		if (result != (full ? Z_STREAM_END : Z_OK)) {
+		result = deflate(&output_stream, full ? Z_FINISH : Z_SYNC_FLUSH);
+		if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
 			fatal_error("deflate returned %d\n", result);
 		}
-		if (full && result == Z_STREAM_END) {
-			result = deflateReset(&output_stream);
-			if (result != Z_OK) {
-				fatal_error("deflateReset returned %d\n", result);
-			}
+		//a flush is only complete once deflate returns with output space to spare
+	} while (full ? result != Z_STREAM_END : !output_stream.avail_out);
+	if (full) {
+		result = deflateReset(&output_stream);
+		if (result != Z_OK) {
+			fatal_error("deflateReset returned %d\n", result);
 		}
-		force = 0;
 	}
 	output_stream.next_in = buffer.data;
 	buffer.size = 0;
@@ -436,6 +692,15 @@ void deflate_flush(uint8_t full)
 
 void event_state(uint32_t cycle, serialize_buffer *state)
 {
+	keyframe_requested = 0;
+	uint8_t waiting = 0;
+	for (int i = 0; i < num_remotes; i++)
+	{
+		waiting |= remote_waiting(remotes + i) || remotes[i].lagging;
+	}
+	if (!waiting && !event_file) {
+		return;
+	}
 	if (!fully_active) {
 		last = cycle;
 	}
@@ -445,52 +710,52 @@ void event_state(uint32_t cycle, serialize_buffer *state)
 		last_byte_address >> 8, last_byte_address,
 		state->size >> 16, state->size >> 8, state->size
 	};
-	uint8_t sent_system_start = 0;
-	for (int i = 0; i < num_remotes; i++)
-	{
-		if (!remotes[i].send_progress) {
-			if (send_all(remotes[i].sock, system_start, system_start_size, 0) == system_start_size) {
-				sent_system_start = 1;
-			} else {
-				socket_close(remotes[i].sock);
-				remotes[i] = remotes[num_remotes-1];
-				num_remotes--;
-				i--;
-			}
+	if (fully_active) {
+		if (multi_count) {
+			finish_multi();
 		}
+		//the next event starts a new zlib stream so it can't be merged with anything before it
+		last_event_type = 0xFF;
+		//full flush is needed so new and old clients can share a stream
+		deflate_flush(1);
 	}
-	if (sent_system_start) {
-		if (fully_active) {
-			if (multi_count) {
-				finish_multi();
-			}
-			//full flush is needed so new and old clients can share a stream
-			deflate_flush(1);
-		}
+	if (event_file) {
+		//a new zlib stream starts here so playback can begin at this point
+		write_compressed();
+		save_int32(&keyframe_index, frame_count);
+		save_int32(&keyframe_index, last);
+		save_int32(&keyframe_index, file_offset >> 32);
+		save_int32(&keyframe_index, file_offset);
+		num_keyframes++;
+		last_keyframe_frame = frame_count;
 		save_buffer8(&buffer, header, sizeof(header));
 		save_buffer8(&buffer, state->data, state->size);
-		size_t old_compressed_size = output_stream.next_out - compressed;
-		deflate_flush(1);
-		size_t state_size = output_stream.next_out - compressed - old_compressed_size;
-		for (int i = 0; i < num_remotes; i++) {
-			if (!remotes[i].send_progress) {
-				if (send_all(remotes[i].sock, compressed + old_compressed_size, state_size, 0) == state_size) {
-					remotes[i].send_progress = compressed + old_compressed_size;
-					socket_blocking(remotes[i].sock, 0);
-					int flag = 1;
-					setsockopt(remotes[i].sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&flag, sizeof(flag));
-					fully_active = 1;
-				} else {
-					socket_close(remotes[i].sock);
-					remotes[i] = remotes[num_remotes-1];
-					num_remotes--;
-					i--;
-				}
-			}
+		deflate_buffer();
+		return;
+	}
+	segment_advance(1);
+	//the state goes in its own segment that is only sent to remotes joining or skipping ahead
+	save_buffer8(&buffer, header, sizeof(header));
+	save_buffer8(&buffer, state->data, state->size);
+	event_segment *shared = tail;
+	event_segment *seg = segment_alloc(deflateBound(&output_stream, buffer.size), 0);
+	set_tail(seg);
+	deflate_flush(1);
+	segment_publish();
+	seg->sealed = seg->stream_end = 1;
+	seg->start = shared->start - seg->size;
+	seg->next = shared;
+	shared->refcount++;
+	set_tail(shared);
+	segment_release(keyframe);
+	keyframe = seg;
+	for (int i = 0; i < num_remotes; i++)
+	{
+		if (remote_waiting(remotes + i)) {
+			remote_attach(remotes + i, keyframe);
 		}
-		output_stream.next_out = compressed + old_compressed_size;
-		output_stream.avail_out = compressed_storage - old_compressed_size;
 	}
+	fully_active = 1;
 }
 
 void event_flush(uint32_t cycle)
@@ -502,13 +767,20 @@ void event_flush(uint32_t cycle)
 		event_header(EVENT_FLUSH, cycle);
 		last = cycle;
 		
-		deflate_flush(0);
+		//end the zlib stream every so often so lagging remotes have somewhere to skip ahead from
+		uint8_t end_stream = listen_sock && tail->start + (output_stream.next_out - compressed) - stream_start >= STREAM_CHUNK;
+		deflate_flush(end_stream);
+		if (end_stream) {
+			segment_advance(1);
+		}
 	}
 	if (event_file) {
-		fwrite(compressed, 1, output_stream.next_out - compressed, event_file);
+		write_compressed();
 		fflush(event_file);
-		output_stream.next_out = compressed;
-		output_stream.avail_out = compressed_storage;
+		frame_count++;
+		if ((!num_keyframes || frame_count - last_keyframe_frame >= KEYFRAME_INTERVAL) && !current_system->save_state) {
+			current_system->save_state = EVENTLOG_SLOT + 1;
+		}
 	} else if (listen_sock) {
 		flush_socket();
 		wrote_since_last_flush = 0;
@@ -535,7 +807,8 @@ static void init_event_reader_common(event_reader *reader)
 	init_deserialize(&reader->buffer, malloc(reader->storage), reader->storage);
 	reader->buffer.size = 0;
 	memset(&reader->input_stream, 0, sizeof(reader->input_stream));
-	
+	reader->keyframes = NULL;
+	reader->num_keyframes = 0;
 }
 
 void init_event_reader(event_reader *reader, uint8_t *data, size_t size)
@@ -547,8 +820,22 @@ void init_event_reader(event_reader *reader, uint8_t *data, size_t size)
 	uint8_t name_len = data[1];
 	reader->buffer.size = name_len + 2;
 	memcpy(reader->buffer.data, data, reader->buffer.size);
-	reader->input_stream.next_in = data + reader->buffer.size;
-	reader->input_stream.avail_in = size - reader->buffer.size;
+	size_t index_ident_size = sizeof(el_index_ident) - 1;
+	if (size >= reader->buffer.size + index_ident_size + 4 && !memcmp(data + size - index_ident_size, el_index_ident, index_ident_size)) {
+		size_t index_end = size - index_ident_size - 4;
+		deserialize_buffer index;
+		init_deserialize(&index, data + index_end, 4);
+		uint32_t num_keyframes = load_int32(&index);
+		if (num_keyframes <= (index_end - reader->buffer.size) / KEYFRAME_ENTRY_SIZE) {
+			reader->num_keyframes = num_keyframes;
+			size = index_end - num_keyframes * KEYFRAME_ENTRY_SIZE;
+			reader->keyframes = data + size;
+		}
+	}
+	reader->compressed = data + reader->buffer.size;
+	reader->compressed_size = size - reader->buffer.size;
+	reader->input_stream.next_in = reader->compressed;
+	reader->input_stream.avail_in = reader->compressed_size;
 	
 	int result = inflateInit(&reader->input_stream);
 	if (Z_OK != result) {
@@ -605,9 +892,13 @@ void init_event_reader_tcp(event_reader *reader, char *address, char *port)
 	reader->input_stream.next_out = reader->buffer.data + init_msg_len;
 	reader->input_stream.avail_out = reader->storage - init_msg_len;
 	res = inflate(&reader->input_stream, Z_NO_FLUSH);
-	if (Z_OK != res && Z_BUF_ERROR != res) {
+	if (Z_OK != res && Z_BUF_ERROR != res && Z_STREAM_END != res) {
 		fatal_error("inflate returned %d in init_event_reader_tcp\n", res);
 	}
+	if (Z_STREAM_END == res) {
+		//the whole initial state arrived at once, the shared stream starts a new zlib stream
+		inflateReset(&reader->input_stream);
+	}
 	int flag = 1;
 	setsockopt(reader->socket, IPPROTO_TCP, TCP_NODELAY, (const char *)&flag, sizeof(flag));
 }
@@ -739,6 +1030,51 @@ uint8_t reader_system_type(event_reader *reader)
 	return load_int8(&reader->buffer);
 }
 
+//Moves a recording to the last keyframe at or before frame, returns the number of frames that
+//precede that keyframe or 0 if there isn't one
+uint32_t reader_seek(event_reader *reader, uint32_t frame)
+{
+	if (!reader->num_keyframes) {
+		return 0;
+	}
+	deserialize_buffer index;
+	init_deserialize(&index, reader->keyframes, reader->num_keyframes * KEYFRAME_ENTRY_SIZE);
+	//find the last keyframe at or before the target, entries are in frame order
+	uint32_t low = 0, high = reader->num_keyframes;
+	while (low < high)
+	{
+		uint32_t mid = low + (high - low) / 2;
+		index.cur_pos = mid * KEYFRAME_ENTRY_SIZE;
+		if (load_int32(&index) <= frame) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	if (!low) {
+		return 0;
+	}
+	index.cur_pos = (low - 1) * KEYFRAME_ENTRY_SIZE;
+	uint32_t keyframe_frame = load_int32(&index);
+	uint32_t cycle = load_int32(&index);
+	uint64_t offset = (uint64_t)load_int32(&index) << 32;
+	offset |= load_int32(&index);
+	if (offset >= reader->compressed_size) {
+		return 0;
+	}
+	inflateReset(&reader->input_stream);
+	reader->input_stream.next_in = reader->compressed + offset;
+	reader->input_stream.avail_in = reader->compressed_size - offset;
+	reader->buffer.size = reader->buffer.cur_pos = 0;
+	reader->input_stream.next_out = reader->buffer.data;
+	reader->input_stream.avail_out = reader->storage;
+	reader->repeat_remaining = 0;
+	reader->repeat_event = 0xFF;
+	reader->last_cycle = cycle;
+	inflate_flush(reader);
+	return keyframe_frame;
+}
+
 void reader_send_gamepad_event(event_reader *reader, uint8_t pad, uint8_t button, uint8_t down)
 {
 	uint8_t buffer[] = {down ? CMD_GAMEPAD_DOWN : CMD_GAMEPAD_UP, pad << 5 | button};
@@ -32,6 +32,10 @@ typedef struct event_reader {
 	uint32_t repeat_delta;
 	deserialize_buffer buffer;
 	z_stream input_stream;
+	uint8_t *compressed;      //start of the compressed data in a recording
+	size_t compressed_size;
+	uint8_t *keyframes;       //keyframe index of a recording, NULL if it has none
+	uint32_t num_keyframes;
 	uint8_t repeat_event;
 	uint8_t repeat_remaining;
 } event_reader;
@@ -55,6 +59,7 @@ void init_event_reader_tcp(event_reader *reader, char *address, char *port);
 uint8_t reader_next_event(event_reader *reader, uint32_t *cycle_out);
 void reader_ensure_data(event_reader *reader, size_t bytes);
 uint8_t reader_system_type(event_reader *reader);
+uint32_t reader_seek(event_reader *reader, uint32_t frame);
 void reader_send_gamepad_event(event_reader *reader, uint8_t pad, uint8_t button, uint8_t down);
 
 #endif //EVENT_LOG_H_
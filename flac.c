@@ -534,6 +534,71 @@ static void decode_subframe(flac_file *f, flac_subframe *sub)
 	}
 }
 
+static flac_pcm_frame *alloc_pcm_frame(flac_file *f)
+{
+	flac_pcm_frame *victim = f->frame_cache;
+	for (uint32_t i = 1; i < FLAC_FRAME_CACHE_SIZE; i++)
+	{
+		flac_pcm_frame *cur = f->frame_cache + i;
+		if (victim->valid && (!cur->valid || cur->last_used < victim->last_used)) {
+			victim = cur;
+		}
+	}
+	return victim;
+}
+
+static void store_pcm(flac_file *f, flac_pcm_frame *frame)
+{
+	frame->channels = f->frame_channels;
+	frame->num_samples = f->frame_block_size;
+	if (frame->num_samples * frame->channels > frame->allocated_samples) {
+		frame->allocated_samples = frame->num_samples * frame->channels;
+		frame->samples = realloc(frame->samples, sizeof(int16_t) * frame->allocated_samples);
+	}
+	int16_t *out = frame->samples;
+	int32_t *ch0 = f->subframes[0].decoded;
+	int32_t *ch1 = frame->channels > 1 ? f->subframes[1].decoded : NULL;
+	int32_t left, right;
+	switch (frame->channels > 1 ? f->frame_joint_stereo : 0)
+	{
+	case 0:
+		for (uint32_t i = 0; i < frame->num_samples; i++)
+		{
+			for (uint8_t channel = 0; channel < frame->channels; channel++)
+			{
+				*(out++) = f->subframes[channel].decoded[i];
+			}
+		}
+		break;
+	case 1:
+		//left-side
+		for (uint32_t i = 0; i < frame->num_samples; i++)
+		{
+			*(out++) = left = ch0[i];
+			*(out++) = left + ch1[i];
+		}
+		break;
+	case 2:
+		//side-right
+		for (uint32_t i = 0; i < frame->num_samples; i++)
+		{
+			right = ch1[i];
+			*(out++) = right + ch0[i];
+			*(out++) = right;
+		}
+		break;
+	case 3:
+		//mid-side
+		for (uint32_t i = 0; i < frame->num_samples; i++)
+		{
+			left = (ch1[i] + 2 * ch0[i]) >> 1;
+			*(out++) = left;
+			*(out++) = left - ch1[i];
+		}
+		break;
+	}
+}
+
 static uint8_t decode_frame(flac_file *f)
 {
 	if (!parse_frame_header(f)) {
@@ -550,108 +615,137 @@ static uint8_t decode_frame(flac_file *f)
 	}
 	f->bits = 0;
 	read16(f);//Frame footer CRC-16
+	flac_pcm_frame *frame = alloc_pcm_frame(f);
+	store_pcm(f, frame);
+	frame->start_sample = f->frame_start_sample;
+	frame->next_offset = f->tell(f);
+	frame->last_used = ++f->frame_use_counter;
+	frame->valid = 1;
+	f->cur_frame = frame;
 	f->frame_sample_pos = 0;
 	return 1;
 }
 
-uint8_t flac_get_sample(flac_file *f, int16_t *out, uint8_t desired_channels)
+static flac_pcm_frame *find_cached_frame(flac_file *f, uint64_t sample_number)
 {
-	if (f->frame_sample_pos == f->frame_block_size) {
-		if (!decode_frame(f)) {
-			return 0;
+	for (uint32_t i = 0; i < FLAC_FRAME_CACHE_SIZE; i++)
+	{
+		flac_pcm_frame *cur = f->frame_cache + i;
+		if (cur->valid && sample_number >= cur->start_sample && sample_number < cur->start_sample + cur->num_samples) {
+			cur->last_used = ++f->frame_use_counter;
+			return cur;
 		}
 	}
-	uint8_t copy_channels;
-	if (f->frame_channels == 1 && desired_channels > 1) {
-		int16_t sample = f->subframes->decoded[f->frame_sample_pos];
-		*(out++) = sample;
-		*(out++) = sample;
-		copy_channels = 2;
-	} else {
-		int32_t left, right, mid, diff;
-		switch (f->frame_joint_stereo)
-		{
-		case 0:
-			copy_channels = desired_channels;
-			if (copy_channels > f->frame_channels) {
-				copy_channels = f->frame_channels;
+	return NULL;
+}
+
+static uint8_t next_frame(flac_file *f)
+{
+	if (f->cur_frame) {
+		flac_pcm_frame *next = find_cached_frame(f, f->cur_frame->start_sample + f->cur_frame->num_samples);
+		if (next) {
+			f->cur_frame = next;
+			f->frame_sample_pos = 0;
+			return 1;
+		}
+		//the stream may have been left elsewhere by a seek that was satisfied from the cache
+		f->seek(f, f->cur_frame->next_offset, 0);
+		f->bits = 0;
+	}
+	return decode_frame(f);
+}
+
+uint32_t flac_get_samples(flac_file *f, int16_t *out, uint32_t num_samples, uint8_t desired_channels)
+{
+	uint32_t done = 0;
+	while (done < num_samples)
+	{
+		if (!f->cur_frame || f->frame_sample_pos == f->cur_frame->num_samples) {
+			if (!next_frame(f)) {
+				break;
 			}
-			for (uint8_t i = 0; i < copy_channels; i++)
+		}
+		flac_pcm_frame *frame = f->cur_frame;
+		uint32_t count = frame->num_samples - f->frame_sample_pos;
+		if (count > num_samples - done) {
+			count = num_samples - done;
+		}
+		int16_t *src = frame->samples + f->frame_sample_pos * frame->channels;
+		if (frame->channels == desired_channels) {
+			memcpy(out, src, sizeof(int16_t) * count * desired_channels);
+			out += count * desired_channels;
+		} else {
+			uint8_t copy_channels = frame->channels < desired_channels ? frame->channels : desired_channels;
+			for (uint32_t i = 0; i < count; i++, src += frame->channels)
 			{
-				*(out++) = f->subframes[i].decoded[f->frame_sample_pos];
-			}
-			break;
-		case 1:
-			//left-side
-			copy_channels = 2;
-			*(out++) = left = f->subframes[0].decoded[f->frame_sample_pos];
-			if (desired_channels > 1) {
-				*(out++) = left + f->subframes[1].decoded[f->frame_sample_pos];
-			}
-			break;
-		case 2:
-			//side-right
-			copy_channels = 2;
-			right = f->subframes[1].decoded[f->frame_sample_pos];
-			left = right + f->subframes[0].decoded[f->frame_sample_pos];
-			*(out++) = left;
-			if (desired_channels > 1) {
-				*(out++) = right;
-			}
-			break;
-		case 3:
-			//mid-side
-			copy_channels = 2;
-			mid = f->subframes[0].decoded[f->frame_sample_pos];
-			diff = f->subframes[1].decoded[f->frame_sample_pos];
-			left = (diff + 2 * mid) >> 1;
-			*(out++) = left;
-			if (desired_channels > 1) {
-				*(out++) = left - diff;
+				uint8_t channel;
+				if (frame->channels == 1) {
+					//duplicate mono samples into both stereo channels
+					*(out++) = *src;
+					channel = 1;
+					if (desired_channels > 1) {
+						*(out++) = *src;
+						channel = 2;
+					}
+				} else {
+					for (channel = 0; channel < copy_channels; channel++)
+					{
+						*(out++) = src[channel];
+					}
+				}
+				for (; channel < desired_channels; channel++)
+				{
+					*(out++) = 0;
+				}
 			}
-			break;
 		}
+		f->frame_sample_pos += count;
+		done += count;
 	}
-	for (uint8_t i = copy_channels; i < desired_channels; i++)
-	{
-		*(out++) = 0;
-	}
-	f->frame_sample_pos++;
+	return done;
+}
 
-	return 1;
+uint8_t flac_get_sample(flac_file *f, int16_t *out, uint8_t desired_channels)
+{
+	return flac_get_samples(f, out, 1, desired_channels);
 }
 
 void flac_seek(flac_file *f, uint64_t sample_number)
 {
-	if (sample_number >= f->frame_start_sample && sample_number < f->frame_start_sample + f->frame_block_size) {
-		f->frame_sample_pos = sample_number - f->frame_start_sample;
+	flac_pcm_frame *frame = f->cur_frame;
+	if (frame && sample_number >= frame->start_sample && sample_number < frame->start_sample + frame->num_samples) {
+		f->frame_sample_pos = sample_number - frame->start_sample;
 		return;
 	}
-	uint32_t best_seekpoint = f->num_seekpoints + 1;
-	if (f->num_seekpoints) {
-		uint64_t best_diff;
-		for (uint32_t i = 0; i < f->num_seekpoints; i++)
-		{
-			if (f->seekpoints[i].sample_number > sample_number) {
-				continue;
-			}
-			uint64_t diff = sample_number - f->seekpoints[i].sample_number;
-			if (best_seekpoint > f->num_seekpoints || diff < best_diff) {
-				best_seekpoint = i;
-				best_diff = diff;
-			}
+	frame = find_cached_frame(f, sample_number);
+	if (frame) {
+		f->cur_frame = frame;
+		f->frame_sample_pos = sample_number - frame->start_sample;
+		return;
+	}
+	//seek points are sorted by sample number so find the last one at or before the target
+	uint32_t low = 0, high = f->num_seekpoints;
+	while (low < high)
+	{
+		uint32_t mid = low + (high - low) / 2;
+		if (f->seekpoints[mid].sample_number > sample_number) {
+			high = mid;
+		} else {
+			low = mid + 1;
 		}
 	}
-	//TODO: more efficient seeking
-	if (best_seekpoint > f->num_seekpoints) {
-		f->seek(f, f->first_frame_offset, 0);
-	} else if (f->seekpoints[best_seekpoint].sample_number > f->frame_start_sample || f->frame_start_sample > sample_number){
-		f->seek(f, f->seekpoints[best_seekpoint].offset + f->first_frame_offset, 0);
+	uint64_t seek_sample = low ? f->seekpoints[low - 1].sample_number : 0;
+	if (!f->cur_frame || f->cur_frame->start_sample > sample_number || seek_sample > f->cur_frame->start_sample) {
+		//decoding forward from the current frame would be slower than starting from the seek point
+		f->cur_frame = NULL;
+		f->seek(f, (low ? f->seekpoints[low - 1].offset : 0) + f->first_frame_offset, 0);
+		//discard any partial byte left over from a failed decode
+		f->bits = 0;
 	}
 	do {
-		if (!decode_frame(f)) {
+		if (!next_frame(f)) {
 			return;
 		}
-	} while ((f->frame_start_sample + f->frame_block_size) <= sample_number);
-	f->frame_sample_pos = sample_number - f->frame_start_sample;
+	} while ((f->cur_frame->start_sample + f->cur_frame->num_samples) <= sample_number);
+	f->frame_sample_pos = sample_number - f->cur_frame->start_sample;
 }
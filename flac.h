@@ -15,6 +15,20 @@ typedef struct {
 	int32_t *decoded;
 } flac_subframe;
 
+//number of decoded frames kept so that seeking back a short distance does not need to decode again
+#define FLAC_FRAME_CACHE_SIZE 4
+
+typedef struct {
+	uint64_t start_sample;
+	int16_t  *samples; //interleaved, with stereo decorrelation already applied
+	uint32_t next_offset; //stream offset of the frame that follows this one
+	uint32_t num_samples;
+	uint32_t allocated_samples;
+	uint32_t last_used;
+	uint8_t  channels;
+	uint8_t  valid;
+} flac_pcm_frame;
+
 typedef struct {
 	uint64_t sample_number;
 	uint64_t offset;
@@ -29,6 +43,7 @@ struct flac_file {
 	flac_seek_fun  seek;
 	flac_tell_fun  tell;
 	flac_subframe  *subframes;
+	flac_pcm_frame *cur_frame;
 	flac_seekpoint *seekpoints;
 	uint32_t       num_seekpoints;
 	uint32_t       offset;
@@ -36,6 +51,8 @@ struct flac_file {
 	uint32_t       first_frame_offset;
 
 	uint32_t       frame_sample_pos;
+	uint32_t       frame_use_counter;
+	flac_pcm_frame frame_cache[FLAC_FRAME_CACHE_SIZE];
 
 	uint32_t       sample_rate;
 	uint32_t       frame_sample_rate;
@@ -54,6 +71,7 @@ struct flac_file {
 flac_file *flac_file_from_buffer(void *buffer, uint32_t size);
 flac_file *flac_file_from_file(FILE *file);
 uint8_t flac_get_sample(flac_file *f, int16_t *out, uint8_t desired_channels);
+uint32_t flac_get_samples(flac_file *f, int16_t *out, uint32_t num_samples, uint8_t desired_channels);
 void flac_seek(flac_file *f, uint64_t sample_number);
 
 #endif //FLAC_H_
@@ -13,4 +13,23 @@ void init_code_info(code_info *code)
 	}
 	code->last = code->cur + size/sizeof(code_word) - RESERVE_WORDS;
 	code->stack_off = 0;
+	code->refs = NULL;
+}
+
+void log_code_ref(code_info *code, code_ptr site, code_ptr target, uint8_t kind)
+{
+	code_ref_log *log = code->refs;
+	if (!log) {
+		return;
+	}
+	if (log->num_refs == log->storage) {
+		log->storage = log->storage ? log->storage * 2 : 1024;
+		log->refs = realloc(log->refs, sizeof(code_ref) * log->storage);
+	}
+	log->refs[log->num_refs++] = (code_ref){
+		.site = site,
+		.target = target,
+		.opcode = site[-1],
+		.kind = kind
+	};
 }
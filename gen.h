@@ -12,13 +12,36 @@ typedef uint32_t code_word;
 typedef code_word * code_ptr;
 #define CODE_ALLOC_SIZE (1024*1024)
 
+//Kinds of references to code addresses embedded in generated code
+enum {
+	CODE_REF_REL8,  //8-bit displacement relative to the end of the reference
+	CODE_REF_REL32, //32-bit displacement relative to the end of the reference
+	CODE_REF_ABS32, //absolute address in a 32-bit immediate, sign-extended on 64-bit hosts
+	CODE_REF_ABS64  //absolute address in a 64-bit immediate
+};
+
+typedef struct {
+	code_ptr  site;   //first byte of the displacement or immediate
+	code_ptr  target;
+	code_word opcode; //instruction byte right before site when the reference was emitted
+	uint8_t   kind;
+} code_ref;
+
+typedef struct {
+	code_ref *refs;
+	uint32_t num_refs;
+	uint32_t storage;
+} code_ref_log;
+
 typedef struct {
-	code_ptr cur;
-	code_ptr last;
-	uint32_t stack_off;
+	code_ptr     cur;
+	code_ptr     last;
+	uint32_t     stack_off;
+	code_ref_log *refs; //when not NULL, every code address emitted is logged here so the code can be relocated
 } code_info;
 
 void check_alloc_code(code_info *code, uint32_t inst_size);
+void log_code_ref(code_info *code, code_ptr site, code_ptr target, uint8_t kind);
 
 void init_code_info(code_info *code);
 void call(code_info *code, code_ptr fun);
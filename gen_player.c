@@ -2,6 +2,7 @@
 #include "gen_player.h"
 #include "event_log.h"
 #include "render.h"
+#include "render_audio.h"
 
 #define MCLKS_NTSC 53693175
 #define MCLKS_PAL  53203395
@@ -31,8 +32,26 @@ static void sync_sound(gen_player *gen, uint32_t target)
 	//printf("Target: %d, YM bufferpos: %d, PSG bufferpos: %d\n", target, gen->ym->buffer_pos, gen->psg->buffer_pos * 2);
 }
 
+static void set_fast_forward(gen_player *player, uint8_t enabled)
+{
+	player->vdp->suppress_output = enabled;
+	render_audio_suppress(enabled);
+}
+
 static void run(gen_player *player)
 {
+	if (player->seek_frame) {
+		uint32_t keyframe = reader_seek(&player->reader, player->seek_frame);
+		if (keyframe) {
+			player->frame = keyframe;
+		}
+		//there's no keyframe for every frame so the rest is played back without output
+		if (player->frame < player->seek_frame) {
+			set_fast_forward(player, 1);
+		} else {
+			player->seek_frame = 0;
+		}
+	}
 	while(player->reader.socket || player->reader.buffer.cur_pos < player->reader.buffer.size)
 	{
 		uint32_t cycle;
@@ -42,6 +61,11 @@ static void run(gen_player *player)
 		case EVENT_FLUSH:
 			sync_sound(player, cycle);
 			vdp_run_context(player->vdp, cycle);
+			player->frame++;
+			if (player->seek_frame && player->frame >= player->seek_frame) {
+				player->seek_frame = 0;
+				set_fast_forward(player, 0);
+			}
 			break;
 		case EVENT_ADJUST: {
 			sync_sound(player, cycle);
@@ -163,6 +187,11 @@ gen_player *alloc_config_gen_player(void *stream, uint32_t rom_size)
 	return player;
 }
 
+void gen_player_seek(gen_player *player, uint32_t frame)
+{
+	player->seek_frame = frame;
+}
+
 gen_player *alloc_config_gen_player_reader(event_reader *reader)
 {
 	gen_player *player = calloc(1, sizeof(gen_player));
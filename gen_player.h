@@ -18,9 +18,12 @@ typedef struct {
 	render_thread   thread;
 #endif
 	event_reader    reader;
+	uint32_t        frame;
+	uint32_t        seek_frame;
 } gen_player;
 
 gen_player *alloc_config_gen_player(void *stream, uint32_t rom_size);
 gen_player *alloc_config_gen_player_reader(event_reader *reader);
+void gen_player_seek(gen_player *player, uint32_t frame);
 
 #endif //GEN_PLAYER_H_
@@ -183,6 +183,7 @@ void jmp_nocheck(code_info *code, code_ptr dest)
 	if (disp <= 0x7F && disp >= -0x80) {
 		*(out++) = OP_JMP_BYTE;
 		*(out++) = disp;
+		log_code_ref(code, out - 1, dest, CODE_REF_REL8);
 	} else {
 		disp = dest-(out+5);
 		if (CHECK_DISP(disp)) {
@@ -194,6 +195,7 @@ void jmp_nocheck(code_info *code, code_ptr dest)
 			*(out++) = disp;
 			disp >>= 8;
 			*(out++) = disp;
+			log_code_ref(code, out - 4, dest, CODE_REF_REL32);
 		} else {
 			fatal_error("jmp: %p - %p = %l which is out of range of a 32-bit displacementX\n", dest, out + 6, (long)disp);
 		}
@@ -1313,6 +1315,16 @@ void mov_ir(code_info *code, int64_t val, uint8_t dst, uint8_t size)
 	code->cur = out;
 }
 
+void log_code_ptr(code_info *code, code_ptr target)
+{
+	//mov_ir only uses a 64-bit immediate when the value doesn't fit in a sign-extended 32-bit one
+	if (sizeof(code_ptr) == sizeof(int32_t) || (intptr_t)target == (int32_t)(intptr_t)target) {
+		log_code_ref(code, code->cur - sizeof(int32_t), target, CODE_REF_ABS32);
+	} else {
+		log_code_ref(code, code->cur - sizeof(int64_t), target, CODE_REF_ABS64);
+	}
+}
+
 uint8_t is_mov_ir(code_ptr inst)
 {
 	while (*inst == PRE_SIZE || *inst == PRE_REX)
@@ -1322,6 +1334,11 @@ uint8_t is_mov_ir(code_ptr inst)
 	return (*inst & 0xF8) == OP_MOV_I8R || (*inst & 0xF8) == OP_MOV_IR || (*inst & 0xFE) == OP_MOV_IEA;
 }
 
+uint8_t is_call(code_ptr inst)
+{
+	return *inst == OP_CALL;
+}
+
 void mov_irdisp(code_info *code, int32_t val, uint8_t dst, int32_t disp, uint8_t size)
 {
 	check_alloc_code(code, 12);
@@ -1933,6 +1950,7 @@ void jcc(code_info *code, uint8_t cc, code_ptr dest)
 	if (disp <= 0x7F && disp >= -0x80) {
 		*(out++) = OP_JCC | cc;
 		*(out++) = disp;
+		log_code_ref(code, out - 1, dest, CODE_REF_REL8);
 	} else {
 		disp = dest-(out+6);
 		if (CHECK_DISP(disp)) {
@@ -1945,6 +1963,7 @@ void jcc(code_info *code, uint8_t cc, code_ptr dest)
 			*(out++) = disp;
 			disp >>= 8;
 			*(out++) = disp;
+			log_code_ref(code, out - 4, dest, CODE_REF_REL32);
 		} else {
 			fatal_error("jcc: %p - %p = %lX which is out of range for a 32-bit displacement\n", dest, out + 6, (long)disp);
 		}
@@ -1960,6 +1979,7 @@ void jmp(code_info *code, code_ptr dest)
 	if (disp <= 0x7F && disp >= -0x80) {
 		*(out++) = OP_JMP_BYTE;
 		*(out++) = disp;
+		log_code_ref(code, out - 1, dest, CODE_REF_REL8);
 	} else {
 		disp = dest-(out+5);
 		if (CHECK_DISP(disp)) {
@@ -1971,6 +1991,7 @@ void jmp(code_info *code, code_ptr dest)
 			*(out++) = disp;
 			disp >>= 8;
 			*(out++) = disp;
+			log_code_ref(code, out - 4, dest, CODE_REF_REL32);
 		} else {
 			fatal_error("jmp: %p - %p = %lX which is out of range for a 32-bit displacement\n", dest, out + 6, (long)disp);
 		}
@@ -2018,6 +2039,7 @@ void call_noalign(code_info *code, code_ptr fun)
 		*(out++) = disp;
 		disp >>= 8;
 		*(out++) = disp;
+		log_code_ref(code, out - 4, fun, CODE_REF_REL32);
 	} else {
 		//TODO: Implement far call???
 		fatal_error("call: %p - %p = %lX which is out of range for a 32-bit displacement\n", fun, out + 5, (long)disp);
@@ -2056,9 +2078,11 @@ void call_raxfallback(code_info *code, code_ptr fun)
 		*(out++) = disp;
 		disp >>= 8;
 		*(out++) = disp;
+		log_code_ref(code, out - 4, fun, CODE_REF_REL32);
 		code->cur = out;
 	} else {
 		mov_ir(code, (int64_t)fun, RAX, SZ_PTR);
+		log_code_ptr(code, fun);
 		call_r(code, RAX);
 	}
 }
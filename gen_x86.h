@@ -186,6 +186,8 @@ void mov_rindr(code_info *code, uint8_t src, uint8_t dst, uint8_t size);
 void mov_ir(code_info *code, int64_t val, uint8_t dst, uint8_t size);
 void mov_irdisp(code_info *code, int32_t val, uint8_t dst, int32_t disp, uint8_t size);
 void mov_irind(code_info *code, int32_t val, uint8_t dst, uint8_t size);
+//logs the code address just loaded into a register by mov_ir with SZ_PTR
+void log_code_ptr(code_info *code, code_ptr target);
 void movsx_rr(code_info *code, uint8_t src, uint8_t dst, uint8_t src_size, uint8_t size);
 void movsx_rdispr(code_info *code, uint8_t src, int32_t disp, uint8_t dst, uint8_t src_size, uint8_t size);
 void movzx_rr(code_info *code, uint8_t src, uint8_t dst, uint8_t src_size, uint8_t size);
@@ -225,6 +227,7 @@ void retn(code_info *code);
 void cdq(code_info *code);
 void loop(code_info *code, code_ptr dst);
 uint8_t is_mov_ir(code_ptr inst);
+uint8_t is_call(code_ptr inst);
 
 #define ALLOC_CODE_RETRY_POINT code_info tmp_alloc_retry = *code; alloc_code_retry:
 #define ALLOC_CODE_RETRY_VAR code_info tmp_alloc_retry
@@ -22,10 +22,15 @@
 #include "config.h"
 #include "event_log.h"
 #include "paths.h"
+#include "rewind.h"
+#include "runahead.h"
+#include "netplay.h"
+#include "hash.h"
+#include "benchmark.h"
 #define MCLKS_NTSC 53693175
 #define MCLKS_PAL  53203395
 
-uint32_t MCLKS_PER_68K;
+INSTANCE_LOCAL uint32_t MCLKS_PER_68K;
 #define MCLKS_PER_YM  7
 #define MCLKS_PER_Z80 15
 #define MCLKS_PER_PSG (MCLKS_PER_Z80*16)
@@ -180,7 +185,9 @@ static void update_z80_bank_pointer(genesis_context *gen)
 	} else {
 		gen->z80->mem_pointers[1] = NULL;
 	}
-	z80_invalidate_code_range(gen->z80, 0x8000, 0xFFFF);
+	//Code in the bank area is never translated directly. Each address gets a stub that fetches the opcode
+	//through z80_read_bank when it runs, so the same translation is valid for every bank and nothing
+	//needs to be invalidated here
 }
 
 static void bus_arbiter_deserialize(deserialize_buffer *buf, void *vgen)
@@ -422,6 +429,7 @@ static void z80_next_int_pulse(z80_context * z_context)
 static void sync_z80(genesis_context *gen, uint32_t mclks)
 {
 	z80_context *z_context = gen->z80;
+	BENCH_ENTER(BENCH_Z80);
 #ifndef NO_Z80
 	if (z80_enabled) {
 #ifdef NEW_CORE
@@ -444,11 +452,13 @@ static void sync_z80(genesis_context *gen, uint32_t mclks)
 	{
 		z_context->Z80_CYCLE = mclks;
 	}
+	BENCH_EXIT();
 }
 
 static void sync_sound(genesis_context * gen, uint32_t target)
 {
 	//printf("YM | Cycle: %d, bpos: %d, PSG | Cycle: %d, bpos: %d\n", gen->ym->current_cycle, gen->ym->buffer_pos, gen->psg->cycles, gen->psg->buffer_pos * 2);
+	BENCH_ENTER(BENCH_SOUND);
 	while (target > gen->psg->cycles && target - gen->psg->cycles > MAX_SOUND_CYCLES) {
 		uint32_t cur_target = gen->psg->cycles + MAX_SOUND_CYCLES;
 		//printf("Running PSG to cycle %d\n", cur_target);
@@ -464,6 +474,7 @@ static void sync_sound(genesis_context * gen, uint32_t target)
 	if (gen->expansion) {
 		scd_run(gen->expansion, gen_cycle_to_scd(target, gen));
 	}
+	BENCH_EXIT();
 
 	//printf("Target: %d, YM bufferpos: %d, PSG bufferpos: %d\n", target, gen->ym->buffer_pos, gen->psg->buffer_pos * 2);
 }
@@ -518,6 +529,83 @@ void gen_update_refresh_no_wait(m68k_context *context)
 #define ADJUST_BUFFER (8*MCLKS_LINE*313)
 #define MAX_NO_ADJUST (UINT_MAX-ADJUST_BUFFER)
 
+static void save_runahead_state(genesis_context *gen, uint32_t address)
+{
+	serialize_buffer *state = runahead_begin_save(gen->header.runahead);
+	genesis_serialize(gen, state, address, 1);
+	runahead_end_save(gen->header.runahead);
+	if (gen->header.rewind && rewind_frame_done(gen->header.rewind)) {
+		//rewind snapshots are taken on the same frame boundary so just reuse this one
+		save_buffer8(rewind_begin_snapshot(gen->header.rewind), state->data, state->size);
+		rewind_end_snapshot(gen->header.rewind);
+	}
+	render_audio_suppress(1);
+	gen->vdp->suppress_output = !runahead_show_frame(gen->header.runahead);
+}
+
+static void set_gamepad_button(genesis_context *gen, uint8_t gamepad_num, uint8_t button, uint8_t down)
+{
+	if (down) {
+		io_gamepad_down(&gen->io, gamepad_num, button);
+		if (gen->mapper_type == MAPPER_JCART) {
+			jcart_gamepad_down(gen, gamepad_num, button);
+		}
+	} else {
+		io_gamepad_up(&gen->io, gamepad_num, button);
+		if (gen->mapper_type == MAPPER_JCART) {
+			jcart_gamepad_up(gen, gamepad_num, button);
+		}
+	}
+}
+
+//controller state isn't part of a snapshot so the buttons are set to match the current netplay frame explicitly
+static void apply_netplay_inputs(genesis_context *gen)
+{
+	netplay_session *np = gen->header.netplay;
+	netplay_frame *f = netplay_inputs(np);
+	uint8_t pads[2] = {np->local_pad, np->remote_pad};
+	for (int i = NETPLAY_LOCAL; i <= NETPLAY_REMOTE; i++)
+	{
+		uint16_t changed = f->input[i] ^ np->applied[i];
+		for (uint8_t button = DPAD_UP; button < NUM_GAMEPAD_BUTTONS; button++)
+		{
+			if (changed & (1 << button)) {
+				set_gamepad_button(gen, pads[i], button, f->input[i] >> button & 1);
+			}
+		}
+		np->applied[i] = f->input[i];
+	}
+}
+
+static void save_netplay_state(genesis_context *gen, uint32_t address)
+{
+	genesis_serialize(gen, netplay_begin_save(gen->header.netplay), address, 1);
+	apply_netplay_inputs(gen);
+	if (netplay_show_frame(gen->header.netplay)) {
+		render_audio_suppress(0);
+		gen->vdp->suppress_output = 0;
+	}
+}
+
+static void netplay_frame_end(genesis_context *gen)
+{
+	netplay_session *np = gen->header.netplay;
+	//every frame needs a snapshot and new inputs to stay in step with the peer, so a save requested
+	//by the user, the event log or serialize is held until the snapshot is done. Loads are refused
+	//by load_state so the only one that can be pending is a rollback that's superseded here
+	if (gen->header.save_state && gen->header.save_state != NETPLAY_SLOT + 1) {
+		np->held_save = gen->header.save_state;
+	}
+	gen->header.save_state = 0;
+	gen->header.delayed_load_slot = 0;
+	if (netplay_frame_done(np) == NETPLAY_ROLLBACK) {
+		gen->header.delayed_load_slot = NETPLAY_SLOT + 1;
+		gen->m68k->should_return = 1;
+	} else {
+		gen->header.save_state = NETPLAY_SLOT + 1;
+	}
+}
+
 static m68k_context *sync_components(m68k_context * context, uint32_t address)
 {
 	genesis_context * gen = context->system;
@@ -563,10 +651,40 @@ static m68k_context *sync_components(m68k_context * context, uint32_t address)
 				gen->header.enter_debugger_frames -= elapsed;
 			}
 		}
+		if (gen->header.netplay) {
+			netplay_frame_end(gen);
+		} else if (!gen->header.save_state && !gen->header.delayed_load_slot) {
+			if (gen->header.rewind && gen->header.rewinding) {
+				gen->header.delayed_load_slot = REWIND_SLOT + 1;
+				context->should_return = 1;
+			} else if (gen->header.runahead) {
+				switch (runahead_frame_done(gen->header.runahead))
+				{
+				case RUNAHEAD_SAVE:
+					gen->header.save_state = RUNAHEAD_SLOT + 1;
+					break;
+				case RUNAHEAD_RESTORE:
+					gen->header.delayed_load_slot = RUNAHEAD_SLOT + 1;
+					context->should_return = 1;
+					break;
+				default:
+					gen->vdp->suppress_output = !runahead_show_frame(gen->header.runahead);
+				}
+			} else if (gen->header.rewind && rewind_frame_done(gen->header.rewind)) {
+				gen->header.save_state = REWIND_SLOT + 1;
+			}
+		}
 
 		if(exit_after){
 			if (elapsed >= exit_after) {
-				exit(0);
+				if (bench_active) {
+					//return to the benchmark runner so it can move on to the next entry
+					exit_after = 0;
+					gen->header.should_exit = 1;
+					context->should_return = 1;
+				} else {
+					exit(0);
+				}
 			} else {
 				exit_after -= elapsed;
 			}
@@ -638,7 +756,19 @@ static m68k_context *sync_components(m68k_context * context, uint32_t address)
 			}
 #endif
 			char *save_path = slot >= SERIALIZE_SLOT ? NULL : get_slot_name(&gen->header, slot, use_native_states ? "state" : "gst");
-			if (use_native_states || slot >= SERIALIZE_SLOT) {
+			if (slot == REWIND_SLOT) {
+				genesis_serialize(gen, rewind_begin_snapshot(gen->header.rewind), address, 1);
+				rewind_end_snapshot(gen->header.rewind);
+			} else if (slot == RUNAHEAD_SLOT) {
+				save_runahead_state(gen, address);
+			} else if (slot == NETPLAY_SLOT) {
+				save_netplay_state(gen, address);
+				if (gen->header.netplay->held_save) {
+					gen->header.save_state = gen->header.netplay->held_save;
+					gen->header.netplay->held_save = 0;
+					context->sync_cycle = context->current_cycle + 1;
+				}
+			} else if (use_native_states || slot >= SERIALIZE_SLOT) {
 				serialize_buffer state;
 				init_serialize(&state);
 				genesis_serialize(gen, &state, address, slot != EVENTLOG_SLOT);
@@ -650,14 +780,12 @@ static m68k_context *sync_components(m68k_context * context, uint32_t address)
 				} else if (slot == EVENTLOG_SLOT) {
 					event_state(context->current_cycle, &state);
 				} else {
-					save_to_file(&state, save_path);
-					free(state.data);
+					save_state_async(&state, save_path);
 				}
 			} else {
-				save_gst(gen, save_path, address);
-			}
-			if (slot != SERIALIZE_SLOT) {
-				debug_message("Saved state to %s\n", save_path);
+				if (save_gst(gen, save_path, address)) {
+					debug_message("Saved state to %s\n", save_path);
+				}
 			}
 			free(save_path);
 		} else if(gen->header.save_state) {
@@ -1354,6 +1482,12 @@ static void toggle_tmss_rom(genesis_context *gen)
 		gen->tmss_pointers[i] = tmp;
 	}
 	m68k_invalidate_code_range(context, 0, 0x400000);
+#ifndef NEW_CORE
+	if (gen->tmss) {
+		//cartridge ROM is visible now so entry points from the translation cache can be translated
+		m68k_warm_translation_cache(context);
+	}
+#endif
 }
 
 static void *unused_write(uint32_t location, void *vcontext, uint16_t value)
@@ -1462,13 +1596,109 @@ void set_region(genesis_context *gen, rom_info *info, uint8_t region)
 	gen->master_clock = gen->normal_clock;
 }
 
+//abandons speculative execution without restoring the snapshot and re-enables output
+static void stop_runahead(genesis_context *gen)
+{
+	size_t size;
+	runahead_restore(gen->header.runahead, &size);
+	render_audio_suppress(0);
+	gen->vdp->suppress_output = 0;
+}
+
+static uint8_t load_rewind_state(genesis_context *gen)
+{
+	if (!gen->m68k->resume_pc) {
+		gen->header.delayed_load_slot = REWIND_SLOT + 1;
+		gen->m68k->should_return = 1;
+		return rewind_available(gen->header.rewind);
+	}
+	size_t size;
+	uint8_t *data = rewind_pop(gen->header.rewind, &size);
+	if (!data) {
+		return 0;
+	}
+	deserialize_buffer state;
+	init_deserialize(&state, data, size);
+	genesis_deserialize(&state, gen);
+	//keep the restored frame counter from looking like a frame boundary
+	gen->last_frame = gen->vdp->frame;
+	if (gen->header.runahead) {
+		//any snapshot taken for run-ahead predates the rewound state
+		stop_runahead(gen);
+	}
+	return 1;
+}
+
+static uint8_t load_runahead_state(genesis_context *gen)
+{
+	if (!gen->m68k->resume_pc) {
+		gen->header.delayed_load_slot = RUNAHEAD_SLOT + 1;
+		gen->m68k->should_return = 1;
+		return 1;
+	}
+	size_t size;
+	uint8_t *data = runahead_restore(gen->header.runahead, &size);
+	render_audio_suppress(0);
+	if (!data) {
+		gen->vdp->suppress_output = 0;
+		return 0;
+	}
+	deserialize_buffer state;
+	init_deserialize(&state, data, size);
+	genesis_deserialize(&state, gen);
+	gen->last_frame = gen->vdp->frame;
+	//this frame was already presented while running ahead
+	gen->vdp->suppress_output = 1;
+	return 1;
+}
+
+static uint8_t load_netplay_state(genesis_context *gen)
+{
+	if (!gen->m68k->resume_pc) {
+		gen->header.delayed_load_slot = NETPLAY_SLOT + 1;
+		gen->m68k->should_return = 1;
+		return 1;
+	}
+	size_t size;
+	uint8_t *data = netplay_rollback(gen->header.netplay, &size);
+	if (!data) {
+		//carry on from the current frame without correcting the misprediction
+		gen->header.save_state = NETPLAY_SLOT + 1;
+		return 0;
+	}
+	deserialize_buffer state;
+	init_deserialize(&state, data, size);
+	genesis_deserialize(&state, gen);
+	gen->last_frame = gen->vdp->frame;
+	//frames up to the one that triggered the rollback were already presented
+	render_audio_suppress(1);
+	gen->vdp->suppress_output = 1;
+	apply_netplay_inputs(gen);
+	return 1;
+}
+
 static uint8_t load_state(system_header *system, uint8_t slot)
 {
 	genesis_context *gen = (genesis_context *)system;
+	if (slot == NETPLAY_SLOT) {
+		return load_netplay_state(gen);
+	}
+	if (system->netplay) {
+		//the peer would have no way to follow along
+		warning("Save states can't be loaded during netplay\n");
+		return 0;
+	}
+	if (slot == REWIND_SLOT) {
+		return load_rewind_state(gen);
+	}
+	if (slot == RUNAHEAD_SLOT) {
+		return load_runahead_state(gen);
+	}
 	char *statepath = get_slot_name(system, slot, "state");
 	deserialize_buffer state;
 	uint32_t pc = 0;
 	uint8_t ret;
+	wait_state_saves();
 	if (!gen->m68k->resume_pc) {
 		system->delayed_load_slot = slot + 1;
 		gen->m68k->should_return = 1;
@@ -1479,7 +1709,7 @@ static uint8_t load_state(system_header *system, uint8_t slot)
 		}
 		goto done;
 	}
-	if (load_from_file(&state, statepath)) {
+	if (load_state_file(&state, statepath)) {
 		genesis_deserialize(&state, gen);
 		free(state.data);
 		ret = 1;
@@ -1515,6 +1745,13 @@ static void handle_reset_requests(genesis_context *gen)
 			resume_68k(gen->m68k);
 		}
 	}
+	if (gen->header.runahead && gen->header.runahead->speculating) {
+		//don't leave the machine in a speculative state with output suppressed while we're not running
+		if (gen->m68k->resume_pc) {
+			load_runahead_state(gen);
+		}
+		stop_runahead(gen);
+	}
 	if (gen->header.force_release || render_should_release_on_exit()) {
 		bindings_release_capture();
 		vdp_release_framebuffer(gen->vdp);
@@ -1523,6 +1760,21 @@ static void handle_reset_requests(genesis_context *gen)
 	}
 }
 
+#ifndef NEW_CORE
+static void load_translation_cache(genesis_context *gen)
+{
+	if (!gen->translation_cache || !gen->header.save_dir) {
+		return;
+	}
+	char *path = path_append(gen->header.save_dir, "m68k.jitcache");
+	m68k_load_translation_cache(gen->m68k, path, gen->rom_hash);
+	free(path);
+	if (!(gen->version_reg & 0xF) || gen->tmss) {
+		m68k_warm_translation_cache(gen->m68k);
+	}
+}
+#endif
+
 static void start_genesis(system_header *system, char *statefile)
 {
 	genesis_context *gen = (genesis_context *)system;
@@ -1530,7 +1782,7 @@ static void start_genesis(system_header *system, char *statefile)
 		//first try loading as a native format savestate
 		deserialize_buffer state;
 		uint32_t pc;
-		if (load_from_file(&state, statefile)) {
+		if (load_state_file(&state, statefile)) {
 			genesis_deserialize(&state, gen);
 			free(state.data);
 			//HACK
@@ -1549,6 +1801,9 @@ static void start_genesis(system_header *system, char *statefile)
 #endif
 		}
 		adjust_int_cycle(gen->m68k, gen->vdp);
+#ifndef NEW_CORE
+		load_translation_cache(gen);
+#endif
 		start_68k_context(gen->m68k, pc);
 	} else {
 		if (gen->header.enter_debugger) {
@@ -1559,6 +1814,9 @@ static void start_genesis(system_header *system, char *statefile)
 			insert_breakpoint(gen->m68k, address, gen->header.debugger_type == DEBUGGER_NATIVE ? debugger : gdb_debug_enter);
 #endif
 		}
+#ifndef NEW_CORE
+		load_translation_cache(gen);
+#endif
 		m68k_reset(gen->m68k);
 	}
 	handle_reset_requests(gen);
@@ -1597,6 +1855,13 @@ static void persist_save(system_header *system)
 {
 	genesis_context *gen = (genesis_context *)system;
 	FILE *f;
+#ifndef NEW_CORE
+	if (gen->translation_cache && system->save_dir) {
+		char *path = path_append(system->save_dir, "m68k.jitcache");
+		m68k_save_translation_cache(gen->m68k, path, gen->rom_hash);
+		free(path);
+	}
+#endif
 	if (gen->expansion) {
 		segacd_context *cd = gen->expansion;
 		char *bram_name = path_append(system->save_dir, "internal.bram");
@@ -1717,17 +1982,24 @@ static void free_genesis(system_header *system)
 	vdp_free(gen->vdp);
 	memmap_chunk *map = (memmap_chunk *)gen->m68k->options->gen.memmap;
 	m68k_options_free(gen->m68k->options);
-	free(gen->cart);
+	free_rom_buffer(gen->cart);
 	free(gen->m68k);
 	free(gen->work_ram);
+#ifndef NO_Z80
+	memmap_chunk *z80_map = (memmap_chunk *)gen->z80->Z80_OPTS->gen.memmap;
 	z80_options_free(gen->z80->Z80_OPTS);
+	free(z80_map);
+#endif
 	free(gen->z80);
 	free(gen->zram);
 	ym_free(gen->ym);
 	psg_free(gen->psg);
 	free(gen->header.save_dir);
+	rewind_free(gen->header.rewind);
+	runahead_free(gen->header.runahead);
+	netplay_free(gen->header.netplay);
 	free_rom_info(&gen->header.info);
-	free(gen->lock_on);
+	free_rom_buffer(gen->lock_on);
 	if (gen->save_type != SAVE_NONE && gen->mapper_type != MAPPER_SEGA_MED_V2) {
 		free(gen->save_storage);
 	}
@@ -1738,19 +2010,19 @@ static void free_genesis(system_header *system)
 static void gamepad_down(system_header *system, uint8_t gamepad_num, uint8_t button)
 {
 	genesis_context *gen = (genesis_context *)system;
-	io_gamepad_down(&gen->io, gamepad_num, button);
-	if (gen->mapper_type == MAPPER_JCART) {
-		jcart_gamepad_down(gen, gamepad_num, button);
+	if (gen->header.netplay && netplay_gamepad_event(gen->header.netplay, gamepad_num, button, 1)) {
+		return;
 	}
+	set_gamepad_button(gen, gamepad_num, button, 1);
 }
 
 static void gamepad_up(system_header *system, uint8_t gamepad_num, uint8_t button)
 {
 	genesis_context *gen = (genesis_context *)system;
-	io_gamepad_up(&gen->io, gamepad_num, button);
-	if (gen->mapper_type == MAPPER_JCART) {
-		jcart_gamepad_up(gen, gamepad_num, button);
+	if (gen->header.netplay && netplay_gamepad_event(gen->header.netplay, gamepad_num, button, 0)) {
+		return;
 	}
+	set_gamepad_button(gen, gamepad_num, button, 0);
 }
 
 static void mouse_down(system_header *system, uint8_t mouse_num, uint8_t button)
@@ -2009,7 +2281,7 @@ static void *tmss_even_write_8(uint32_t address, void *context, uint8_t value)
 
 static genesis_context *shared_init(uint32_t system_opts, rom_info *rom, uint8_t force_region)
 {
-	static memmap_chunk z80_map[] = {
+	static const memmap_chunk base_z80_map[] = {
 		{ 0x0000, 0x4000,  0x1FFF, .flags = MMAP_READ | MMAP_WRITE | MMAP_CODE},
 		{ 0x8000, 0x10000, 0x7FFF, .read_8 = z80_read_bank, .write_8 = z80_write_bank},
 		{ 0x4000, 0x6000,  0x0003, .read_8 = z80_read_ym, .write_8 = z80_write_ym},
@@ -2066,6 +2338,11 @@ static genesis_context *shared_init(uint32_t system_opts, rom_info *rom, uint8_t
 	uint8_t max_vsram = !strcmp(tern_find_ptr_default(model, "vsram", "40"), "64");
 	gen->vdp = init_vdp_context(gen->version_reg & 0x40, max_vsram, VDP_GENESIS);
 	gen->vdp->system = &gen->header;
+#ifndef IS_LIB
+	if (!headless && !strcmp(tern_find_path_default(config, "video\0vdp_thread\0", (tern_val){.ptrval = "off"}, TVAL_PTR).ptrval, "on")) {
+		vdp_start_render_thread(gen->vdp);
+	}
+#endif
 	gen->frame_end = vdp_cycles_to_frame_end(gen->vdp);
 	char * config_cycles = tern_find_path(config, "clocks\0max_cycles\0", TVAL_PTR).ptrval;
 	gen->max_cycles = config_cycles ? atoi(config_cycles) : DEFAULT_SYNC_INTERVAL;
@@ -2085,8 +2362,12 @@ static genesis_context *shared_init(uint32_t system_opts, rom_info *rom, uint8_t
 	gen->psg = malloc(sizeof(psg_context));
 	psg_init(gen->psg, gen->master_clock, MCLKS_PER_PSG);
 
-	z80_map[0].buffer = gen->zram = calloc(1, Z80_RAM_BYTES);
+	gen->zram = calloc(1, Z80_RAM_BYTES);
 #ifndef NO_Z80
+	//each instance needs its own copy of the map since the RAM buffer differs
+	memmap_chunk *z80_map = malloc(sizeof(base_z80_map));
+	memcpy(z80_map, base_z80_map, sizeof(base_z80_map));
+	z80_map[0].buffer = gen->zram;
 	z80_options *z_opts = malloc(sizeof(z80_options));
 	init_z80_opts(z_opts, z80_map, 5, NULL, 0, MCLKS_PER_Z80, 0xFFFF);
 	gen->z80 = init_z80_context(z_opts);
@@ -2171,6 +2452,12 @@ genesis_context *alloc_config_genesis(void *rom, uint32_t rom_size, void *lock_o
 
 	gen->cart = rom;
 	gen->lock_on = lock_on;
+#ifndef NEW_CORE
+	if (!strcmp(tern_find_path_default(config, "system\0jit_cache\0", (tern_val){.ptrval = "off"}, TVAL_PTR).ptrval, "on")) {
+		gen->translation_cache = 1;
+		sha1(rom, rom_size, gen->rom_hash);
+	}
+#endif
 
 	setup_io_devices(config, &info, &gen->io);
 	gen->header.has_keyboard = io_has_keyboard(&gen->io);
@@ -2352,6 +2639,7 @@ genesis_context *alloc_config_genesis(void *rom, uint32_t rom_size, void *lock_o
 		memcpy(map + info.map_chunks - 1, cd_map, sizeof(memmap_chunk) * cd_chunks);
 		memcpy(map + map_chunks - 1, info.map + info.map_chunks - 1, sizeof(memmap_chunk));
 		free(info.map);
+		free(cd_map);
 		int max_ptr_index = -1;
 		for (int i = 0; i < info.map_chunks - 1; i++)
 		{
@@ -2441,6 +2729,7 @@ genesis_context *alloc_config_genesis_cdboot(system_media *media, uint32_t syste
 	memmap_chunk *map = malloc(sizeof(memmap_chunk) * (cd_chunks + base_chunks));
 	memcpy(map, cd_map, sizeof(memmap_chunk) * cd_chunks);
 	memcpy(map + cd_chunks, base_map, sizeof(memmap_chunk) * base_chunks);
+	free(cd_map);
 	map[cd_chunks].buffer = gen->work_ram;
 	uint32_t num_chunks = cd_chunks + base_chunks;
 
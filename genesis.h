@@ -77,6 +77,8 @@ struct genesis_context {
 	uint8_t         tmss;
 	uint8_t         vdp_unlocked;
 	uint8_t         enter_z80_debugger;
+	uint8_t         translation_cache;
+	uint8_t         rom_hash[20];
 	eeprom_state    eeprom;
 	nor_state       nor;
 };
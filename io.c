@@ -18,6 +18,7 @@
 #include "serialize.h"
 #include "io.h"
 #include "blastem.h"
+#include "benchmark.h"
 #include "render.h"
 #include "util.h"
 #include "bindings.h"
@@ -1206,6 +1207,7 @@ enum {
 
 void io_run(io_port *port, uint32_t current_cycle)
 {
+	BENCH_ENTER(BENCH_IO);
 	uint32_t new_serial_cycle = ((current_cycle - port->serial_cycle) / port->serial_divider) * port->serial_divider + port->serial_cycle;
 	if (port->transmit_end && port->transmit_end <= new_serial_cycle) {
 		port->transmit_end = 0;
@@ -1254,6 +1256,7 @@ void io_run(io_port *port, uint32_t current_cycle)
 			}
 		}
 	}
+	BENCH_EXIT();
 }
 
 void io_control_write(io_port *port, uint8_t value, uint32_t current_cycle)
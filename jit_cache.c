@@ -0,0 +1,914 @@
+#include <stdlib.h>
+#include <string.h>
+#include "jit_cache.h"
+#include "gen_x86.h"
+#include "serialize.h"
+#include "util.h"
+
+#define JIT_CACHE_MAGIC "BLASTJIT"
+//bump this whenever a change to a translator or to the code emitter could make previously saved code wrong
+#define JIT_CACHE_VERSION 2
+#define ROM_HASH_BYTES 20
+//larger groups of instructions are split up so that each one easily fits in a fresh code chunk
+#define MAX_BLOCK_SIZE (64*1024)
+#define TAIL_JMP_SIZE 5
+#define CALL_REL32 0xE8
+
+enum {
+	TARGET_SELF,   //offset from the start of the block
+	TARGET_GUEST,  //translated code for a guest address
+	TARGET_SYMBOL, //index into the symbol list
+	TARGET_HELPER  //tag of a helper that is generated on demand
+};
+
+//an instruction or run of instructions translated this session
+typedef struct {
+	code_ptr native;
+	code_ptr native_end;
+	uint32_t address;
+	uint32_t size;
+	uint32_t guest_offset; //location of the guest code in guest_data
+	uint8_t  map_size;
+	uint8_t  falls_through;
+} jit_record;
+
+typedef struct {
+	uint8_t  *guest;
+	uint32_t address;
+	uint32_t size;
+	uint32_t native_offset;
+	uint8_t  map_size;
+} saved_record;
+
+typedef struct {
+	uint32_t offset;
+	uint32_t value;
+	uint8_t  kind;
+	uint8_t  type;
+} saved_ref;
+
+//a group of natively contiguous records from the cache file
+typedef struct {
+	saved_record *records;
+	saved_ref    *refs;
+	uint8_t      *code;
+	uint32_t     native_size;
+	uint32_t     num_records;
+	uint32_t     num_refs;
+	uint32_t     tail;
+	uint8_t      falls_through;
+	uint8_t      applied;
+} saved_block;
+
+typedef struct {
+	code_ptr native;
+	uint32_t address;
+} guest_entry;
+
+struct jit_cache {
+	void                  *context;
+	cpu_options           *opts;
+	jit_cache_funcs const *funcs;
+	code_ptr              *symbols;
+	code_ref_log          log;
+	jit_record            *records;
+	uint8_t               *guest_data;
+	guest_entry           *forgotten;
+	saved_block           *blocks;
+	uint8_t               *file_data;
+	uint32_t              num_symbols;
+	uint32_t              fingerprint;
+	uint32_t              map_chunk_size;
+	uint32_t              map_chunks;
+	uint32_t              num_records;
+	uint32_t              records_storage;
+	uint32_t              guest_size;
+	uint32_t              guest_storage;
+	uint32_t              num_forgotten;
+	uint32_t              forgotten_storage;
+	uint32_t              num_blocks;
+	uint32_t              mark_refs;
+	code_ptr              mark_cur;
+	code_ptr              mark_last;
+	uint8_t               active;
+};
+
+#define FNV_OFFSET 0x811C9DC5
+#define FNV_PRIME 0x01000193
+
+static uint32_t hash32(uint32_t hash, uint32_t value)
+{
+	for (int i = 0; i < 4; i++, value >>= 8)
+	{
+		hash = (hash ^ (value & 0xFF)) * FNV_PRIME;
+	}
+	return hash;
+}
+
+static uint32_t hash_bytes(uint32_t hash, uint8_t *data, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+	{
+		hash = (hash ^ data[i]) * FNV_PRIME;
+	}
+	return hash;
+}
+
+static uint32_t calc_fingerprint(cpu_options *opts, uint32_t num_symbols, uint32_t layout)
+{
+	uint32_t hash = hash32(FNV_OFFSET, JIT_CACHE_VERSION);
+	hash = hash32(hash, sizeof(code_ptr));
+	hash = hash32(hash, layout);
+	hash = hash32(hash, num_symbols);
+	hash = hash32(hash, opts->flags);
+	hash = hash32(hash, opts->address_mask);
+	hash = hash32(hash, opts->max_address);
+	hash = hash32(hash, opts->bus_cycles);
+	hash = hash32(hash, opts->clock_divider);
+	hash = hash32(hash, opts->mem_page_shift << 8 | opts->ram_flags_shift);
+	hash = hash32(hash, opts->byte_swap << 8 | opts->address_size);
+	hash = hash32(hash, opts->context_reg << 24 | opts->cycles << 16 | opts->limit << 8 | opts->scratch1);
+	hash = hash32(hash, opts->scratch2);
+	for (uint32_t i = 0; i < opts->memmap_chunks; i++)
+	{
+		memmap_chunk const *chunk = opts->memmap + i;
+		hash = hash32(hash, chunk->start);
+		hash = hash32(hash, chunk->end);
+		hash = hash32(hash, chunk->mask);
+		hash = hash32(hash, chunk->aux_mask);
+		hash = hash32(hash, chunk->shift);
+		hash = hash32(hash, chunk->ptr_index << 16 | chunk->flags);
+		hash = hash32(hash, (chunk->buffer != NULL) | (chunk->read_16 != NULL) << 1 | (chunk->write_16 != NULL) << 2
+			| (chunk->read_8 != NULL) << 3 | (chunk->write_8 != NULL) << 4);
+	}
+	return hash;
+}
+
+jit_cache *jit_cache_new(void *context, cpu_options *opts, jit_cache_funcs const *funcs, code_ptr *symbols, uint32_t num_symbols, uint32_t layout, uint32_t map_chunk_size, uint32_t map_chunks)
+{
+	jit_cache *cache = calloc(1, sizeof(jit_cache));
+	cache->context = context;
+	cache->opts = opts;
+	cache->funcs = funcs;
+	cache->symbols = malloc(sizeof(code_ptr) * num_symbols);
+	memcpy(cache->symbols, symbols, sizeof(code_ptr) * num_symbols);
+	cache->num_symbols = num_symbols;
+	cache->fingerprint = calc_fingerprint(opts, num_symbols, layout);
+	cache->map_chunk_size = map_chunk_size;
+	cache->map_chunks = map_chunks;
+	return cache;
+}
+
+static void free_blocks(jit_cache *cache)
+{
+	for (uint32_t i = 0; i < cache->num_blocks; i++)
+	{
+		free(cache->blocks[i].records);
+		free(cache->blocks[i].refs);
+	}
+	free(cache->blocks);
+	free(cache->file_data);
+	cache->blocks = NULL;
+	cache->file_data = NULL;
+	cache->num_blocks = 0;
+}
+
+void jit_cache_free(jit_cache *cache)
+{
+	if (!cache) {
+		return;
+	}
+	free_blocks(cache);
+	free(cache->symbols);
+	free(cache->log.refs);
+	free(cache->records);
+	free(cache->guest_data);
+	free(cache->forgotten);
+	free(cache);
+}
+
+void jit_cache_begin(jit_cache *cache)
+{
+	if (!cache || cache->active) {
+		return;
+	}
+	code_info *code = &cache->opts->code;
+	cache->active = 1;
+	cache->mark_refs = cache->log.num_refs;
+	cache->mark_cur = code->cur;
+	cache->mark_last = code->last;
+	code->refs = &cache->log;
+}
+
+static void add_record(jit_cache *cache, uint32_t address, uint32_t size, code_ptr native, code_ptr native_end, uint8_t map_size, uint8_t falls_through, uint8_t *guest)
+{
+	if (cache->num_records == cache->records_storage) {
+		cache->records_storage = cache->records_storage ? cache->records_storage * 2 : 1024;
+		cache->records = realloc(cache->records, sizeof(jit_record) * cache->records_storage);
+	}
+	if (cache->guest_size + size > cache->guest_storage) {
+		cache->guest_storage = cache->guest_storage ? cache->guest_storage * 2 : 16 * 1024;
+		if (cache->guest_size + size > cache->guest_storage) {
+			cache->guest_storage = cache->guest_size + size;
+		}
+		cache->guest_data = realloc(cache->guest_data, cache->guest_storage);
+	}
+	if (guest) {
+		memcpy(cache->guest_data + cache->guest_size, guest, size);
+	} else {
+		cache->funcs->fetch(cache->context, address, cache->guest_data + cache->guest_size, size);
+	}
+	cache->records[cache->num_records++] = (jit_record){
+		.native = native,
+		.native_end = native_end,
+		.address = address,
+		.size = size,
+		.guest_offset = cache->guest_size,
+		.map_size = map_size,
+		.falls_through = falls_through
+	};
+	cache->guest_size += size;
+}
+
+void jit_cache_end(jit_cache *cache, uint32_t address, uint32_t size, uint8_t falls_through)
+{
+	if (!cache || !cache->active) {
+		return;
+	}
+	code_info *code = &cache->opts->code;
+	code->refs = NULL;
+	cache->active = 0;
+	code_ptr native = cache->funcs->get_native(cache->context, address);
+	//a switch to a new code chunk leaves a gap in the middle of the code, so it can't be saved
+	if (
+		code->last != cache->mark_last || !native || native < cache->mark_cur || native >= code->cur
+		|| !cache->funcs->cacheable(cache->context, address, size)
+	) {
+		cache->log.num_refs = cache->mark_refs;
+		return;
+	}
+	add_record(cache, address, size, native, code->cur, cache->funcs->map_size(cache->context, address), falls_through, NULL);
+}
+
+void jit_cache_forget(jit_cache *cache, uint32_t address, code_ptr native)
+{
+	if (!cache) {
+		return;
+	}
+	if (cache->num_forgotten == cache->forgotten_storage) {
+		cache->forgotten_storage = cache->forgotten_storage ? cache->forgotten_storage * 2 : 64;
+		cache->forgotten = realloc(cache->forgotten, sizeof(guest_entry) * cache->forgotten_storage);
+	}
+	cache->forgotten[cache->num_forgotten++] = (guest_entry){native, address};
+}
+
+static uint8_t ref_width(uint8_t kind)
+{
+	switch (kind)
+	{
+	case CODE_REF_REL8:
+		return 1;
+	case CODE_REF_ABS64:
+		return 8;
+	default:
+		return 4;
+	}
+}
+
+static uint8_t fits_int32(intptr_t value)
+{
+	return value == (int32_t)value;
+}
+
+static uint8_t has_bytes(deserialize_buffer *buf, size_t bytes)
+{
+	return buf->size - buf->cur_pos >= bytes;
+}
+
+static uint8_t parse_block(jit_cache *cache, deserialize_buffer *buf, saved_block *block)
+{
+	if (!has_bytes(buf, 3 * sizeof(uint32_t) + 1)) {
+		return 0;
+	}
+	block->native_size = load_int32(buf);
+	block->falls_through = load_int8(buf);
+	block->tail = load_int32(buf);
+	block->num_records = load_int32(buf);
+	if (!block->native_size || block->native_size > MAX_BLOCK_SIZE || !block->num_records || block->num_records > block->native_size) {
+		return 0;
+	}
+	block->records = calloc(block->num_records, sizeof(saved_record));
+	for (uint32_t i = 0; i < block->num_records; i++)
+	{
+		saved_record *rec = block->records + i;
+		if (!has_bytes(buf, 3 * sizeof(uint32_t) + 1)) {
+			return 0;
+		}
+		rec->address = load_int32(buf);
+		rec->size = load_int32(buf);
+		rec->native_offset = load_int32(buf);
+		rec->map_size = load_int8(buf);
+		if (!rec->size || rec->native_offset >= block->native_size || (i && rec->native_offset <= block->records[i-1].native_offset)) {
+			return 0;
+		}
+		if (!has_bytes(buf, rec->size)) {
+			return 0;
+		}
+		rec->guest = buf->data + buf->cur_pos;
+		buf->cur_pos += rec->size;
+	}
+	if (block->records[0].native_offset || !has_bytes(buf, sizeof(uint32_t))) {
+		return 0;
+	}
+	block->num_refs = load_int32(buf);
+	if (block->num_refs > block->native_size || !has_bytes(buf, (size_t)block->num_refs * (2 * sizeof(uint32_t) + 2))) {
+		return 0;
+	}
+	block->refs = calloc(block->num_refs ? block->num_refs : 1, sizeof(saved_ref));
+	for (uint32_t i = 0; i < block->num_refs; i++)
+	{
+		saved_ref *ref = block->refs + i;
+		ref->offset = load_int32(buf);
+		ref->kind = load_int8(buf);
+		ref->type = load_int8(buf);
+		ref->value = load_int32(buf);
+		if (ref->kind > CODE_REF_ABS64 || !ref->offset || ref->offset + ref_width(ref->kind) > block->native_size) {
+			return 0;
+		}
+		switch (ref->type)
+		{
+		case TARGET_SELF:
+			if (ref->value > block->native_size || (ref->value == block->native_size && !block->falls_through)) {
+				return 0;
+			}
+			break;
+		case TARGET_GUEST:
+			//only relative jumps can be left for process_deferred to fill in
+			if (ref->kind != CODE_REF_REL32) {
+				return 0;
+			}
+			break;
+		case TARGET_SYMBOL:
+			if (ref->kind == CODE_REF_REL8 || ref->value >= cache->num_symbols) {
+				return 0;
+			}
+			break;
+		case TARGET_HELPER:
+			if (ref->kind == CODE_REF_REL8) {
+				return 0;
+			}
+			break;
+		default:
+			return 0;
+		}
+	}
+	if (!has_bytes(buf, block->native_size)) {
+		return 0;
+	}
+	block->code = buf->data + buf->cur_pos;
+	buf->cur_pos += block->native_size;
+	return 1;
+}
+
+void jit_cache_load(jit_cache *cache, char *path, uint8_t *rom_hash)
+{
+	deserialize_buffer buf;
+	if (!cache || !load_from_file(&buf, path)) {
+		return;
+	}
+	char magic[sizeof(JIT_CACHE_MAGIC) - 1];
+	uint8_t hash[ROM_HASH_BYTES];
+	if (!has_bytes(&buf, sizeof(magic) + sizeof(hash) + 4 * sizeof(uint32_t))) {
+		goto invalid;
+	}
+	//the file ends with a checksum of everything before it, native code can't be allowed to be damaged
+	buf.size -= sizeof(uint32_t);
+	uint8_t *check = buf.data + buf.size;
+	if (hash_bytes(FNV_OFFSET, buf.data, buf.size) != ((uint32_t)check[0] << 24 | check[1] << 16 | check[2] << 8 | check[3])) {
+		goto invalid;
+	}
+	load_buffer8(&buf, magic, sizeof(magic));
+	if (memcmp(magic, JIT_CACHE_MAGIC, sizeof(magic)) || load_int32(&buf) != JIT_CACHE_VERSION) {
+		debug_message("Translation cache %s is from a different version, ignoring\n", path);
+		goto done;
+	}
+	load_buffer8(&buf, hash, sizeof(hash));
+	if (memcmp(hash, rom_hash, sizeof(hash))) {
+		debug_message("Translation cache %s is for a different ROM, ignoring\n", path);
+		goto done;
+	}
+	if (load_int32(&buf) != cache->fingerprint) {
+		debug_message("Translation cache %s was generated with different settings, ignoring\n", path);
+		goto done;
+	}
+	uint32_t num_blocks = load_int32(&buf);
+	if (num_blocks > buf.size / 16) {
+		goto invalid;
+	}
+	free_blocks(cache);
+	cache->blocks = calloc(num_blocks ? num_blocks : 1, sizeof(saved_block));
+	cache->num_blocks = num_blocks;
+	cache->file_data = buf.data;
+	for (uint32_t i = 0; i < num_blocks; i++)
+	{
+		if (!parse_block(cache, &buf, cache->blocks + i)) {
+			//file_data is freed along with the blocks
+			buf.data = NULL;
+			free_blocks(cache);
+			goto invalid;
+		}
+	}
+	debug_message("Loaded %u blocks from translation cache %s\n", num_blocks, path);
+	return;
+invalid:
+	warning("Translation cache %s is corrupt, ignoring\n", path);
+done:
+	free(buf.data);
+}
+
+static uint8_t apply_block(jit_cache *cache, saved_block *block, uint8_t *guest)
+{
+	jit_cache_funcs const *funcs = cache->funcs;
+	void *context = cache->context;
+	for (uint32_t i = 0; i < block->num_records; i++)
+	{
+		saved_record *rec = block->records + i;
+		if (!funcs->cacheable(context, rec->address, rec->size) || !funcs->unmapped(context, rec->address, rec->size)) {
+			return 0;
+		}
+		funcs->fetch(context, rec->address, guest, rec->size);
+		if (memcmp(guest, rec->guest, rec->size)) {
+			return 0;
+		}
+	}
+	code_ptr *targets = calloc(block->num_refs ? block->num_refs : 1, sizeof(code_ptr));
+	for (uint32_t i = 0; i < block->num_refs; i++)
+	{
+		saved_ref *ref = block->refs + i;
+		if (ref->type == TARGET_SYMBOL) {
+			targets[i] = cache->symbols[ref->value];
+		} else if (ref->type == TARGET_HELPER) {
+			targets[i] = funcs->helper_resolve(context, ref->value);
+			if (!targets[i]) {
+				free(targets);
+				return 0;
+			}
+		} else if (ref->type == TARGET_GUEST) {
+			//NULL means the target hasn't been translated yet and is deferred instead
+			targets[i] = funcs->get_native(context, ref->value);
+		}
+	}
+	code_info *code = &cache->opts->code;
+	check_alloc_code(code, block->native_size + TAIL_JMP_SIZE);
+	code_ptr base = code->cur;
+	//check everything can be reached from the new location before committing to anything
+	for (uint32_t i = 0; i < block->num_refs; i++)
+	{
+		saved_ref *ref = block->refs + i;
+		code_ptr target = ref->type == TARGET_SELF ? base + ref->value : targets[i];
+		if (!target) {
+			continue;
+		}
+		if (ref->kind == CODE_REF_REL32 && ref->type != TARGET_SELF) {
+			if (!fits_int32(target - (base + ref->offset + sizeof(int32_t)))) {
+				free(targets);
+				return 0;
+			}
+		} else if (ref->kind == CODE_REF_ABS32 && !fits_int32((intptr_t)target)) {
+			free(targets);
+			return 0;
+		}
+	}
+	memcpy(base, block->code, block->native_size);
+	code->cur = base + block->native_size;
+	code->refs = &cache->log;
+	for (uint32_t i = 0; i < block->num_refs; i++)
+	{
+		saved_ref *ref = block->refs + i;
+		code_ptr site = base + ref->offset;
+		code_ptr target = ref->type == TARGET_SELF ? base + ref->value : targets[i];
+		if (ref->kind == CODE_REF_REL32 && ref->type != TARGET_SELF) {
+			if (target) {
+				int32_t disp = target - (site + sizeof(int32_t));
+				memcpy(site, &disp, sizeof(disp));
+			} else {
+				cache->opts->deferred = defer_address(cache->opts->deferred, ref->value, site);
+			}
+		} else if (ref->kind == CODE_REF_ABS32) {
+			int32_t value = (intptr_t)target;
+			memcpy(site, &value, sizeof(value));
+		} else if (ref->kind == CODE_REF_ABS64) {
+			int64_t value = (intptr_t)target;
+			memcpy(site, &value, sizeof(value));
+		}
+		//the relocated code needs to be saveable again next time
+		log_code_ref(code, site, target, ref->kind);
+	}
+	code->refs = NULL;
+	for (uint32_t i = 0; i < block->num_records; i++)
+	{
+		saved_record *rec = block->records + i;
+		code_ptr native = base + rec->native_offset;
+		code_ptr native_end = base + (i + 1 < block->num_records ? block->records[i + 1].native_offset : block->native_size);
+		funcs->map(context, rec->address, native, rec->size, rec->map_size);
+		add_record(cache, rec->address, rec->size, native, native_end, rec->map_size, i + 1 == block->num_records && block->falls_through, rec->guest);
+	}
+	if (block->falls_through) {
+		code_ptr next = funcs->get_native(context, block->tail);
+		if (!next) {
+			cache->opts->deferred = defer_address(cache->opts->deferred, block->tail, code->cur + 1);
+			//dummy address to be replaced later, make sure it generates a 4-byte displacement
+			next = code->cur + 256;
+		}
+		jmp(code, next);
+	}
+	free(targets);
+	return 1;
+}
+
+void jit_cache_apply(jit_cache *cache)
+{
+	if (!cache || !cache->num_blocks) {
+		return;
+	}
+	uint32_t applied = 0, pending = 0;
+	uint8_t *guest = NULL;
+	uint32_t guest_storage = 0;
+	for (uint32_t i = 0; i < cache->num_blocks; i++)
+	{
+		saved_block *block = cache->blocks + i;
+		if (block->applied) {
+			continue;
+		}
+		for (uint32_t j = 0; j < block->num_records; j++)
+		{
+			if (block->records[j].size > guest_storage) {
+				guest_storage = block->records[j].size;
+				guest = realloc(guest, guest_storage);
+			}
+		}
+		if (apply_block(cache, block, guest)) {
+			block->applied = 1;
+			applied++;
+		} else {
+			//guest code doesn't match right now, but it might once a different bank or ROM is mapped in
+			pending++;
+		}
+	}
+	free(guest);
+	if (applied) {
+		cache->funcs->handle_deferred(cache->context);
+	}
+	debug_message("Applied %u blocks from the translation cache, %u don't match the current memory contents\n", applied, pending);
+}
+
+static int compare_records(const void *a, const void *b)
+{
+	jit_record const *left = *(jit_record * const *)a, *right = *(jit_record * const *)b;
+	return left->native < right->native ? -1 : left->native > right->native;
+}
+
+static int compare_refs(const void *a, const void *b)
+{
+	code_ref const *left = a, *right = b;
+	return left->site < right->site ? -1 : left->site > right->site;
+}
+
+static int compare_guest(const void *a, const void *b)
+{
+	guest_entry const *left = a, *right = b;
+	return left->native < right->native ? -1 : left->native > right->native;
+}
+
+static int compare_addresses(const void *a, const void *b)
+{
+	uint32_t left = *(const uint32_t *)a, right = *(const uint32_t *)b;
+	return left < right ? -1 : left > right;
+}
+
+static int compare_entry_addresses(const void *a, const void *b)
+{
+	guest_entry const *left = a, *right = b;
+	return left->address < right->address ? -1 : left->address > right->address;
+}
+
+//builds a list of every translated guest address sorted by native address
+static guest_entry *build_guest_map(jit_cache *cache, uint32_t *count)
+{
+	native_map_slot *map = cache->opts->native_code_map;
+	uint32_t num = 0, storage = 1024;
+	guest_entry *entries = malloc(sizeof(guest_entry) * storage);
+	for (uint32_t chunk = 0; chunk < cache->map_chunks; chunk++)
+	{
+		if (!map[chunk].base) {
+			continue;
+		}
+		for (uint32_t offset = 0; offset < cache->map_chunk_size; offset++)
+		{
+			int32_t native = map[chunk].offsets[offset];
+			if (native == (int32_t)INVALID_OFFSET || native == (int32_t)EXTENSION_WORD) {
+				continue;
+			}
+			if (num == storage) {
+				storage *= 2;
+				entries = realloc(entries, sizeof(guest_entry) * storage);
+			}
+			entries[num++] = (guest_entry){map[chunk].base + native, chunk * cache->map_chunk_size + offset};
+		}
+	}
+	//code can still jump to a translation that was replaced after the jump was linked, the old entry point
+	//is patched to jump to the replacement so jumping there is the same as entering the address
+	for (uint32_t i = 0; i < cache->num_forgotten; i++)
+	{
+		guest_entry *entry = cache->forgotten + i;
+		if (!entry->native || cache->funcs->get_native(cache->context, entry->address) == entry->native) {
+			continue;
+		}
+		if (num == storage) {
+			storage *= 2;
+			entries = realloc(entries, sizeof(guest_entry) * storage);
+		}
+		entries[num++] = *entry;
+	}
+	qsort(entries, num, sizeof(guest_entry), compare_guest);
+	*count = num;
+	return entries;
+}
+
+static uint8_t record_is_live(jit_cache *cache, jit_record *rec, uint8_t *guest)
+{
+	guest_entry key = {.address = rec->address};
+	if (bsearch(&key, cache->forgotten, cache->num_forgotten, sizeof(guest_entry), compare_entry_addresses)) {
+		return 0;
+	}
+	//patched for retranslation or a breakpoint, or replaced by a different translation
+	if (cache->funcs->get_native(cache->context, rec->address) != rec->native || is_mov_ir(rec->native)) {
+		return 0;
+	}
+	if (!cache->funcs->cacheable(cache->context, rec->address, rec->size)) {
+		return 0;
+	}
+	cache->funcs->fetch(cache->context, rec->address, guest, rec->size);
+	return !memcmp(guest, cache->guest_data + rec->guest_offset, rec->size);
+}
+
+static uint8_t classify_target(jit_cache *cache, guest_entry *guest_map, uint32_t guest_count, code_ptr target, saved_ref *out)
+{
+	for (uint32_t i = 0; i < cache->num_symbols; i++)
+	{
+		if (cache->symbols[i] == target) {
+			out->type = TARGET_SYMBOL;
+			out->value = i;
+			return 1;
+		}
+	}
+	if (cache->funcs->helper_tag(cache->context, target, &out->value)) {
+		out->type = TARGET_HELPER;
+		return 1;
+	}
+	if (out->kind != CODE_REF_REL32) {
+		return 0;
+	}
+	guest_entry key = {.native = target};
+	guest_entry *entry = bsearch(&key, guest_map, guest_count, sizeof(guest_entry), compare_guest);
+	if (!entry) {
+		return 0;
+	}
+	out->type = TARGET_GUEST;
+	out->value = entry->address;
+	return 1;
+}
+
+//writes out a group of natively contiguous records, returns 0 if any code address in it can't be relocated
+static uint8_t save_block(jit_cache *cache, serialize_buffer *buf, jit_record **recs, uint32_t count, guest_entry *guest_map, uint32_t guest_count)
+{
+	code_ptr start = recs[0]->native, end = recs[count - 1]->native_end;
+	uint8_t falls_through = recs[count - 1]->falls_through;
+	uint32_t native_size = end - start;
+	uint8_t *code = malloc(native_size);
+	memcpy(code, start, native_size);
+	code_ref *refs = cache->log.refs;
+	uint32_t first = 0, last = cache->log.num_refs;
+	while (first < last)
+	{
+		uint32_t mid = (first + last) / 2;
+		if (refs[mid].site < start) {
+			first = mid + 1;
+		} else {
+			last = mid;
+		}
+	}
+	uint32_t num_refs = 0;
+	for (uint32_t i = first; i < cache->log.num_refs && refs[i].site < end; i++)
+	{
+		num_refs++;
+	}
+	saved_ref *out = calloc(num_refs ? num_refs : 1, sizeof(saved_ref));
+	uint32_t num_out = 0;
+	uint8_t success = 1;
+	for (uint32_t i = first; i < first + num_refs && success; i++)
+	{
+		code_ref *ref = refs + i;
+		if (i + 1 < first + num_refs && refs[i + 1].site == ref->site) {
+			//the same code was emitted twice, which is only fine if both times agree
+			if (refs[i + 1].kind != ref->kind || refs[i + 1].opcode != ref->opcode) {
+				success = 0;
+				break;
+			}
+			continue;
+		}
+		uint32_t offset = ref->site - start;
+		if (!offset || offset + ref_width(ref->kind) > native_size) {
+			success = 0;
+			break;
+		}
+		code_ptr target;
+		if (ref->kind == CODE_REF_REL8 || ref->kind == CODE_REF_REL32) {
+			if (code[offset - 1] != ref->opcode) {
+				//a call that has been replaced by a jump, like the one to checked_run, can be restored
+				if (ref->kind == CODE_REF_REL32 && ref->opcode == CALL_REL32) {
+					code[offset - 1] = CALL_REL32;
+					target = ref->target;
+				} else {
+					success = 0;
+					break;
+				}
+			} else if (ref->kind == CODE_REF_REL8) {
+				target = ref->site + 1 + (int8_t)code[offset];
+			} else {
+				int32_t disp;
+				memcpy(&disp, code + offset, sizeof(disp));
+				target = ref->site + sizeof(disp) + disp;
+			}
+		} else if (ref->kind == CODE_REF_ABS32) {
+			int32_t value;
+			memcpy(&value, code + offset, sizeof(value));
+			target = (code_ptr)(intptr_t)value;
+		} else {
+			int64_t value;
+			memcpy(&value, code + offset, sizeof(value));
+			target = (code_ptr)(intptr_t)value;
+		}
+		saved_ref *saved = out + num_out++;
+		saved->offset = offset;
+		saved->kind = ref->kind;
+		if (target >= start && (target < end || (target == end && falls_through))) {
+			saved->type = TARGET_SELF;
+			saved->value = target - start;
+		} else if (ref->kind == CODE_REF_REL8 || !classify_target(cache, guest_map, guest_count, target, saved)) {
+			success = 0;
+		}
+	}
+	if (success) {
+		jit_record *last_rec = recs[count - 1];
+		save_int32(buf, native_size);
+		save_int8(buf, falls_through);
+		save_int32(buf, (last_rec->address + last_rec->size) & cache->opts->address_mask);
+		save_int32(buf, count);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			save_int32(buf, recs[i]->address);
+			save_int32(buf, recs[i]->size);
+			save_int32(buf, recs[i]->native - start);
+			save_int8(buf, recs[i]->map_size);
+			save_buffer8(buf, cache->guest_data + recs[i]->guest_offset, recs[i]->size);
+		}
+		save_int32(buf, num_out);
+		for (uint32_t i = 0; i < num_out; i++)
+		{
+			save_int32(buf, out[i].offset);
+			save_int8(buf, out[i].kind);
+			save_int8(buf, out[i].type);
+			save_int32(buf, out[i].value);
+		}
+		save_buffer8(buf, code, native_size);
+	}
+	free(out);
+	free(code);
+	return success;
+}
+
+static void save_saved_block(serialize_buffer *buf, saved_block *block)
+{
+	save_int32(buf, block->native_size);
+	save_int8(buf, block->falls_through);
+	save_int32(buf, block->tail);
+	save_int32(buf, block->num_records);
+	for (uint32_t i = 0; i < block->num_records; i++)
+	{
+		saved_record *rec = block->records + i;
+		save_int32(buf, rec->address);
+		save_int32(buf, rec->size);
+		save_int32(buf, rec->native_offset);
+		save_int8(buf, rec->map_size);
+		save_buffer8(buf, rec->guest, rec->size);
+	}
+	save_int32(buf, block->num_refs);
+	for (uint32_t i = 0; i < block->num_refs; i++)
+	{
+		saved_ref *ref = block->refs + i;
+		save_int32(buf, ref->offset);
+		save_int8(buf, ref->kind);
+		save_int8(buf, ref->type);
+		save_int32(buf, ref->value);
+	}
+	save_buffer8(buf, block->code, block->native_size);
+}
+
+void jit_cache_save(jit_cache *cache, char *path, uint8_t *rom_hash)
+{
+	if (!cache) {
+		return;
+	}
+	qsort(cache->forgotten, cache->num_forgotten, sizeof(guest_entry), compare_entry_addresses);
+	qsort(cache->log.refs, cache->log.num_refs, sizeof(code_ref), compare_refs);
+	jit_record **live = malloc(sizeof(jit_record *) * (cache->num_records ? cache->num_records : 1));
+	uint32_t num_live = 0, max_size = 0;
+	for (uint32_t i = 0; i < cache->num_records; i++)
+	{
+		if (cache->records[i].size > max_size) {
+			max_size = cache->records[i].size;
+		}
+	}
+	uint8_t *guest = malloc(max_size ? max_size : 1);
+	for (uint32_t i = 0; i < cache->num_records; i++)
+	{
+		if (record_is_live(cache, cache->records + i, guest)) {
+			live[num_live++] = cache->records + i;
+		}
+	}
+	free(guest);
+	qsort(live, num_live, sizeof(jit_record *), compare_records);
+	uint32_t guest_count;
+	guest_entry *guest_map = build_guest_map(cache, &guest_count);
+
+	serialize_buffer buf;
+	init_serialize(&buf);
+	save_buffer8(&buf, JIT_CACHE_MAGIC, sizeof(JIT_CACHE_MAGIC) - 1);
+	save_int32(&buf, JIT_CACHE_VERSION);
+	save_buffer8(&buf, rom_hash, ROM_HASH_BYTES);
+	save_int32(&buf, cache->fingerprint);
+	size_t count_pos = buf.size;
+	save_int32(&buf, 0);
+	uint32_t num_blocks = 0, skipped = 0;
+	for (uint32_t i = 0; i < num_live;)
+	{
+		uint32_t count = 1;
+		while (
+			i + count < num_live && live[i + count]->native == live[i + count - 1]->native_end
+			&& live[i + count]->native_end - live[i]->native <= MAX_BLOCK_SIZE
+		) {
+			count++;
+		}
+		if (live[i + count - 1]->native_end - live[i]->native > MAX_BLOCK_SIZE) {
+			//a single oversized run of instructions
+			skipped++;
+		} else {
+			size_t block_start = buf.size;
+			if (save_block(cache, &buf, live + i, count, guest_map, guest_count)) {
+				num_blocks++;
+			} else {
+				buf.size = block_start;
+				skipped++;
+			}
+		}
+		i += count;
+	}
+	//blocks that never matched memory this session are kept unless the same code was translated again
+	uint32_t *saved_addresses = malloc(sizeof(uint32_t) * (num_live ? num_live : 1));
+	for (uint32_t i = 0; i < num_live; i++)
+	{
+		saved_addresses[i] = live[i]->address;
+	}
+	qsort(saved_addresses, num_live, sizeof(uint32_t), compare_addresses);
+	for (uint32_t i = 0; i < cache->num_blocks; i++)
+	{
+		saved_block *block = cache->blocks + i;
+		if (block->applied) {
+			continue;
+		}
+		uint8_t superseded = 0;
+		for (uint32_t j = 0; j < block->num_records && !superseded; j++)
+		{
+			superseded = bsearch(&block->records[j].address, saved_addresses, num_live, sizeof(uint32_t), compare_addresses) != NULL;
+		}
+		if (!superseded) {
+			save_saved_block(&buf, block);
+			num_blocks++;
+		}
+	}
+	free(saved_addresses);
+	buf.data[count_pos] = num_blocks >> 24;
+	buf.data[count_pos + 1] = num_blocks >> 16;
+	buf.data[count_pos + 2] = num_blocks >> 8;
+	buf.data[count_pos + 3] = num_blocks;
+	save_int32(&buf, hash_bytes(FNV_OFFSET, buf.data, buf.size));
+	if (save_to_file(&buf, path)) {
+		debug_message("Saved %u blocks to translation cache %s, %u could not be relocated\n", num_blocks, path, skipped);
+	} else {
+		warning("Failed to save translation cache to %s\n", path);
+	}
+	free(buf.data);
+	free(guest_map);
+	free(live);
+}
@@ -0,0 +1,44 @@
+#ifndef JIT_CACHE_H_
+#define JIT_CACHE_H_
+#include "backend.h"
+
+//Persists translated ROM code between runs. Code emitted while a cacheable instruction is translated
+//has every code address it contains logged, so on save each contiguous group of translated instructions
+//can be written out with its native_code_map entries and a relocation for each of those addresses.
+//On load the code is copied into the code buffer, the relocations are applied and the instructions are
+//mapped as if they had just been translated
+
+typedef struct {
+	//non-zero if code translated from this guest range can be saved or loaded, i.e. it's in ROM
+	uint8_t  (*cacheable)(void *context, uint32_t address, uint32_t size);
+	//non-zero if no part of this guest range has been translated yet
+	uint8_t  (*unmapped)(void *context, uint32_t address, uint32_t size);
+	//copies the guest code the translation was generated from
+	void     (*fetch)(void *context, uint32_t address, uint8_t *dst, uint32_t size);
+	code_ptr (*get_native)(void *context, uint32_t address);
+	//native size to pass to map for an existing translation, only matters in MMAP_CODE chunks
+	uint8_t  (*map_size)(void *context, uint32_t address);
+	void     (*map)(void *context, uint32_t address, code_ptr native, uint8_t size, uint8_t native_size);
+	//translates whatever is left on the deferred list
+	void     (*handle_deferred)(void *context);
+	//identifies code generated outside of the main helpers on demand, like the MOVEM routines
+	uint8_t  (*helper_tag)(void *context, code_ptr target, uint32_t *tag);
+	code_ptr (*helper_resolve)(void *context, uint32_t tag);
+} jit_cache_funcs;
+
+//symbols lists every helper and C function translated code can reference in a fixed order,
+//layout is anything else about the core the generated code depends on, like the size of its context
+jit_cache *jit_cache_new(void *context, cpu_options *opts, jit_cache_funcs const *funcs, code_ptr *symbols, uint32_t num_symbols, uint32_t layout, uint32_t map_chunk_size, uint32_t map_chunks);
+void jit_cache_free(jit_cache *cache);
+//wraps the translation of a single instruction or run of instructions, end is passed the guest range
+//that was translated and whether execution continues past it
+void jit_cache_begin(jit_cache *cache);
+void jit_cache_end(jit_cache *cache, uint32_t address, uint32_t size, uint8_t falls_through);
+//called when the translation of address at native is replaced, code linked to native stays valid
+void jit_cache_forget(jit_cache *cache, uint32_t address, code_ptr native);
+void jit_cache_load(jit_cache *cache, char *path, uint8_t *rom_hash);
+//translates code loaded from the cache that matches what is currently in memory
+void jit_cache_apply(jit_cache *cache);
+void jit_cache_save(jit_cache *cache, char *path, uint8_t *rom_hash);
+
+#endif //JIT_CACHE_H_
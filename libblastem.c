@@ -9,7 +9,7 @@
 #include "genesis.h"
 #include "sms.h"
 
-static retro_environment_t retro_environment;
+static INSTANCE_LOCAL retro_environment_t retro_environment;
 RETRO_API void retro_set_environment(retro_environment_t re)
 {
 	retro_environment = re;
@@ -42,7 +42,7 @@ RETRO_API void retro_set_environment(retro_environment_t re)
 	re(RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS, (void *)desc);
 }
 
-static retro_video_refresh_t retro_video_refresh;
+static INSTANCE_LOCAL retro_video_refresh_t retro_video_refresh;
 RETRO_API void retro_set_video_refresh(retro_video_refresh_t rvf)
 {
 	retro_video_refresh = rvf;
@@ -52,37 +52,40 @@ RETRO_API void retro_set_audio_sample(retro_audio_sample_t ras)
 {
 }
 
-static retro_audio_sample_batch_t retro_audio_sample_batch;
+static INSTANCE_LOCAL retro_audio_sample_batch_t retro_audio_sample_batch;
 RETRO_API void retro_set_audio_sample_batch(retro_audio_sample_batch_t rasb)
 {
 	retro_audio_sample_batch = rasb;
 }
 
-static retro_input_poll_t retro_input_poll;
+static INSTANCE_LOCAL retro_input_poll_t retro_input_poll;
 RETRO_API void retro_set_input_poll(retro_input_poll_t rip)
 {
 	retro_input_poll = rip;
 }
 
-static retro_input_state_t retro_input_state;
+static INSTANCE_LOCAL retro_input_state_t retro_input_state;
 RETRO_API void retro_set_input_state(retro_input_state_t ris)
 {
 	retro_input_state = ris;
 }
 
 int headless = 0;
-int exit_after = 0;
-int z80_enabled = 1;
-char *save_filename;
-tern_node *config;
-uint8_t use_native_states = 1;
-system_header *current_system;
-static system_media media;
+INSTANCE_LOCAL int exit_after = 0;
+INSTANCE_LOCAL int z80_enabled = 1;
+INSTANCE_LOCAL char *save_filename;
+INSTANCE_LOCAL tern_node *config;
+INSTANCE_LOCAL uint8_t use_native_states = 1;
+INSTANCE_LOCAL system_header *current_system;
+static INSTANCE_LOCAL system_media media;
 const system_media *current_media(void)
 {
 	return &media;
 }
 
+//allocated on first use rather than as a TLS array so threads that never run a system don't pay for it
+static INSTANCE_LOCAL uint32_t *fb;
+
 RETRO_API void retro_init(void)
 {
 	render_audio_initialized(RENDER_AUDIO_S16, 53693175 / (7 * 6 * 4), 2, 4, sizeof(int16_t));
@@ -93,6 +96,8 @@ RETRO_API void retro_deinit(void)
 	if (current_system) {
 		retro_unload_game();
 	}
+	free(fb);
+	fb = NULL;
 }
 
 RETRO_API unsigned retro_api_version(void)
@@ -109,9 +114,9 @@ RETRO_API void retro_get_system_info(struct retro_system_info *info)
 	info->block_extract = 0;
 }
 
-static vid_std video_standard;
-static uint32_t last_width, last_height;
-static uint32_t overscan_top, overscan_bot, overscan_left, overscan_right;
+static INSTANCE_LOCAL vid_std video_standard;
+static INSTANCE_LOCAL uint32_t last_width, last_height;
+static INSTANCE_LOCAL uint32_t overscan_top, overscan_bot, overscan_left, overscan_right;
 static void update_overscan(void)
 {
 	uint8_t overscan;
@@ -133,7 +138,7 @@ static void update_overscan(void)
 	}
 }
 
-static int32_t sample_rate;
+static INSTANCE_LOCAL int32_t sample_rate;
 RETRO_API void retro_get_system_av_info(struct retro_system_av_info *info)
 {
 	update_overscan();
@@ -171,7 +176,7 @@ RETRO_API void retro_reset(void)
  * a frame if GET_CAN_DUPE returns true.
  * In this case, the video callback can take a NULL argument for data.
  */
-static uint8_t started;
+static INSTANCE_LOCAL uint8_t started;
 RETRO_API void retro_run(void)
 {
 	if (started) {
@@ -188,7 +193,7 @@ RETRO_API void retro_run(void)
  * returned size is never allowed to be larger than a previous returned
  * value, to ensure that the frontend can allocate a save state buffer once.
  */
-static size_t serialize_size_cache;
+static INSTANCE_LOCAL size_t serialize_size_cache;
 RETRO_API size_t retro_serialize_size(void)
 {
 	if (!serialize_size_cache) {
@@ -228,7 +233,7 @@ RETRO_API void retro_cheat_set(unsigned index, bool enabled, const char *code)
 }
 
 /* Loads a game. */
-static system_type stype;
+static INSTANCE_LOCAL system_type stype;
 RETRO_API bool retro_load_game(const struct retro_game_info *game)
 {
 	serialize_size_cache = 0;
@@ -267,6 +272,7 @@ RETRO_API void retro_unload_game(void)
 	media.buffer = NULL;
 	current_system->free_context(current_system);
 	current_system = NULL;
+	started = 0;
 }
 
 /* Gets region of game. */
@@ -349,10 +355,12 @@ void render_destroy_window(uint8_t which)
 	//not supported in lib build
 }
 
-static uint32_t fb[LINEBUF_SIZE * 294 * 2];
-static uint8_t last_fb;
+static INSTANCE_LOCAL uint8_t last_fb;
 uint32_t *render_get_framebuffer(uint8_t which, int *pitch)
 {
+	if (!fb) {
+		fb = calloc(LINEBUF_SIZE * 294 * 2, sizeof(uint32_t));
+	}
 	*pitch = LINEBUF_SIZE * sizeof(uint32_t);
 	if (which != last_fb) {
 		*pitch = *pitch * 2;
@@ -415,7 +423,7 @@ uint32_t render_overscan_bot()
 
 void process_events()
 {
-	static int16_t prev_state[2][RETRO_DEVICE_ID_JOYPAD_L2];
+	static INSTANCE_LOCAL int16_t prev_state[2][RETRO_DEVICE_ID_JOYPAD_L2];
 	static const uint8_t map[] = {
 		BUTTON_A, BUTTON_X, BUTTON_MODE, BUTTON_START, DPAD_UP, DPAD_DOWN,
 		DPAD_LEFT, DPAD_RIGHT, BUTTON_B, BUTTON_Y, BUTTON_Z, BUTTON_C
@@ -10,6 +10,7 @@
 #include "gen.h"
 #include "util.h"
 #include "serialize.h"
+#include "jit_cache.h"
 #include <stdio.h>
 #include <stddef.h>
 #include <stdlib.h>
@@ -227,8 +228,7 @@ static void translate_m68k_jmp_jsr(m68k_options * opts, m68kinst * inst)
 			push_const(opts, inst->address+2);
 		}
 		areg_to_native(opts, inst->src.params.regs.pri, opts->gen.scratch1);
-		call(code, opts->native_addr);
-		jmp_r(code, opts->gen.scratch1);
+		jump_m68k_indirect(opts);
 		break;
 	case MODE_AREG_DISPLACE:
 		cycles(&opts->gen, BUS*2 + 2);
@@ -236,8 +236,7 @@ static void translate_m68k_jmp_jsr(m68k_options * opts, m68kinst * inst)
 			push_const(opts, inst->address+4);
 		}
 		calc_areg_displace(opts, &inst->src, opts->gen.scratch1);
-		call(code, opts->native_addr);
-		jmp_r(code, opts->gen.scratch1);
+		jump_m68k_indirect(opts);
 		break;
 	case MODE_AREG_INDEX_DISP8:
 		cycles(&opts->gen, BUS*3 + 2);
@@ -245,8 +244,7 @@ static void translate_m68k_jmp_jsr(m68k_options * opts, m68kinst * inst)
 			push_const(opts, inst->address+4);
 		}
 		calc_areg_index_disp8(opts, &inst->src, opts->gen.scratch1);
-		call(code, opts->native_addr);
-		jmp_r(code, opts->gen.scratch1);
+		jump_m68k_indirect(opts);
 		break;
 	case MODE_PC_DISPLACE:
 		//TODO: Add cycles in the right place relative to pushing the return address on the stack
@@ -263,8 +261,7 @@ static void translate_m68k_jmp_jsr(m68k_options * opts, m68kinst * inst)
 		}
 		ldi_native(opts, inst->address+2, opts->gen.scratch1);
 		calc_index_disp8(opts, &inst->src, opts->gen.scratch1);
-		call(code, opts->native_addr);
-		jmp_r(code, opts->gen.scratch1);
+		jump_m68k_indirect(opts);
 		break;
 	case MODE_ABSOLUTE:
 	case MODE_ABSOLUTE_SHORT:
@@ -491,6 +488,13 @@ static code_ptr get_movem_impl(m68k_options *opts, m68kinst *inst)
 	opts->gen.code = tmp;
 
 	rts(&opts->extra_code);
+	opts->big_movem[opts->num_movem++] = (movem_fun){
+		.impl = impl,
+		.reglist = reglist,
+		.reg_to_mem = reg_to_mem,
+		.size = size,
+		.dir = dir
+	};
 	return impl;
 }
 
@@ -710,6 +714,10 @@ static void map_native_address(m68k_context * context, uint32_t address, code_pt
 			uint32_t final_off = masked + meta_off;
 			uint32_t ram_flags_off = final_off >> (opts->gen.ram_flags_shift + 3);
 			context->ram_code_flags[ram_flags_off] |= 1 << ((final_off >> opts->gen.ram_flags_shift) & 7);
+			//stubs for deferred translation are already in the patched form
+			if (m68k_is_live(opts, native_addr)) {
+				opts->live_code[final_off >> opts->gen.ram_flags_shift]++;
+			}
 
 			uint32_t slot = final_off / 1024;
 			if (!opts->gen.ram_inst_sizes[slot]) {
@@ -753,6 +761,17 @@ static void map_native_address(m68k_context * context, uint32_t address, code_pt
 	}
 }
 
+//Returns the index of the ram_code_flags bit that covers address or -1 if it's not in a code chunk
+int32_t m68k_code_page(m68k_options *opts, uint32_t address)
+{
+	uint32_t meta_off;
+	memmap_chunk const *chunk = find_map_chunk(address, &opts->gen, MMAP_CODE, &meta_off);
+	if (!chunk || !(chunk->flags & MMAP_CODE)) {
+		return -1;
+	}
+	return (meta_off + ((address - chunk->start) & chunk->mask)) >> opts->gen.ram_flags_shift;
+}
+
 static uint8_t get_native_inst_size(m68k_options * opts, uint32_t address)
 {
 	uint32_t meta_off;
@@ -817,7 +836,12 @@ void insert_breakpoint(m68k_context * context, uint32_t address, m68k_debug_hand
 			.handler = bp_handler,
 			.address = address
 		};
-		m68k_breakpoint_patch(context, address, bp_handler, NULL);
+		if (!get_native_address(context->options, address) && get_instruction_start(context->options, address)) {
+			//address is inside a run translated without per-instruction checks, retranslate it
+			m68k_invalidate_code_range(context, address, address + 2);
+		} else {
+			m68k_breakpoint_patch(context, address, bp_handler, NULL);
+		}
 	}
 }
 
@@ -1077,21 +1101,8 @@ static impl_info m68k_impls[] = {
 	RAW_IMPL(M68K_TAS, translate_m68k_tas),
 };
 
-static void translate_m68k(m68k_context *context, m68kinst * inst)
+static void translate_m68k_body(m68k_options *opts, m68kinst *inst)
 {
-	m68k_options * opts = context->options;
-	if (inst->address & 1) {
-		translate_m68k_odd(opts, inst);
-		return;
-	}
-	code_ptr start = opts->gen.code.cur;
-	check_cycles_int(&opts->gen, inst->address);
-
-	m68k_debug_handler bp;
-	if ((bp = find_breakpoint(context, inst->address))) {
-		m68k_breakpoint_patch(context, inst->address, bp, start);
-	}
-
 	//log_address(&opts->gen, inst->address, opts->gen.clock_divider == 4 ? "Sub M68k: %X @ %d\n" : "Main M68K: %X @ %d\n");
 	if (
 		(inst->src.addr_mode > MODE_AREG && inst->src.addr_mode < MODE_IMMEDIATE)
@@ -1134,12 +1145,283 @@ static void translate_m68k(m68k_context *context, m68kinst * inst)
 	}
 }
 
+static void translate_m68k(m68k_context *context, m68kinst * inst)
+{
+	m68k_options * opts = context->options;
+	if (inst->address & 1) {
+		translate_m68k_odd(opts, inst);
+		return;
+	}
+	code_ptr start = opts->gen.code.cur;
+	check_cycles_int(&opts->gen, inst->address);
+
+	m68k_debug_handler bp;
+	if ((bp = find_breakpoint(context, inst->address))) {
+		m68k_breakpoint_patch(context, inst->address, bp, start);
+	}
+	translate_m68k_body(opts, inst);
+}
+
 uint16_t m68k_instruction_fetch(uint32_t address, void *vcontext)
 {
 	m68k_context *context = vcontext;
 	return read_word(address, (void **)context->mem_pointers, &context->options->gen, context);
 }
 
+//identifies a MOVEM routine by what it does, which unlike its address is the same on every run
+#define MOVEM_TAG(reglist, reg_to_mem, size, dir) ((reglist) | (reg_to_mem) << 16 | (size) << 17 | ((dir) < 0) << 19)
+
+static uint8_t m68k_cache_cacheable(void *vcontext, uint32_t address, uint32_t size)
+{
+	m68k_context *context = vcontext;
+	if (address & 1) {
+		return 0;
+	}
+	//only ROM contents are stable enough between runs to be worth saving
+	memmap_chunk const *chunk = find_map_chunk(address, &context->options->gen, 0, NULL);
+	if (!chunk || (chunk->flags & (MMAP_READ | MMAP_WRITE)) != MMAP_READ || address + size > chunk->end) {
+		return 0;
+	}
+	for (uint32_t i = 0; i < context->num_breakpoints; i++)
+	{
+		if (context->breakpoints[i].address >= address && context->breakpoints[i].address < address + size) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static uint8_t m68k_cache_unmapped(void *vcontext, uint32_t address, uint32_t size)
+{
+	m68k_context *context = vcontext;
+	native_map_slot *native_code_map = context->options->gen.native_code_map;
+	memmap_chunk const *chunk = find_map_chunk(address, &context->options->gen, 0, NULL);
+	for (uint32_t end = address + size; address < end; address++)
+	{
+		//calculate the lowest alias for this address
+		uint32_t lowest = chunk->start + ((address - chunk->start) & chunk->mask);
+		native_map_slot *slot = native_code_map + lowest / NATIVE_CHUNK_SIZE;
+		if (slot->base && slot->offsets[lowest % NATIVE_CHUNK_SIZE] != INVALID_OFFSET) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void m68k_cache_fetch(void *vcontext, uint32_t address, uint8_t *dst, uint32_t size)
+{
+	for (uint32_t i = 0; i < size; i += 2)
+	{
+		uint16_t word = m68k_instruction_fetch(address + i, vcontext);
+		dst[i] = word >> 8;
+		dst[i + 1] = word;
+	}
+}
+
+static code_ptr m68k_cache_get_native(void *vcontext, uint32_t address)
+{
+	m68k_context *context = vcontext;
+	return get_native_address(context->options, address);
+}
+
+static uint8_t m68k_cache_map_size(void *vcontext, uint32_t address)
+{
+	m68k_context *context = vcontext;
+	memmap_chunk const *chunk = find_map_chunk(address, &context->options->gen, 0, NULL);
+	return chunk && (chunk->flags & MMAP_CODE) ? get_native_inst_size(context->options, address) : 0;
+}
+
+static void m68k_cache_map(void *vcontext, uint32_t address, code_ptr native, uint8_t size, uint8_t native_size)
+{
+	map_native_address(vcontext, address, native, size, native_size);
+}
+
+static void m68k_cache_handle_deferred(void *vcontext)
+{
+	m68k_handle_deferred(vcontext);
+}
+
+static uint8_t m68k_cache_helper_tag(void *vcontext, code_ptr target, uint32_t *tag)
+{
+	m68k_context *context = vcontext;
+	m68k_options *opts = context->options;
+	for (uint32_t i = 0; i < opts->num_movem; i++)
+	{
+		movem_fun *movem = opts->big_movem + i;
+		if (movem->impl == target) {
+			*tag = MOVEM_TAG(movem->reglist, movem->reg_to_mem, movem->size, movem->dir);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static code_ptr m68k_cache_helper_resolve(void *vcontext, uint32_t tag)
+{
+	m68k_context *context = vcontext;
+	m68kinst inst;
+	memset(&inst, 0, sizeof(inst));
+	inst.op = M68K_MOVEM;
+	inst.extra.size = tag >> 17 & 3;
+	if (inst.extra.size != OPSIZE_WORD && inst.extra.size != OPSIZE_LONG) {
+		return NULL;
+	}
+	if (tag & 1 << 16) {
+		inst.src.addr_mode = MODE_REG;
+		inst.src.params.immed = tag;
+		inst.dst.addr_mode = tag & 1 << 19 ? MODE_AREG_PREDEC : MODE_AREG_INDIRECT;
+	} else if (tag & 1 << 19) {
+		return NULL;
+	} else {
+		inst.src.addr_mode = MODE_AREG_INDIRECT;
+		inst.dst.addr_mode = MODE_REG;
+		inst.dst.params.immed = tag;
+	}
+	return get_movem_impl(context->options, &inst);
+}
+
+static jit_cache_funcs const m68k_cache_funcs = {
+	.cacheable = m68k_cache_cacheable,
+	.unmapped = m68k_cache_unmapped,
+	.fetch = m68k_cache_fetch,
+	.get_native = m68k_cache_get_native,
+	.map_size = m68k_cache_map_size,
+	.map = m68k_cache_map,
+	.handle_deferred = m68k_cache_handle_deferred,
+	.helper_tag = m68k_cache_helper_tag,
+	.helper_resolve = m68k_cache_helper_resolve
+};
+
+static uint8_t is_deferred(m68k_options *opts, uint32_t address)
+{
+	for (deferred_addr *cur = opts->gen.deferred; cur; cur = cur->next)
+	{
+		if (cur->address == address) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static uint8_t is_plain_operand(m68k_op_info *op)
+{
+	return op->addr_mode == MODE_REG || op->addr_mode == MODE_AREG || op->addr_mode == MODE_IMMEDIATE
+		|| op->addr_mode == MODE_IMMEDIATE_WORD || op->addr_mode == MODE_UNUSED;
+}
+
+//Instructions that only touch registers, can't raise an exception and have a cost known at translation time.
+//Nothing they do can move the cycle limit, so a run of them only needs one cycle check up front
+static uint8_t can_elide_check(m68k_context *context, m68kinst *inst)
+{
+	if ((inst->address & 1) || find_breakpoint(context, inst->address)) {
+		return 0;
+	}
+	switch (inst->op)
+	{
+	case M68K_NOP:
+		return 1;
+	case M68K_LEA:
+		//effective address calculation only, no bus access
+		return 1;
+	case M68K_MOVE:
+	case M68K_ADD:
+	case M68K_ADDX:
+	case M68K_SUB:
+	case M68K_SUBX:
+	case M68K_AND:
+	case M68K_OR:
+	case M68K_EOR:
+	case M68K_CMP:
+	case M68K_NEG:
+	case M68K_NOT:
+	case M68K_CLR:
+	case M68K_TST:
+	case M68K_EXT:
+	case M68K_SWAP:
+	case M68K_EXG:
+		return is_plain_operand(&inst->src) && is_plain_operand(&inst->dst);
+	default:
+		return 0;
+	}
+}
+
+static uint32_t gather_run(m68k_context *context, memmap_chunk const *chunk, m68kinst *first, m68kinst *run)
+{
+	m68k_options *opts = context->options;
+	//code in writable memory can be invalidated one instruction at a time so it needs a check on every instruction
+	if (opts->gen.limit < 0 || (chunk->flags & MMAP_WRITE) || !can_elide_check(context, first)) {
+		return 0;
+	}
+	run[0] = *first;
+	uint32_t count = 1;
+	uint32_t address = first->address + first->bytes;
+	while (count < M68K_MAX_RUN && !(address & 1))
+	{
+		if (get_native_address(opts, address) || is_deferred(opts, address) || find_map_chunk(address, &opts->gen, 0, NULL) != chunk) {
+			break;
+		}
+		m68k_decode(m68k_instruction_fetch, context, run + count, address);
+		if (!can_elide_check(context, run + count)) {
+			break;
+		}
+		address += run[count++].bytes;
+	}
+	return count;
+}
+
+//Translates a run of instructions from gather_run with a single cycle check that covers all of them.
+//Only the first instruction is mapped, the others are marked as extension words so that jumps into
+//the middle of the run get a fresh translation with their own check
+static uint32_t translate_m68k_run(m68k_context *context, m68kinst *run, uint32_t count)
+{
+	m68k_options *opts = context->options;
+	code_info *code = &opts->gen.code;
+	//reserve enough for the whole run so it stays contiguous
+	check_alloc_code(code, M68K_MAX_RUN * MAX_NATIVE_SIZE);
+	code_ptr start = code->cur;
+	code_ptr cost = m68k_run_guard(opts, run[0].address, count);
+	uint32_t guard_cycles = 0;
+	opts->gen.cycle_tally = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		//the check at the start of the next instruction handles the last one
+		if (i == count - 1) {
+			guard_cycles = opts->gen.cycle_tally;
+		}
+		translate_m68k_body(opts, run + i);
+	}
+	memcpy(cost, &guard_cycles, sizeof(guard_cycles));
+	uint32_t end = run[count - 1].address + run[count - 1].bytes;
+	uint32_t native_size = code->cur - start;
+	//keep retranslation off the in-place path, which assumes the original code is no bigger than MAX_NATIVE_SIZE
+	map_native_address(context, run[0].address, start, end - run[0].address, native_size < MAX_NATIVE_SIZE ? native_size : MAX_NATIVE_SIZE - 1);
+	return end;
+}
+
+code_ptr m68k_translate_checked_run(m68k_context *context, uint32_t address, uint32_t count)
+{
+	m68k_options *opts = context->options;
+	code_info *code = &opts->gen.code;
+	m68kinst run[M68K_MAX_RUN];
+	for (uint32_t i = 0; i < count; i++)
+	{
+		address = m68k_decode(m68k_instruction_fetch, context, run + i, address);
+	}
+	code_ptr next = get_native_address_trans(context, address);
+	check_alloc_code(code, M68K_MAX_RUN * MAX_NATIVE_SIZE);
+	code_ptr start = code->cur;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		//the guard at the start of the run already did the check for the first instruction
+		if (i) {
+			check_cycles_int(&opts->gen, run[i].address);
+		}
+		translate_m68k_body(opts, run + i);
+	}
+	jmp(code, next);
+	return start;
+}
+
 void translate_m68k_stream(uint32_t address, m68k_context * context)
 {
 	m68kinst instbuf;
@@ -1194,6 +1476,15 @@ void translate_m68k_stream(uint32_t address, m68k_context * context)
 				}
 			}
 			next_address = m68k_decode(m68k_instruction_fetch, context, &instbuf, address);
+			m68kinst run[M68K_MAX_RUN];
+			uint32_t run_length = gather_run(context, chunk, &instbuf, run);
+			if (run_length > 1) {
+				jit_cache_begin(opts->gen.jit_cache);
+				address = translate_m68k_run(context, run, run_length);
+				instbuf = run[run_length - 1];
+				jit_cache_end(opts->gen.jit_cache, run[0].address, address - run[0].address, !m68k_is_terminal(&instbuf));
+				continue;
+			}
 			uint16_t m68k_size = next_address - address;
 			address = next_address;
 			//char disbuf[1024];
@@ -1203,9 +1494,11 @@ void translate_m68k_stream(uint32_t address, m68k_context * context)
 			//make sure the beginning of the code for an instruction is contiguous
 			check_code_prologue(code);
 			code_ptr start = code->cur;
+			jit_cache_begin(opts->gen.jit_cache);
 			translate_m68k(context, &instbuf);
 			code_ptr after = code->cur;
 			map_native_address(context, instbuf.address, start, m68k_size, after-start);
+			jit_cache_end(opts->gen.jit_cache, instbuf.address, m68k_size, !m68k_is_terminal(&instbuf));
 		} while(!m68k_is_terminal(&instbuf) && !(address & 1));
 		process_deferred(&opts->gen.deferred, context, (native_addr_func)get_native_from_context);
 		if (opts->gen.deferred) {
@@ -1222,6 +1515,7 @@ void * m68k_retranslate_inst(uint32_t address, m68k_context * context)
 	code_ptr orig_start = get_native_address(context->options, address);
 	uint32_t orig = address;
 	code_info orig_code = {orig_start, orig_start + orig_size + 5, 0};
+	jit_cache_forget(opts->gen.jit_cache, address, orig_start);
 	m68kinst instbuf;
 	uint32_t after_address = m68k_decode(m68k_instruction_fetch, context, &instbuf, orig);
 	if (orig_size != MAX_NATIVE_SIZE) {
@@ -1280,6 +1574,16 @@ void * m68k_retranslate_inst(uint32_t address, m68k_context * context)
 		code_info tmp = *code;
 		*code = orig_code;
 		translate_m68k(context, &instbuf);
+		//the original mapping is reused so map_native_address won't mark the instruction as live again
+		int32_t page = m68k_code_page(opts, orig);
+		if (page >= 0) {
+			opts->live_code[page]++;
+			context->ram_code_flags[page >> 3] |= 1 << (page & 7);
+			page = m68k_code_page(opts, after_address - 1);
+			if (page >= 0) {
+				context->ram_code_flags[page >> 3] |= 1 << (page & 7);
+			}
+		}
 		orig_code = *code;
 		*code = tmp;
 		if (!m68k_is_terminal(&instbuf)) {
@@ -1300,6 +1604,16 @@ code_ptr get_native_address_trans(m68k_context * context, uint32_t address)
 	return ret;
 }
 
+code_ptr m68k_lookup_target(m68k_context *context, uint32_t address)
+{
+	code_ptr native = get_native_address_trans(context, address);
+	//native addresses stay valid for the life of the context since invalidated code is patched in place
+	m68k_target_entry *entry = context->target_cache + ((address >> 1) & (M68K_TARGET_CACHE_SIZE - 1));
+	entry->address = address;
+	entry->native = native;
+	return native;
+}
+
 void remove_breakpoint(m68k_context * context, uint32_t address)
 {
 	for (uint32_t i = 0; i < context->num_breakpoints; i++)
@@ -1359,6 +1673,27 @@ void m68k_reset(m68k_context * context)
 	start_68k_context(context, address);
 }
 
+void m68k_load_translation_cache(m68k_context *context, char *path, uint8_t *rom_hash)
+{
+	m68k_options *opts = context->options;
+	if (!opts->gen.jit_cache) {
+		code_ptr symbols[M68K_MAX_JIT_SYMBOLS];
+		uint32_t num_symbols = m68k_jit_symbols(opts, symbols);
+		opts->gen.jit_cache = jit_cache_new(context, &opts->gen, &m68k_cache_funcs, symbols, num_symbols, sizeof(m68k_context), NATIVE_CHUNK_SIZE, NATIVE_MAP_CHUNKS);
+	}
+	jit_cache_load(opts->gen.jit_cache, path, rom_hash);
+}
+
+void m68k_warm_translation_cache(m68k_context *context)
+{
+	jit_cache_apply(context->options->gen.jit_cache);
+}
+
+void m68k_save_translation_cache(m68k_context *context, char *path, uint8_t *rom_hash)
+{
+	jit_cache_save(context->options->gen.jit_cache, path, rom_hash);
+}
+
 void m68k_options_free(m68k_options *opts)
 {
 	for (uint32_t address = 0; address < opts->gen.address_mask; address += NATIVE_CHUNK_SIZE)
@@ -1375,7 +1710,9 @@ void m68k_options_free(m68k_options *opts)
 		free(opts->gen.ram_inst_sizes[i]);
 	}
 	free(opts->gen.ram_inst_sizes);
+	free(opts->live_code);
 	free(opts->big_movem);
+	jit_cache_free(opts->gen.jit_cache);
 	free(opts);
 }
 
@@ -1387,6 +1724,12 @@ m68k_context * init_68k_context(m68k_options * opts, m68k_reset_handler reset_ha
 	context->int_cycle = CYCLE_NEVER;
 	context->status = 0x27;
 	context->reset_handler = (code_ptr)reset_handler;
+	for (uint32_t i = 0; i < M68K_TARGET_CACHE_SIZE; i++)
+	{
+		//use an address that hashes to a different slot so an empty entry can never match
+		context->target_cache[i].address = ((i + 1) & (M68K_TARGET_CACHE_SIZE - 1)) << 1;
+	}
+	init_mem_pages(&opts->gen, (void **)context->mem_pointers, context->mem_pages);
 	return context;
 }
 
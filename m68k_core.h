@@ -16,6 +16,10 @@ typedef struct m68kinst m68kinst;
 #define NATIVE_MAP_CHUNKS (64*1024)
 #define NATIVE_CHUNK_SIZE ((16 * 1024 * 1024 / NATIVE_MAP_CHUNKS))
 #define MAX_NATIVE_SIZE 255
+#define M68K_TARGET_CACHE_SIZE 256
+#define M68K_MAX_RUN 16
+#define M68K_PAGE_SHIFT 16
+#define M68K_NUM_PAGES (16 * 1024 * 1024 >> M68K_PAGE_SHIFT)
 
 #define M68K_OPT_BROKEN_READ_MODIFY 1
 
@@ -37,6 +41,11 @@ typedef struct {
 	int8_t   dir;
 } movem_fun;
 
+typedef struct {
+	code_ptr native;
+	uint32_t address;
+} m68k_target_entry;
+
 typedef struct {
 	cpu_options     gen;
 
@@ -58,6 +67,8 @@ typedef struct {
 	code_ptr        retrans_stub;
 	code_ptr        native_addr;
 	code_ptr        native_addr_and_sync;
+	code_ptr        link_indirect;
+	code_ptr        checked_run;
 	code_ptr		get_sr;
 	code_ptr		set_sr;
 	code_ptr		set_ccr;
@@ -70,6 +81,7 @@ typedef struct {
 	movem_fun       *big_movem;
 	uint32_t        num_movem;
 	uint32_t        movem_storage;
+	uint16_t        *live_code; //instructions in each ram_code_flags page that haven't been patched for retranslation
 	code_word       prologue_start;
 } m68k_options;
 
@@ -128,6 +140,8 @@ struct m68k_context {
 	uint8_t         trace_pending;
 	uint8_t         should_return;
 	uint8_t         stack_storage_count;
+	m68k_target_entry target_cache[M68K_TARGET_CACHE_SIZE]; //native addresses of recent computed jump targets
+	mem_page        mem_pages[M68K_NUM_PAGES];
 	uint8_t         ram_code_flags[];
 };
 
@@ -152,6 +166,9 @@ void m68k_print_regs(m68k_context * context);
 void m68k_invalidate_code_range(m68k_context *context, uint32_t start, uint32_t end);
 void m68k_serialize(m68k_context *context, uint32_t pc, serialize_buffer *buf);
 void m68k_deserialize(deserialize_buffer *buf, void *vcontext);
+void m68k_load_translation_cache(m68k_context *context, char *path, uint8_t *rom_hash);
+void m68k_warm_translation_cache(m68k_context *context);
+void m68k_save_translation_cache(m68k_context *context, char *path, uint8_t *rom_hash);
 uint16_t m68k_instruction_fetch(uint32_t address, void *vcontext);
 uint8_t m68k_is_terminal(m68kinst * inst);
 
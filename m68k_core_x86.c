@@ -2375,7 +2375,10 @@ void translate_m68k_stop(m68k_options *opts, m68kinst *inst)
 		cmp_irdisp(code, 0, opts->gen.context_reg, offsetof(m68k_context, should_return), SZ_B);
 		code_ptr no_return = code->cur + 1;
 		jcc(code, CC_Z, no_return);
-		mov_irdisp(code, (intptr_t)loop_top, opts->gen.context_reg, offsetof(m68k_context, resume_pc), SZ_PTR);
+		//a pointer immediate only fits in a register, mov_irdisp would truncate it to 32 bits
+		mov_ir(code, (intptr_t)loop_top, opts->gen.scratch1, SZ_PTR);
+		log_code_ptr(code, loop_top);
+		mov_rrdisp(code, opts->gen.scratch1, opts->gen.context_reg, offsetof(m68k_context, resume_pc), SZ_PTR);
 		retn(code);
 		*no_return = code->cur - (no_return+1);
 		cmp_rr(code, opts->gen.cycles, opts->gen.limit, SZ_D);
@@ -2506,17 +2509,136 @@ void nop_fill_or_jmp_next(code_info *code, code_ptr old_end, code_ptr next_inst)
 	}
 }
 
+//Placeholder target for unlinked indirect jump sites, chosen so that cmp_ir always uses a 32-bit immediate
+#define UNLINKED_TARGET 0x7FFFFFFF
+#define LINK_SITE_SIZE 64
+#define LINK_JMP_SIZE 5
+
+void jump_m68k_indirect(m68k_options *opts)
+{
+	code_info *code = &opts->gen.code;
+	//the compare and jumps are patched later so they need to be contiguous
+	check_alloc_code(code, LINK_SITE_SIZE);
+	cmp_ir(code, UNLINKED_TARGET, opts->gen.scratch1, SZ_D);
+	code_ptr no_match = code->cur + 1;
+	jcc(code, CC_NZ, code->cur + 2);
+	//force a rel32 jump so it can be pointed at the translated target later
+	code_ptr link = code->cur;
+	jmp(code, code->cur + 256);
+	//plain lookup used once the site is linked or has proven to have more than one target
+	call(code, opts->native_addr);
+	jmp_r(code, opts->gen.scratch1);
+	code_ptr candidate = code->cur;
+	*no_match = candidate - (no_match + 1);
+	int32_t disp = candidate - (link + LINK_JMP_SIZE);
+	memcpy(link + 1, &disp, sizeof(disp));
+	mov_ir(code, (intptr_t)link, opts->gen.scratch2, SZ_PTR);
+	log_code_ptr(code, link);
+	call(code, opts->link_indirect);
+	jmp_r(code, opts->gen.scratch1);
+}
+
+code_ptr m68k_link_indirect(code_ptr link, m68k_context *context, uint32_t address)
+{
+	code_ptr native = m68k_lookup_target(context, address);
+	//the immediate of the compare sits right before the 2-byte jcc
+	code_ptr key = link - 2 - sizeof(uint32_t);
+	code_ptr plain = link + LINK_JMP_SIZE;
+	uint32_t last;
+	memcpy(&last, key, sizeof(last));
+	if (last == address) {
+		//same target as last time, jump straight there from now on
+		ptrdiff_t target_disp = native - plain;
+		int32_t disp = target_disp == (int32_t)target_disp ? target_disp : 0;
+		memcpy(link + 1, &disp, sizeof(disp));
+	} else if (last == UNLINKED_TARGET) {
+		memcpy(key, &address, sizeof(address));
+		return native;
+	}
+	//either linked or the target changed, further misses just use the target cache
+	link[-1] = plain - link;
+	return native;
+}
+
+//Forces add_ir to use a 32-bit immediate so the real cost can be patched in once the run is translated
+#define RUN_COST_PLACEHOLDER 0x10000
+#define RUN_CALL_SIZE 5
+
+code_ptr m68k_run_guard(m68k_options *opts, uint32_t address, uint32_t count)
+{
+	code_info *code = &opts->gen.code;
+	check_cycles_int(&opts->gen, address);
+	//skip the checks in the run if the cycle limit can't be reached before the last instruction
+	mov_rr(code, opts->gen.cycles, opts->gen.scratch1, SZ_D);
+	add_ir(code, RUN_COST_PLACEHOLDER, opts->gen.scratch1, SZ_D);
+	code_ptr cost = code->cur - sizeof(uint32_t);
+	cmp_rr(code, opts->gen.scratch1, opts->gen.limit, SZ_D);
+	code_ptr fits = code->cur + 1;
+	jcc(code, CC_A, code->cur + 2);
+	//otherwise fall back to a copy of the run with a check on every instruction, translated on first use
+	call_noalign(code, opts->checked_run);
+	memcpy(code->cur, &address, sizeof(address));
+	code->cur += sizeof(address);
+	*(code->cur++) = count;
+	*fits = code->cur - (fits + 1);
+	return cost;
+}
+
+code_ptr m68k_checked_run(code_ptr data, m68k_context *context)
+{
+	uint32_t address;
+	memcpy(&address, data, sizeof(address));
+	code_ptr copy = m68k_translate_checked_run(context, address, data[sizeof(address)]);
+	//replace the call with a jump so later overruns go straight to the copy
+	code_info patch = {data - RUN_CALL_SIZE, data + sizeof(address) + 1, 0};
+	jmp(&patch, copy);
+	return copy;
+}
+
 #define M68K_MAX_INST_SIZE (2*(1+2+2))
 
+uint8_t m68k_is_live(m68k_options *opts, code_ptr native)
+{
+	//a breakpoint also replaces the cycle check with a mov_ir, but the instruction is still live
+	return !is_mov_ir(native) || is_call(native + opts->gen.move_pc_size);
+}
+
+static void m68k_patch_retranslate(m68k_context *context, uint32_t address, code_ptr native)
+{
+	m68k_options *opts = context->options;
+	if (m68k_is_live(opts, native)) {
+		int32_t page = m68k_code_page(opts, address);
+		if (page >= 0 && opts->live_code[page]) {
+			opts->live_code[page]--;
+		}
+	}
+	patch_for_retranslate(&opts->gen, native, opts->retrans_stub);
+}
+
 m68k_context * m68k_handle_code_write(uint32_t address, m68k_context * context)
 {
 	m68k_options * options = context->options;
 	uint32_t inst_start = get_instruction_start(options, address);
 	while (inst_start && (address - inst_start) < M68K_MAX_INST_SIZE) {
 		code_ptr dst = get_native_address(context->options, inst_start);
-		patch_for_retranslate(&options->gen, dst, options->retrans_stub);
+		m68k_patch_retranslate(context, inst_start, dst);
 		inst_start = get_instruction_start(options, inst_start - 2);
 	}
+	//Once nothing in this page is live, stores to it can skip this handler until code is translated there again
+	int32_t page = m68k_code_page(options, address);
+	if (page < 0 || options->live_code[page]) {
+		return context;
+	}
+	//instructions are only counted in the page they start in, so check for any that run over from the previous one
+	uint32_t page_start = address & ~((1 << options->gen.ram_flags_shift) - 1);
+	for (uint32_t prev = page_start - (M68K_MAX_INST_SIZE - 2); prev != page_start; prev += 2)
+	{
+		code_ptr native = get_native_address(options, prev);
+		if (native && m68k_is_live(options, native)) {
+			return context;
+		}
+	}
+	context->ram_code_flags[page >> 3] &= ~(1 << (page & 7));
 	return context;
 }
 
@@ -2534,6 +2656,11 @@ void m68k_invalidate_code_range(m68k_context *context, uint32_t start, uint32_t
 		//calculate the lowest alias for this address
 		start = mem_chunk->start + ((start - mem_chunk->start) & mem_chunk->mask);
 	}
+	//start may be in the middle of a run translated with a single cycle check, include the whole run
+	uint32_t run_start = get_instruction_start(opts, start);
+	if (run_start && run_start < start) {
+		start = run_start;
+	}
 	mem_chunk = find_map_chunk(end - 1, &opts->gen, 0, NULL);
 	if (mem_chunk) {
 		//calculate the lowest alias for this address
@@ -2548,7 +2675,7 @@ void m68k_invalidate_code_range(m68k_context *context, uint32_t start, uint32_t
 			for (uint32_t offset = start_offset; offset < end_offset; offset++)
 			{
 				if (native_code_map[chunk].offsets[offset] != INVALID_OFFSET && native_code_map[chunk].offsets[offset] != EXTENSION_WORD) {
-					patch_for_retranslate(&opts->gen, native_code_map[chunk].base + native_code_map[chunk].offsets[offset], opts->retrans_stub);
+					m68k_patch_retranslate(context, chunk * NATIVE_CHUNK_SIZE + offset, native_code_map[chunk].base + native_code_map[chunk].offsets[offset]);
 					/*code_info code;
 					code.cur = native_code_map[chunk].base + native_code_map[chunk].offsets[offset];
 					code.last = code.cur + 32;
@@ -2577,6 +2704,7 @@ void m68k_breakpoint_patch(m68k_context *context, uint32_t address, m68k_debug_h
 	}
 	native.last = native.cur + 128;
 	native.stack_off = 0;
+	native.refs = NULL;
 	code_ptr start_native = native.cur;
 	mov_ir(&native, address, opts->gen.scratch1, SZ_D);
 
@@ -2597,8 +2725,11 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	opts->gen.clock_divider = clock_divider;
 	opts->gen.watchpoint_range_off = offsetof(m68k_context, watchpoint_min);
 	opts->gen.mem_ptr_off = offsetof(m68k_context, mem_pointers);
+	opts->gen.mem_pages_off = offsetof(m68k_context, mem_pages);
+	opts->gen.mem_page_shift = M68K_PAGE_SHIFT;
 	opts->gen.ram_flags_off = offsetof(m68k_context, ram_code_flags);
-	opts->gen.ram_flags_shift = 11;
+	//small pages keep stores to data that sits near code off the code write handler
+	opts->gen.ram_flags_shift = 8;
 	for (int i = 0; i < 8; i++)
 	{
 		opts->dregs[i] = opts->aregs[i] = -1;
@@ -2647,6 +2778,7 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	uint32_t inst_size_size = sizeof(uint8_t *) * ram_size(&opts->gen) / 1024;
 	opts->gen.ram_inst_sizes = malloc(inst_size_size);
 	memset(opts->gen.ram_inst_sizes, 0, inst_size_size);
+	opts->live_code = calloc(ram_size(&opts->gen) >> opts->gen.ram_flags_shift, sizeof(uint16_t));
 
 	code_info *code = &opts->gen.code;
 	init_code_info(code);
@@ -2745,9 +2877,30 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	retn(code);
 
 	opts->native_addr = code->cur;
+	//check the target cache first so common returns and jump tables don't need a round trip through C
+	mov_rr(code, opts->gen.scratch1, opts->gen.scratch2, SZ_D);
+	and_ir(code, (M68K_TARGET_CACHE_SIZE - 1) << 1, opts->gen.scratch2, SZ_D);
+	shl_ir(code, __builtin_ctz(sizeof(m68k_target_entry)) - 1, opts->gen.scratch2, SZ_D);
+	add_rr(code, opts->gen.context_reg, opts->gen.scratch2, SZ_PTR);
+	cmp_rdispr(code, opts->gen.scratch2, offsetof(m68k_context, target_cache) + offsetof(m68k_target_entry, address), opts->gen.scratch1, SZ_D);
+	code_ptr cache_miss = code->cur + 1;
+	jcc(code, CC_NZ, code->cur + 2);
+	mov_rdispr(code, opts->gen.scratch2, offsetof(m68k_context, target_cache) + offsetof(m68k_target_entry, native), opts->gen.scratch1, SZ_PTR);
+	retn(code);
+	*cache_miss = code->cur - (cache_miss + 1);
+	call(code, opts->gen.save_context);
+	push_r(code, opts->gen.context_reg);
+	call_args(code, (code_ptr)m68k_lookup_target, 2, opts->gen.context_reg, opts->gen.scratch1);
+	mov_rr(code, RAX, opts->gen.scratch1, SZ_PTR); //move result to scratch reg
+	pop_r(code, opts->gen.context_reg);
+	call(code, opts->gen.load_context);
+	retn(code);
+
+	opts->link_indirect = code->cur;
 	call(code, opts->gen.save_context);
 	push_r(code, opts->gen.context_reg);
-	call_args(code, (code_ptr)get_native_address_trans, 2, opts->gen.context_reg, opts->gen.scratch1);
+	//argument order matches the registers as closely as possible since prep_args can't untangle a rotation
+	call_args(code, (code_ptr)m68k_link_indirect, 3, opts->gen.scratch2, opts->gen.context_reg, opts->gen.scratch1);
 	mov_rr(code, RAX, opts->gen.scratch1, SZ_PTR); //move result to scratch reg
 	pop_r(code, opts->gen.context_reg);
 	call(code, opts->gen.load_context);
@@ -3264,6 +3417,20 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	call(code, opts->gen.load_context);
 	jmp_r(code, opts->gen.scratch1);
 
+	opts->checked_run = code->cur;
+	//return address points at the run address and length stored after the call
+	tmp_stack_off = code->stack_off;
+	code->stack_off += sizeof(void *);
+	pop_r(code, opts->gen.scratch2);
+	call(code, opts->gen.save_context);
+	push_r(code, opts->gen.context_reg);
+	call_args(code, (code_ptr)m68k_checked_run, 2, opts->gen.scratch2, opts->gen.context_reg);
+	pop_r(code, opts->gen.context_reg);
+	mov_rr(code, RAX, opts->gen.scratch1, SZ_PTR);
+	call(code, opts->gen.load_context);
+	jmp_r(code, opts->gen.scratch1);
+	code->stack_off = tmp_stack_off;
+
 
 	check_code_prologue(code);
 	opts->bp_stub = code->cur;
@@ -3304,3 +3471,43 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 
 	retranslate_calc(&opts->gen);
 }
+
+uint32_t m68k_jit_symbols(m68k_options *opts, code_ptr *symbols)
+{
+	uint32_t num = 0;
+	symbols[num++] = opts->gen.save_context;
+	symbols[num++] = opts->gen.load_context;
+	symbols[num++] = opts->gen.handle_cycle_limit;
+	symbols[num++] = opts->gen.handle_cycle_limit_int;
+	symbols[num++] = opts->gen.handle_code_write;
+	symbols[num++] = opts->gen.handle_align_error_write;
+	symbols[num++] = opts->gen.handle_align_error_read;
+	symbols[num++] = opts->read_16;
+	symbols[num++] = opts->write_16;
+	symbols[num++] = opts->read_8;
+	symbols[num++] = opts->write_8;
+	symbols[num++] = opts->read_32;
+	symbols[num++] = opts->write_32_lowfirst;
+	symbols[num++] = opts->write_32_highfirst;
+	symbols[num++] = opts->do_sync;
+	symbols[num++] = opts->handle_int_latch;
+	symbols[num++] = opts->trap;
+	symbols[num++] = opts->retrans_stub;
+	symbols[num++] = opts->native_addr;
+	symbols[num++] = opts->native_addr_and_sync;
+	symbols[num++] = opts->link_indirect;
+	symbols[num++] = opts->checked_run;
+	symbols[num++] = opts->get_sr;
+	symbols[num++] = opts->set_sr;
+	symbols[num++] = opts->set_ccr;
+	symbols[num++] = opts->bp_stub;
+	symbols[num++] = opts->save_context_scratch;
+	symbols[num++] = opts->load_context_scratch;
+	symbols[num++] = (code_ptr)divu;
+	symbols[num++] = (code_ptr)divs;
+	symbols[num++] = (code_ptr)mulu_cycles;
+	symbols[num++] = (code_ptr)muls_cycles;
+	symbols[num++] = (code_ptr)m68k_get_ir;
+	symbols[num++] = (code_ptr)m68k_out_of_bounds_execution;
+	return num;
+}
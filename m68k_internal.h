@@ -37,7 +37,12 @@ void translate_m68k_odd(m68k_options *opts, m68kinst *inst);
 void m68k_trap_if_not_supervisor(m68k_options *opts, m68kinst *inst);
 void m68k_breakpoint_patch(m68k_context *context, uint32_t address, m68k_debug_handler bp_handler, code_ptr native_addr);
 void m68k_check_cycles_int_latch(m68k_options *opts);
+void jump_m68k_indirect(m68k_options *opts);
+code_ptr m68k_run_guard(m68k_options *opts, uint32_t address, uint32_t count);
 uint8_t translate_m68k_op(m68kinst * inst, host_ea * ea, m68k_options * opts, uint8_t dst);
+//fills symbols with the helpers and C functions translated code can reference, returns how many there are
+#define M68K_MAX_JIT_SYMBOLS 48
+uint32_t m68k_jit_symbols(m68k_options *opts, code_ptr *symbols);
 
 //functions implemented in m68k_core.c
 int8_t native_reg(m68k_op_info * op, m68k_options * opts);
@@ -51,6 +56,10 @@ void jump_m68k_abs(m68k_options * opts, uint32_t address);
 void swap_ssp_usp(m68k_options * opts);
 code_ptr get_native_address(m68k_options *opts, uint32_t address);
 code_ptr get_native_address_trans(m68k_context * context, uint32_t address);
+code_ptr m68k_lookup_target(m68k_context *context, uint32_t address);
+int32_t m68k_code_page(m68k_options *opts, uint32_t address);
+uint8_t m68k_is_live(m68k_options *opts, code_ptr native);
+code_ptr m68k_translate_checked_run(m68k_context *context, uint32_t address, uint32_t count);
 void * m68k_retranslate_inst(uint32_t address, m68k_context * context);
 m68k_context *m68k_bp_dispatcher(m68k_context *context, uint32_t address);
 
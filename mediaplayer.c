@@ -453,9 +453,11 @@ void vgm_frame(media_player *player)
 		}
 	}
 frame_end:
+#ifndef IS_LIB
 	if (player->scope) {
 		scope_render(player->scope);
 	}
+#endif
 }
 
 void wave_frame(media_player *player)
@@ -494,16 +496,21 @@ void wave_frame(media_player *player)
 
 void flac_frame(media_player *player)
 {
-	for (uint32_t remaining_samples = player->flac->sample_rate / 60; remaining_samples > 0; remaining_samples--)
+	int16_t samples[2 * 256];
+	for (uint32_t remaining_samples = player->flac->sample_rate / 60; remaining_samples > 0;)
 	{
-		int16_t samples[2];
-		if (flac_get_sample(player->flac, samples, 2)) {
-			render_put_stereo_sample(player->audio, samples[0], samples[1]);
-		} else {
+		uint32_t wanted = remaining_samples < 256 ? remaining_samples : 256;
+		uint32_t decoded = flac_get_samples(player->flac, samples, wanted, 2);
+		for (uint32_t i = 0; i < decoded; i++)
+		{
+			render_put_stereo_sample(player->audio, samples[i * 2], samples[i * 2 + 1]);
+		}
+		if (decoded < wanted) {
 			player->state = STATE_PAUSED;
 			player->playback_time = 0;
 			return;
 		}
+		remaining_samples -= decoded;
 	}
 }
 
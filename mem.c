@@ -29,13 +29,19 @@ void * alloc_code(size_t *size)
 	if (*size & (PAGE_SIZE -1)) {
 		*size += PAGE_SIZE - (*size & (PAGE_SIZE - 1));
 	}
-	ret = mmap(next, *size, PROT_EXEC | PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	//claim the hint range atomically so instances on other threads don't all ask for the same address
+	uint8_t *hint = __atomic_fetch_add(&next, *size, __ATOMIC_RELAXED);
+	ret = mmap(hint, *size, PROT_EXEC | PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 	if (ret == MAP_FAILED) {
 		perror("alloc_code");
 		return NULL;
 	}
 	track_block(ret);
-	next = ret + *size;
+	if (ret != hint) {
+		//the kernel placed us elsewhere, continue from there to stay close to previous allocations
+		uint8_t *expected = hint + *size;
+		__atomic_compare_exchange_n(&next, &expected, ret + *size, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	}
 	return ret;
 }
 
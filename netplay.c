@@ -0,0 +1,456 @@
+#ifdef _WIN32
+#define WINVER 0x501
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netdb.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include "netplay.h"
+#include "util.h"
+
+//Both players emulate the whole machine. Each frame the local controller is sampled for
+//input_delay frames in the future and sent to the peer, while the remote controller is
+//predicted to keep doing whatever it did in the last frame we have real input for. When
+//real input arrives that doesn't match what was predicted, the snapshot taken at the start
+//of the first mispredicted frame is restored and everything up to the current frame is
+//emulated again with output suppressed. Frames 0 through input_delay always have neutral
+//local input since nothing was sampled for them
+
+#define NETPLAY_MASK (NETPLAY_FRAMES - 1)
+#define NETPLAY_POLL_MS 100
+#define NETPLAY_POLLS_PER_SECOND (1000 / NETPLAY_POLL_MS)
+//how many polls to wait for the peer to show up before the session starts
+#define NETPLAY_CONNECT_POLLS 600
+//how many polls without any progress before giving up on the peer once it has started
+#define NETPLAY_TIMEOUT_POLLS 50
+
+static netplay_frame *input_slot(netplay_session *np, uint32_t frame)
+{
+	netplay_frame *f = np->ring + (frame & NETPLAY_MASK);
+	if (f->input_frame != frame) {
+		f->input_frame = frame;
+		f->input[NETPLAY_LOCAL] = f->input[NETPLAY_REMOTE] = 0;
+		f->confirmed = 0;
+	}
+	return f;
+}
+
+netplay_session *netplay_alloc(uint8_t local_pad, uint8_t input_delay)
+{
+	netplay_session *np = calloc(1, sizeof(netplay_session));
+	np->local_pad = local_pad;
+	np->remote_pad = local_pad == 1 ? 2 : 1;
+	np->input_delay = input_delay > NETPLAY_MAX_INPUT_DELAY ? NETPLAY_MAX_INPUT_DELAY : input_delay;
+	for (uint32_t i = 0; i < NETPLAY_FRAMES; i++)
+	{
+		init_serialize(&np->ring[i].state);
+		np->ring[i].state_frame = np->ring[i].input_frame = 0xFFFFFFFF;
+	}
+	//frame 0 is already running by the time anything could be sent so it's neutral for both players
+	input_slot(np, 0)->confirmed = 1;
+	np->remote_frames = 1;
+	return np;
+}
+
+void netplay_free(netplay_session *np)
+{
+	if (!np) {
+		return;
+	}
+	if (np->transport) {
+		np->transport->free(np->transport);
+	}
+	for (uint32_t i = 0; i < NETPLAY_FRAMES; i++)
+	{
+		free(np->ring[i].state.data);
+	}
+	free(np);
+}
+
+//waits for the peer before emulation starts so the first frames don't stall until it shows up,
+//progress is called about once a second with the time left, returns 0 if the peer never showed up
+uint8_t netplay_connect(netplay_session *np, void (*progress)(uint32_t seconds_left))
+{
+	for (uint32_t polls = 0; polls < NETPLAY_CONNECT_POLLS; polls++)
+	{
+		if (progress && !(polls % NETPLAY_POLLS_PER_SECOND)) {
+			progress((NETPLAY_CONNECT_POLLS - polls) / NETPLAY_POLLS_PER_SECOND);
+		}
+		if (np->transport->handshake(np->transport, np, NETPLAY_POLL_MS)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//records button presses from bindings, returns 1 if the event belongs to one of the
+//players and shouldn't be passed to the emulated controller directly
+uint8_t netplay_gamepad_event(netplay_session *np, uint8_t pad, uint8_t button, uint8_t down)
+{
+	uint16_t *buttons;
+	if (pad == np->local_pad) {
+		buttons = &np->local_buttons;
+	} else if (pad == np->remote_pad) {
+		buttons = &np->peer_buttons;
+	} else {
+		return 0;
+	}
+	if (down) {
+		*buttons |= 1 << button;
+	} else {
+		*buttons &= ~(1 << button);
+	}
+	return 1;
+}
+
+//called by transports for each remote input received, inputs must arrive in order so anything
+//else is dropped and left for the transport to resend
+void netplay_remote_input(netplay_session *np, uint32_t frame, uint16_t input)
+{
+	if (frame != np->remote_frames || (int32_t)(frame - np->frame) >= NETPLAY_MAX_ROLLBACK) {
+		return;
+	}
+	netplay_frame *f = input_slot(np, frame);
+	if (frame < np->frame && f->input[NETPLAY_REMOTE] != input && !np->rollback_pending) {
+		//frames are confirmed in order so the first misprediction is always the oldest
+		np->rollback_pending = 1;
+		np->rollback_frame = frame;
+	}
+	f->input[NETPLAY_REMOTE] = input;
+	f->confirmed = 1;
+	np->remote_frames++;
+	np->remote_input = input;
+}
+
+static void wait_for_peer(netplay_session *np)
+{
+	uint32_t polls = 0;
+	//the oldest unconfirmed frame has to stay within reach of a rollback
+	while ((int32_t)(np->frame - np->remote_frames) >= NETPLAY_MAX_ROLLBACK)
+	{
+		uint32_t confirmed = np->remote_frames;
+		np->transport->receive(np->transport, np, NETPLAY_POLL_MS);
+		if (np->remote_frames != confirmed) {
+			polls = 0;
+		} else if (++polls >= NETPLAY_TIMEOUT_POLLS) {
+			warning("Lost connection to netplay peer, remote player's input will no longer change\n");
+			np->disconnected = 1;
+			return;
+		}
+	}
+}
+
+//called at the end of each frame, returns NETPLAY_ROLLBACK if a misprediction needs to be
+//corrected before the next frame, otherwise a snapshot should be taken before it starts
+uint8_t netplay_frame_done(netplay_session *np)
+{
+	np->frame++;
+	if (np->resimulating) {
+		//input for these frames was sampled before the rollback started
+		if (np->frame == np->resume_frame) {
+			np->resimulating = 0;
+		}
+		return NETPLAY_SAVE;
+	}
+	if (np->disconnected) {
+		return NETPLAY_SAVE;
+	}
+	if (np->frame == 1) {
+		for (uint32_t frame = 1; frame <= np->input_delay; frame++)
+		{
+			input_slot(np, frame);
+			np->transport->send(np->transport, frame, 0);
+		}
+	}
+	uint32_t target = np->frame + np->input_delay;
+	input_slot(np, target)->input[NETPLAY_LOCAL] = np->local_buttons;
+	np->transport->send(np->transport, target, np->local_buttons);
+	np->transport->receive(np->transport, np, 0);
+	wait_for_peer(np);
+	if (!np->rollback_pending) {
+		return NETPLAY_SAVE;
+	}
+	np->resume_frame = np->frame;
+	np->resimulating = 1;
+	return NETPLAY_ROLLBACK;
+}
+
+serialize_buffer *netplay_begin_save(netplay_session *np)
+{
+	netplay_frame *f = np->ring + (np->frame & NETPLAY_MASK);
+	f->state_frame = np->frame;
+	f->state.size = 0;
+	f->state.current_section_start = 0;
+	return &f->state;
+}
+
+//returns the inputs for the current frame with the remote player's filled in by
+//prediction if they haven't arrived yet
+netplay_frame *netplay_inputs(netplay_session *np)
+{
+	netplay_frame *f = input_slot(np, np->frame);
+	if (!f->confirmed) {
+		f->input[NETPLAY_REMOTE] = np->remote_input;
+		f->confirmed = np->disconnected;
+	}
+	return f;
+}
+
+//returns the snapshot taken at the start of the oldest mispredicted frame, the current
+//frame becomes that frame
+uint8_t *netplay_rollback(netplay_session *np, size_t *size_out)
+{
+	np->rollback_pending = 0;
+	netplay_frame *f = np->ring + (np->rollback_frame & NETPLAY_MASK);
+	if (f->state_frame != np->rollback_frame || !f->state.size) {
+		warning("Netplay snapshot for frame %u is missing, players are out of sync\n", np->rollback_frame);
+		np->resimulating = 0;
+		return NULL;
+	}
+	np->frame = np->rollback_frame;
+	*size_out = f->state.size;
+	return f->state.data;
+}
+
+//whether the frame currently being emulated should be presented
+uint8_t netplay_show_frame(netplay_session *np)
+{
+	return !np->resimulating;
+}
+
+typedef struct {
+	netplay_transport header;
+	netplay_session   *np;
+	uint32_t          *frames;
+	uint16_t          *inputs;
+	uint32_t          delay;
+	uint32_t          read;
+	uint32_t          write;
+} loopback_transport;
+
+static void loopback_send(netplay_transport *transport, uint32_t frame, uint16_t input)
+{
+	loopback_transport *lb = (loopback_transport *)transport;
+	//the stand-in peer samples the second local controller at the same time we sample ours
+	lb->frames[lb->write % (lb->delay + NETPLAY_FRAMES)] = frame;
+	lb->inputs[lb->write % (lb->delay + NETPLAY_FRAMES)] = frame > lb->np->input_delay ? lb->np->peer_buttons : 0;
+	lb->write++;
+}
+
+static void loopback_receive(netplay_transport *transport, netplay_session *np, uint32_t timeout_ms)
+{
+	loopback_transport *lb = (loopback_transport *)transport;
+	while (lb->read != lb->write)
+	{
+		uint32_t index = lb->read % (lb->delay + NETPLAY_FRAMES);
+		//each input is held back until delay frames after it was sent
+		uint32_t sent = lb->frames[index] > np->input_delay ? lb->frames[index] - np->input_delay : 1;
+		if (np->frame < sent + lb->delay) {
+			break;
+		}
+		netplay_remote_input(np, lb->frames[index], lb->inputs[index]);
+		lb->read++;
+	}
+}
+
+static uint8_t loopback_handshake(netplay_transport *transport, netplay_session *np, uint32_t timeout_ms)
+{
+	return 1;
+}
+
+static void loopback_free(netplay_transport *transport)
+{
+	loopback_transport *lb = (loopback_transport *)transport;
+	free(lb->frames);
+	free(lb->inputs);
+	free(lb);
+}
+
+//stand-in for a remote peer that plays the remote player's controller from local input
+//with delay frames of simulated latency, for testing rollback without a network
+netplay_transport *netplay_loopback(netplay_session *np, uint32_t delay)
+{
+	if (delay > NETPLAY_MAX_ROLLBACK) {
+		warning("Netplay loopback delay of %u is longer than the maximum rollback of %u frames\n", delay, NETPLAY_MAX_ROLLBACK);
+		delay = NETPLAY_MAX_ROLLBACK;
+	}
+	loopback_transport *lb = calloc(1, sizeof(loopback_transport));
+	lb->header.send = loopback_send;
+	lb->header.receive = loopback_receive;
+	lb->header.free = loopback_free;
+	lb->header.handshake = loopback_handshake;
+	lb->np = np;
+	lb->delay = delay;
+	lb->frames = calloc(delay + NETPLAY_FRAMES, sizeof(uint32_t));
+	lb->inputs = calloc(delay + NETPLAY_FRAMES, sizeof(uint16_t));
+	return &lb->header;
+}
+
+//Each datagram carries the number of remote frames we have confirmed followed by every local
+//input the peer hasn't acknowledged yet so a lost packet is covered by the next one
+#define UDP_HISTORY (NETPLAY_FRAMES * 2)
+#define UDP_HEADER_SIZE 9
+#define UDP_PACKET_SIZE (UDP_HEADER_SIZE + UDP_HISTORY * 2)
+
+typedef struct {
+	netplay_transport       header;
+	netplay_session         *np;
+	struct sockaddr_storage peer;
+	socklen_t               peer_len;
+	int                     sock;
+	uint32_t                sent_frames;  //one past the newest frame in history
+	uint32_t                acked_frames; //frames the peer has confirmed
+	uint16_t                history[UDP_HISTORY];
+	uint8_t                 peer_seen;
+} udp_transport;
+
+static void write_u32(uint8_t *dst, uint32_t value)
+{
+	dst[0] = value >> 24;
+	dst[1] = value >> 16;
+	dst[2] = value >> 8;
+	dst[3] = value;
+}
+
+static uint32_t read_u32(uint8_t *src)
+{
+	return src[0] << 24 | src[1] << 16 | src[2] << 8 | src[3];
+}
+
+static void udp_flush(udp_transport *udp)
+{
+	uint8_t packet[UDP_PACKET_SIZE];
+	uint32_t first = udp->acked_frames;
+	if (udp->sent_frames - first > UDP_HISTORY) {
+		first = udp->sent_frames - UDP_HISTORY;
+	}
+	write_u32(packet, udp->np->remote_frames);
+	write_u32(packet + 4, first);
+	packet[8] = udp->sent_frames - first;
+	uint8_t *cur = packet + UDP_HEADER_SIZE;
+	for (uint32_t frame = first; frame != udp->sent_frames; frame++, cur += 2)
+	{
+		uint16_t input = udp->history[frame % UDP_HISTORY];
+		cur[0] = input >> 8;
+		cur[1] = input;
+	}
+	sendto(udp->sock, (const char *)packet, cur - packet, 0, (struct sockaddr *)&udp->peer, udp->peer_len);
+}
+
+static void udp_send(netplay_transport *transport, uint32_t frame, uint16_t input)
+{
+	udp_transport *udp = (udp_transport *)transport;
+	if (!udp->sent_frames) {
+		udp->sent_frames = udp->acked_frames = frame;
+	}
+	udp->history[frame % UDP_HISTORY] = input;
+	udp->sent_frames = frame + 1;
+	udp_flush(udp);
+}
+
+static void udp_receive(netplay_transport *transport, netplay_session *np, uint32_t timeout_ms)
+{
+	udp_transport *udp = (udp_transport *)transport;
+	if (timeout_ms) {
+		fd_set read_fds;
+		FD_ZERO(&read_fds);
+		FD_SET(udp->sock, &read_fds);
+		struct timeval timeout = {
+			.tv_sec = timeout_ms / 1000,
+			.tv_usec = (timeout_ms % 1000) * 1000
+		};
+		if (select(udp->sock + 1, &read_fds, NULL, NULL, &timeout) <= 0) {
+			//the peer may be waiting on inputs that were lost
+			udp_flush(udp);
+			return;
+		}
+	}
+	uint8_t packet[UDP_PACKET_SIZE];
+	int bytes;
+	while ((bytes = recv(udp->sock, (char *)packet, sizeof(packet), 0)) > 0)
+	{
+		if (bytes < UDP_HEADER_SIZE || bytes < UDP_HEADER_SIZE + packet[8] * 2) {
+			continue;
+		}
+		udp->peer_seen = 1;
+		uint32_t acked = read_u32(packet);
+		if ((int32_t)(acked - udp->acked_frames) > 0 && (int32_t)(udp->sent_frames - acked) >= 0) {
+			udp->acked_frames = acked;
+		}
+		uint32_t frame = read_u32(packet + 4);
+		uint8_t *cur = packet + UDP_HEADER_SIZE;
+		for (uint8_t i = 0; i < packet[8]; i++, cur += 2)
+		{
+			netplay_remote_input(np, frame + i, cur[0] << 8 | cur[1]);
+		}
+	}
+}
+
+//before the session starts the flushed packets carry no inputs and just let the peer know we're here
+static uint8_t udp_handshake(netplay_transport *transport, netplay_session *np, uint32_t timeout_ms)
+{
+	udp_transport *udp = (udp_transport *)transport;
+	if (!udp->peer_seen) {
+		udp_flush(udp);
+		udp_receive(transport, np, timeout_ms);
+	}
+	return udp->peer_seen;
+}
+
+static void udp_free(netplay_transport *transport)
+{
+	udp_transport *udp = (udp_transport *)transport;
+	socket_close(udp->sock);
+	free(udp);
+}
+
+//exchanges inputs with a peer over UDP, both sides send to each other's port directly
+netplay_transport *netplay_udp(netplay_session *np, char *local_port, char *peer_address, char *peer_port)
+{
+	struct addrinfo request, *result;
+	socket_init();
+	memset(&request, 0, sizeof(request));
+	request.ai_family = AF_INET;
+	request.ai_socktype = SOCK_DGRAM;
+	if (getaddrinfo(peer_address, peer_port, &request, &result)) {
+		warning("Failed to resolve netplay peer %s:%s\n", peer_address, peer_port);
+		return NULL;
+	}
+	udp_transport *udp = calloc(1, sizeof(udp_transport));
+	memcpy(&udp->peer, result->ai_addr, result->ai_addrlen);
+	udp->peer_len = result->ai_addrlen;
+	freeaddrinfo(result);
+	request.ai_flags = AI_PASSIVE;
+	if (getaddrinfo(NULL, local_port, &request, &result)) {
+		warning("Invalid netplay port %s\n", local_port);
+		free(udp);
+		return NULL;
+	}
+	udp->sock = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+	if (udp->sock < 0) {
+		warning("Failed to create netplay socket\n");
+		freeaddrinfo(result);
+		free(udp);
+		return NULL;
+	}
+	if (bind(udp->sock, result->ai_addr, result->ai_addrlen) < 0) {
+		warning("Failed to bind netplay socket to port %s\n", local_port);
+		freeaddrinfo(result);
+		socket_close(udp->sock);
+		free(udp);
+		return NULL;
+	}
+	freeaddrinfo(result);
+	socket_blocking(udp->sock, 0);
+	udp->header.send = udp_send;
+	udp->header.receive = udp_receive;
+	udp->header.free = udp_free;
+	udp->header.handshake = udp_handshake;
+	udp->np = np;
+	return &udp->header;
+}
@@ -0,0 +1,78 @@
+#ifndef NETPLAY_H_
+#define NETPLAY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "serialize.h"
+
+//number of frames of history kept, must be a power of 2
+#define NETPLAY_FRAMES 16
+//furthest a misprediction can be corrected, inputs for a frame must stay in the ring
+//for this many frames after it plus the input delay
+#define NETPLAY_MAX_ROLLBACK (NETPLAY_FRAMES/2)
+#define NETPLAY_MAX_INPUT_DELAY (NETPLAY_MAX_ROLLBACK - 1)
+
+enum {
+	NETPLAY_SAVE,
+	NETPLAY_ROLLBACK
+};
+
+enum {
+	NETPLAY_LOCAL,
+	NETPLAY_REMOTE
+};
+
+typedef struct {
+	serialize_buffer state;       //snapshot taken at the start of state_frame
+	uint32_t         state_frame;
+	uint32_t         input_frame; //frame the inputs below apply to
+	uint16_t         input[2];    //button masks indexed by NETPLAY_LOCAL/NETPLAY_REMOTE
+	uint8_t          confirmed;   //remote input was received rather than predicted
+} netplay_frame;
+
+typedef struct netplay_session netplay_session;
+typedef struct netplay_transport netplay_transport;
+struct netplay_transport {
+	void (*send)(netplay_transport *transport, uint32_t frame, uint16_t input);
+	//passes everything that has arrived to netplay_remote_input, blocks for up to timeout_ms
+	//if nothing has
+	void (*receive)(netplay_transport *transport, netplay_session *np, uint32_t timeout_ms);
+	void (*free)(netplay_transport *transport);
+	//returns 1 once the peer has been heard from, blocks for up to timeout_ms if it hasn't
+	uint8_t (*handshake)(netplay_transport *transport, netplay_session *np, uint32_t timeout_ms);
+};
+
+struct netplay_session {
+	netplay_frame     ring[NETPLAY_FRAMES];
+	netplay_transport *transport;
+	uint32_t          frame;          //frame currently being emulated
+	uint32_t          resume_frame;   //first frame that is presented again after a rollback
+	uint32_t          rollback_frame; //oldest frame emulated with a misprediction
+	uint32_t          remote_frames;  //number of frames with confirmed remote input
+	uint16_t          remote_input;   //most recent confirmed remote input, used as the prediction
+	uint16_t          local_buttons;  //live state of the local controller
+	uint16_t          peer_buttons;   //live state of the controller standing in for the remote player
+	uint16_t          applied[2];     //button masks currently set on the emulated controllers
+	uint8_t           local_pad;
+	uint8_t           remote_pad;
+	uint8_t           input_delay;
+	uint8_t           resimulating;
+	uint8_t           rollback_pending;
+	uint8_t           disconnected;
+	uint8_t           held_save;      //save request from outside the session, handled after the next snapshot
+};
+
+netplay_session *netplay_alloc(uint8_t local_pad, uint8_t input_delay);
+void netplay_free(netplay_session *np);
+uint8_t netplay_connect(netplay_session *np, void (*progress)(uint32_t seconds_left));
+netplay_transport *netplay_loopback(netplay_session *np, uint32_t delay);
+netplay_transport *netplay_udp(netplay_session *np, char *local_port, char *peer_address, char *peer_port);
+uint8_t netplay_gamepad_event(netplay_session *np, uint8_t pad, uint8_t button, uint8_t down);
+void netplay_remote_input(netplay_session *np, uint32_t frame, uint16_t input);
+uint8_t netplay_frame_done(netplay_session *np);
+serialize_buffer *netplay_begin_save(netplay_session *np);
+netplay_frame *netplay_inputs(netplay_session *np);
+uint8_t *netplay_rollback(netplay_session *np, size_t *size_out);
+uint8_t netplay_show_frame(netplay_session *np);
+
+#endif //NETPLAY_H_
@@ -523,11 +523,11 @@ void view_key_bindings(struct nk_context *context)
 		"gamepads.2.start", "gamepads.2.mode"
 	};
 	static const char *general_binds[] = {
-		"ui.menu", "ui.save_state", "ui.load_state", "ui.toggle_fullscreen", "ui.soft_reset", "ui.reload",
+		"ui.menu", "ui.save_state", "ui.load_state", "ui.rewind", "ui.toggle_fullscreen", "ui.soft_reset", "ui.reload",
 		"ui.screenshot", "ui.vgm_log", "ui.sms_pause", "ui.toggle_keyboard_captured", "ui.release_mouse", "ui.exit"
 	};
 	static const char *general_names[] = {
-		"Show Menu", "Quick Save", "Quick Load", "Toggle Fullscreen", "Soft Reset", "Reload Media",
+		"Show Menu", "Quick Save", "Quick Load", "Rewind", "Toggle Fullscreen", "Soft Reset", "Reload Media",
 		"Internal Screenshot", "Toggle VGM Log", "SMS Pause", "Capture Keyboard", "Release Mouse", "Exit"
 	};
 	static const char *speed_binds[] = {
@@ -680,6 +680,7 @@ const char *translate_binding_option(const char *option)
 		conf_names = tern_insert_ptr(conf_names, "ui.exit", "Exit");
 		conf_names = tern_insert_ptr(conf_names, "ui.save_state", "Quick Save");
 		conf_names = tern_insert_ptr(conf_names, "ui.load_state", "Quick Load");
+		conf_names = tern_insert_ptr(conf_names, "ui.rewind", "Rewind");
 		conf_names = tern_insert_ptr(conf_names, "ui.set_speed.0", "Set Speed 0");
 		conf_names = tern_insert_ptr(conf_names, "ui.set_speed.1", "Set Speed 1");
 		conf_names = tern_insert_ptr(conf_names, "ui.set_speed.2", "Set Speed 2");
@@ -744,6 +745,7 @@ static void view_button_binding(struct nk_context *context)
 	static const char *emu_control[] = {
 		"ui.save_state",
 		"ui.load_state",
+		"ui.rewind",
 		"ui.menu",
 		"ui.toggle_fullscreen",
 		"ui.screenshot",
@@ -2038,6 +2040,7 @@ void view_video_settings(struct nk_context *context)
 		settings_toggle(context, "Fullscreen", "video\0fullscreen\0", 0);
 		settings_toggle(context, "Open GL", "video\0gl\0", 1);
 		settings_toggle(context, "Scanlines", "video\0scanlines\0", 0);
+		settings_toggle(context, "Threaded VDP", "video\0vdp_thread\0", 0);
 		selected_vsync = settings_dropdown_ex(context, "VSync", vsync_opts, vsync_opt_names, num_vsync_opts, selected_vsync, "video\0vsync\0");
 		settings_int_input(context, "Windowed Width", "video\0width\0", "640");
 		nk_label(context, "Shader", NK_TEXT_LEFT);
@@ -2088,16 +2091,27 @@ void view_audio_settings(struct nk_context *context)
 		"Zero Offset",
 		"Linear"
 	};
+	const char *resamplers[] = {
+		"linear",
+		"sinc"
+	};
+	const char *resampler_desc[] = {
+		"Linear",
+		"Windowed Sinc (more CPU)"
+	};
 	const uint32_t num_rates = sizeof(rates)/sizeof(*rates);
 	const uint32_t num_sizes = sizeof(sizes)/sizeof(*sizes);
 	const uint32_t num_dacs = sizeof(dac)/sizeof(*dac);
+	const uint32_t num_resamplers = sizeof(resamplers)/sizeof(*resamplers);
 	static int32_t selected_rate = -1;
 	static int32_t selected_size = -1;
 	static int32_t selected_dac = -1;
-	if (selected_rate < 0 || selected_size < 0 || selected_dac < 0) {
+	static int32_t selected_resampler = -1;
+	if (selected_rate < 0 || selected_size < 0 || selected_dac < 0 || selected_resampler < 0) {
 		selected_rate = find_match(rates, num_rates, "audio\0rate\0", "48000");
 		selected_size = find_match(sizes, num_sizes, "audio\0buffer\0", "512");
 		selected_dac = find_match(dac, num_dacs, "audio\0fm_dac\0", "zero_offset");
+		selected_resampler = find_match(resamplers, num_resamplers, "audio\0resampler\0", "linear");
 	}
 	uint32_t width = render_width();
 	uint32_t height = render_height();
@@ -2110,6 +2124,7 @@ void view_audio_settings(struct nk_context *context)
 		selected_rate = settings_dropdown(context, "Rate in Hz", rates, num_rates, selected_rate, "audio\0rate\0");
 		selected_size = settings_dropdown(context, "Buffer Samples", sizes, num_sizes, selected_size, "audio\0buffer\0");
 		settings_int_input(context, "Lowpass Cutoff Hz", "audio\0lowpass_cutoff\0", "3390");
+		selected_resampler = settings_dropdown_ex(context, "Resampler", resamplers, resampler_desc, num_resamplers, selected_resampler, "audio\0resampler\0");
 		settings_float_property(context, "Gain (dB)", "Overall", "audio\0gain\0", 0, -30.0f, 30.0f, 0.5f);
 		settings_float_property(context, "", "FM", "audio\0fm_gain\0", 0, -30.0f, 30.0f, 0.5f);
 		settings_float_property(context, "", "PSG", "audio\0psg_gain\0", 0, -30.0f, 30.0f, 0.5f);
@@ -2219,6 +2234,21 @@ void view_system_settings(struct nk_context *context)
 		}
 	}
 
+	static const char *netplay_opts[] = {
+		"off",
+		"udp",
+		"loopback"
+	};
+	static const char *netplay_names[] = {
+		"Off",
+		"UDP",
+		"Local Loopback"
+	};
+	const uint32_t num_netplay_opts = sizeof(netplay_opts)/sizeof(*netplay_opts);
+	static int32_t selected_netplay = -1;
+	if (selected_netplay < 0) {
+		selected_netplay = find_match(netplay_opts, num_netplay_opts, "system\0netplay\0", "off");
+	}
 	static const char *formats[] = {
 		"native",
 		"gst"
@@ -2228,6 +2258,21 @@ void view_system_settings(struct nk_context *context)
 	if (selected_format < 0) {
 		selected_format = find_match(formats, num_formats, "ui\0state_format\0", "native");
 	}
+	static const char *video_formats[] = {
+		"apng",
+		"y4m",
+		"pipe"
+	};
+	static const char *video_format_names[] = {
+		"APNG",
+		"Y4M",
+		"Pipe to Encoder"
+	};
+	const uint32_t num_video_formats = sizeof(video_formats)/sizeof(*video_formats);
+	static int32_t selected_video_format = -1;
+	if (selected_video_format < 0) {
+		selected_video_format = find_match(video_formats, num_video_formats, "ui\0video_format\0", "apng");
+	}
 	static const char *ram_inits[] = {
 		"zero",
 		"random"
@@ -2321,10 +2366,23 @@ void view_system_settings(struct nk_context *context)
 			selected_format = settings_dropdown(context, "Save State Format", formats, num_formats, selected_format, "ui\0state_format\0");
 		}
 		selected_init = settings_dropdown(context, "Initial RAM Value", ram_inits, num_inits, selected_init, "system\0ram_init\0");
+		settings_toggle(context, "Enable Rewind", "system\0rewind\0", 0);
+		settings_int_property(context, "Rewind Memory (MB)", "", "system\0rewind_memory\0", 32, 1, 1024);
+		settings_int_property(context, "Run-Ahead Frames", "", "system\0runahead\0", 0, 0, 4);
+		settings_toggle(context, "Cache JIT Translations", "system\0jit_cache\0", 0);
+		if (!show_sms) {
+			selected_netplay = settings_dropdown_ex(context, "Netplay", netplay_opts, netplay_names, num_netplay_opts, selected_netplay, "system\0netplay\0");
+			settings_int_property(context, "Netplay Player", "", "system\0netplay_player\0", 1, 1, 2);
+			settings_int_property(context, "Netplay Input Delay", "", "system\0netplay_input_delay\0", 1, 0, 7);
+			settings_string(context, "Netplay Peer Address", "system\0netplay_peer_address\0", "");
+		}
 		settings_toggle(context, "Remember ROM Path", "ui\0remember_path\0", 1);
 		settings_toggle(context, "Use Native File Picker", "ui\0use_native_filechooser\0", 0);
 		settings_toggle(context, "Save config with EXE", "ui\0config_in_exe_dir\0", 0);
 		settings_string(context, "Game Save Path", "ui\0save_path\0", "$USERDATA/blastem/$ROMNAME");
+		selected_video_format = settings_dropdown_ex(context, "Video Recording Format", video_formats, video_format_names, num_video_formats, selected_video_format, "ui\0video_format\0");
+		settings_string(context, "Video Encoder Command", "ui\0video_pipe_command\0", "ffmpeg -loglevel error -y -f yuv4mpegpipe -i - -c:v libx264 -pix_fmt yuv420p");
+		settings_int_property(context, "PNG Encoder Threads", "Threads", "ui\0png_threads\0", 1, 1, 16);
 
 		if (nk_button_label(context, "Back")) {
 			if (config_dirty) {
@@ -4,6 +4,14 @@
 #include <string.h>
 #include "zlib/zlib.h"
 #include "png.h"
+#ifndef IS_LIB
+#include "render.h"
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 static const char png_magic[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
 static const char ihdr[] = {'I', 'H', 'D', 'R'};
@@ -60,28 +68,463 @@ static void write_header(FILE *f, uint32_t width, uint32_t height, uint8_t color
 	write_chunk(f, ihdr, chunk, sizeof(chunk));
 }
 
-void save_png24_frame(FILE *f, uint32_t *buffer, apng_state *apng, uint32_t width, uint32_t height, uint32_t pitch)
+static uint8_t paeth(uint8_t a, uint8_t b, uint8_t c)
 {
-	uint32_t idat_size = (1 + width*3) * height;
-	uint8_t *idat_buffer = malloc(idat_size);
-	uint32_t *pixel = buffer;
-	uint8_t *cur = idat_buffer;
-	for (uint32_t y = 0; y < height; y++)
+	int32_t p = a + b - c;
+	int32_t pa = abs(p - a);
+	int32_t pb = abs(p - b);
+	int32_t pc = abs(p - c);
+	if (pa <= pb && pa <= pc) {
+		return a;
+	}
+	if (pb <= pc) {
+		return b;
+	}
+	return c;
+}
+
+enum {
+	FILTER_NONE,
+	FILTER_SUB,
+	FILTER_UP,
+	FILTER_AVG,
+	FILTER_PAETH
+};
+
+//The banded encoder splits the image into horizontal bands that are filtered and deflated
+//independently. Each band is primed with the preceding 32KB of filtered data as a dictionary
+//and ends with a sync flush so the compressed bands can simply be concatenated
+#define MAX_BANDS 16
+//bands smaller than this aren't worth the extra flush and thread handoff
+#define MIN_BAND_ROWS 16
+#define DEFLATE_WINDOW 32768
+
+typedef struct {
+	uint8_t  *compressed;
+	uint32_t compressed_size;
+	uint32_t start_row;
+	uint32_t end_row;
+	uLong    adler;
+} png_band;
+
+enum {
+	PHASE_FILTER,
+	PHASE_DEFLATE
+};
+
+typedef struct {
+	uint32_t *pixels; //NULL when the rows in filtered are already complete
+	uint8_t  *filtered;
+	uint32_t width;
+	uint32_t height;
+	uint32_t pitch;
+	uint32_t row_bytes;
+	uint32_t num_bands;
+	uint8_t  phase;
+	png_band bands[MAX_BANDS];
+} png_job;
+
+static uint32_t encoder_threads = 1;
+
+void png_set_threads(uint32_t threads)
+{
+	if (!threads) {
+		threads = 1;
+	} else if (threads > MAX_BANDS) {
+		threads = MAX_BANDS;
+	}
+	__atomic_store_n(&encoder_threads, threads, __ATOMIC_RELAXED);
+}
+
+static uint32_t filter_cost(uint8_t value)
+{
+	//sum of absolute values of the residuals interpreted as signed bytes
+	return value < 128 ? value : 256 - value;
+}
+
+#ifdef __SSE2__
+static __m128i abs_epi16(__m128i value)
+{
+	return _mm_max_epi16(value, _mm_sub_epi16(_mm_setzero_si128(), value));
+}
+
+static __m128i paeth_epi16(__m128i a, __m128i b, __m128i c)
+{
+	__m128i pa = _mm_sub_epi16(b, c);
+	__m128i pb = _mm_sub_epi16(a, c);
+	__m128i pc = abs_epi16(_mm_add_epi16(pa, pb));
+	pa = abs_epi16(pa);
+	pb = abs_epi16(pb);
+	__m128i not_a = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+	__m128i not_b = _mm_cmpgt_epi16(pb, pc);
+	__m128i b_or_c = _mm_or_si128(_mm_and_si128(not_b, c), _mm_andnot_si128(not_b, b));
+	return _mm_or_si128(_mm_and_si128(not_a, b_or_c), _mm_andnot_si128(not_a, a));
+}
+
+static __m128i cost_epi8(__m128i value)
+{
+	__m128i zero = _mm_setzero_si128();
+	return _mm_sad_epu8(_mm_min_epu8(value, _mm_sub_epi8(zero, value)), zero);
+}
+#elif defined(__ARM_NEON)
+static uint8x16_t paeth_u8(uint8x16_t a, uint8x16_t b, uint8x16_t c)
+{
+	//|p - a| and |p - b| fit in 8 bits, |p - c| is widened and saturated which doesn't change
+	//the outcome of either comparison
+	uint8x16_t pa = vabdq_u8(b, c);
+	uint8x16_t pb = vabdq_u8(a, c);
+	int16x8_t pc_lo = vabsq_s16(vaddq_s16(
+		vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(b), vget_low_u8(c))),
+		vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(a), vget_low_u8(c)))
+	));
+	int16x8_t pc_hi = vabsq_s16(vaddq_s16(
+		vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(b), vget_high_u8(c))),
+		vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(a), vget_high_u8(c)))
+	));
+	uint8x16_t pc = vcombine_u8(vqmovun_s16(pc_lo), vqmovun_s16(pc_hi));
+	uint8x16_t not_a = vorrq_u8(vcgtq_u8(pa, pb), vcgtq_u8(pa, pc));
+	uint8x16_t not_b = vcgtq_u8(pb, pc);
+	return vbslq_u8(not_a, vbslq_u8(not_b, c, b), a);
+}
+
+static uint32x4_t add_cost(uint32x4_t sum, uint8x16_t value)
+{
+	return vpadalq_u16(sum, vpaddlq_u8(vminq_u8(value, vsubq_u8(vdupq_n_u8(0), value))));
+}
+
+static uint32_t sum_cost(uint32x4_t sum)
+{
+	uint64x2_t wide = vpaddlq_u32(sum);
+	return vgetq_lane_u64(wide, 0) + vgetq_lane_u64(wide, 1);
+}
+#endif
+
+//Picks whichever of none, sub, up and paeth gives the smallest residuals for a row and
+//writes the filter type followed by the filtered bytes to out. cur and prior must be preceded
+//by bpp zero bytes so the left neighbors of the first pixel don't need special handling
+static void filter_row(uint8_t *out, uint8_t *cur, uint8_t *prior, uint32_t len, uint8_t bpp, uint8_t *scratch)
+{
+	uint8_t *sub = scratch, *up = sub + len, *pae = up + len;
+	uint8_t *left = cur - bpp, *up_left = prior - bpp;
+	uint32_t cost[4] = {0, 0, 0, 0};
+	uint32_t i = 0;
+#ifdef __SSE2__
+	__m128i zero = _mm_setzero_si128();
+	__m128i sums[4] = {zero, zero, zero, zero};
+	for (; i + 16 <= len; i += 16)
 	{
-		//save filter type
-		*(cur++) = 0;
-		uint32_t *start = pixel;
-		for (uint32_t x = 0; x < width; x++, pixel++)
-		{
-			uint32_t value = *pixel;
-			*(cur++) = value >> 16;
-			*(cur++) = value >> 8;
-			*(cur++) = value;
+		__m128i x = _mm_loadu_si128((__m128i *)(cur + i));
+		__m128i a = _mm_loadu_si128((__m128i *)(left + i));
+		__m128i b = _mm_loadu_si128((__m128i *)(prior + i));
+		__m128i c = _mm_loadu_si128((__m128i *)(up_left + i));
+		__m128i pred = _mm_packus_epi16(
+			paeth_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero)),
+			paeth_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero))
+		);
+		__m128i vsub = _mm_sub_epi8(x, a);
+		__m128i vup = _mm_sub_epi8(x, b);
+		__m128i vpaeth = _mm_sub_epi8(x, pred);
+		_mm_storeu_si128((__m128i *)(sub + i), vsub);
+		_mm_storeu_si128((__m128i *)(up + i), vup);
+		_mm_storeu_si128((__m128i *)(pae + i), vpaeth);
+		sums[0] = _mm_add_epi64(sums[0], cost_epi8(x));
+		sums[1] = _mm_add_epi64(sums[1], cost_epi8(vsub));
+		sums[2] = _mm_add_epi64(sums[2], cost_epi8(vup));
+		sums[3] = _mm_add_epi64(sums[3], cost_epi8(vpaeth));
+	}
+	for (int j = 0; j < 4; j++)
+	{
+		cost[j] = _mm_cvtsi128_si32(sums[j]) + _mm_cvtsi128_si32(_mm_srli_si128(sums[j], 8));
+	}
+#elif defined(__ARM_NEON)
+	uint32x4_t sums[4] = {vdupq_n_u32(0), vdupq_n_u32(0), vdupq_n_u32(0), vdupq_n_u32(0)};
+	for (; i + 16 <= len; i += 16)
+	{
+		uint8x16_t x = vld1q_u8(cur + i);
+		uint8x16_t a = vld1q_u8(left + i);
+		uint8x16_t b = vld1q_u8(prior + i);
+		uint8x16_t c = vld1q_u8(up_left + i);
+		uint8x16_t vsub = vsubq_u8(x, a);
+		uint8x16_t vup = vsubq_u8(x, b);
+		uint8x16_t vpaeth = vsubq_u8(x, paeth_u8(a, b, c));
+		vst1q_u8(sub + i, vsub);
+		vst1q_u8(up + i, vup);
+		vst1q_u8(pae + i, vpaeth);
+		sums[0] = add_cost(sums[0], x);
+		sums[1] = add_cost(sums[1], vsub);
+		sums[2] = add_cost(sums[2], vup);
+		sums[3] = add_cost(sums[3], vpaeth);
+	}
+	for (int j = 0; j < 4; j++)
+	{
+		cost[j] = sum_cost(sums[j]);
+	}
+#endif
+	for (; i < len; i++)
+	{
+		uint8_t x = cur[i], a = left[i], b = prior[i], c = up_left[i];
+		sub[i] = x - a;
+		up[i] = x - b;
+		pae[i] = x - paeth(a, b, c);
+		cost[0] += filter_cost(x);
+		cost[1] += filter_cost(sub[i]);
+		cost[2] += filter_cost(up[i]);
+		cost[3] += filter_cost(pae[i]);
+	}
+	static const uint8_t types[] = {FILTER_NONE, FILTER_SUB, FILTER_UP, FILTER_PAETH};
+	uint8_t *candidates[] = {cur, sub, up, pae};
+	int best = 0;
+	for (int j = 1; j < 4; j++)
+	{
+		if (cost[j] < cost[best]) {
+			best = j;
 		}
-		pixel = start + pitch / sizeof(uint32_t);
 	}
-	
-	uLongf compress_buffer_size = idat_size + 5 * (idat_size/16383 + 1) + 3;
+	out[0] = types[best];
+	memcpy(out + 1, candidates[best], len);
+}
+
+static void pixels_to_rgb(uint8_t *dst, uint32_t *pixel, uint32_t width)
+{
+	for (uint32_t x = 0; x < width; x++, pixel++)
+	{
+		uint32_t value = *pixel;
+		*(dst++) = value >> 16;
+		*(dst++) = value >> 8;
+		*(dst++) = value;
+	}
+}
+
+static void filter_band(png_job *job, png_band *band)
+{
+	uint32_t len = job->width * 3;
+	//two RGB rows with 3 bytes of zero padding in front plus room for 3 candidate filters
+	uint8_t *rows = calloc(2 * (len + 3) + 3 * len, 1);
+	uint8_t *prior = rows + 3, *cur = prior + len + 3, *scratch = cur + len;
+	uint32_t *pixel = job->pixels + band->start_row * (job->pitch / sizeof(uint32_t));
+	if (band->start_row) {
+		//the first row of a band is still filtered against the last row of the previous one
+		pixels_to_rgb(prior, pixel - job->pitch / sizeof(uint32_t), job->width);
+	}
+	uint8_t *out = job->filtered + band->start_row * job->row_bytes;
+	for (uint32_t y = band->start_row; y < band->end_row; y++, out += job->row_bytes)
+	{
+		pixels_to_rgb(cur, pixel, job->width);
+		filter_row(out, cur, prior, len, 3, scratch);
+		pixel += job->pitch / sizeof(uint32_t);
+		uint8_t *tmp = prior;
+		prior = cur;
+		cur = tmp;
+	}
+	free(rows);
+}
+
+static void deflate_band(png_job *job, png_band *band)
+{
+	uint32_t offset = band->start_row * job->row_bytes;
+	uint8_t *data = job->filtered + offset;
+	uint32_t size = (band->end_row - band->start_row) * job->row_bytes;
+	uint8_t last = band->end_row == job->height;
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+	if (offset) {
+		uint32_t dict_size = offset < DEFLATE_WINDOW ? offset : DEFLATE_WINDOW;
+		deflateSetDictionary(&stream, data - dict_size, dict_size);
+	}
+	//deflateBound doesn't account for the empty stored block emitted by a sync flush
+	uint32_t capacity = deflateBound(&stream, size) + 16;
+	band->compressed = malloc(capacity);
+	stream.next_in = data;
+	stream.avail_in = size;
+	stream.next_out = band->compressed;
+	stream.avail_out = capacity;
+	for (;;)
+	{
+		int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+		if (last ? result == Z_STREAM_END : stream.avail_out != 0) {
+			break;
+		}
+		capacity *= 2;
+		band->compressed = realloc(band->compressed, capacity);
+		stream.next_out = band->compressed + stream.total_out;
+		stream.avail_out = capacity - stream.total_out;
+	}
+	band->compressed_size = stream.total_out;
+	deflateEnd(&stream);
+	band->adler = adler32(adler32(0, NULL, 0), data, size);
+}
+
+static void run_band(png_job *job, uint32_t index)
+{
+	if (job->phase == PHASE_FILTER) {
+		filter_band(job, job->bands + index);
+	} else {
+		deflate_band(job, job->bands + index);
+	}
+}
+
+#ifndef IS_LIB
+typedef struct {
+	png_job          *job;
+	uint32_t         band;
+	//posted by the encoding thread once job and band are filled in
+	render_semaphore wake;
+	render_thread    thread;
+} png_worker;
+
+static png_worker workers[MAX_BANDS-1];
+static uint32_t num_workers;
+//posted by each worker when it finishes its band
+static render_semaphore workers_done;
+static uint8_t workers_done_created;
+//only one image is encoded with the workers at a time, anyone else encodes on their own thread
+static uint8_t workers_busy;
+
+static int png_worker_main(void *data)
+{
+	png_worker *worker = data;
+	for (;;)
+	{
+		render_semaphore_wait(worker->wake);
+		run_band(worker->job, worker->band);
+		render_semaphore_post(workers_done);
+	}
+	return 0;
+}
+
+static uint32_t start_workers(uint32_t wanted)
+{
+	if (!workers_done_created) {
+		if (!render_create_semaphore(&workers_done)) {
+			return 0;
+		}
+		workers_done_created = 1;
+	}
+	while (num_workers < wanted)
+	{
+		png_worker *worker = workers + num_workers;
+		if (!worker->wake && !render_create_semaphore(&worker->wake)) {
+			break;
+		}
+		if (!render_create_thread(&worker->thread, "PNG encoder", png_worker_main, worker)) {
+			break;
+		}
+		num_workers++;
+	}
+	return num_workers < wanted ? num_workers : wanted;
+}
+#endif
+
+static void run_phase(png_job *job, uint32_t helpers)
+{
+#ifndef IS_LIB
+	//bands 1 through helpers go to the worker threads, the rest are done here
+	for (uint32_t i = 0; i < helpers; i++)
+	{
+		workers[i].job = job;
+		workers[i].band = i + 1;
+		render_semaphore_post(workers[i].wake);
+	}
+#endif
+	run_band(job, 0);
+	for (uint32_t i = helpers + 1; i < job->num_bands; i++)
+	{
+		run_band(job, i);
+	}
+#ifndef IS_LIB
+	for (uint32_t i = 0; i < helpers; i++)
+	{
+		render_semaphore_wait(workers_done);
+	}
+#endif
+}
+
+//returns 0 when the banded encoder isn't enabled
+static uint32_t num_bands(uint32_t height)
+{
+	uint32_t bands = __atomic_load_n(&encoder_threads, __ATOMIC_RELAXED);
+	if (bands < 2) {
+		return 0;
+	}
+	if (bands > height / MIN_BAND_ROWS) {
+		bands = height / MIN_BAND_ROWS;
+	}
+	return bands ? bands : 1;
+}
+
+//Produces a zlib stream for the image data with prefix bytes left free at the start of the
+//returned buffer. If pixels is non-NULL, rows are filtered into a newly allocated buffer,
+//otherwise filtered must already contain the complete scanlines
+static uint8_t *encode_bands(uint32_t *pixels, uint8_t *filtered, uint32_t width, uint32_t height, uint32_t pitch, uint32_t row_bytes, uint32_t bands, uint32_t prefix, uint32_t *size_out)
+{
+	png_job job = {
+		.pixels = pixels,
+		.filtered = pixels ? malloc(row_bytes * height) : filtered,
+		.width = width,
+		.height = height,
+		.pitch = pitch,
+		.row_bytes = row_bytes,
+		.num_bands = bands
+	};
+	for (uint32_t i = 0; i < bands; i++)
+	{
+		job.bands[i].start_row = height * i / bands;
+		job.bands[i].end_row = height * (i + 1) / bands;
+	}
+	uint32_t helpers = 0;
+#ifndef IS_LIB
+	uint8_t have_workers = bands > 1 && !__atomic_exchange_n(&workers_busy, 1, __ATOMIC_ACQUIRE);
+	if (have_workers) {
+		helpers = start_workers(bands - 1);
+	}
+#endif
+	if (pixels) {
+		job.phase = PHASE_FILTER;
+		run_phase(&job, helpers);
+	}
+	job.phase = PHASE_DEFLATE;
+	run_phase(&job, helpers);
+#ifndef IS_LIB
+	if (have_workers) {
+		__atomic_store_n(&workers_busy, 0, __ATOMIC_RELEASE);
+	}
+#endif
+
+	uint32_t size = prefix + 2 + sizeof(uint32_t);
+	for (uint32_t i = 0; i < bands; i++)
+	{
+		size += job.bands[i].compressed_size;
+	}
+	uint8_t *out = malloc(size);
+	uint8_t *cur = out + prefix;
+	//32KB window, default compression level
+	*(cur++) = 0x78;
+	*(cur++) = 0x9C;
+	uLong adler = job.bands[0].adler;
+	for (uint32_t i = 0; i < bands; i++)
+	{
+		png_band *band = job.bands + i;
+		memcpy(cur, band->compressed, band->compressed_size);
+		cur += band->compressed_size;
+		free(band->compressed);
+		if (i) {
+			adler = adler32_combine(adler, band->adler, (band->end_row - band->start_row) * row_bytes);
+		}
+	}
+	*(cur++) = adler >> 24;
+	*(cur++) = adler >> 16;
+	*(cur++) = adler >> 8;
+	*(cur++) = adler;
+	if (pixels) {
+		free(job.filtered);
+	}
+	*size_out = size;
+	return out;
+}
+
+void save_png24_frame(FILE *f, uint32_t *buffer, apng_state *apng, uint32_t width, uint32_t height, uint32_t pitch)
+{
 	uint32_t offset = 0;
 	if (apng) {
 		uint8_t chunk[26] = {
@@ -100,15 +543,41 @@ void save_png24_frame(FILE *f, uint32_t *buffer, apng_state *apng, uint32_t widt
 		apng->num_frames++;
 		if (apng->sequence_number > 1) {
 			offset = sizeof(uint32_t);
-			compress_buffer_size += offset;
 		}
 	}
-	uint8_t *compressed = malloc(compress_buffer_size);
-	compress_buffer_size -= offset;
-	compress(compressed + offset, &compress_buffer_size, idat_buffer, idat_size);
-	free(idat_buffer);
+	uint8_t *compressed;
+	uLongf compress_buffer_size;
+	uint32_t bands = num_bands(height);
+	if (bands) {
+		uint32_t size;
+		compressed = encode_bands(buffer, NULL, width, height, pitch, 1 + width*3, bands, offset, &size);
+		compress_buffer_size = size - offset;
+	} else {
+		uint32_t idat_size = (1 + width*3) * height;
+		uint8_t *idat_buffer = malloc(idat_size);
+		uint32_t *pixel = buffer;
+		uint8_t *cur = idat_buffer;
+		for (uint32_t y = 0; y < height; y++)
+		{
+			//save filter type
+			*(cur++) = 0;
+			uint32_t *start = pixel;
+			for (uint32_t x = 0; x < width; x++, pixel++)
+			{
+				uint32_t value = *pixel;
+				*(cur++) = value >> 16;
+				*(cur++) = value >> 8;
+				*(cur++) = value;
+			}
+			pixel = start + pitch / sizeof(uint32_t);
+		}
+		compress_buffer_size = compressBound(idat_size);
+		compressed = malloc(compress_buffer_size + offset);
+		compress(compressed + offset, &compress_buffer_size, idat_buffer, idat_size);
+		free(idat_buffer);
+	}
 	if (offset) {
-		cur = compressed;
+		uint8_t *cur = compressed;
 		*(cur++) = apng->sequence_number >> 24;
 		*(cur++) = apng->sequence_number >> 16;
 		*(cur++) = apng->sequence_number >> 8;
@@ -140,8 +609,18 @@ void end_apng(FILE *f, apng_state *apng)
 	fseek(f, apng->num_frame_offset, SEEK_SET);
 	uint8_t bytes[] = {
 		apng->num_frames >> 24, apng->num_frames >> 16, 
-		apng->num_frames >> 8, apng->num_frames
+		apng->num_frames >> 8, apng->num_frames,
+		0, 0, 0, 1, //num_plays is left alone
+		0, 0, 0, 0 //CRC
 	};
+	//the CRC covers the frame count so it has to be rewritten as well
+	uint32_t crc = crc32(0, NULL, 0);
+	crc = crc32(crc, (uint8_t *)actl, sizeof(actl));
+	crc = crc32(crc, bytes, 8);
+	bytes[8] = crc >> 24;
+	bytes[9] = crc >> 16;
+	bytes[10] = crc >> 8;
+	bytes[11] = crc;
 	fwrite(bytes, 1, sizeof(bytes), f);
 	fclose(f);
 	free(apng);
@@ -200,9 +679,19 @@ void save_png(FILE *f, uint32_t *buffer, uint32_t width, uint32_t height, uint32
 		*(cur++) = palette[i];
 	}
 	write_chunk(f, plte, pal_buffer, num_pal * 3);
-	uLongf compress_buffer_size = index_size + 5 * (index_size/16383 + 1) + 3;
-	uint8_t *compressed = malloc(compress_buffer_size);
-	compress(compressed, &compress_buffer_size, index_buffer, index_size);
+	uint8_t *compressed;
+	uLongf compress_buffer_size;
+	uint32_t bands = num_bands(height);
+	if (bands) {
+		//filtering doesn't help palette indices so the rows are deflated as is
+		uint32_t size;
+		compressed = encode_bands(NULL, index_buffer, width, height, pitch, 1 + width, bands, 0, &size);
+		compress_buffer_size = size;
+	} else {
+		compress_buffer_size = compressBound(index_size);
+		compressed = malloc(compress_buffer_size);
+		compress(compressed, &compress_buffer_size, index_buffer, index_size);
+	}
 	free(index_buffer);
 	write_chunk(f, idat, compressed, compress_buffer_size);
 	write_chunk(f, iend, NULL, 0);
@@ -242,21 +731,6 @@ static uint8_t filter_avg(uint8_t *cur, uint8_t *last, uint8_t bpp, uint32_t x)
 	return *cur + ((prev + prior) >> 1);
 }
 
-static uint8_t paeth(uint8_t a, uint8_t b, uint8_t c)
-{
-	int32_t p = a + b - c;
-	int32_t pa = abs(p - a);
-	int32_t pb = abs(p - b);
-	int32_t pc = abs(p - c);
-	if (pa <= pb && pa <= pc) {
-		return a;
-	}
-	if (pb <= pc) {
-		return b;
-	}
-	return c;
-}
-
 static uint8_t filter_paeth(uint8_t *cur, uint8_t *last, uint8_t bpp, uint32_t x)
 {
 	uint8_t prev, prev_prior;
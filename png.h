@@ -12,6 +12,9 @@ typedef struct {
 void save_png24_frame(FILE *f, uint32_t *buffer, apng_state *apng, uint32_t width, uint32_t height, uint32_t pitch);
 void save_png24(FILE *f, uint32_t *buffer, uint32_t width, uint32_t height, uint32_t pitch);
 void save_png(FILE *f, uint32_t *buffer, uint32_t width, uint32_t height, uint32_t pitch);
+//number of threads used to filter and compress image data, 1 keeps the original single
+//threaded encoder
+void png_set_threads(uint32_t threads);
 apng_state* start_apng(FILE *f, uint32_t width, uint32_t height, float frame_rate);
 void end_apng(FILE *f, apng_state *apng);
 uint32_t *load_png(uint8_t *buffer, uint32_t buf_size, uint32_t *width, uint32_t *height);
@@ -68,6 +68,7 @@
 #define RENDER_DPAD_RIGHT  SDL_HAT_RIGHT
 #define render_relative_mouse SDL_SetRelativeMouseMode
 typedef SDL_Thread* render_thread;
+typedef SDL_sem* render_semaphore;
 #endif
 #endif
 
@@ -151,6 +152,12 @@ int render_ui_to_pixels_x(int ui);
 int render_ui_to_pixels_y(int ui);
 #ifndef IS_LIB
 uint8_t render_create_thread(render_thread *thread, const char *name, render_thread_fun fun, void *data);
+uint8_t render_create_semaphore(render_semaphore *sem);
+void render_semaphore_wait(render_semaphore sem);
+//waits for up to timeout_ms, returns 0 if the semaphore wasn't signaled in time
+uint8_t render_semaphore_wait_timeout(render_semaphore sem, uint32_t timeout_ms);
+void render_semaphore_post(render_semaphore sem);
+void render_destroy_semaphore(render_semaphore sem);
 #endif
 
 #endif //RENDER_H_
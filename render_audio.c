@@ -6,43 +6,45 @@
 #include "util.h"
 #include "config.h"
 #include "blastem.h"
-#include "wave.h"
-
-static uint8_t output_channels;
-static uint32_t buffer_samples, sample_rate;
-
-static audio_source *audio_sources[8];
-static audio_source *inactive_audio_sources[8];
-static uint8_t num_audio_sources;
-static uint8_t num_inactive_audio_sources;
-
-static float overall_gain_mult, *mix_buf;
-static int sample_size;
-
-static FILE *wav_file;
+#include "capture.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+static INSTANCE_LOCAL uint8_t output_channels;
+static INSTANCE_LOCAL uint32_t buffer_samples, sample_rate;
+
+static INSTANCE_LOCAL audio_source *audio_sources[8];
+static INSTANCE_LOCAL audio_source *inactive_audio_sources[8];
+static INSTANCE_LOCAL uint8_t num_audio_sources;
+static INSTANCE_LOCAL uint8_t num_inactive_audio_sources;
+
+static INSTANCE_LOCAL float overall_gain_mult, *mix_buf;
+static INSTANCE_LOCAL int sample_size;
+static INSTANCE_LOCAL uint8_t use_polyphase;
+
+//samples are handed to the capture encoder thread rather than written from the audio callback
+static INSTANCE_LOCAL uint8_t capturing_audio;
 void render_end_audio(void)
 {
 	render_lock_audio();
-		if (wav_file) {
-			wave_finalize(wav_file);
-			fclose(wav_file);
-			wav_file = NULL;
-		}
+		uint8_t was_capturing = capturing_audio;
+		capturing_audio = 0;
 	render_unlock_audio();
+	if (was_capturing) {
+		capture_end_audio();
+	}
 }
 
 void render_save_audio(char *path)
 {
 	render_end_audio();
-	FILE *f = fopen(path, "wb");
-	if (f) {
-		wave_init(f, sample_rate, 16, 2);
+	if (capture_start_audio(path, sample_rate, 2)) {
 		render_lock_audio();
-			wav_file = f;
+			capturing_audio = 1;
 		render_unlock_audio();
-		printf("Saving audio to %s\n", path);
-	} else {
-		warning("Failed to open %s for writing\n", path);
 	}
 	free(path);
 }
@@ -70,13 +72,13 @@ static void convert_s16(float *samples, void *vstream, int sample_count)
 		}
 		*stream = out_sample;
 	}
-	if (wav_file) {
-		fwrite(vstream, sizeof(int16_t), sample_count, wav_file);
+	if (capturing_audio) {
+		capture_audio(vstream, sample_count);
 	}
 }
 
-static int16_t *wave_buffer;
-static int wave_buffer_samples;
+static INSTANCE_LOCAL int16_t *wave_buffer;
+static INSTANCE_LOCAL int wave_buffer_samples;
 static void clamp_f32(float *samples, void *vstream, int sample_count)
 {
 	float *start = samples;
@@ -90,11 +92,11 @@ static void clamp_f32(float *samples, void *vstream, int sample_count)
 		}
 		*samples = sample;
 	}
-	if (wav_file) {
+	if (capturing_audio) {
 		if (!wave_buffer) {
 			wave_buffer = calloc(sample_count, sizeof(int16_t));
 			wave_buffer_samples = sample_count;
-		} else if (sample_count < wave_buffer_samples) {
+		} else if (sample_count > wave_buffer_samples) {
 			wave_buffer = realloc(wave_buffer, sizeof(int16_t) * sample_count);
 			wave_buffer_samples = sample_count;
 		}
@@ -107,7 +109,8 @@ static int32_t mix_f32(audio_source *audio, float *stream, int samples)
 	float *end = stream + samples;
 	int16_t *src = audio->front;
 	uint32_t i = audio->read_start;
-	uint32_t i_end = audio->read_end;
+	//read_end is published by the emulation thread after the samples before it are written
+	uint32_t i_end = __atomic_load_n(&audio->read_end, __ATOMIC_ACQUIRE);
 	float *cur = stream;
 	float gain_mult = audio->gain_mult * overall_gain_mult;
 	size_t first_add = output_channels > 1 ? 1 : 0, second_add = output_channels > 1 ? output_channels - 1 : 1;
@@ -131,7 +134,7 @@ static int32_t mix_f32(audio_source *audio, float *stream, int samples)
 		}
 	}
 	if (!render_is_audio_sync()) {
-		audio->read_start = i;
+		__atomic_store_n(&audio->read_start, i, __ATOMIC_RELEASE);
 	}
 	if (cur != end) {
 		debug_message("Underflow of %d samples, read_start: %d, read_end: %d, mask: %X\n", (int)(end-cur)/2, audio->read_start, audio->read_end, audio->mask);
@@ -141,7 +144,7 @@ static int32_t mix_f32(audio_source *audio, float *stream, int samples)
 	}
 }
 
-static conv_func convert;
+static INSTANCE_LOCAL conv_func convert;
 
 
 int mix_and_convert(unsigned char *byte_stream, int len, int *min_remaining_out)
@@ -180,45 +183,222 @@ uint8_t all_sources_ready(void)
 	return num_populated == num_audio_sources;
 }
 
-uint8_t audio_deadlock_hack(void)
+#define BUFFER_INC_RES 0x40000000UL
+
+//Polyphase resampler
+//Input frames are collected into a per-channel history and filtered a block at a time with a
+//windowed sinc. Output positions come from buffer_fraction/buffer_inc exactly as in the linear
+//path so dynamic rate control works unchanged; only the coefficient table depends on the ratio
+#define RESAMPLE_PHASES 512
+#define RESAMPLE_BLOCK 64
+#define RESAMPLE_MIN_TAPS 32
+#define RESAMPLE_MAX_TAPS 256
+
+struct polyphase_resampler {
+	float    *coefficients;  //RESAMPLE_PHASES+1 rows of taps coefficients, oldest input first
+	//RESAMPLE_MAX_TAPS-1 frames from previous blocks followed by up to RESAMPLE_BLOCK new ones, kept at
+	//the maximum length so the tap count can change without losing the signal the filter is reading
+	float    *history[2];
+	uint64_t table_inc;      //buffer_inc the coefficient table was built for
+	uint32_t taps;
+	uint32_t frames;         //number of new frames in history
+};
+
+static void resampler_build(audio_source *src)
 {
-	uint32_t min_buffer_pos = 0xFFFFFFFFU;
-	for (uint8_t i = 0; i < num_audio_sources; i++)
+	polyphase_resampler *rs = src->resampler;
+	double ratio = (double)src->buffer_inc / BUFFER_INC_RES;
+	if (ratio > 1.0) {
+		ratio = 1.0;
+	}
+	//filter length is fixed in output samples so downsampling by a large factor needs more taps
+	uint32_t taps = (uint32_t)ceil(RESAMPLE_MIN_TAPS / ratio / 8.0) * 8;
+	if (taps > RESAMPLE_MAX_TAPS) {
+		taps = RESAMPLE_MAX_TAPS;
+	}
+	if (taps != rs->taps) {
+		free(rs->coefficients);
+		rs->coefficients = malloc((RESAMPLE_PHASES + 1) * taps * sizeof(float));
+		rs->taps = taps;
+	}
+	//leave a bit of room below Nyquist of the lower rate for the transition band
+	double cutoff = 0.45 * ratio;
+	double center = taps / 2 - 1;
+	for (uint32_t phase = 0; phase <= RESAMPLE_PHASES; phase++)
 	{
-		if (audio_sources[i]->front_populated) {
-			uint32_t buffer_pos = audio_sources[i]->buffer_pos;
-			if (audio_sources[i]->num_channels == 1) {
-				buffer_pos *= 2;
-			}
-			if (buffer_pos < min_buffer_pos) {
-				min_buffer_pos = buffer_pos;
-			}
+		float *row = rs->coefficients + phase * taps;
+		double sum = 0.0;
+		for (uint32_t i = 0; i < taps; i++)
+		{
+			//distance in input samples between this tap and the output position
+			double x = center + (double)phase / RESAMPLE_PHASES - (taps - 1 - i);
+			double arg = 2.0 * M_PI * cutoff * x;
+			double value = fabs(arg) < 1e-9 ? 1.0 : sin(arg) / arg;
+			double w = 2.0 * M_PI * x / taps;
+			//Blackman window
+			value *= 0.42 + 0.5 * cos(w) + 0.08 * cos(2.0 * w);
+			row[i] = value;
+			sum += value;
+		}
+		for (uint32_t i = 0; i < taps; i++)
+		{
+			row[i] /= sum;
 		}
 	}
-	uint8_t do_signal = 0;
-	for (uint8_t i = 0; i < num_audio_sources; i++)
+	rs->table_inc = src->buffer_inc;
+}
+
+static void resampler_free(audio_source *src)
+{
+	polyphase_resampler *rs = src->resampler;
+	if (!rs) {
+		return;
+	}
+	free(rs->coefficients);
+	free(rs->history[0]);
+	free(rs->history[1]);
+	free(rs);
+	src->resampler = NULL;
+}
+
+static void resampler_init(audio_source *src)
+{
+	polyphase_resampler *rs = src->resampler = calloc(1, sizeof(polyphase_resampler));
+	for (int i = 0; i < 2; i++)
+	{
+		rs->history[i] = calloc(RESAMPLE_MAX_TAPS - 1 + RESAMPLE_BLOCK, sizeof(float));
+	}
+	resampler_build(src);
+}
+
+//Filters one output frame. Coefficients are linearly interpolated between the two nearest
+//phases and shared between both channels so each tap is only loaded once
+static void fir_filter(float *row, float weight, float *left, float *right, uint32_t taps, float *out)
+{
+	float *next = row + taps;
+#ifdef __SSE2__
+	__m128 w = _mm_set1_ps(weight);
+	__m128 sum_left = _mm_setzero_ps(), sum_right = _mm_setzero_ps();
+	for (uint32_t i = 0; i < taps; i += 4)
 	{
-		if (!audio_sources[i]->front_populated) {
-			audio_sources[i]->front_populated = 1;
-			int16_t *tmp = audio_sources[i]->front;
-			audio_sources[i]->front = audio_sources[i]->back;
-			audio_sources[i]->back = tmp;
-			if (audio_sources[i]->num_channels == 2) {
-				audio_sources[i]->buffer_pos = min_buffer_pos;
-			} else {
-				audio_sources[i]->buffer_pos = min_buffer_pos / 2;
+		__m128 cur = _mm_loadu_ps(row + i);
+		__m128 coef = _mm_add_ps(cur, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(next + i), cur), w));
+		sum_left = _mm_add_ps(sum_left, _mm_mul_ps(coef, _mm_loadu_ps(left + i)));
+		if (right) {
+			sum_right = _mm_add_ps(sum_right, _mm_mul_ps(coef, _mm_loadu_ps(right + i)));
+		}
+	}
+	//horizontal add of both accumulators at once
+	__m128 lo = _mm_unpacklo_ps(sum_left, sum_right);
+	__m128 hi = _mm_unpackhi_ps(sum_left, sum_right);
+	lo = _mm_add_ps(lo, hi);
+	lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+	_mm_storel_pi((__m64 *)out, lo);
+#elif defined(__ARM_NEON)
+	float32x4_t w = vdupq_n_f32(weight);
+	float32x4_t sum_left = vdupq_n_f32(0.0f), sum_right = vdupq_n_f32(0.0f);
+	for (uint32_t i = 0; i < taps; i += 4)
+	{
+		float32x4_t cur = vld1q_f32(row + i);
+		float32x4_t coef = vmlaq_f32(cur, vsubq_f32(vld1q_f32(next + i), cur), w);
+		sum_left = vmlaq_f32(sum_left, coef, vld1q_f32(left + i));
+		if (right) {
+			sum_right = vmlaq_f32(sum_right, coef, vld1q_f32(right + i));
+		}
+	}
+	float32x2_t sums = vpadd_f32(
+		vadd_f32(vget_low_f32(sum_left), vget_high_f32(sum_left)),
+		vadd_f32(vget_low_f32(sum_right), vget_high_f32(sum_right))
+	);
+	vst1_f32(out, sums);
+#else
+	float sum_left = 0.0f, sum_right = 0.0f;
+	for (uint32_t i = 0; i < taps; i++)
+	{
+		float coef = row[i] + (next[i] - row[i]) * weight;
+		sum_left += coef * left[i];
+		if (right) {
+			sum_right += coef * right[i];
+		}
+	}
+	out[0] = sum_left;
+	out[1] = sum_right;
+#endif
+}
+
+static INSTANCE_LOCAL uint32_t sync_samples;
+static void resample_block(audio_source *src)
+{
+	polyphase_resampler *rs = src->resampler;
+	uint32_t taps = rs->taps;
+	uint32_t base = render_is_audio_sync() ? 0 : src->read_end;
+	uint32_t sync_threshold = sync_samples * src->num_channels;
+	float phase_scale = (float)RESAMPLE_PHASES / (float)(int64_t)src->buffer_inc;
+	//every filter is centered on the same point in the history so the delay doesn't jump when the tap count changes
+	uint32_t first = (RESAMPLE_MAX_TAPS - taps) / 2;
+	for (uint32_t frame = 0; frame < rs->frames; frame++)
+	{
+		src->buffer_fraction += src->buffer_inc;
+		while (src->buffer_fraction > BUFFER_INC_RES)
+		{
+			src->buffer_fraction -= BUFFER_INC_RES;
+			//output lies this many phases before the current input frame
+			float position = (float)(int64_t)src->buffer_fraction * phase_scale;
+			uint32_t phase = position;
+			if (phase >= RESAMPLE_PHASES) {
+				phase = RESAMPLE_PHASES - 1;
+			}
+			float samples[2];
+			fir_filter(
+				rs->coefficients + phase * taps, position - phase, rs->history[0] + first + frame,
+				src->num_channels > 1 ? rs->history[1] + first + frame : NULL, taps, samples
+			);
+			for (uint8_t channel = 0; channel < src->num_channels; channel++)
+			{
+				float sample = samples[channel];
+				if (sample > 0x7FFF) {
+					sample = 0x7FFF;
+				} else if (sample < -0x8000) {
+					sample = -0x8000;
+				}
+				src->back[src->buffer_pos++] = sample;
 			}
-			do_signal = 1;
+			if (((src->buffer_pos - base) & src->mask) >= sync_threshold) {
+				render_do_audio_ready(src);
+			}
+			src->buffer_pos &= src->mask;
 		}
 	}
-	return do_signal;
+	for (uint8_t channel = 0; channel < src->num_channels; channel++)
+	{
+		memmove(rs->history[channel], rs->history[channel] + rs->frames, (RESAMPLE_MAX_TAPS - 1) * sizeof(float));
+	}
+	rs->frames = 0;
+	//dynamic rate control only nudges the ratio, but it can drift far enough over time
+	//that the filter cutoff should follow
+	uint64_t diff = src->buffer_inc > rs->table_inc ? src->buffer_inc - rs->table_inc : rs->table_inc - src->buffer_inc;
+	if (diff > rs->table_inc / 64) {
+		resampler_build(src);
+	}
 }
 
-#define BUFFER_INC_RES 0x40000000UL
+static void resampler_put(audio_source *src, int16_t left, int16_t right)
+{
+	polyphase_resampler *rs = src->resampler;
+	uint32_t index = RESAMPLE_MAX_TAPS - 1 + rs->frames++;
+	rs->history[0][index] = left;
+	rs->history[1][index] = right;
+	if (rs->frames == RESAMPLE_BLOCK) {
+		resample_block(src);
+	}
+}
 
 void render_audio_adjust_clock(audio_source *src, uint64_t master_clock, uint64_t sample_divider)
 {
 	src->buffer_inc = ((BUFFER_INC_RES * sample_divider * (uint64_t)sample_rate) / master_clock);
+	if (src->resampler) {
+		resampler_build(src);
+	}
 }
 
 void render_audio_adjust_speed(float adjust_ratio)
@@ -261,6 +441,9 @@ audio_source *render_audio_source(const char *name, uint64_t master_clock, uint6
 		ret->read_end = render_is_audio_sync() ? buffer_samples * channels : 0;
 		ret->mask = render_is_audio_sync() ? 0xFFFFFFFF : alloc_size-1;
 		ret->gain_mult = 1.0f;
+		if (use_polyphase) {
+			resampler_init(ret);
+		}
 	}
 	render_audio_created(ret);
 
@@ -331,6 +514,7 @@ void render_free_source(audio_source *src)
 		num_inactive_audio_sources--;
 	}
 
+	resampler_free(src);
 	free(src->front);
 	if (render_is_audio_sync()) {
 		free(src->back);
@@ -353,10 +537,25 @@ static void interp_sample(audio_source *src, int16_t last, int16_t current)
 	src->back[src->buffer_pos++] = tmp >> 16;
 }
 
-static uint32_t sync_samples;
+static INSTANCE_LOCAL uint8_t output_suppressed;
+//drops all samples from sources without disturbing their state, used while emulating
+//frames that will be discarded
+void render_audio_suppress(uint8_t suppress)
+{
+	output_suppressed = suppress;
+}
+
 void render_put_mono_sample(audio_source *src, int16_t value)
 {
+	if (output_suppressed) {
+		return;
+	}
 	value = lowpass_sample(src, src->last_left, value);
+	if (src->resampler) {
+		src->last_left = value;
+		resampler_put(src, value, 0);
+		return;
+	}
 	src->buffer_fraction += src->buffer_inc;
 	uint32_t base = render_is_audio_sync() ? 0 : src->read_end;
 	while (src->buffer_fraction > BUFFER_INC_RES)
@@ -374,8 +573,17 @@ void render_put_mono_sample(audio_source *src, int16_t value)
 
 void render_put_stereo_sample(audio_source *src, int16_t left, int16_t right)
 {
+	if (output_suppressed) {
+		return;
+	}
 	left = lowpass_sample(src, src->last_left, left);
 	right = lowpass_sample(src, src->last_right, right);
+	if (src->resampler) {
+		src->last_left = left;
+		src->last_right = right;
+		resampler_put(src, left, right);
+		return;
+	}
 	src->buffer_fraction += src->buffer_inc;
 	uint32_t base = render_is_audio_sync() ? 0 : src->read_end;
 	while (src->buffer_fraction > BUFFER_INC_RES)
@@ -413,9 +621,14 @@ static void update_source(audio_source *src, double rc, uint8_t sync_changed)
 		src->read_end = render_is_audio_sync() ? buffer_samples * src->num_channels : 0;
 		src->buffer_pos = 0;
 	}
+	if (use_polyphase && !src->resampler) {
+		resampler_init(src);
+	} else if (!use_polyphase && src->resampler) {
+		resampler_free(src);
+	}
 }
 
-uint8_t old_audio_sync;
+INSTANCE_LOCAL uint8_t old_audio_sync;
 void render_audio_initialized(render_audio_format format, uint32_t rate, uint8_t channels, uint32_t buffer_size, int sample_size_in)
 {
 	sample_rate = rate;
@@ -448,6 +661,8 @@ void render_audio_initialized(render_audio_format format, uint32_t rate, uint8_t
 	}
 	char * gain_str = tern_find_path(config, "audio\0gain\0", TVAL_PTR).ptrval;
 	overall_gain_mult = db_to_mult(gain_str ? atof(gain_str) : 0.0f);
+	char *resampler = tern_find_path_default(config, "audio\0resampler\0", (tern_val){.ptrval = "linear"}, TVAL_PTR).ptrval;
+	use_polyphase = !strcmp(resampler, "sinc");
 	uint8_t sync_changed = old_audio_sync != render_is_audio_sync();
 	old_audio_sync = render_is_audio_sync();
 	double lowpass_cutoff = get_lowpass_cutoff(config);
@@ -8,9 +8,12 @@ typedef enum {
 	RENDER_AUDIO_UNKNOWN
 } render_audio_format;
 
+typedef struct polyphase_resampler polyphase_resampler;
+
 typedef struct {
 	const char *name;
 	void     *opaque;
+	polyphase_resampler *resampler;
 	int16_t  *front;
 	int16_t  *back;
 	double   dt;
@@ -37,6 +40,7 @@ void render_put_stereo_sample(audio_source *src, int16_t left, int16_t right);
 void render_pause_source(audio_source *src);
 void render_resume_source(audio_source *src);
 void render_free_source(audio_source *src);
+void render_audio_suppress(uint8_t suppress);
 void render_end_audio(void);
 void render_save_audio(char *path);
 //interface for render backends
@@ -16,6 +16,7 @@
 #include "paths.h"
 #include "ppm.h"
 #include "png.h"
+#include "capture.h"
 #include "config.h"
 #include "controller_info.h"
 
@@ -46,8 +47,10 @@ static uint8_t scanlines, is_fullscreen, force_cursor;
 
 static uint32_t last_frame = 0;
 
-static SDL_mutex *audio_mutex, *frame_mutex, *free_buffer_mutex;
-static SDL_cond *audio_ready, *frame_ready;
+static SDL_mutex *frame_mutex, *free_buffer_mutex;
+static SDL_cond *frame_ready;
+//posted by the audio callback each time it consumes samples so a throttled emulation thread can wake up
+static SDL_sem *audio_consumed;
 static uint8_t quitting = 0;
 
 enum {
@@ -69,11 +72,19 @@ uint32_t render_min_buffered(void)
 	return min_buffered;
 }
 
-uint8_t render_is_audio_sync(void)
+//whether emulation speed is driven by the audio device rather than video
+static uint8_t audio_drives_timing(void)
 {
 	return sync_src < SYNC_VIDEO;
 }
 
+uint8_t render_is_audio_sync(void)
+{
+	//Only the audio thread mode hands whole buffers back and forth. Sync to audio uses the same
+	//lock-free ring as the other modes and throttles the emulation thread when the ring fills up
+	return sync_src == SYNC_AUDIO_THREAD;
+}
+
 uint8_t render_should_release_on_exit(void)
 {
 	return sync_src != SYNC_AUDIO_THREAD;
@@ -81,23 +92,13 @@ uint8_t render_should_release_on_exit(void)
 
 void render_buffer_consumed(audio_source *src)
 {
-	SDL_CondSignal(src->opaque);
 }
 
 static void audio_callback(void * userdata, uint8_t *byte_stream, int len)
 {
-	SDL_LockMutex(audio_mutex);
-		uint8_t all_ready;
-		do {
-			all_ready = all_sources_ready();
-			if (!quitting && !all_ready) {
-				SDL_CondWait(audio_ready, audio_mutex);
-			}
-		} while(!quitting && !all_ready);
-		if (!quitting) {
-			mix_and_convert(byte_stream, len, NULL);
-		}
-	SDL_UnlockMutex(audio_mutex);
+	//never waits on the emulation thread, if it has fallen behind the missing samples are silent
+	mix_and_convert(byte_stream, len, NULL);
+	SDL_SemPost(audio_consumed);
 }
 
 #define NO_LAST_BUFFERED -2000000000
@@ -127,28 +128,18 @@ static void audio_callback_run_on_audio(void *user_data, uint8_t *byte_stream, i
 
 void render_lock_audio()
 {
-	if (sync_src == SYNC_AUDIO) {
-		SDL_LockMutex(audio_mutex);
-	} else {
-		SDL_LockAudio();
-	}
+	SDL_LockAudio();
 }
 
 void render_unlock_audio()
 {
-	if (sync_src == SYNC_AUDIO) {
-		SDL_UnlockMutex(audio_mutex);
-	} else {
-		SDL_UnlockAudio();
-	}
+	SDL_UnlockAudio();
 }
 
 static void render_close_audio()
 {
-	SDL_LockMutex(audio_mutex);
-		quitting = 1;
-		SDL_CondSignal(audio_ready);
-	SDL_UnlockMutex(audio_mutex);
+	quitting = 1;
+	SDL_SemPost(audio_consumed);
 	SDL_CloseAudio();
 	/*
 	FIXME: move this to render_audio.c
@@ -162,26 +153,16 @@ static void render_close_audio()
 static uint8_t audio_active;
 void *render_new_audio_opaque(void)
 {
-	return SDL_CreateCond();
+	return NULL;
 }
 
 void render_free_audio_opaque(void *opaque)
 {
-	SDL_DestroyCond(opaque);
 }
 
 void render_audio_created(audio_source *source)
 {
 	audio_active = 1;
-	if (sync_src == SYNC_AUDIO) {
-		//SDL_PauseAudio acquires the audio device lock, which is held while the callback runs
-		//since our callback can itself be stuck waiting on the audio_ready condition variable
-		//calling SDL_PauseAudio(0) again for audio sources after the first can deadlock
-		//fortunately SDL_GetAudioStatus does not acquire the lock so is safe to call here
-		if (SDL_GetAudioStatus() == SDL_AUDIO_PAUSED) {
-			SDL_PauseAudio(0);
-		}
-	}
 	if (current_system && sync_src == SYNC_AUDIO_THREAD) {
 		system_request_exit(current_system, 0);
 	}
@@ -189,10 +170,7 @@ void render_audio_created(audio_source *source)
 
 void render_source_paused(audio_source *src, uint8_t remaining_sources)
 {
-	if (sync_src == SYNC_AUDIO) {
-		SDL_CondSignal(audio_ready);
-	}
-	if (!remaining_sources && render_is_audio_sync()) {
+	if (!remaining_sources && audio_drives_timing()) {
 		SDL_PauseAudio(1);
 		audio_active = 0;
 		if (sync_src == SYNC_AUDIO_THREAD) {
@@ -204,21 +182,17 @@ void render_source_paused(audio_source *src, uint8_t remaining_sources)
 void render_source_resumed(audio_source *src)
 {
 	audio_active = 1;
-	if (sync_src == SYNC_AUDIO) {
-		//SDL_PauseAudio acquires the audio device lock, which is held while the callback runs
-		//since our callback can itself be stuck waiting on the audio_ready condition variable
-		//calling SDL_PauseAudio(0) again for audio sources after the first can deadlock
-		//fortunately SDL_GetAudioStatus does not acquire the lock so is safe to call here
-		if (SDL_GetAudioStatus() == SDL_AUDIO_PAUSED) {
-			SDL_PauseAudio(0);
-		}
-	}
 	if (current_system && sync_src == SYNC_AUDIO_THREAD) {
 		system_request_exit(current_system, 0);
 	}
 }
 
-uint8_t audio_deadlock_hack(void);
+//number of frames the callback has yet to consume from a source's ring
+static uint32_t ring_buffered(audio_source *src)
+{
+	uint32_t read_start = __atomic_load_n(&src->read_start, __ATOMIC_ACQUIRE);
+	return ((src->read_end - read_start) & src->mask) / src->num_channels;
+}
 
 void render_do_audio_ready(audio_source *src)
 {
@@ -232,32 +206,25 @@ void render_do_audio_ready(audio_source *src)
 			//we've emulated far enough to fill the current buffer
 			system_request_exit(current_system, 0);
 		}
-	} else if (sync_src == SYNC_AUDIO) {
-		SDL_LockMutex(audio_mutex);
-			if (src->front_populated) {
-				if (audio_deadlock_hack()) {
-					SDL_CondSignal(audio_ready);
-				}
-			}
-			while (src->front_populated) {
-				SDL_CondWait(src->opaque, audio_mutex);
-			}
-			int16_t *tmp = src->front;
-			src->front = src->back;
-			src->back = tmp;
-			src->front_populated = 1;
-			src->buffer_pos = 0;
-			SDL_CondSignal(audio_ready);
-		SDL_UnlockMutex(audio_mutex);
 	} else {
-		uint32_t num_buffered;
-		SDL_LockAudio();
-			src->read_end = src->buffer_pos;
-			num_buffered = ((src->read_end - src->read_start) & src->mask) / src->num_channels;
-		SDL_UnlockAudio();
+		//samples up to buffer_pos are fully written before the callback is allowed to see them
+		__atomic_store_n(&src->read_end, src->buffer_pos & src->mask, __ATOMIC_RELEASE);
+		uint32_t num_buffered = ring_buffered(src);
 		if (num_buffered >= min_buffered && SDL_GetAudioStatus() == SDL_AUDIO_PAUSED) {
 			SDL_PauseAudio(0);
 		}
+		if (sync_src == SYNC_AUDIO) {
+			//the callback posts whether or not anyone is waiting, throw away the stale posts so the
+			//wait below blocks until a buffer is consumed after the check instead of returning right away
+			while (!SDL_SemTryWait(audio_consumed))
+			{
+			}
+			//keep roughly two device buffers queued, the same latency as the old double buffering
+			while (!quitting && ring_buffered(src) >= 2 * min_buffered && SDL_GetAudioStatus() == SDL_AUDIO_PLAYING)
+			{
+				SDL_SemWaitTimeout(audio_consumed, 10);
+			}
+		}
 	}
 }
 
@@ -1022,6 +989,10 @@ static void init_audio()
 		fatal_error("Unable to open SDL audio: %s\n", SDL_GetError());
 	}
 	sample_rate = actual.freq;
+	if (sync_src == SYNC_AUDIO) {
+		//start playback once a full device buffer is queued, video sync calculates this from the frame rate instead
+		min_buffered = actual.samples;
+	}
 	debug_message("Initialized audio at frequency %d with a %d sample buffer, ", actual.freq, actual.samples);
 	render_audio_format format = RENDER_AUDIO_UNKNOWN;
 	if (actual.format == AUDIO_S16SYS) {
@@ -1255,8 +1226,7 @@ void render_init(int width, int height, char * title, uint8_t fullscreen)
 
 	window_setup();
 
-	audio_mutex = SDL_CreateMutex();
-	audio_ready = SDL_CreateCond();
+	audio_consumed = SDL_CreateSemaphore(0);
 
 	init_audio();
 
@@ -1383,10 +1353,10 @@ uint32_t render_audio_syncs_per_sec(void)
 void render_set_video_standard(vid_std std)
 {
 	video_standard = std;
-	if (render_is_audio_sync()) {
+	source_hz = std == VID_PAL ? 50 : 60;
+	if (audio_drives_timing()) {
 		return;
 	}
-	source_hz = std == VID_PAL ? 50 : 60;
 	uint32_t max_repeat = 0;
 	if (abs(source_hz - display_hz) < 2) {
 		memset(frame_repeat, 0, sizeof(int)*display_hz);
@@ -1435,41 +1405,19 @@ void render_save_screenshot(char *path)
 	screenshot_path = path;
 }
 
-#ifndef DISABLE_ZLIB
-static apng_state *apng;
-static FILE *apng_file;
-#endif
 uint8_t render_saving_video(void)
 {
-#ifdef DISABLE_ZLIB
-	return apng_file != NULL;
-#else
-	return 0;
-#endif
+	return capture_video_active();
 }
 
 void render_end_video(void)
 {
-#ifndef DISABLE_ZLIB
-	if (apng) {
-		puts("Ending recording");
-		end_apng(apng_file, apng);
-		apng = NULL;
-		apng_file = NULL;
-	}
-#endif
+	capture_end_video();
 }
+
 void render_save_video(char *path)
 {
-	render_end_video();
-#ifndef DISABLE_ZLIB
-	apng_file = fopen(path, "wb");
-	if (apng_file) {
-		printf("Saving video to %s\n", path);
-	} else {
-		warning("Failed to open %s for writing\n", path);
-	}
-#endif
+	capture_start_video(path);
 	free(path);
 }
 
@@ -1625,6 +1573,8 @@ static void process_framebuffer(uint32_t *buffer, uint8_t which, int width)
 		if (screenshot_file) {
 #ifndef DISABLE_ZLIB
 			ext = path_extension(screenshot_path);
+			char *threads = tern_find_path_default(config, "ui\0png_threads\0", (tern_val){.ptrval = "1"}, TVAL_PTR).ptrval;
+			png_set_threads(atoi(threads));
 #endif
 			debug_message("Saving screenshot to %s\n", screenshot_path);
 		} else {
@@ -1655,15 +1605,8 @@ static void process_framebuffer(uint32_t *buffer, uint8_t which, int width)
 			}
 #endif
 		}
-#ifndef DISABLE_ZLIB
-		if (apng_file) {
-			if (!apng) {
-				//TODO: more precise frame rate
-				apng = start_apng(apng_file, width, height, video_standard == VID_PAL ? 50.0 : 60.0);
-			}
-			save_png24_frame(apng_file, buffer, apng, width, height, LINEBUF_SIZE*sizeof(uint32_t));
-		}
-#endif
+		//TODO: more precise frame rate
+		capture_video_frame(buffer, width, height, LINEBUF_SIZE*sizeof(uint32_t), video_standard == VID_PAL ? 50.0 : 60.0);
 	} else {
 #endif
 		uint32_t shot_height = height;
@@ -1748,7 +1691,7 @@ static void process_framebuffer(uint32_t *buffer, uint8_t which, int width)
 			frame_counter = 0;
 		}
 	}
-	if (!render_is_audio_sync()) {
+	if (!audio_drives_timing()) {
 		int32_t local_cur_min, local_min_remaining;
 		SDL_LockAudio();
 			if (last_buffered > NO_LAST_BUFFERED) {
@@ -2206,3 +2149,29 @@ uint8_t render_create_thread(render_thread *thread, const char *name, render_thr
 	*thread = SDL_CreateThread(fun, name, data);
 	return *thread != 0;
 }
+
+uint8_t render_create_semaphore(render_semaphore *sem)
+{
+	*sem = SDL_CreateSemaphore(0);
+	return *sem != NULL;
+}
+
+void render_semaphore_wait(render_semaphore sem)
+{
+	SDL_SemWait(sem);
+}
+
+uint8_t render_semaphore_wait_timeout(render_semaphore sem, uint32_t timeout_ms)
+{
+	return SDL_SemWaitTimeout(sem, timeout_ms) == 0;
+}
+
+void render_semaphore_post(render_semaphore sem)
+{
+	SDL_SemPost(sem);
+}
+
+void render_destroy_semaphore(render_semaphore sem)
+{
+	SDL_DestroySemaphore(sem);
+}
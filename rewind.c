@@ -0,0 +1,301 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rewind.h"
+#include "util.h"
+
+//Snapshots are stored as an XOR against the most recent keyframe with unchanged bytes
+//run-length encoded. Keyframes use the same encoding against an all zero reference.
+//Each token starts with a 16-bit big endian header. If the high bit is set, it is
+//followed by (header & 0x7FFF) + 1 literal bytes, otherwise it represents header + 1
+//bytes that are unchanged from the reference
+#define TOKEN_LITERAL 0x8000
+#define MAX_RUN 0x8000
+//don't end a literal run for a match shorter than this as a new token costs 2 bytes
+#define MIN_MATCH 4
+
+rewind_buffer *rewind_alloc(size_t memory_budget, uint32_t frame_interval, uint32_t keyframe_interval)
+{
+	rewind_buffer *rw = calloc(1, sizeof(rewind_buffer));
+	rw->ring_size = memory_budget;
+	rw->ring = malloc(memory_budget);
+	rw->max_entries = 256;
+	rw->entries = calloc(rw->max_entries, sizeof(rewind_entry));
+	rw->frame_interval = frame_interval ? frame_interval : 1;
+	rw->keyframe_interval = keyframe_interval ? keyframe_interval : 1;
+	init_serialize(&rw->state);
+	return rw;
+}
+
+void rewind_free(rewind_buffer *rw)
+{
+	if (!rw) {
+		return;
+	}
+	free(rw->state.data);
+	free(rw->entries);
+	free(rw->ring);
+	free(rw->keyframe);
+	free(rw->decoded);
+	free(rw->scratch);
+	free(rw);
+}
+
+uint8_t rewind_frame_done(rewind_buffer *rw)
+{
+	if (++rw->frame_counter < rw->frame_interval) {
+		return 0;
+	}
+	rw->frame_counter = 0;
+	return 1;
+}
+
+serialize_buffer *rewind_begin_snapshot(rewind_buffer *rw)
+{
+	rw->state.size = 0;
+	rw->state.current_section_start = 0;
+	return &rw->state;
+}
+
+static uint8_t ref_byte(uint8_t *ref, size_t ref_size, size_t pos)
+{
+	return pos < ref_size ? ref[pos] : 0;
+}
+
+static size_t match_len(uint8_t *src, uint8_t *ref, size_t ref_size, size_t pos, size_t max)
+{
+	size_t len = 0;
+	while (len + sizeof(uint64_t) <= max && pos + len + sizeof(uint64_t) <= ref_size)
+	{
+		uint64_t a, b;
+		memcpy(&a, src + pos + len, sizeof(a));
+		memcpy(&b, ref + pos + len, sizeof(b));
+		if (a != b) {
+			break;
+		}
+		len += sizeof(uint64_t);
+	}
+	while (len < max && src[pos + len] == ref_byte(ref, ref_size, pos + len))
+	{
+		len++;
+	}
+	return len;
+}
+
+static size_t encode_delta(uint8_t *dst, uint8_t *src, size_t size, uint8_t *ref, size_t ref_size)
+{
+	size_t out = 0, pos = 0;
+	while (pos < size)
+	{
+		size_t limit = size - pos;
+		if (limit > MAX_RUN) {
+			limit = MAX_RUN;
+		}
+		size_t run = match_len(src, ref, ref_size, pos, limit);
+		if (run) {
+			dst[out++] = (run - 1) >> 8;
+			dst[out++] = run - 1;
+			pos += run;
+			continue;
+		}
+		size_t literal = 1;
+		while (literal < limit)
+		{
+			size_t remaining = limit - literal;
+			if (match_len(src, ref, ref_size, pos + literal, remaining < MIN_MATCH ? remaining : MIN_MATCH) >= MIN_MATCH) {
+				break;
+			}
+			literal++;
+		}
+		dst[out++] = (TOKEN_LITERAL | (literal - 1)) >> 8;
+		dst[out++] = literal - 1;
+		for (size_t i = 0; i < literal; i++, pos++)
+		{
+			dst[out++] = src[pos] ^ ref_byte(ref, ref_size, pos);
+		}
+	}
+	return out;
+}
+
+static void decode_delta(uint8_t *dst, size_t size, uint8_t *src, size_t src_size, uint8_t *ref, size_t ref_size)
+{
+	size_t in = 0, pos = 0;
+	while (in + 2 <= src_size && pos < size)
+	{
+		uint16_t header = src[in] << 8 | src[in + 1];
+		in += 2;
+		size_t len = (header & ~TOKEN_LITERAL) + 1;
+		if (len > size - pos) {
+			fatal_error("Corrupt rewind snapshot\n");
+		}
+		if (header & TOKEN_LITERAL) {
+			for (size_t i = 0; i < len; i++, pos++)
+			{
+				dst[pos] = src[in++] ^ ref_byte(ref, ref_size, pos);
+			}
+		} else {
+			size_t common = pos < ref_size ? ref_size - pos : 0;
+			if (common > len) {
+				common = len;
+			}
+			if (common) {
+				memcpy(dst + pos, ref + pos, common);
+			}
+			memset(dst + pos + common, 0, len - common);
+			pos += len;
+		}
+	}
+}
+
+static void reserve_buffers(rewind_buffer *rw, size_t size)
+{
+	if (size <= rw->buffer_size) {
+		return;
+	}
+	rw->buffer_size = size;
+	rw->keyframe = realloc(rw->keyframe, size);
+	rw->decoded = realloc(rw->decoded, size);
+	//worst case encoding is a little under twice the size of the input
+	rw->scratch = realloc(rw->scratch, size * 2 + 64);
+}
+
+static rewind_entry *entry_at(rewind_buffer *rw, uint32_t index)
+{
+	return rw->entries + ((rw->first_entry + index) % rw->max_entries);
+}
+
+static void ring_write(rewind_buffer *rw, uint8_t *src, size_t size)
+{
+	size_t first = rw->ring_size - rw->write_pos;
+	if (first > size) {
+		first = size;
+	}
+	memcpy(rw->ring + rw->write_pos, src, first);
+	memcpy(rw->ring, src + first, size - first);
+	rw->write_pos = (rw->write_pos + size) % rw->ring_size;
+	rw->ring_used += size;
+}
+
+static void ring_read(rewind_buffer *rw, rewind_entry *entry, uint8_t *dst)
+{
+	size_t first = rw->ring_size - entry->offset;
+	if (first > entry->size) {
+		first = entry->size;
+	}
+	memcpy(dst, rw->ring + entry->offset, first);
+	memcpy(dst + first, rw->ring, entry->size - first);
+}
+
+//drops the oldest keyframe along with all the deltas that depend on it
+static void drop_oldest_group(rewind_buffer *rw)
+{
+	do {
+		rw->ring_used -= entry_at(rw, 0)->size;
+		rw->first_entry = (rw->first_entry + 1) % rw->max_entries;
+		rw->num_entries--;
+	} while (rw->num_entries && !entry_at(rw, 0)->keyframe);
+	if (!rw->num_entries) {
+		rw->ring_used = 0;
+		rw->write_pos = 0;
+		rw->since_keyframe = 0;
+	}
+}
+
+static void add_entry(rewind_buffer *rw, rewind_entry *entry)
+{
+	if (rw->num_entries == rw->max_entries) {
+		uint32_t old_max = rw->max_entries;
+		rw->max_entries *= 2;
+		rw->entries = realloc(rw->entries, rw->max_entries * sizeof(rewind_entry));
+		//move the wrapped portion so that the entries are contiguous again
+		memcpy(rw->entries + old_max, rw->entries, rw->first_entry * sizeof(rewind_entry));
+		memmove(rw->entries, rw->entries + rw->first_entry, old_max * sizeof(rewind_entry));
+		rw->first_entry = 0;
+	}
+	*entry_at(rw, rw->num_entries++) = *entry;
+}
+
+void rewind_end_snapshot(rewind_buffer *rw)
+{
+	size_t raw_size = rw->state.size;
+	reserve_buffers(rw, raw_size);
+	uint8_t keyframe = !rw->num_entries || rw->since_keyframe >= rw->keyframe_interval;
+	size_t size;
+	if (keyframe) {
+		size = encode_delta(rw->scratch, rw->state.data, raw_size, NULL, 0);
+	} else {
+		size = encode_delta(rw->scratch, rw->state.data, raw_size, rw->keyframe, rw->keyframe_size);
+	}
+	while (rw->num_entries && rw->ring_size - rw->ring_used < size)
+	{
+		if (!keyframe && rw->num_entries == rw->since_keyframe + 1) {
+			//making room would require dropping the keyframe this delta depends on
+			keyframe = 1;
+			size = encode_delta(rw->scratch, rw->state.data, raw_size, NULL, 0);
+		}
+		drop_oldest_group(rw);
+	}
+	if (size > rw->ring_size) {
+		warning("Rewind snapshot of %d bytes does not fit in rewind buffer of %d bytes\n", (int)size, (int)rw->ring_size);
+		return;
+	}
+	rewind_entry entry = {
+		.offset = rw->write_pos,
+		.size = size,
+		.raw_size = raw_size,
+		.keyframe = keyframe
+	};
+	ring_write(rw, rw->scratch, size);
+	add_entry(rw, &entry);
+	if (keyframe) {
+		memcpy(rw->keyframe, rw->state.data, raw_size);
+		rw->keyframe_size = raw_size;
+		rw->since_keyframe = 0;
+	} else {
+		rw->since_keyframe++;
+	}
+}
+
+uint8_t rewind_available(rewind_buffer *rw)
+{
+	return rw && rw->num_entries;
+}
+
+//returns the most recent snapshot and removes it from the history
+//the oldest snapshot is left in place so that holding rewind stops there
+uint8_t *rewind_pop(rewind_buffer *rw, size_t *size_out)
+{
+	if (!rewind_available(rw)) {
+		return NULL;
+	}
+	rewind_entry *entry = entry_at(rw, rw->num_entries - 1);
+	if (entry->keyframe) {
+		memcpy(rw->decoded, rw->keyframe, entry->raw_size);
+	} else {
+		ring_read(rw, entry, rw->scratch);
+		decode_delta(rw->decoded, entry->raw_size, rw->scratch, entry->size, rw->keyframe, rw->keyframe_size);
+	}
+	*size_out = entry->raw_size;
+	if (rw->num_entries == 1) {
+		return rw->decoded;
+	}
+	rw->num_entries--;
+	rw->ring_used -= entry->size;
+	rw->write_pos = entry->offset;
+	rw->frame_counter = 0;
+	if (entry->keyframe) {
+		//restore the keyframe that the remaining deltas depend on
+		uint32_t index = rw->num_entries - 1;
+		while (!entry_at(rw, index)->keyframe)
+		{
+			index--;
+		}
+		rewind_entry *key = entry_at(rw, index);
+		ring_read(rw, key, rw->scratch);
+		decode_delta(rw->keyframe, key->raw_size, rw->scratch, key->size, NULL, 0);
+		rw->keyframe_size = key->raw_size;
+		rw->since_keyframe = rw->num_entries - 1 - index;
+	} else {
+		rw->since_keyframe--;
+	}
+	return rw->decoded;
+}
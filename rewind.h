@@ -0,0 +1,45 @@
+#ifndef REWIND_H_
+#define REWIND_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "serialize.h"
+
+typedef struct {
+	size_t   offset;   //position of the encoded snapshot in the ring
+	uint32_t size;     //size of the encoded snapshot
+	uint32_t raw_size; //size of the snapshot once decoded
+	uint8_t  keyframe;
+} rewind_entry;
+
+typedef struct rewind_buffer rewind_buffer;
+struct rewind_buffer {
+	serialize_buffer state;      //reused for capturing each snapshot
+	rewind_entry     *entries;
+	uint8_t          *ring;
+	uint8_t          *keyframe;  //decoded copy of the most recent keyframe
+	uint8_t          *decoded;
+	uint8_t          *scratch;
+	size_t           ring_size;
+	size_t           ring_used;
+	size_t           write_pos;
+	size_t           keyframe_size;
+	size_t           buffer_size; //capacity of keyframe and decoded, scratch is twice as large
+	uint32_t         num_entries;
+	uint32_t         max_entries;
+	uint32_t         first_entry;
+	uint32_t         frame_interval;
+	uint32_t         keyframe_interval;
+	uint32_t         frame_counter;
+	uint32_t         since_keyframe;
+};
+
+rewind_buffer *rewind_alloc(size_t memory_budget, uint32_t frame_interval, uint32_t keyframe_interval);
+void rewind_free(rewind_buffer *rw);
+uint8_t rewind_frame_done(rewind_buffer *rw);
+serialize_buffer *rewind_begin_snapshot(rewind_buffer *rw);
+void rewind_end_snapshot(rewind_buffer *rw);
+uint8_t *rewind_pop(rewind_buffer *rw, size_t *size_out);
+uint8_t rewind_available(rewind_buffer *rw);
+
+#endif //REWIND_H_
@@ -41,7 +41,7 @@ char const *save_type_name(uint8_t save_type)
 
 tern_node *get_rom_db()
 {
-	static tern_node *db;
+	static INSTANCE_LOCAL tern_node *db;
 	if (!db) {
 		db = parse_bundled_config("rom.db");
 		if (!db) {
@@ -264,7 +264,7 @@ void add_memmap_header(rom_info *info, uint8_t *rom, uint32_t size, memmap_chunk
 	uint8_t is_med_ssf = size >= 0x108 && !memcmp("SEGA SSF", rom + 0x100, 8);
 	if (is_med_ssf || (size > 0x400000 && rom_end_raw <= 0x400000)) {
 		if (is_med_ssf && rom_end < 16*1024*1024) {
-			info->rom = rom = realloc(rom, 16*1024*1024);
+			info->rom = rom = realloc_rom_buffer(rom, rom_end, 16*1024*1024);
 		}
 		info->mapper_start_index = 0;
 		info->mapper_type = is_med_ssf ? MAPPER_SEGA_MED_V2 : MAPPER_SEGA;
@@ -977,7 +977,7 @@ void map_iter_fun(char *key, tern_val val, uint8_t valtype, void *data)
 		state->info->mapper_type = MAPPER_MULTI_GAME;
 		state->info->mapper_start_index = state->ptr_index++;
 		//make a mirror copy of the ROM so we can efficiently support arbitrary start offsets
-		state->rom = realloc(state->rom, state->rom_size * 2);
+		state->rom = realloc_rom_buffer(state->rom, state->rom_size, state->rom_size * 2);
 		memcpy(state->rom + state->rom_size, state->rom, state->rom_size);
 		state->rom_size *= 2;
 		//make room for an extra map entry
@@ -0,0 +1,64 @@
+#include <stdlib.h>
+#include "runahead.h"
+
+//Each host frame consists of one real frame followed by a snapshot and some number of
+//speculative frames. The speculative frames run with audio muted and only the last one
+//is presented. The snapshot is then restored and the next real frame is emulated with
+//audio, but without video since its result was already shown a frame early
+
+runahead_buffer *runahead_alloc(uint32_t frames)
+{
+	runahead_buffer *ra = calloc(1, sizeof(runahead_buffer));
+	ra->frames = frames ? frames : 1;
+	init_serialize(&ra->state);
+	return ra;
+}
+
+void runahead_free(runahead_buffer *ra)
+{
+	if (!ra) {
+		return;
+	}
+	free(ra->state.data);
+	free(ra);
+}
+
+uint8_t runahead_frame_done(runahead_buffer *ra)
+{
+	if (!ra->speculating) {
+		return RUNAHEAD_SAVE;
+	}
+	if (--ra->remaining) {
+		return RUNAHEAD_NONE;
+	}
+	return RUNAHEAD_RESTORE;
+}
+
+serialize_buffer *runahead_begin_save(runahead_buffer *ra)
+{
+	ra->state.size = 0;
+	ra->state.current_section_start = 0;
+	return &ra->state;
+}
+
+void runahead_end_save(runahead_buffer *ra)
+{
+	ra->speculating = 1;
+	ra->remaining = ra->frames;
+}
+
+//returns the snapshot taken at the end of the last real frame, speculation stops
+//regardless of whether the caller restores it
+uint8_t *runahead_restore(runahead_buffer *ra, size_t *size_out)
+{
+	ra->speculating = 0;
+	ra->remaining = 0;
+	*size_out = ra->state.size;
+	return ra->state.size ? ra->state.data : NULL;
+}
+
+//whether the frame currently being emulated should be presented
+uint8_t runahead_show_frame(runahead_buffer *ra)
+{
+	return ra->speculating && ra->remaining == 1;
+}
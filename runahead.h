@@ -0,0 +1,30 @@
+#ifndef RUNAHEAD_H_
+#define RUNAHEAD_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "serialize.h"
+
+enum {
+	RUNAHEAD_NONE,
+	RUNAHEAD_SAVE,
+	RUNAHEAD_RESTORE
+};
+
+typedef struct runahead_buffer runahead_buffer;
+struct runahead_buffer {
+	serialize_buffer state;       //snapshot of the last real frame, storage is reused every frame
+	uint32_t         frames;      //number of frames to emulate ahead of the real frame
+	uint32_t         remaining;   //speculative frames left before the snapshot is restored
+	uint8_t          speculating;
+};
+
+runahead_buffer *runahead_alloc(uint32_t frames);
+void runahead_free(runahead_buffer *ra);
+uint8_t runahead_frame_done(runahead_buffer *ra);
+serialize_buffer *runahead_begin_save(runahead_buffer *ra);
+void runahead_end_save(runahead_buffer *ra);
+uint8_t *runahead_restore(runahead_buffer *ra, size_t *size_out);
+uint8_t runahead_show_frame(runahead_buffer *ra);
+
+#endif //RUNAHEAD_H_
@@ -1,7 +1,14 @@
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include "saves.h"
 #include "util.h"
+#ifndef IS_LIB
+#include "render.h"
+#endif
+#ifndef DISABLE_ZLIB
+#include "zlib/zlib.h"
+#endif
 
 #ifdef _WIN32
 #define localtime_r(a,b) localtime(a)
@@ -34,6 +41,8 @@ char *get_slot_name(system_header *system, uint32_t slot_index, char *ext)
 
 save_slot_info *get_slot_info(system_header *system, uint32_t *num_out)
 {
+	//make sure modification times reflect any save that is still being written
+	wait_state_saves();
 	save_slot_info *dst = calloc(11, sizeof(save_slot_info));
 	time_t modtime;
 	struct tm ltime;
@@ -75,3 +84,232 @@ void free_slot_info(save_slot_info *slots)
 	}
 	free(slots);
 }
+
+//compressed states are the usual BLSTSZ payload deflated with zlib and prefixed with its uncompressed size
+static const char compressed_ident[] = "BLSTSC\x01\x07";
+static const char legacy_ident[] = "BLSTSZ\x01\x07";
+#define STATE_IDENT_SIZE (sizeof(legacy_ident)-1)
+
+//a job with no path is a flush marker that wait_state_saves uses to find out when earlier jobs are done
+typedef struct {
+	uint8_t *data;
+	size_t  size;
+	char    *path;
+} state_save_job;
+
+#define STATE_SAVE_QUEUE_SIZE 8
+
+//write is only modified while holding queue_lock, read only by the writer thread
+static state_save_job save_queue[STATE_SAVE_QUEUE_SIZE];
+static uint32_t save_write;
+static uint32_t save_read;
+#ifndef IS_LIB
+static render_thread writer_thread;
+//posted once for each queued job
+static render_semaphore writer_wake;
+//posted once for each free entry in save_queue
+static render_semaphore queue_free;
+//posted when the writer reaches a flush marker
+static render_semaphore flush_done;
+//used as a mutex, available when its count is 1
+static render_semaphore queue_lock;
+static uint8_t writer_started, writer_failed;
+#endif
+
+static uint8_t replace_file(char *tmp_path, char *path)
+{
+#ifdef _WIN32
+	return MoveFileExA(tmp_path, path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(tmp_path, path) == 0;
+#endif
+}
+
+static void write_state_job(state_save_job *job)
+{
+	uint8_t *out = job->data;
+	size_t out_size = job->size;
+	const char *ident = legacy_ident;
+#ifndef DISABLE_ZLIB
+	uLongf compressed_size = compressBound(job->size);
+	uint8_t *compressed = malloc(compressed_size + 4);
+	if (Z_OK == compress2(compressed + 4, &compressed_size, job->data, job->size, Z_BEST_SPEED)) {
+		compressed[0] = job->size;
+		compressed[1] = job->size >> 8;
+		compressed[2] = job->size >> 16;
+		compressed[3] = job->size >> 24;
+		out = compressed;
+		out_size = compressed_size + 4;
+		ident = compressed_ident;
+	}
+#endif
+	//write to a temporary file first so a crash or full disk never clobbers the previous state
+	char const *parts[] = {job->path, ".tmp"};
+	char *tmp_path = alloc_concat_m(2, parts);
+	FILE *f = fopen(tmp_path, "wb");
+	uint8_t success = 0;
+	if (f) {
+		success = fwrite(ident, 1, STATE_IDENT_SIZE, f) == STATE_IDENT_SIZE
+			&& fwrite(out, 1, out_size, f) == out_size;
+		success = !fclose(f) && success;
+		if (success) {
+			success = replace_file(tmp_path, job->path);
+		} else {
+			remove(tmp_path);
+		}
+	}
+	if (success) {
+		debug_message("Saved state to %s\n", job->path);
+	} else {
+		warning("Failed to write save state to %s\n", job->path);
+	}
+	free(tmp_path);
+#ifndef DISABLE_ZLIB
+	free(compressed);
+#endif
+	free(job->data);
+	free(job->path);
+}
+
+#ifndef IS_LIB
+static int state_writer_main(void *unused)
+{
+	for (;;)
+	{
+		render_semaphore_wait(writer_wake);
+		while (__atomic_load_n(&save_write, __ATOMIC_ACQUIRE) != save_read)
+		{
+			state_save_job *job = save_queue + (save_read % STATE_SAVE_QUEUE_SIZE);
+			if (job->path) {
+				write_state_job(job);
+			} else {
+				render_semaphore_post(flush_done);
+			}
+			__atomic_store_n(&save_read, save_read + 1, __ATOMIC_RELEASE);
+			render_semaphore_post(queue_free);
+		}
+	}
+	return 0;
+}
+
+static void wait_state_saves_atexit(void)
+{
+	wait_state_saves();
+}
+
+static void start_state_writer(void)
+{
+	//the writer thread lives for the rest of the process and sleeps on the semaphore when idle
+	if (render_create_semaphore(&queue_lock) && render_create_semaphore(&writer_wake)
+		&& render_create_semaphore(&queue_free) && render_create_semaphore(&flush_done)
+		&& render_create_thread(&writer_thread, "State writer", state_writer_main, NULL)
+	) {
+		for (int i = 0; i < STATE_SAVE_QUEUE_SIZE; i++)
+		{
+			render_semaphore_post(queue_free);
+		}
+		render_semaphore_post(queue_lock);
+		atexit(wait_state_saves_atexit);
+	} else {
+		warning("Failed to create save state writer thread, writing synchronously\n");
+		writer_failed = 1;
+	}
+}
+
+//must be called with queue_lock held
+static void queue_state_job(state_save_job *job)
+{
+	render_semaphore_wait(queue_free);
+	save_queue[save_write % STATE_SAVE_QUEUE_SIZE] = *job;
+	__atomic_store_n(&save_write, save_write + 1, __ATOMIC_RELEASE);
+	render_semaphore_post(writer_wake);
+}
+#endif
+
+void save_state_async(serialize_buffer *buf, char *path)
+{
+	state_save_job job = {
+		.data = buf->data,
+		.size = buf->size,
+		.path = strdup(path)
+	};
+	buf->data = NULL;
+	buf->size = buf->storage = 0;
+#ifdef IS_LIB
+	write_state_job(&job);
+#else
+	run_once(&writer_started, start_state_writer);
+	if (writer_failed) {
+		write_state_job(&job);
+		return;
+	}
+	render_semaphore_wait(queue_lock);
+	queue_state_job(&job);
+	render_semaphore_post(queue_lock);
+#endif
+}
+
+void wait_state_saves(void)
+{
+#ifndef IS_LIB
+	if (!writer_started || writer_failed) {
+		return;
+	}
+	render_semaphore_wait(queue_lock);
+	if (save_write != __atomic_load_n(&save_read, __ATOMIC_ACQUIRE)) {
+		//queue_lock stays held until the marker is reached so another waiter can't take this flush_done post
+		state_save_job marker = {0};
+		queue_state_job(&marker);
+		render_semaphore_wait(flush_done);
+	}
+	render_semaphore_post(queue_lock);
+#endif
+}
+
+uint8_t load_state_file(deserialize_buffer *buf, char *path)
+{
+	wait_state_saves();
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		return 0;
+	}
+	long file_size_bytes = file_size(f);
+	char ident[STATE_IDENT_SIZE];
+	if (fread(ident, 1, sizeof(ident), f) != sizeof(ident) || memcmp(ident, compressed_ident, sizeof(ident))) {
+		//uncompressed states from older versions or built without zlib
+		fclose(f);
+		return load_from_file(buf, path);
+	}
+#ifdef DISABLE_ZLIB
+	fclose(f);
+	warning("%s is a compressed save state, but this build does not support compression\n", path);
+	return 0;
+#else
+	uint8_t *compressed = NULL;
+	uint8_t *data = NULL;
+	if (file_size_bytes < STATE_IDENT_SIZE + 4) {
+		goto fail;
+	}
+	size_t compressed_size = file_size_bytes - STATE_IDENT_SIZE;
+	compressed = malloc(compressed_size);
+	if (fread(compressed, 1, compressed_size, f) != compressed_size) {
+		goto fail;
+	}
+	uLongf size = compressed[0] | compressed[1] << 8 | compressed[2] << 16 | (uint32_t)compressed[3] << 24;
+	data = malloc(size);
+	uLongf out_size = size;
+	if (Z_OK != uncompress(data, &out_size, compressed + 4, compressed_size - 4) || out_size != size) {
+		warning("Save state %s is corrupt\n", path);
+		goto fail;
+	}
+	fclose(f);
+	free(compressed);
+	init_deserialize(buf, data, size);
+	return 1;
+fail:
+	fclose(f);
+	free(compressed);
+	free(data);
+	return 0;
+#endif
+}
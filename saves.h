@@ -4,10 +4,14 @@
 #include <time.h>
 #include <stdint.h>
 #include "system.h"
+#include "serialize.h"
 
 #define QUICK_SAVE_SLOT 10
 #define SERIALIZE_SLOT 11
 #define EVENTLOG_SLOT 12
+#define REWIND_SLOT 13
+#define RUNAHEAD_SLOT 14
+#define NETPLAY_SLOT 15
 
 typedef struct {
 	char   *desc;
@@ -17,5 +21,10 @@ typedef struct {
 char *get_slot_name(system_header *system, uint32_t slot_index, char *ext);
 save_slot_info *get_slot_info(system_header *system, uint32_t *num_out);
 void free_slot_info(save_slot_info *slots);
+//takes ownership of buf->data and writes it out compressed on a background thread
+void save_state_async(serialize_buffer *buf, char *path);
+void wait_state_saves(void);
+//accepts both compressed and legacy uncompressed native states
+uint8_t load_state_file(deserialize_buffer *buf, char *path);
 
 #endif //SAVES_H_
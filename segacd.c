@@ -8,6 +8,7 @@
 #include "gdb_remote.h"
 #include "blastem.h"
 #include "cdimage.h"
+#include "benchmark.h"
 
 #define SCD_MCLKS 50000000
 #define SCD_PERIPH_RESET_CLKS (SCD_MCLKS / 10)
@@ -1205,6 +1206,7 @@ static m68k_context *int_ack(m68k_context *context)
 
 void scd_run(segacd_context *cd, uint32_t cycle)
 {
+	BENCH_ENTER(BENCH_SCD);
 	uint8_t m68k_run = !can_main_access_prog(cd);
 	while (cycle > cd->m68k->current_cycle) {
 		if (m68k_run && !cd->sub_paused_wordram) {
@@ -1227,7 +1229,7 @@ void scd_run(segacd_context *cd, uint32_t cycle)
 		}
 		scd_peripherals_run(cd, cd->m68k->current_cycle);
 	}
-
+	BENCH_EXIT();
 }
 
 uint32_t gen_cycle_to_scd(uint32_t cycle, genesis_context *gen)
@@ -1552,7 +1554,7 @@ static void *laseractive_write8(uint32_t address, void *vcontext, uint8_t value)
 
 segacd_context *alloc_configure_segacd(system_media *media, uint32_t opts, uint8_t force_region, rom_info *info)
 {
-	static memmap_chunk sub_cpu_map[] = {
+	static const memmap_chunk base_sub_cpu_map[] = {
 		{0x000000, 0x01FF00, 0xFFFFFF, .flags=MMAP_READ | MMAP_CODE, .write_16 = prog_ram_wp_write16, .write_8 = prog_ram_wp_write8},
 		{0x01FF00, 0x080000, 0xFFFFFF, .flags=MMAP_READ | MMAP_WRITE | MMAP_CODE},
 		{0x080000, 0x0C0000, 0x03FFFF, .flags=MMAP_READ | MMAP_WRITE | MMAP_CODE | MMAP_PTR_IDX | MMAP_FUNC_NULL, .ptr_index = 0,
@@ -1628,10 +1630,13 @@ segacd_context *alloc_configure_segacd(system_media *media, uint32_t opts, uint8
 		}
 	}
 
+	//each instance needs its own copy of the map since the buffers differ
+	memmap_chunk *sub_cpu_map = malloc(sizeof(base_sub_cpu_map));
+	memcpy(sub_cpu_map, base_sub_cpu_map, sizeof(base_sub_cpu_map));
 	sub_cpu_map[0].buffer = sub_cpu_map[1].buffer = cd->prog_ram;
 	sub_cpu_map[4].buffer = cd->bram;
 	m68k_options *mopts = malloc(sizeof(m68k_options));
-	init_m68k_opts(mopts, sub_cpu_map, sizeof(sub_cpu_map) / sizeof(*sub_cpu_map), 4, sync_components, int_ack);
+	init_m68k_opts(mopts, sub_cpu_map, sizeof(base_sub_cpu_map) / sizeof(*base_sub_cpu_map), 4, sync_components, int_ack);
 	cd->m68k = init_68k_context(mopts, NULL);
 	cd->m68k->system = cd;
 	cd->int2_cycle = CYCLE_NEVER;
@@ -1658,12 +1663,16 @@ void free_segacd(segacd_context *cd)
 {
 	cdd_fader_deinit(&cd->fader);
 	rf5c164_deinit(&cd->pcm);
+	memmap_chunk *sub_cpu_map = (memmap_chunk *)cd->m68k->options->gen.memmap;
 	m68k_options_free(cd->m68k->options);
+	free(sub_cpu_map);
 	free(cd->m68k);
 	free(cd->bram);
 	free(cd->word_ram);
 	free(cd->prog_ram);
 	free(cd->rom_mut);
+	//the cached sectors belong to this disc, a later load into the same media must not see them
+	cdimage_free_sectors(cd->cdd.media);
 }
 
 void segacd_serialize(segacd_context *cd, serialize_buffer *buf, uint8_t all)
@@ -1803,7 +1812,7 @@ void segacd_register_section_handlers(segacd_context *cd, deserialize_buffer *bu
 
 memmap_chunk *segacd_main_cpu_map(segacd_context *cd, uint8_t cart_boot, uint32_t *num_chunks)
 {
-	static memmap_chunk main_cpu_map[] = {
+	static const memmap_chunk base_main_cpu_map[] = {
 		{0x000000, 0x020000, 0x01FFFF, .flags=MMAP_READ},
 		{0x020000, 0x040000, 0x01FFFF, .flags=MMAP_READ|MMAP_WRITE|MMAP_PTR_IDX|MMAP_FUNC_NULL|MMAP_CODE, .ptr_index = 0,
 			.read_16 = unmapped_prog_read16, .write_16 = unmapped_prog_write16, .read_8 = unmapped_prog_read8, .write_8 = unmapped_prog_write8},
@@ -1816,7 +1825,9 @@ memmap_chunk *segacd_main_cpu_map(segacd_context *cd, uint8_t cart_boot, uint32_
 		{0xA12000, 0xA13000, 0xFFFFFF, .read_16 = main_gate_read16, .write_16 = main_gate_write16, .read_8 = main_gate_read8, .write_8 = main_gate_write8},
 		{0x400000, 0x800000, 0xFFFFFF, .read_16 = cart_area_read16, .write_16 = cart_area_write16, .read_8 = cart_area_read8, .write_8 = cart_area_write8}
 	};
-	*num_chunks = sizeof(main_cpu_map) / sizeof(*main_cpu_map);
+	memmap_chunk *main_cpu_map = malloc(sizeof(base_main_cpu_map));
+	memcpy(main_cpu_map, base_main_cpu_map, sizeof(base_main_cpu_map));
+	*num_chunks = sizeof(base_main_cpu_map) / sizeof(*base_main_cpu_map);
 	if (cart_boot) {
 		(*num_chunks)--;
 	}
@@ -9,6 +9,10 @@
 #include "debug.h"
 #include "saves.h"
 #include "bindings.h"
+#include "rewind.h"
+#include "runahead.h"
+#include "hash.h"
+#include "paths.h"
 
 #ifdef NEW_CORE
 #define Z80_CYCLE cycles
@@ -391,23 +395,45 @@ static void deserialize(system_header *sys, uint8_t *data, size_t size)
 	sms_deserialize(&buffer, sms);
 }
 
+static void save_runahead_state(sms_context *sms)
+{
+	serialize_buffer *state = runahead_begin_save(sms->header.runahead);
+	sms_serialize(sms, state);
+	runahead_end_save(sms->header.runahead);
+	if (sms->header.rewind && rewind_frame_done(sms->header.rewind)) {
+		//rewind snapshots are taken on the same frame boundary so just reuse this one
+		save_buffer8(rewind_begin_snapshot(sms->header.rewind), state->data, state->size);
+		rewind_end_snapshot(sms->header.rewind);
+	}
+	render_audio_suppress(1);
+	sms->vdp->suppress_output = !runahead_show_frame(sms->header.runahead);
+}
+
 static void save_state(sms_context *sms, uint8_t slot)
 {
+	if (slot == REWIND_SLOT) {
+		sms_serialize(sms, rewind_begin_snapshot(sms->header.rewind));
+		rewind_end_snapshot(sms->header.rewind);
+		return;
+	}
+	if (slot == RUNAHEAD_SLOT) {
+		save_runahead_state(sms);
+		return;
+	}
 	char *save_path = get_slot_name(&sms->header, slot, "state");
 	serialize_buffer state;
 	init_serialize(&state);
 	sms_serialize(sms, &state);
-	save_to_file(&state, save_path);
-	printf("Saved state to %s\n", save_path);
+	//the writer reports success or failure once the file is actually written
+	save_state_async(&state, save_path);
 	free(save_path);
-	free(state.data);
 }
 
 static uint8_t load_state_path(sms_context *sms, char *path)
 {
 	deserialize_buffer state;
 	uint8_t ret;
-	if ((ret = load_from_file(&state, path))) {
+	if ((ret = load_state_file(&state, path))) {
 		sms_deserialize(&state, sms);
 		free(state.data);
 		printf("Loaded %s\n", path);
@@ -415,9 +441,61 @@ static uint8_t load_state_path(sms_context *sms, char *path)
 	return ret;
 }
 
+//abandons speculative execution without restoring the snapshot and re-enables output
+static void stop_runahead(sms_context *sms)
+{
+	size_t size;
+	runahead_restore(sms->header.runahead, &size);
+	render_audio_suppress(0);
+	sms->vdp->suppress_output = 0;
+}
+
+static uint8_t load_rewind_state(sms_context *sms)
+{
+	size_t size;
+	uint8_t *data = rewind_pop(sms->header.rewind, &size);
+	if (!data) {
+		return 0;
+	}
+	deserialize_buffer state;
+	init_deserialize(&state, data, size);
+	sms_deserialize(&state, sms);
+	//keep the restored frame counter from looking like a frame boundary
+	sms->last_frame = sms->vdp->frame;
+	if (sms->header.runahead) {
+		//any snapshot taken for run-ahead predates the rewound state
+		stop_runahead(sms);
+	}
+	return 1;
+}
+
+static uint8_t load_runahead_state(sms_context *sms)
+{
+	size_t size;
+	uint8_t *data = runahead_restore(sms->header.runahead, &size);
+	render_audio_suppress(0);
+	if (!data) {
+		sms->vdp->suppress_output = 0;
+		return 0;
+	}
+	deserialize_buffer state;
+	init_deserialize(&state, data, size);
+	sms_deserialize(&state, sms);
+	sms->last_frame = sms->vdp->frame;
+	//this frame was already presented while running ahead
+	sms->vdp->suppress_output = 1;
+	return 1;
+}
+
 static uint8_t load_state(system_header *system, uint8_t slot)
 {
 	sms_context *sms = (sms_context *)system;
+	if (slot == REWIND_SLOT) {
+		return load_rewind_state(sms);
+	}
+	if (slot == RUNAHEAD_SLOT) {
+		return load_runahead_state(sms);
+	}
 	char *statepath = get_slot_name(system, slot, "state");
 	uint8_t ret;
 #ifndef NEW_CORE
@@ -469,6 +547,25 @@ static void run_sms(system_header *system)
 					system->enter_debugger_frames -= elapsed;
 				}
 			}
+			if (!system->save_state && !system->delayed_load_slot) {
+				if (system->rewind && system->rewinding) {
+					load_rewind_state(sms);
+				} else if (system->runahead) {
+					switch (runahead_frame_done(system->runahead))
+					{
+					case RUNAHEAD_SAVE:
+						system->save_state = RUNAHEAD_SLOT + 1;
+						break;
+					case RUNAHEAD_RESTORE:
+						load_runahead_state(sms);
+						break;
+					default:
+						sms->vdp->suppress_output = !runahead_show_frame(system->runahead);
+					}
+				} else if (system->rewind && rewind_frame_done(system->rewind)) {
+					system->save_state = REWIND_SLOT + 1;
+				}
+			}
 
 			if(exit_after){
 				if (elapsed >= exit_after) {
@@ -526,6 +623,11 @@ static void run_sms(system_header *system)
 			target_cycle -= adjust;
 		}
 	}
+	if (system->runahead && system->runahead->speculating) {
+		//don't leave the machine in a speculative state with output suppressed while we're not running
+		load_runahead_state(sms);
+		stop_runahead(sms);
+	}
 	if (sms->header.force_release || render_should_release_on_exit()) {
 		bindings_release_capture();
 		vdp_release_framebuffer(sms->vdp);
@@ -556,6 +658,16 @@ static void start_sms(system_header *system, char *statefile)
 	if (statefile) {
 		load_state_path(sms, statefile);
 	}
+#ifndef NEW_CORE
+	if (sms->translation_cache && system->save_dir) {
+		char *path = path_append(system->save_dir, "z80.jitcache");
+		z80_load_translation_cache(sms->z80, path, sms->rom_hash);
+		free(path);
+		if (!statefile) {
+			z80_warm_translation_cache(sms->z80);
+		}
+	}
+#endif
 
 	if (system->enter_debugger) {
 		system->enter_debugger = 0;
@@ -583,6 +695,8 @@ static void free_sms(system_header *system)
 	z80_options_free(sms->z80->Z80_OPTS);
 	free(sms->z80);
 	psg_free(sms->psg);
+	rewind_free(sms->header.rewind);
+	runahead_free(sms->header.runahead);
 	free(sms);
 }
 
@@ -613,7 +727,15 @@ static void load_save(system_header *system)
 
 static void persist_save(system_header *system)
 {
-	//TODO: Implement me
+#ifndef NEW_CORE
+	sms_context *sms = (sms_context *)system;
+	if (sms->translation_cache && system->save_dir) {
+		char *path = path_append(system->save_dir, "z80.jitcache");
+		z80_save_translation_cache(sms->z80, path, sms->rom_hash);
+		free(path);
+	}
+#endif
+	//TODO: Implement cartridge RAM saving
 }
 
 static void gamepad_down(system_header *system, uint8_t gamepad_num, uint8_t button)
@@ -765,6 +887,12 @@ sms_context *alloc_configure_sms(system_media *media, uint32_t opts, uint8_t for
 
 	sms->rom = media->buffer;
 	sms->rom_size = rom_size;
+#ifndef NEW_CORE
+	if (!strcmp(tern_find_path_default(config, "system\0jit_cache\0", (tern_val){.ptrval = "off"}, TVAL_PTR).ptrval, "on")) {
+		sms->translation_cache = 1;
+		sha1(sms->rom, rom_size, sms->rom_hash);
+	}
+#endif
 	if (sms->header.info.map_chunks > 2) {
 		sms->z80->mem_pointers[0] = sms->rom;
 		sms->z80->mem_pointers[1] = sms->rom + 0x4000;
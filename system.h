@@ -7,6 +7,7 @@
 
 typedef struct system_header system_header;
 typedef struct system_media system_media;
+typedef struct sector_cache sector_cache;
 
 typedef enum {
 	SYSTEM_UNKNOWN,
@@ -51,6 +52,9 @@ typedef void (*system_ptr8_sizet_fun)(system_header *, uint8_t *, size_t);
 #include "arena.h"
 #include "romdb.h"
 typedef struct event_reader event_reader;
+typedef struct rewind_buffer rewind_buffer;
+typedef struct runahead_buffer runahead_buffer;
+typedef struct netplay_session netplay_session;
 
 struct system_header {
 	system_header     *next_context;
@@ -83,6 +87,9 @@ struct system_header {
 	arena             *arena;
 	char              *next_rom;
 	char              *save_dir;
+	rewind_buffer     *rewind;
+	runahead_buffer   *runahead;
+	netplay_session   *netplay;
 	int               enter_debugger_frames;
 	uint8_t           enter_debugger;
 	uint8_t           should_exit;
@@ -91,6 +98,7 @@ struct system_header {
 	uint8_t           has_keyboard;
 	uint8_t                 vgm_logging;
 	uint8_t                 force_release;
+	uint8_t                 rewinding;
 	debugger_type     debugger_type;
 	system_type       type;
 };
@@ -137,6 +145,7 @@ struct system_media {
 	system_media *chain;
 	track_info   *tracks;
 	uint8_t      *tmp_buffer;
+	sector_cache *sectors;
 	seek_fun     seek;
 	read_fun     read;
 	read_fun     read_subcodes;
@@ -144,7 +153,6 @@ struct system_media {
 	uint32_t     cur_track;
 	uint32_t     size;
 	uint32_t     cur_sector;
-	uint16_t     cdrom_scramble_lsfr;
 	media_type   type;
 	uint8_t      in_fake_pregap;
 	uint8_t      byte_storage[3];
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "vdp_composite.h"
+
+#define TIMING_COLUMNS (320/16 * 224)
+#define TIMING_PASSES 200
+
+static uint8_t bg_colors[] = {0x00, 0x15, 0x2E, 0x3F, 0x7E, 0xC1};
+
+//mirrors the scalar loop in render_normal
+static void scalar_normal(uint8_t *dst, uint8_t *debug_dst, uint8_t *sprite, uint8_t *plane_a, uint8_t *plane_b, uint8_t bg_index)
+{
+	for (int i = 0; i < 16; i++)
+	{
+		dst[i] = composite_normal(NULL, debug_dst + i, sprite[i], plane_a[i], plane_b[i], bg_index) & 0x3F;
+	}
+}
+
+//mirrors the scalar loop in render_highlight
+static void scalar_highlight(uint8_t *dst, uint8_t *debug_dst, uint8_t *sprite, uint8_t *plane_a, uint8_t *plane_b, uint8_t bg_index)
+{
+	for (int i = 0; i < 16; i++)
+	{
+		sh_pixel pixel = composite_highlight(NULL, debug_dst + i, sprite[i], plane_a[i], plane_b[i], bg_index);
+		if (pixel.intensity == BUF_BIT_PRIORITY << 1) {
+			dst[i] = (pixel.index & 0x3F) + HIGHLIGHT_OFFSET;
+		} else if (pixel.intensity) {
+			dst[i] = pixel.index & 0x3F;
+		} else {
+			dst[i] = (pixel.index & 0x3F) + SHADOW_OFFSET;
+		}
+	}
+}
+
+typedef void (*composite_fun)(uint8_t *dst, uint8_t *debug_dst, uint8_t *sprite, uint8_t *plane_a, uint8_t *plane_b, uint8_t bg_index);
+
+#ifdef SIMD_COMPOSITE
+//runs every combination of sprite, plane A and plane B pixel through both versions
+static int compare(const char *name, composite_fun scalar, composite_fun simd)
+{
+	uint8_t sprite[16], plane_a[16], plane_b[16];
+	uint8_t expected[16], expected_debug[16], actual[16], actual_debug[16];
+	int mismatches = 0;
+	for (int bg = 0; bg < sizeof(bg_colors); bg++)
+	{
+		for (int s = 0; s < 256; s++)
+		{
+			for (int a = 0; a < 256; a++)
+			{
+				for (int b = 0; b < 256; b += 16)
+				{
+					for (int i = 0; i < 16; i++)
+					{
+						sprite[i] = s;
+						plane_a[i] = a;
+						plane_b[i] = b + i;
+					}
+					scalar(expected, expected_debug, sprite, plane_a, plane_b, bg_colors[bg]);
+					simd(actual, actual_debug, sprite, plane_a, plane_b, bg_colors[bg]);
+					for (int i = 0; i < 16; i++)
+					{
+						if (expected[i] != actual[i] || expected_debug[i] != actual_debug[i]) {
+							if (mismatches < 10) {
+								printf("%s mismatch for sprite %02X, A %02X, B %02X, BG %02X: expected %02X/%X, got %02X/%X\n",
+									name, s, a, b + i, bg_colors[bg], expected[i], expected_debug[i], actual[i], actual_debug[i]
+								);
+							}
+							mismatches++;
+						}
+					}
+				}
+			}
+		}
+	}
+	printf("%s: %d mismatches\n", name, mismatches);
+	return mismatches;
+}
+#endif
+
+static double time_composite(composite_fun fun, uint8_t *sprite, uint8_t *plane_a, uint8_t *plane_b, uint8_t *dst, uint8_t *debug_dst)
+{
+	clock_t start = clock();
+	for (int pass = 0; pass < TIMING_PASSES; pass++)
+	{
+		for (int col = 0; col < TIMING_COLUMNS; col++)
+		{
+			fun(dst + col * 16, debug_dst + col * 16, sprite + col * 16, plane_a + col * 16, plane_b + col * 16, 0x15);
+		}
+	}
+	double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+	return elapsed * 1000000000.0 / ((double)TIMING_PASSES * TIMING_COLUMNS * 16);
+}
+
+static void benchmark(const char *name, composite_fun scalar, composite_fun simd)
+{
+	uint32_t size = TIMING_COLUMNS * 16;
+	uint8_t *sprite = malloc(size), *plane_a = malloc(size), *plane_b = malloc(size);
+	uint8_t *dst = malloc(size), *debug_dst = malloc(size);
+	srand(1);
+	for (uint32_t i = 0; i < size; i++)
+	{
+		//roughly half of each layer transparent like a typical scene
+		sprite[i] = (rand() & 1) ? rand() & 0xFF : 0;
+		plane_a[i] = (rand() & 1) ? rand() & 0xFF : 0;
+		plane_b[i] = (rand() & 1) ? rand() & 0xFF : 0;
+	}
+	double scalar_ns = time_composite(scalar, sprite, plane_a, plane_b, dst, debug_dst);
+	printf("%s scalar: %.3f ns/pixel\n", name, scalar_ns);
+	if (simd) {
+		double simd_ns = time_composite(simd, sprite, plane_a, plane_b, dst, debug_dst);
+		printf("%s SIMD: %.3f ns/pixel (%.2fx)\n", name, simd_ns, simd_ns > 0 ? scalar_ns / simd_ns : 0);
+	}
+	free(sprite);
+	free(plane_a);
+	free(plane_b);
+	free(dst);
+	free(debug_dst);
+}
+
+int main(int argc, char **argv)
+{
+	int ret = 0;
+#ifdef SIMD_COMPOSITE
+	ret |= compare("Normal", scalar_normal, composite_normal_simd) != 0;
+	ret |= compare("Highlight", scalar_highlight, composite_highlight_simd) != 0;
+	benchmark("Normal", scalar_normal, composite_normal_simd);
+	benchmark("Highlight", scalar_highlight, composite_highlight_simd);
+#else
+	puts("SIMD compositing is not enabled for this target, only timing the scalar versions");
+	benchmark("Normal", scalar_normal, NULL);
+	benchmark("Highlight", scalar_highlight, NULL);
+#endif
+	printf("Result: %s\n", ret ? "failure" : "success");
+	return ret;
+}
@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "libretro.h"
+#include "system.h"
+#include "blastem.h"
+#include "util.h"
+
+//Runs a small Genesis program and a small SMS program on four library instances at once, two of each,
+//and checks that every frame and every block of audio matches what each program produces when run alone.
+//The concurrent pass goes first so the shared lookup tables are also built with all threads racing
+
+#define DEFAULT_FRAMES 120
+#define MAX_FRAMES 10000
+#define NUM_THREADS 4
+
+#define FNV_OFFSET 0xCBF29CE484222325ULL
+#define FNV_PRIME  0x100000001B3ULL
+
+#define GENESIS_ROM_SIZE 0x1000
+#define SMS_ROM_SIZE 0x8000
+
+//sets up the VDP, then endlessly writes a counter to CRAM entry 0 (the backdrop) and the PSG tone 0 period
+static const uint16_t genesis_code[] = {
+	0x46FC, 0x2700,                 //move #$2700, sr
+	0x41F9, 0x00C0, 0x0004,         //lea $C00004, a0
+	0x43F9, 0x00C0, 0x0000,         //lea $C00000, a1
+	0x45F9, 0x00C0, 0x0011,         //lea $C00011, a2
+	0x30BC, 0x8004,                 //move.w #$8004, (a0)
+	0x30BC, 0x8144,                 //move.w #$8144, (a0)
+	0x30BC, 0x8700,                 //move.w #$8700, (a0)
+	0x14BC, 0x0090,                 //move.b #$90, (a2)
+	0x7000,                         //moveq #0, d0
+	0x20BC, 0xC000, 0x0000,         //loop: move.l #$C0000000, (a0)
+	0x3280,                         //move.w d0, (a1)
+	0x1200,                         //move.b d0, d1
+	0x0201, 0x000F,                 //andi.b #$F, d1
+	0x0001, 0x0080,                 //ori.b #$80, d1
+	0x1481,                         //move.b d1, (a2)
+	0x1200,                         //move.b d0, d1
+	0xE809,                         //lsr.b #4, d1
+	0x1481,                         //move.b d1, (a2)
+	0x5240,                         //addq.w #1, d0
+	0x60E2                          //bra loop
+};
+#define GENESIS_ENTRY 0x200
+
+//same idea for the SMS VDP and PSG, the color is written twice since the Game Gear VDP latches the first byte
+static const uint8_t sms_code[] = {
+	0xF3,                           //di
+	0x31, 0xF0, 0xDF,               //ld sp, $DFF0
+	0x3E, 0x04, 0xD3, 0xBF,         //ld a, $04 : out ($BF), a
+	0x3E, 0x80, 0xD3, 0xBF,         //ld a, $80 : out ($BF), a
+	0x3E, 0xC0, 0xD3, 0xBF,         //ld a, $C0 : out ($BF), a
+	0x3E, 0x81, 0xD3, 0xBF,         //ld a, $81 : out ($BF), a
+	0x3E, 0x90, 0xD3, 0x7F,         //ld a, $90 : out ($7F), a
+	0x06, 0x00,                     //ld b, 0
+	0xAF,                           //loop: xor a
+	0xD3, 0xBF,                     //out ($BF), a
+	0x3E, 0xC0, 0xD3, 0xBF,         //ld a, $C0 : out ($BF), a
+	0x78,                           //ld a, b
+	0xD3, 0xBE,                     //out ($BE), a
+	0xD3, 0xBE,                     //out ($BE), a
+	0xE6, 0x0F,                     //and $0F
+	0xF6, 0x80,                     //or $80
+	0xD3, 0x7F,                     //out ($7F), a
+	0x78,                           //ld a, b
+	0x0F, 0x0F, 0x0F, 0x0F,         //rrca x4
+	0xE6, 0x0F,                     //and $0F
+	0xD3, 0x7F,                     //out ($7F), a
+	0x04,                           //inc b
+	0x18, 0xE2                      //jr loop
+};
+
+typedef struct {
+	char     *name;
+	char     *path;
+	uint8_t  *rom;
+	uint32_t rom_size;
+} test_program;
+
+typedef struct {
+	test_program *program;
+	uint64_t     *video;
+	uint64_t     *audio;
+	uint32_t     frames_seen;
+} test_run;
+
+static test_program programs[2];
+static uint32_t frames = DEFAULT_FRAMES;
+static pthread_barrier_t start_barrier;
+
+static INSTANCE_LOCAL test_run *current_run;
+static INSTANCE_LOCAL uint32_t current_frame;
+
+static uint64_t fnv1a(uint64_t hash, const uint8_t *data, size_t size)
+{
+	for (const uint8_t *end = data + size; data < end; data++)
+	{
+		hash = (hash ^ *data) * FNV_PRIME;
+	}
+	return hash;
+}
+
+static void build_programs(void)
+{
+	uint8_t *rom = calloc(1, GENESIS_ROM_SIZE);
+	//initial SP and PC, everything else also points at the entry point
+	rom[0] = 0x00; rom[1] = 0xFF; rom[2] = 0xFE; rom[3] = 0x00;
+	for (uint32_t vector = 4; vector < 0x100; vector += 4)
+	{
+		rom[vector + 2] = GENESIS_ENTRY >> 8;
+		rom[vector + 3] = GENESIS_ENTRY & 0xFF;
+	}
+	memcpy(rom + 0x100, "SEGA MEGA DRIVE ", 16);
+	rom[0x1A4] = (GENESIS_ROM_SIZE - 1) >> 24;
+	rom[0x1A5] = (GENESIS_ROM_SIZE - 1) >> 16;
+	rom[0x1A6] = (GENESIS_ROM_SIZE - 1) >> 8;
+	rom[0x1A7] = (GENESIS_ROM_SIZE - 1) & 0xFF;
+	for (uint32_t i = 0; i < sizeof(genesis_code) / sizeof(*genesis_code); i++)
+	{
+		rom[GENESIS_ENTRY + i * 2] = genesis_code[i] >> 8;
+		rom[GENESIS_ENTRY + i * 2 + 1] = genesis_code[i];
+	}
+	programs[0] = (test_program){"Genesis", "instance.md", rom, GENESIS_ROM_SIZE};
+
+	rom = calloc(1, SMS_ROM_SIZE);
+	memcpy(rom, sms_code, sizeof(sms_code));
+	memcpy(rom + 0x7FF0, "TMR SEGA", 8);
+	rom[0x7FFF] = 0x4C;
+	programs[1] = (test_program){"SMS", "instance.sms", rom, SMS_ROM_SIZE};
+}
+
+static bool environment(unsigned cmd, void *data)
+{
+	return false;
+}
+
+static void video_refresh(const void *data, unsigned width, unsigned height, size_t pitch)
+{
+	uint64_t hash = FNV_OFFSET;
+	const uint8_t *line = data;
+	for (unsigned y = 0; y < height; y++, line += pitch)
+	{
+		hash = fnv1a(hash, line, width * sizeof(uint32_t));
+	}
+	current_run->video[current_frame] = hash;
+	current_run->frames_seen++;
+}
+
+static size_t audio_sample_batch(const int16_t *data, size_t num_frames)
+{
+	current_run->audio[current_frame] = fnv1a(current_run->audio[current_frame], (const uint8_t *)data, num_frames * 2 * sizeof(int16_t));
+	return num_frames;
+}
+
+static void input_poll(void)
+{
+}
+
+static int16_t input_state(unsigned port, unsigned device, unsigned index, unsigned id)
+{
+	return 0;
+}
+
+static void init_run(test_run *run, test_program *program)
+{
+	run->program = program;
+	run->video = calloc(frames, sizeof(uint64_t));
+	run->audio = malloc(frames * sizeof(uint64_t));
+	for (uint32_t i = 0; i < frames; i++)
+	{
+		run->audio[i] = FNV_OFFSET;
+	}
+	run->frames_seen = 0;
+}
+
+static void free_run(test_run *run)
+{
+	free(run->video);
+	free(run->audio);
+}
+
+static void *run_instance(void *data)
+{
+	test_run *run = data;
+	current_run = run;
+	retro_set_environment(environment);
+	retro_set_video_refresh(video_refresh);
+	retro_set_audio_sample_batch(audio_sample_batch);
+	retro_set_input_poll(input_poll);
+	retro_set_input_state(input_state);
+	retro_init();
+	//line everyone up so that loading, and the lookup table setup that comes with it, overlaps as much as possible
+	pthread_barrier_wait(&start_barrier);
+	struct retro_game_info info = {
+		.path = run->program->path,
+		.data = run->program->rom,
+		.size = run->program->rom_size
+	};
+	if (retro_load_game(&info)) {
+		//each start/resume runs exactly one frame since the library frontend requests an exit after each one
+		current_frame = 0;
+		current_system->start_context(current_system, NULL);
+		for (current_frame = 1; current_frame < frames; current_frame++)
+		{
+			current_system->resume_context(current_system);
+		}
+		retro_unload_game();
+	}
+	retro_deinit();
+	return NULL;
+}
+
+static uint32_t compare(test_run *expected, test_run *actual, uint32_t instance)
+{
+	uint32_t mismatches = 0;
+	if (expected->frames_seen != actual->frames_seen) {
+		printf("%s instance %u presented %u frames, %u when run alone\n", actual->program->name, instance, actual->frames_seen, expected->frames_seen);
+		mismatches++;
+	}
+	for (uint32_t i = 0; i < frames; i++)
+	{
+		if (expected->video[i] != actual->video[i] || expected->audio[i] != actual->audio[i]) {
+			if (!mismatches) {
+				printf("%s instance %u differs from a lone run at frame %u\n", actual->program->name, instance, i);
+			}
+			mismatches++;
+		}
+	}
+	return mismatches;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1) {
+		frames = atoi(argv[1]);
+	}
+	if (!frames || frames > MAX_FRAMES) {
+		fprintf(stderr, "Frame count must be between 1 and %d\n", MAX_FRAMES);
+		return 1;
+	}
+	disable_stdout_messages();
+	build_programs();
+
+	test_run concurrent[NUM_THREADS];
+	pthread_t threads[NUM_THREADS];
+	pthread_barrier_init(&start_barrier, NULL, NUM_THREADS);
+	for (uint32_t i = 0; i < NUM_THREADS; i++)
+	{
+		init_run(concurrent + i, programs + (i & 1));
+		if (pthread_create(threads + i, NULL, run_instance, concurrent + i)) {
+			fatal_error("Failed to create instance thread\n");
+		}
+	}
+	for (uint32_t i = 0; i < NUM_THREADS; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	pthread_barrier_destroy(&start_barrier);
+
+	int ret = 0;
+	uint32_t mismatches = 0;
+	for (uint32_t p = 0; p < 2; p++)
+	{
+		test_run alone;
+		init_run(&alone, programs + p);
+		pthread_barrier_init(&start_barrier, NULL, 1);
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, run_instance, &alone)) {
+			fatal_error("Failed to create instance thread\n");
+		}
+		pthread_join(thread, NULL);
+		pthread_barrier_destroy(&start_barrier);
+		if (!alone.frames_seen) {
+			printf("%s program failed to load\n", programs[p].name);
+			ret = 1;
+		}
+		uint32_t changed = 0;
+		for (uint32_t i = 1; i < frames; i++)
+		{
+			changed += alone.video[i] != alone.video[i-1];
+		}
+		if (frames > 1 && !changed) {
+			printf("%s output never changed between frames, nothing was checked\n", programs[p].name);
+			ret = 1;
+		}
+		for (uint32_t i = p; i < NUM_THREADS; i += 2)
+		{
+			mismatches += compare(&alone, concurrent + i, i);
+		}
+		free_run(&alone);
+	}
+	for (uint32_t i = 0; i < NUM_THREADS; i++)
+	{
+		free_run(concurrent + i);
+	}
+	printf("%u instances compared over %u frames, %u frames differ\n", NUM_THREADS, frames, mismatches);
+	ret |= mismatches != 0;
+	printf("Result: %s\n", ret ? "failure" : "success");
+	return ret;
+}
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include "netplay.h"
+
+//Drives a netplay session over the loopback transport with a stand-in machine whose state is a hash
+//of every input it has been given. The stand-in follows the same save, rollback and resimulate steps
+//as genesis.c, and the state it ends up in is compared with one built directly from the inputs each
+//frame really had, for every combination of input delay and simulated latency
+
+#define DEFAULT_FRAMES 2000
+//inputs stop changing this long before the end so the last frames have nothing left to correct
+#define SETTLE_FRAMES (NETPLAY_FRAMES * 2)
+
+static uint32_t frames = DEFAULT_FRAMES;
+static int verbose;
+
+void warning(char *format, ...)
+{
+	if (verbose) {
+		va_list args;
+		va_start(args, format);
+		vprintf(format, args);
+		va_end(args);
+	}
+}
+
+void fatal_error(char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	exit(1);
+}
+
+long file_size(FILE *f)
+{
+	return 0;
+}
+
+void socket_init(void)
+{
+}
+
+int socket_blocking(int sock, int should_block)
+{
+	return 0;
+}
+
+void socket_close(int sock)
+{
+}
+
+//live controller state at the end of frame, each player holds a combination for a few frames
+static uint16_t live_buttons(uint32_t frame, uint32_t seed)
+{
+	if (frame + SETTLE_FRAMES >= frames) {
+		return 0;
+	}
+	uint32_t hold = frame / (seed % 5 + 2);
+	uint32_t hash = (hold + seed) * 2654435761U;
+	return hash >> 20 & 0xFFF;
+}
+
+static uint32_t step(uint32_t state, uint16_t local, uint16_t remote)
+{
+	return (state ^ (local | remote << 16)) * 16777619U + 1;
+}
+
+static uint32_t expected_state(uint8_t input_delay)
+{
+	uint32_t state = 0;
+	for (uint32_t frame = 0; frame < frames; frame++)
+	{
+		//input for a frame is sampled at the end of the frame input_delay + 1 frames earlier
+		uint16_t local = 0, remote = 0;
+		if (frame > input_delay) {
+			local = live_buttons(frame - input_delay - 1, 1);
+			remote = live_buttons(frame - input_delay - 1, 2);
+		}
+		state = step(state, local, remote);
+	}
+	return state;
+}
+
+static uint32_t run_session(uint8_t input_delay, uint32_t latency, uint32_t *rollbacks, uint8_t *disconnected)
+{
+	netplay_session *np = netplay_alloc(1, input_delay);
+	np->transport = netplay_loopback(np, latency);
+	uint32_t state = 0;
+	uint32_t last_state = 0;
+	netplay_frame *inputs = netplay_inputs(np);
+	serialize_buffer *buf = netplay_begin_save(np);
+	save_int32(buf, state);
+	*rollbacks = 0;
+	while (np->frame < frames)
+	{
+		state = step(state, inputs->input[NETPLAY_LOCAL], inputs->input[NETPLAY_REMOTE]);
+		if (np->frame == frames - 1) {
+			last_state = state;
+		}
+		np->local_buttons = live_buttons(np->frame, 1);
+		np->peer_buttons = live_buttons(np->frame, 2);
+		if (netplay_frame_done(np) == NETPLAY_ROLLBACK) {
+			size_t size;
+			uint8_t *data = netplay_rollback(np, &size);
+			if (!data) {
+				break;
+			}
+			deserialize_buffer saved;
+			init_deserialize(&saved, data, size);
+			state = load_int32(&saved);
+			(*rollbacks)++;
+		} else {
+			buf = netplay_begin_save(np);
+			save_int32(buf, state);
+		}
+		inputs = netplay_inputs(np);
+	}
+	*disconnected = np->disconnected;
+	netplay_free(np);
+	return last_state;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1) {
+		frames = atoi(argv[1]);
+	}
+	verbose = argc > 2;
+	if (frames <= SETTLE_FRAMES) {
+		fprintf(stderr, "Frame count must be greater than %d\n", SETTLE_FRAMES);
+		return 1;
+	}
+	int ret = 0;
+	uint32_t sessions = 0, total_rollbacks = 0;
+	for (uint8_t input_delay = 0; input_delay <= NETPLAY_MAX_INPUT_DELAY; input_delay++)
+	{
+		uint32_t expected = expected_state(input_delay);
+		for (uint32_t latency = 0; latency <= NETPLAY_MAX_ROLLBACK; latency++)
+		{
+			uint32_t rollbacks;
+			uint8_t disconnected;
+			uint32_t actual = run_session(input_delay, latency, &rollbacks, &disconnected);
+			uint32_t repeat = run_session(input_delay, latency, &rollbacks, &disconnected);
+			sessions++;
+			total_rollbacks += rollbacks;
+			if (disconnected) {
+				printf("Input delay %u, latency %u: loopback peer was considered lost\n", input_delay, latency);
+				ret = 1;
+			}
+			if (actual != expected) {
+				printf("Input delay %u, latency %u: ended in state %08X, expected %08X\n", input_delay, latency, actual, expected);
+				ret = 1;
+			}
+			if (actual != repeat) {
+				printf("Input delay %u, latency %u: ended in state %08X, then %08X when run again\n", input_delay, latency, actual, repeat);
+				ret = 1;
+			}
+			if (latency > input_delay && !rollbacks) {
+				printf("Input delay %u, latency %u: inputs arrived late but nothing was rolled back\n", input_delay, latency);
+				ret = 1;
+			}
+		}
+	}
+	printf("%u sessions of %u frames, %u rollbacks\n", sessions, frames, total_rollbacks);
+	printf("Result: %s\n", ret ? "failure" : "success");
+	return ret;
+}
@@ -0,0 +1,435 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "vdp.h"
+#include "render.h"
+#include "benchmark.h"
+#include "event_log.h"
+
+//Drives the VDP with the same pseudo-random stream of VRAM, CRAM, VSRAM, register and DMA writes
+//at arbitrary points in each frame, once rendering on the emulation thread and once with the
+//render thread, and checks that every presented frame is identical
+
+#define DEFAULT_FRAMES 300
+#define MAX_FRAMES 10000
+#define FB_LINES 512
+
+#define FNV_OFFSET 0xCBF29CE484222325ULL
+#define FNV_PRIME  0x100000001B3ULL
+
+int headless = 0;
+uint8_t bench_active;
+
+static uint32_t framebuffers[2][FB_LINES * LINEBUF_SIZE];
+static uint64_t *frame_hashes;
+static uint32_t num_frames;
+static uint32_t rng_state;
+static vdp_context *vdp;
+
+uint32_t render_map_color(uint8_t r, uint8_t g, uint8_t b)
+{
+	return 0xFF000000 | r << 16 | g << 8 | b;
+}
+
+uint32_t *render_get_framebuffer(uint8_t which, int *pitch)
+{
+	*pitch = LINEBUF_SIZE * sizeof(uint32_t);
+	return framebuffers[which];
+}
+
+void render_framebuffer_updated(uint8_t which, int width)
+{
+	uint64_t hash = FNV_OFFSET;
+	uint8_t *data = (uint8_t *)framebuffers[which];
+	for (size_t i = 0; i < sizeof(framebuffers[which]); i++)
+	{
+		hash = (hash ^ data[i]) * FNV_PRIME;
+	}
+	hash = (hash ^ width) * FNV_PRIME;
+	if (num_frames < MAX_FRAMES) {
+		frame_hashes[num_frames++] = hash;
+	}
+}
+
+uint8_t render_get_active_framebuffer(void)
+{
+	return FRAMEBUFFER_ODD;
+}
+
+uint8_t render_create_window(char *caption, uint32_t width, uint32_t height, window_close_handler close_handler)
+{
+	return 0;
+}
+
+void render_destroy_window(uint8_t which)
+{
+}
+
+uint32_t render_overscan_top()
+{
+	return 0;
+}
+
+uint32_t render_overscan_bot()
+{
+	return 0;
+}
+
+static void *thread_start(void *data)
+{
+	void **args = data;
+	render_thread_fun fun = (render_thread_fun)args[0];
+	void *fun_data = args[1];
+	free(args);
+	fun(fun_data);
+	return NULL;
+}
+
+uint8_t render_create_thread(render_thread *thread, const char *name, render_thread_fun fun, void *data)
+{
+	void **args = malloc(2 * sizeof(void *));
+	args[0] = (void *)fun;
+	args[1] = data;
+	pthread_t pthread;
+	if (pthread_create(&pthread, NULL, thread_start, args)) {
+		free(args);
+		return 0;
+	}
+	pthread_detach(pthread);
+	return 1;
+}
+
+struct SDL_semaphore {
+	sem_t sem;
+};
+
+uint8_t render_create_semaphore(render_semaphore *sem)
+{
+	*sem = malloc(sizeof(**sem));
+	return !sem_init(&(*sem)->sem, 0, 0);
+}
+
+void render_semaphore_wait(render_semaphore sem)
+{
+	while (sem_wait(&sem->sem))
+	{
+	}
+}
+
+void render_semaphore_post(render_semaphore sem)
+{
+	sem_post(&sem->sem);
+}
+
+void render_destroy_semaphore(render_semaphore sem)
+{
+	sem_destroy(&sem->sem);
+	free(sem);
+}
+
+uint16_t read_dma_value(uint32_t address)
+{
+	return (address * 2654435761U) >> 16;
+}
+
+void vdp_dma_started(void)
+{
+}
+
+void event_log(uint8_t type, uint32_t cycle, uint8_t size, uint8_t *payload)
+{
+}
+
+void event_vram_word(uint32_t cycle, uint32_t address, uint16_t value)
+{
+}
+
+void event_vram_byte(uint32_t cycle, uint16_t address, uint8_t byte, uint8_t auto_inc)
+{
+}
+
+void reader_ensure_data(event_reader *reader, size_t bytes)
+{
+}
+
+void init_terminal()
+{
+}
+
+uint8_t is_stdout_enabled(void)
+{
+	return 0;
+}
+
+void bench_push(bench_subsystem sub)
+{
+}
+
+void bench_pop(void)
+{
+}
+
+long file_size(FILE *f)
+{
+	return 0;
+}
+
+void run_once(uint8_t *done, void (*init)(void))
+{
+	if (!*done) {
+		init();
+		*done = 1;
+	}
+}
+
+void warning(char *format, ...)
+{
+}
+
+void fatal_error(char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	exit(1);
+}
+
+static uint32_t rng(void)
+{
+	rng_state = rng_state * 1103515245 + 12345;
+	return rng_state >> 8;
+}
+
+static void wait_dma(void)
+{
+	while (vdp->flags & FLAG_DMA_RUN)
+	{
+		vdp_run_dma_done(vdp, vdp->cycles + MCLKS_LINE);
+	}
+}
+
+static void control_write(uint16_t value)
+{
+	int blocked = vdp_control_port_write(vdp, value, vdp->cycles);
+	while (blocked)
+	{
+		wait_dma();
+		blocked = blocked < 0 ? vdp_control_port_write(vdp, value, vdp->cycles) : 0;
+	}
+}
+
+static void data_write(uint16_t value)
+{
+	while (vdp_data_port_write(vdp, value) < 0)
+	{
+		wait_dma();
+	}
+}
+
+static void reg_write(uint8_t reg, uint8_t value)
+{
+	control_write(0x8000 | reg << 8 | value);
+}
+
+static void set_address(uint8_t cd, uint16_t address)
+{
+	control_write((cd & 3) << 14 | (address & 0x3FFF));
+	control_write((cd & 0x3C) << 2 | address >> 14);
+}
+
+static void write_words(uint8_t cd, uint16_t address, uint32_t count, uint16_t mask)
+{
+	set_address(cd, address);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		data_write(rng() & mask);
+	}
+}
+
+static void setup_dma(uint32_t length, uint32_t source)
+{
+	reg_write(REG_DMALEN_L, length);
+	reg_write(REG_DMALEN_H, length >> 8);
+	reg_write(REG_DMASRC_L, source);
+	reg_write(REG_DMASRC_M, source >> 8);
+	reg_write(REG_DMASRC_H, source >> 16);
+}
+
+static void setup_scene(void)
+{
+	static const uint8_t regs[] = {0x04, 0x34, 0x30, 0x3C, 0x07, 0x6C, 0x00, 0x00, 0x00, 0x00, 0xFF, 0x00, 0x81, 0x3F, 0x00, 0x02, 0x01, 0x00, 0x00};
+	for (int i = 0; i < sizeof(regs); i++)
+	{
+		reg_write(i, regs[i]);
+	}
+	write_words(1, 0, VRAM_SIZE / 2, 0xFFFF);
+	//keep the sprite list linked so that all 80 sprites are visited
+	set_address(1, 0xD800);
+	for (int i = 0; i < 80; i++)
+	{
+		data_write(rng() % 240 + 128);
+		data_write((rng() & 0xF00) | (i < 79 ? i + 1 : 0));
+		data_write(rng());
+		data_write(rng() % 320 + 128);
+	}
+	write_words(3, 0, 64, 0xEEE);
+	write_words(5, 0, 40, 0x3FF);
+	reg_write(REG_MODE_2, 0x74);
+}
+
+static void random_register(void)
+{
+	static const uint8_t mode_4[] = {0x81, 0x81, 0x81, 0x00, 0x89, 0x08, 0x83, 0x87};
+	static const uint8_t mode_3[] = {0x00, 0x02, 0x03, 0x04, 0x07};
+	static const uint8_t scroll_size[] = {0x00, 0x01, 0x03, 0x10, 0x11, 0x13};
+	static const uint8_t mode_1[] = {0x04, 0x04, 0x24, 0x14, 0x84, 0x44};
+	switch (rng() % 9)
+	{
+	case 0:
+		reg_write(REG_MODE_4, mode_4[rng() % sizeof(mode_4)]);
+		break;
+	case 1:
+		reg_write(REG_MODE_3, mode_3[rng() % sizeof(mode_3)]);
+		break;
+	case 2:
+		reg_write(REG_SCROLL, scroll_size[rng() % sizeof(scroll_size)]);
+		break;
+	case 3:
+		reg_write(REG_MODE_1, mode_1[rng() % sizeof(mode_1)]);
+		break;
+	case 4:
+		reg_write(REG_BG_COLOR, rng() & 0x3F);
+		break;
+	case 5:
+		reg_write(REG_WINDOW_H, rng() & 0x9F);
+		break;
+	case 6:
+		reg_write(REG_WINDOW_V, rng() & 0x9F);
+		break;
+	case 7:
+		//briefly blank the display
+		reg_write(REG_MODE_2, rng() & 7 ? 0x74 : 0x34);
+		break;
+	case 8:
+		reg_write(REG_SCROLL_A, (rng() & 0x7) << 3);
+		break;
+	}
+}
+
+static void random_event(void)
+{
+	switch (rng() % 16)
+	{
+	case 0:
+	case 1:
+	case 2:
+	case 3:
+		write_words(1, rng() & 0xFFFE, rng() % 32 + 1, 0xFFFF);
+		break;
+	case 4:
+	case 5:
+		write_words(3, rng() & 0x7E, rng() % 4 + 1, 0xEEE);
+		break;
+	case 6:
+		write_words(5, rng() % 80 & 0x7E, rng() % 4 + 1, 0x3FF);
+		break;
+	case 7:
+		//horizontal scroll table
+		write_words(1, 0xFC00 + (rng() & 0x3FE), rng() % 8 + 1, 0x3FF);
+		break;
+	case 8:
+	case 9:
+		random_register();
+		break;
+	case 10:
+		setup_dma(rng() % 256 + 1, rng() & 0x7FFFFF);
+		set_address(0x21, rng() & 0xFFFE);
+		break;
+	case 11:
+		setup_dma(rng() % 256 + 1, 0x800000);
+		set_address(0x21, rng() & 0xFFFF);
+		data_write(rng());
+		break;
+	case 12:
+		setup_dma(rng() % 256 + 1, 0xC00000 | (rng() & 0xFFFF));
+		set_address(0x30, rng() & 0xFFFF);
+		break;
+	case 13:
+		setup_dma(rng() % 64 + 1, rng() & 0x7FFFFF);
+		set_address(0x23, rng() & 0x7E);
+		break;
+	default:
+		break;
+	}
+	wait_dma();
+}
+
+static uint32_t run(uint8_t threaded, uint32_t frames, uint64_t *hashes)
+{
+	frame_hashes = hashes;
+	num_frames = 0;
+	rng_state = 1;
+	memset(framebuffers, 0, sizeof(framebuffers));
+	vdp = init_vdp_context(0, 0, VDP_GENESIS);
+	if (threaded) {
+		vdp_start_render_thread(vdp);
+		if (!vdp->render_worker) {
+			fatal_error("Failed to start the render thread\n");
+		}
+	}
+	setup_scene();
+	uint32_t end_frame = vdp->frame + frames;
+	while (vdp->frame < end_frame)
+	{
+		vdp_run_context(vdp, vdp->cycles + rng() % (MCLKS_LINE * 16) + 1);
+		random_event();
+	}
+	vdp_free(vdp);
+	vdp = NULL;
+	return num_frames;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t frames = argc > 1 ? atoi(argv[1]) : DEFAULT_FRAMES;
+	if (!frames || frames > MAX_FRAMES) {
+		fprintf(stderr, "Frame count must be between 1 and %d\n", MAX_FRAMES);
+		return 1;
+	}
+	uint64_t *expected = calloc(MAX_FRAMES, sizeof(uint64_t));
+	uint64_t *actual = calloc(MAX_FRAMES, sizeof(uint64_t));
+	uint32_t expected_frames = run(0, frames, expected);
+	uint32_t actual_frames = run(1, frames, actual);
+	int ret = 0;
+	if (expected_frames != actual_frames) {
+		printf("Presented %u frames without the render thread, but %u with it\n", expected_frames, actual_frames);
+		ret = 1;
+	}
+	uint32_t changed = 0, mismatches = 0;
+	for (uint32_t i = 0; i < expected_frames && i < actual_frames; i++)
+	{
+		if (i && expected[i] != expected[i-1]) {
+			changed++;
+		}
+		if (expected[i] != actual[i]) {
+			if (!mismatches) {
+				printf("Frame %u differs: %016llX without the render thread, %016llX with it\n", i, (unsigned long long)expected[i], (unsigned long long)actual[i]);
+			}
+			mismatches++;
+		}
+	}
+	if (!changed) {
+		puts("Output never changed between frames, nothing was checked");
+		ret = 1;
+	}
+	printf("%u frames compared, %u differ\n", expected_frames < actual_frames ? expected_frames : actual_frames, mismatches);
+	ret |= mismatches != 0;
+	printf("Result: %s\n", ret ? "failure" : "success");
+	free(expected);
+	free(actual);
+	return ret;
+}
@@ -167,10 +167,95 @@ char *replace_vars(char *base, tern_node *vars, uint8_t allow_env)
 
 void byteswap_rom(int filesize, uint16_t *cart)
 {
-	for(uint16_t *cur = cart; cur - cart < filesize/2; ++cur)
+	//swap 4 words at a time, compilers will widen this further when SIMD is available
+	uint8_t *cur = (uint8_t *)cart, *end = cur + (filesize & ~1);
+	for (; end - cur >= 8; cur += 8)
 	{
-		*cur = (*cur >> 8) | (*cur << 8);
+		uint64_t words;
+		memcpy(&words, cur, sizeof(words));
+		words = (words >> 8 & 0x00FF00FF00FF00FFULL) | (words << 8 & 0xFF00FF00FF00FF00ULL);
+		memcpy(cur, &words, sizeof(words));
 	}
+	for (; cur < end; cur += 2)
+	{
+		uint8_t tmp = cur[0];
+		cur[0] = cur[1];
+		cur[1] = tmp;
+	}
+}
+
+typedef struct mapped_buffer mapped_buffer;
+struct mapped_buffer {
+	mapped_buffer *next;
+	void          *base;
+	size_t        size;
+};
+
+//the library can run several instances at once, so process-wide state in here is guarded by a single lock
+static void lock_util(void);
+static void unlock_util(void);
+
+void run_once(uint8_t *done, void (*init)(void))
+{
+	if (__atomic_load_n(done, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	lock_util();
+	if (!*done) {
+		init();
+		__atomic_store_n(done, 1, __ATOMIC_RELEASE);
+	}
+	unlock_util();
+}
+
+static mapped_buffer *mapped_buffers;
+
+static mapped_buffer *find_mapped_buffer(void *buffer, mapped_buffer ***prev_next)
+{
+	mapped_buffer **next = &mapped_buffers;
+	for (mapped_buffer *cur = mapped_buffers; cur; cur = cur->next)
+	{
+		if (cur->base == buffer) {
+			*prev_next = next;
+			return cur;
+		}
+		next = &cur->next;
+	}
+	return NULL;
+}
+
+static void unmap_buffer(void *base, size_t size);
+
+void free_rom_buffer(void *buffer)
+{
+	mapped_buffer **prev_next;
+	lock_util();
+	mapped_buffer *mapped = find_mapped_buffer(buffer, &prev_next);
+	if (mapped) {
+		*prev_next = mapped->next;
+	}
+	unlock_util();
+	if (mapped) {
+		unmap_buffer(mapped->base, mapped->size);
+		free(mapped);
+	} else {
+		free(buffer);
+	}
+}
+
+void *realloc_rom_buffer(void *buffer, size_t old_size, size_t new_size)
+{
+	mapped_buffer **prev_next;
+	lock_util();
+	mapped_buffer *mapped = find_mapped_buffer(buffer, &prev_next);
+	unlock_util();
+	if (!mapped) {
+		return realloc(buffer, new_size);
+	}
+	void *ret = malloc(new_size);
+	memcpy(ret, buffer, old_size < new_size ? old_size : new_size);
+	free_rom_buffer(buffer);
+	return ret;
 }
 
 
@@ -752,9 +837,37 @@ int socket_error_is_wouldblock(void)
 	return WSAGetLastError() == WSAEWOULDBLOCK;
 }
 
+void *map_file_private(FILE *f, size_t file_size, size_t buffer_size)
+{
+	//MapViewOfFile can't extend a view past the end of the file, callers fall back to reading
+	return NULL;
+}
+
+static void unmap_buffer(void *base, size_t size)
+{
+}
+
+static volatile LONG util_lock;
+
+static void lock_util(void)
+{
+	//only held for a few list operations or a one-time table build, so spinning is fine
+	while (InterlockedCompareExchange(&util_lock, 1, 0))
+	{
+		SwitchToThread();
+	}
+}
+
+static void unlock_util(void)
+{
+	InterlockedExchange(&util_lock, 0);
+}
+
 #else
 #include <fcntl.h>
 #include <signal.h>
+#include <sys/mman.h>
+#include <pthread.h>
 
 void socket_init(void)
 {
@@ -787,6 +900,46 @@ int socket_error_is_wouldblock(void)
 	return errno == EAGAIN || errno == EWOULDBLOCK;
 }
 
+void *map_file_private(FILE *f, size_t file_size, size_t buffer_size)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t map_size = (buffer_size + page_size - 1) & ~(page_size - 1);
+	//reserve zero-filled space for the whole buffer and then place the file over the start of it
+	uint8_t *base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		return NULL;
+	}
+	if (mmap(base, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(f), 0) == MAP_FAILED) {
+		munmap(base, map_size);
+		return NULL;
+	}
+	mapped_buffer *mapped = malloc(sizeof(mapped_buffer));
+	mapped->base = base;
+	mapped->size = map_size;
+	lock_util();
+	mapped->next = mapped_buffers;
+	mapped_buffers = mapped;
+	unlock_util();
+	return base;
+}
+
+static void unmap_buffer(void *base, size_t size)
+{
+	munmap(base, size);
+}
+
+static pthread_mutex_t util_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void lock_util(void)
+{
+	pthread_mutex_lock(&util_lock);
+}
+
+static void unlock_util(void)
+{
+	pthread_mutex_unlock(&util_lock);
+}
+
 char * get_home_dir()
 {
 	return getenv("HOME");
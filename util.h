@@ -16,6 +16,14 @@ typedef struct {
 #define PATH_SEP "/"
 #endif
 
+#ifdef IS_LIB
+//the library runs one emulated system per thread, so state that is process-wide in the standalone
+//build is kept per thread to allow several independent instances in a single process
+#define INSTANCE_LOCAL __thread
+#else
+#define INSTANCE_LOCAL
+#endif
+
 //Utility functions
 
 //Allocates a new string containing the concatenation of first and second
@@ -28,6 +36,16 @@ char * alloc_join(int num_parts, char const **parts, char sep);
 char *replace_vars(char *base, tern_node *vars, uint8_t allow_env);
 //Byteswaps a ROM image in memory
 void byteswap_rom(int filesize, uint16_t *cart);
+//Maps a file copy-on-write into a buffer of buffer_size bytes, the space past the end of the file is zero-filled
+//Returns NULL if the file could not be mapped, the result must be released with free_rom_buffer
+void *map_file_private(FILE *f, size_t file_size, size_t buffer_size);
+//Releases a ROM buffer that was either allocated with malloc or mapped with map_file_private
+void free_rom_buffer(void *buffer);
+//Like realloc, but also works on buffers mapped with map_file_private
+void *realloc_rom_buffer(void *buffer, size_t old_size, size_t new_size);
+//Calls init unless done is already set and then sets it, safe to call from several threads at once
+//init must not call run_once itself or any of the ROM buffer functions above
+void run_once(uint8_t *done, void (*init)(void));
 //Returns the size of a file using fseek and ftell
 long file_size(FILE * f);
 //Strips whitespace and non-printable characters from the beginning and end of a string
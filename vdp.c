@@ -11,11 +11,12 @@
 #include "util.h"
 #include "event_log.h"
 #include "terminal.h"
+#include "benchmark.h"
+#include "vdp_composite.h"
 
 #define NTSC_INACTIVE_START 224
 #define PAL_INACTIVE_START 240
 #define MODE4_INACTIVE_START 192
-#define BUF_BIT_PRIORITY 0x40
 #define MAP_BIT_PRIORITY 0x8000
 #define MAP_BIT_H_FLIP 0x800
 #define MAP_BIT_V_FLIP 0x1000
@@ -72,6 +73,173 @@ static uint8_t debug_base[][3] = {
 	{127, 0, 127}    //Sprites
 };
 
+static uint32_t dummy_buffer[LINEBUF_SIZE];
+
+//When the render thread is active, the context on the emulation thread still runs the full
+//slot state machine so that timing, DMA, FIFO and status flags are unaffected, but it skips
+//tile decoding and composition. A second context owned by the render thread is fed every
+//write that lands in VRAM, CRAM, VSRAM or the registers along with the cycle it happened on
+//and runs the same state machine to produce pixels
+enum {
+	WORKER_LINE,
+	WORKER_FRAME,
+	WORKER_VRAM_WORD,
+	WORKER_VRAM_BYTE,
+	WORKER_VRAM_COPY,
+	WORKER_CRAM,
+	WORKER_VSRAM,
+	WORKER_REG,
+	WORKER_TEST_PORT,
+	WORKER_ADJUST
+};
+
+typedef struct {
+	uint32_t cycle;
+	uint32_t address;
+	uint16_t value;
+	uint8_t  type;
+} worker_event;
+
+#define WORKER_QUEUE_SIZE 8192
+//how long a thread that ran out of work keeps checking before it goes to sleep
+#define WORKER_SPINS 64
+//the render thread is woken at least this often while lines are being queued so it keeps up
+#define WORKER_WAKE_LINES 16
+
+//a thread that runs out of work sets sleeping and waits on wake, the other thread posts wake when it
+//sees sleeping set after making progress
+typedef struct {
+#ifndef IS_LIB
+	render_semaphore wake;
+#endif
+	uint8_t          sleeping;
+} worker_signal;
+
+struct vdp_render_worker {
+	vdp_context   *shadow;
+	uint32_t      *pending_fb;
+	uint32_t      pending_pitch;
+	uint32_t      completed_frame;
+	//write is only modified by the emulation thread, read only by the render thread
+	uint32_t      write;
+	uint32_t      read;
+	uint8_t       quit;
+	uint8_t       running;
+	//the render thread waits on consumer for events, the emulation thread waits on producer for the render thread
+	worker_signal consumer;
+	worker_signal producer;
+	//value of read the emulation thread needs before it can continue, finishing a frame also wakes it
+	uint32_t      wake_read;
+	uint32_t      lines_since_wake;
+	//memory write waiting for the render thread's context to reach the slot it happened in
+	worker_event  *pending;
+	//where the render thread's context was during its most recent external slot
+	uint32_t      *external_output;
+	uint32_t      external_cycle;
+	uint16_t      external_vcounter;
+	uint8_t       external_hslot;
+#ifndef IS_LIB
+	render_thread thread;
+#endif
+	worker_event  queue[WORKER_QUEUE_SIZE];
+};
+
+typedef uint8_t (*worker_cond)(vdp_render_worker *worker, uint32_t arg);
+
+//wakes the thread waiting on signal, if any, after a store that could satisfy its condition
+static void worker_notify(worker_signal *signal)
+{
+#ifndef IS_LIB
+	//pairs with the fence in worker_wait, either the waiter sees our store or we see it sleeping
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&signal->sleeping, __ATOMIC_RELAXED) && __atomic_exchange_n(&signal->sleeping, 0, __ATOMIC_ACQ_REL)) {
+		render_semaphore_post(signal->wake);
+	}
+#endif
+}
+
+static void worker_wait(vdp_render_worker *worker, worker_signal *signal, worker_cond done, uint32_t arg)
+{
+	uint32_t spins = 0;
+	while (!done(worker, arg))
+	{
+#ifndef IS_LIB
+		if (++spins < WORKER_SPINS) {
+			continue;
+		}
+		__atomic_store_n(&signal->sleeping, 1, __ATOMIC_RELEASE);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (done(worker, arg)) {
+			if (!__atomic_exchange_n(&signal->sleeping, 0, __ATOMIC_ACQ_REL)) {
+				//the other thread already took the flag so a post is coming, it must not be left for the next wait
+				render_semaphore_wait(signal->wake);
+			}
+			return;
+		}
+		render_semaphore_wait(signal->wake);
+#endif
+	}
+}
+
+static uint8_t worker_read_reached(vdp_render_worker *worker, uint32_t read)
+{
+	return (int32_t)(__atomic_load_n(&worker->read, __ATOMIC_ACQUIRE) - read) >= 0;
+}
+
+//waits on the render thread until it has processed everything before the event at index read
+static void worker_wait_read(vdp_render_worker *worker, uint32_t read)
+{
+	if (worker_read_reached(worker, read)) {
+		return;
+	}
+	__atomic_store_n(&worker->wake_read, read, __ATOMIC_RELAXED);
+	worker_notify(&worker->consumer);
+	worker_wait(worker, &worker->producer, worker_read_reached, read);
+}
+
+static void worker_push_at(vdp_context *context, uint32_t cycle, uint8_t type, uint32_t address, uint16_t value)
+{
+	vdp_render_worker *worker = context->render_worker;
+	uint32_t write = worker->write;
+	if (write - __atomic_load_n(&worker->read, __ATOMIC_ACQUIRE) == WORKER_QUEUE_SIZE) {
+		//wait for half of the queue to free up so the threads don't trade places for every event
+		worker_wait_read(worker, write - WORKER_QUEUE_SIZE / 2);
+	}
+	worker_event *event = worker->queue + (write & (WORKER_QUEUE_SIZE - 1));
+	event->cycle = cycle;
+	event->address = address;
+	event->value = value;
+	event->type = type;
+	__atomic_store_n(&worker->write, write + 1, __ATOMIC_RELEASE);
+	if (type == WORKER_LINE) {
+		if (++worker->lines_since_wake < WORKER_WAKE_LINES) {
+			return;
+		}
+		worker->lines_since_wake = 0;
+	} else if (type != WORKER_FRAME) {
+		return;
+	}
+	worker_notify(&worker->consumer);
+}
+
+static void worker_push(vdp_context *context, uint8_t type, uint32_t address, uint16_t value)
+{
+	worker_push_at(context, context->cycles, type, address, value);
+}
+
+//waits for the render thread to process everything that has been queued
+//the shadow context can be safely accessed from the emulation thread afterwards
+static void worker_drain(vdp_render_worker *worker)
+{
+	worker_wait_read(worker, worker->write);
+}
+
+static uint8_t composition_offloaded(vdp_context *context)
+{
+	//the layer debug views need the composition results on this side
+	return context->render_worker && !context->enabled_debuggers;
+}
+
 static uint32_t calc_crop(uint32_t crop, uint32_t border)
 {
 	return crop >= border ? 0 : border - crop;
@@ -152,6 +320,27 @@ static void update_video_params(vdp_context *context)
 
 static uint8_t static_table_init_done;
 
+static void init_static_tables(void)
+{
+	for (uint16_t mode4_addr = 0; mode4_addr < 0x4000; mode4_addr++)
+	{
+		uint16_t mode5_addr = mode4_addr & 0x3DFD;
+		mode5_addr |= mode4_addr << 8 & 0x200;
+		mode5_addr |= mode4_addr >> 8 & 2;
+		mode4_address_map[mode4_addr] = mode5_addr;
+	}
+	for (uint32_t planar = 0; planar < 256; planar++)
+	{
+		uint32_t chunky = 0;
+		for (int bit = 7; bit >= 0; bit--)
+		{
+			chunky = chunky << 4;
+			chunky |= planar >> bit & 1;
+		}
+		planar_to_chunky[planar] = chunky;
+	}
+}
+
 vdp_context *init_vdp_context(uint8_t region_pal, uint8_t has_max_vsram, uint8_t type)
 {
 	vdp_context *context = calloc(1, sizeof(vdp_context) + VRAM_SIZE);
@@ -269,27 +458,7 @@ vdp_context *init_vdp_context(uint8_t region_pal, uint8_t has_max_vsram, uint8_t
 		context->color_map[color] = render_map_color(r, g, b);
 	}
 
-	if (!static_table_init_done) {
-
-		for (uint16_t mode4_addr = 0; mode4_addr < 0x4000; mode4_addr++)
-		{
-			uint16_t mode5_addr = mode4_addr & 0x3DFD;
-			mode5_addr |= mode4_addr << 8 & 0x200;
-			mode5_addr |= mode4_addr >> 8 & 2;
-			mode4_address_map[mode4_addr] = mode5_addr;
-		}
-		for (uint32_t planar = 0; planar < 256; planar++)
-		{
-			uint32_t chunky = 0;
-			for (int bit = 7; bit >= 0; bit--)
-			{
-				chunky = chunky << 4;
-				chunky |= planar >> bit & 1;
-			}
-			planar_to_chunky[planar] = chunky;
-		}
-		static_table_init_done = 1;
-	}
+	run_once(&static_table_init_done, init_static_tables);
 	for (uint8_t color = 0; color < (1 << (3 + 1 + 1 + 1)); color++)
 	{
 		uint8_t src = color & DBG_SRC_MASK;
@@ -341,6 +510,7 @@ vdp_context *init_vdp_context(uint8_t region_pal, uint8_t has_max_vsram, uint8_t
 
 void vdp_free(vdp_context *context)
 {
+	vdp_stop_render_thread(context);
 	if (headless) {
 		free(context->fb);
 	}
@@ -1043,8 +1213,13 @@ static void write_vram_byte(vdp_context *context, uint32_t address, uint8_t valu
 #define DMA_FILL 0x80
 #define DMA_COPY 0xC0
 #define DMA_TYPE_MASK 0xC0
+static void worker_external_slot(vdp_context *context);
 static void external_slot(vdp_context * context)
 {
+	if (context->owning_worker) {
+		worker_external_slot(context);
+		return;
+	}
 	if ((context->flags & FLAG_DMA_RUN) && (context->regs[REG_DMASRC_H] & DMA_TYPE_MASK) == DMA_FILL && context->fifo_read < 0) {
 		context->fifo_read = (context->fifo_write-1) & (FIFO_SIZE-1);
 		fifo_entry * cur = context->fifo + context->fifo_read;
@@ -1060,12 +1235,18 @@ static void external_slot(vdp_context * context)
 		case VRAM_WRITE:
 			if ((context->regs[REG_MODE_2] & (BIT_128K_VRAM|BIT_MODE_5)) == (BIT_128K_VRAM|BIT_MODE_5)) {
 				event_vram_word(context->cycles, start->address, start->value);
+				if (context->render_worker) {
+					worker_push(context, WORKER_VRAM_WORD, start->address, start->value);
+				}
 				vdp_check_update_sat(context, start->address, start->value);
 				write_vram_word(context, start->address, start->value);
 			} else {
 				uint8_t byte = start->partial == 1 ? start->value >> 8 : start->value;
 				uint32_t address = start->address ^ 1;
 				event_vram_byte(context->cycles, start->address, byte, context->regs[REG_AUTOINC]);
+				if (context->render_worker) {
+					worker_push(context, WORKER_VRAM_BYTE, address, byte);
+				}
 				vdp_check_update_sat_byte(context, address, byte);
 				write_vram_byte(context, address, byte);
 				if (!start->partial) {
@@ -1098,6 +1279,9 @@ static void external_slot(vdp_context * context)
 			}
 			uint8_t buffer[3] = {start->address & 127, val >> 8, val};
 			event_log(EVENT_VDP_INTRAM, context->cycles, sizeof(buffer), buffer);
+			if (context->render_worker) {
+				worker_push(context, WORKER_CRAM, start->address, val);
+			}
 			write_cram(context, start->address, val);
 			break;
 		}
@@ -1117,6 +1301,9 @@ static void external_slot(vdp_context * context)
 				}
 				uint8_t buffer[3] = {((start->address/2) & 63) + 128, context->vsram[(start->address/2) & 63] >> 8, context->vsram[(start->address/2) & 63]};
 				event_log(EVENT_VDP_INTRAM, context->cycles, sizeof(buffer), buffer);
+				if (context->render_worker) {
+					worker_push(context, WORKER_VSRAM, (start->address/2) & 63, context->vsram[(start->address/2) & 63]);
+				}
 			}
 
 			break;
@@ -1138,6 +1325,9 @@ static void external_slot(vdp_context * context)
 		}
 	} else if ((context->flags & FLAG_DMA_RUN) && (context->regs[REG_DMASRC_H] & DMA_TYPE_MASK) == DMA_COPY) {
 		if (context->flags & FLAG_READ_FETCHED) {
+			if (context->render_worker) {
+				worker_push(context, WORKER_VRAM_COPY, context->address ^ 1, context->prefetch);
+			}
 			write_vram_byte(context, context->address ^ 1, context->prefetch);
 
 			//Update DMA state
@@ -1385,6 +1575,9 @@ static void read_map_mode4(uint16_t column, uint32_t line, vdp_context * context
 
 static void render_map(uint16_t col, uint8_t * tmp_buf, uint8_t offset, vdp_context * context)
 {
+	if (composition_offloaded(context)) {
+		return;
+	}
 	uint16_t address;
 	uint16_t vflip_base;
 	if (context->double_res) {
@@ -1459,63 +1652,6 @@ static void fetch_map_mode4(uint16_t col, uint32_t line, vdp_context *context)
 	context->fetch_tmp[1] = context->vdpmem[address+1];
 }
 
-static uint8_t composite_normal(vdp_context *context, uint8_t *debug_dst, uint8_t sprite, uint8_t plane_a, uint8_t plane_b, uint8_t bg_index)
-{
-	uint8_t pixel = bg_index;
-	uint8_t src = DBG_SRC_BG;
-	if (plane_b & 0xF) {
-		pixel = plane_b;
-		src = DBG_SRC_B;
-	}
-	if (plane_a & 0xF && (plane_a & BUF_BIT_PRIORITY) >= (pixel & BUF_BIT_PRIORITY)) {
-		pixel = plane_a;
-		src = DBG_SRC_A;
-	}
-	if (sprite & 0xF && (sprite & BUF_BIT_PRIORITY) >= (pixel & BUF_BIT_PRIORITY)) {
-		pixel = sprite;
-		src = DBG_SRC_S;
-	}
-	*debug_dst = src;
-	return pixel;
-}
-typedef struct {
-	uint8_t index, intensity;
-} sh_pixel;
-
-static sh_pixel composite_highlight(vdp_context *context, uint8_t *debug_dst, uint8_t sprite, uint8_t plane_a, uint8_t plane_b, uint8_t bg_index)
-{
-	uint8_t pixel = bg_index;
-	uint8_t src = DBG_SRC_BG;
-	uint8_t intensity = 0;
-	if (plane_b & 0xF) {
-		pixel = plane_b;
-		src = DBG_SRC_B;
-	}
-	intensity = plane_b & BUF_BIT_PRIORITY;
-	if (plane_a & 0xF && (plane_a & BUF_BIT_PRIORITY) >= (pixel & BUF_BIT_PRIORITY)) {
-		pixel = plane_a;
-		src = DBG_SRC_A;
-	}
-	intensity |= plane_a & BUF_BIT_PRIORITY;
-	if (sprite & 0xF && (sprite & BUF_BIT_PRIORITY) >= (pixel & BUF_BIT_PRIORITY)) {
-		if ((sprite & 0x3F) == 0x3E) {
-			intensity += BUF_BIT_PRIORITY;
-		} else if ((sprite & 0x3F) == 0x3F) {
-			intensity = 0;
-		} else {
-			pixel = sprite;
-			src = DBG_SRC_S;
-			if ((pixel & 0xF) == 0xE) {
-				intensity = BUF_BIT_PRIORITY;
-			} else {
-				intensity |= pixel & BUF_BIT_PRIORITY;
-			}
-		}
-	}
-	*debug_dst = src;
-	return (sh_pixel){.index = pixel, .intensity = intensity};
-}
-
 static void render_normal(vdp_context *context, int32_t col, uint8_t *dst, uint8_t *debug_dst, uint8_t *buf_a, int plane_a_off, int plane_a_mask, int plane_b_off)
 {
 	uint8_t *sprite_buf = context->linebuf + col * 8;
@@ -1536,6 +1672,12 @@ static void render_normal(vdp_context *context, int32_t col, uint8_t *dst, uint8
 			debug_dst++;
 		}
 	} else {
+#ifdef SIMD_COMPOSITE
+		uint8_t plane_a[16], plane_b[16];
+		gather_plane(plane_a, buf_a, plane_a_off, plane_a_mask);
+		gather_plane(plane_b, context->tmp_buf_b, plane_b_off, SCROLL_BUFFER_MASK);
+		composite_normal_simd(dst, debug_dst, sprite_buf, plane_a, plane_b, context->regs[REG_BG_COLOR]);
+#else
 		for (int i = 0; i < 16; ++plane_a_off, ++plane_b_off, ++sprite_buf, ++i)
 		{
 			uint8_t sprite, plane_a, plane_b;
@@ -1544,6 +1686,7 @@ static void render_normal(vdp_context *context, int32_t col, uint8_t *dst, uint8
 			*(dst++) = composite_normal(context, debug_dst, *sprite_buf, plane_a, plane_b, context->regs[REG_BG_COLOR]) & 0x3F;
 			debug_dst++;
 		}
+#endif
 	}
 }
 
@@ -1558,6 +1701,15 @@ static void render_highlight(vdp_context *context, int32_t col, uint8_t *dst, ui
 		start = 8;
 	}
 	uint8_t *sprite_buf = context->linebuf + col * 8 + start;
+#ifdef SIMD_COMPOSITE
+	if (!start) {
+		uint8_t plane_a[16], plane_b[16];
+		gather_plane(plane_a, buf_a, plane_a_off, plane_a_mask);
+		gather_plane(plane_b, context->tmp_buf_b, plane_b_off, SCROLL_BUFFER_MASK);
+		composite_highlight_simd(dst, debug_dst, sprite_buf, plane_a, plane_b, context->regs[REG_BG_COLOR]);
+		return;
+	}
+#endif
 	for (int i = start; i < 16; ++plane_a_off, ++plane_b_off, ++sprite_buf, ++i)
 	{
 		uint8_t sprite, plane_a, plane_b;
@@ -1774,6 +1926,9 @@ static void render_map_output(uint32_t line, int32_t col, vdp_context * context)
 {
 	uint8_t *dst;
 	uint8_t *debug_dst;
+	if (composition_offloaded(context)) {
+		return;
+	}
 	uint8_t output_disabled = (context->test_port & TEST_BIT_DISABLE) != 0;
 	uint8_t test_layer = context->test_port >> 7 & 3;
 	if (context->state == PREPARING && !test_layer) {
@@ -2381,11 +2536,85 @@ static void vdp_update_per_frame_debug(vdp_context *context)
 	}
 }
 
+static uint8_t worker_fb_ready(vdp_render_worker *worker, uint32_t unused)
+{
+	return __atomic_load_n(&worker->pending_fb, __ATOMIC_ACQUIRE) || __atomic_load_n(&worker->quit, __ATOMIC_ACQUIRE);
+}
+
+static void get_framebuffer(vdp_context *context)
+{
+	if (context->owning_worker) {
+		//the emulation thread hands over a framebuffer when its copy of the state machine reaches the same line
+		vdp_render_worker *worker = context->owning_worker;
+		worker_wait(worker, &worker->consumer, worker_fb_ready, 0);
+		uint32_t *fb = __atomic_exchange_n(&worker->pending_fb, NULL, __ATOMIC_ACQUIRE);
+		if (!fb) {
+			//shutting down, send the rest of the output nowhere
+			context->fb = dummy_buffer;
+			context->output_pitch = 0;
+			return;
+		}
+		context->fb = fb;
+		context->output_pitch = worker->pending_pitch;
+		return;
+	}
+	context->fb = render_get_framebuffer(context->cur_buffer, &context->output_pitch);
+	if (context->render_worker) {
+		context->render_worker->pending_pitch = context->output_pitch;
+		__atomic_store_n(&context->render_worker->pending_fb, context->fb, __ATOMIC_RELEASE);
+		worker_notify(&context->render_worker->consumer);
+	}
+}
+
+static uint8_t worker_frame_finished(vdp_render_worker *worker, uint32_t frame)
+{
+	return __atomic_load_n(&worker->completed_frame, __ATOMIC_ACQUIRE) == frame || worker_read_reached(worker, worker->write);
+}
+
+static void worker_frame_done(vdp_context *context)
+{
+	vdp_render_worker *worker = context->render_worker;
+	uint32_t cycle = context->cycles;
+	if (context->hslot == LINE_CHANGE_H40) {
+		//vdp_h40_line draws a whole line with the cycle count from its start, send the slot the
+		//frame really ended in so the render thread never has to run ahead of us to find it
+		cycle += (BG_START_SLOT + LINEBUF_SIZE/2 - LINE_CHANGE_H40) * MCLKS_SLOT_H40;
+	}
+	worker_push_at(context, cycle, WORKER_FRAME, 0, context->suppress_output);
+	if (headless || context->suppress_output) {
+		return;
+	}
+	//the frame is about to be presented so the render thread needs to finish it first
+	if (!worker_frame_finished(worker, context->frame + 1)) {
+		__atomic_store_n(&worker->wake_read, worker->write, __ATOMIC_RELAXED);
+		worker_wait(worker, &worker->producer, worker_frame_finished, context->frame + 1);
+	}
+}
+
+//points the render thread's context at the same framebuffer as ours after it was changed outside of advance_output_line
+static void worker_sync_framebuffer(vdp_context *context)
+{
+	vdp_render_worker *worker = context->render_worker;
+	worker_drain(worker);
+	vdp_context *shadow = worker->shadow;
+	__atomic_store_n(&worker->pending_fb, NULL, __ATOMIC_RELAXED);
+	shadow->fb = context->fb;
+	shadow->output_pitch = context->output_pitch;
+	if (context->fb && context->output && shadow->output_lines) {
+		shadow->output = (uint32_t *)(((char *)shadow->fb) + shadow->output_pitch * (shadow->output_lines - 1 + shadow->top_offset));
+	} else {
+		shadow->output = NULL;
+	}
+}
+
 void vdp_force_update_framebuffer(vdp_context *context)
 {
 	if (!context->fb) {
 		return;
 	}
+	if (context->render_worker) {
+		worker_drain(context->render_worker);
+	}
 	uint16_t lines_max = context->inactive_start + context->border_bot + context->border_top;
 
 	uint16_t to_fill = lines_max - context->output_lines;
@@ -2396,6 +2625,9 @@ void vdp_force_update_framebuffer(vdp_context *context)
 	);
 	render_framebuffer_updated(context->cur_buffer, context->h40_lines > context->output_lines / 2 ? LINEBUF_SIZE : (256+HORIZ_BORDER));
 	context->fb = render_get_framebuffer(context->cur_buffer, &context->output_pitch);
+	if (context->render_worker) {
+		worker_sync_framebuffer(context);
+	}
 	vdp_update_per_frame_debug(context);
 }
 
@@ -2411,8 +2643,14 @@ static void advance_output_line(vdp_context *context)
 
 	if (context->output_lines >= lines_max || (!context->pushed_frame && output_line == context->inactive_start + context->border_top)) {
 		//we've either filled up a full frame or we're at the bottom of screen in the current defined mode + border crop
-		if (!headless) {
-			render_framebuffer_updated(context->cur_buffer, context->h40_lines > (context->inactive_start + context->border_top) / 2 ? LINEBUF_SIZE : (256+HORIZ_BORDER));
+		if (context->render_worker) {
+			worker_frame_done(context);
+		}
+		if (!headless && !context->suppress_output) {
+			if (!context->owning_worker) {
+				//when rendering on a separate thread, the emulation thread presents the frame
+				render_framebuffer_updated(context->cur_buffer, context->h40_lines > (context->inactive_start + context->border_top) / 2 ? LINEBUF_SIZE : (256+HORIZ_BORDER));
+			}
 			uint8_t is_even = context->flags2 & FLAG2_EVEN_FIELD;
 			if (context->vcounter <= context->inactive_start && (context->regs[REG_MODE_4] & BIT_INTERLACE)) {
 				is_even = !is_even;
@@ -2425,6 +2663,11 @@ static void advance_output_line(vdp_context *context)
 		context->h40_lines = 0;
 		context->frame++;
 		context->output_lines = 0;
+		if (context->owning_worker) {
+			__atomic_store_n(&context->owning_worker->completed_frame, context->frame, __ATOMIC_RELEASE);
+			//the next line can block waiting for a framebuffer so don't wait for the event to finish
+			worker_notify(&context->owning_worker->producer);
+		}
 	}
 
 	if (output_line < context->inactive_start + context->border_bot) {
@@ -2451,10 +2694,15 @@ static void advance_output_line(vdp_context *context)
 		return;
 	}
 	if (!context->fb) {
-		context->fb = render_get_framebuffer(context->cur_buffer, &context->output_pitch);
+		get_framebuffer(context);
 	}
 	output_line += context->top_offset;
-	context->output = (uint32_t *)(((char *)context->fb) + context->output_pitch * output_line);
+	if (context->render_worker) {
+		context->output = dummy_buffer;
+		worker_push(context, WORKER_LINE, 0, 0);
+	} else {
+		context->output = (uint32_t *)(((char *)context->fb) + context->output_pitch * output_line);
+	}
 #ifdef DEBUG_FB_FILL
 	for (int i = 0; i < LINEBUF_SIZE; i++)
 	{
@@ -2469,8 +2717,14 @@ static void advance_output_line(vdp_context *context)
 void vdp_release_framebuffer(vdp_context *context)
 {
 	if (context->fb) {
+		if (context->render_worker) {
+			worker_drain(context->render_worker);
+		}
 		render_framebuffer_updated(context->cur_buffer, context->h40_lines > (context->inactive_start + context->border_top) / 2 ? LINEBUF_SIZE : (256+HORIZ_BORDER));
 		context->output = context->fb = NULL;
+		if (context->render_worker) {
+			worker_sync_framebuffer(context);
+		}
 	}
 }
 
@@ -2479,10 +2733,17 @@ void vdp_reacquire_framebuffer(vdp_context *context)
 	uint16_t lines_max = context->inactive_start + context->border_bot + context->border_top;
 	if (context->output_lines <= lines_max && context->output_lines > 0) {
 		context->fb = render_get_framebuffer(context->cur_buffer, &context->output_pitch);
-		context->output = (uint32_t *)(((char *)context->fb) + context->output_pitch * (context->output_lines - 1 + context->top_offset));
+		if (context->render_worker) {
+			context->output = dummy_buffer;
+		} else {
+			context->output = (uint32_t *)(((char *)context->fb) + context->output_pitch * (context->output_lines - 1 + context->top_offset));
+		}
 	} else {
 		context->output = NULL;
 	}
+	if (context->render_worker) {
+		worker_sync_framebuffer(context);
+	}
 }
 
 static void render_border_garbage(vdp_context *context, uint32_t address, uint8_t *buf, uint8_t buf_off, uint16_t col)
@@ -2854,7 +3115,6 @@ static void draw_right_border(vdp_context *context)
 		render_sprite_cells_mode4(context);\
 		MODE4_CHECK_SLOT_LINE(CALC_SLOT(slot, 5))
 
-static uint32_t dummy_buffer[LINEBUF_SIZE];
 static void vdp_h40_line(vdp_context * context)
 {
 	uint16_t address;
@@ -4580,7 +4840,245 @@ void vdp_run_context(vdp_context *context, uint32_t target_cycles)
 		//avoid overflow
 		return;
 	}
+	BENCH_ENTER(BENCH_VDP);
 	vdp_run_context_full(context, target_cycles - slot_cyc);
+	BENCH_EXIT();
+}
+
+static void worker_write(vdp_context *context, worker_event *event)
+{
+	switch (event->type)
+	{
+	case WORKER_VRAM_WORD:
+		vdp_check_update_sat(context, event->address, event->value);
+		write_vram_word(context, event->address, event->value);
+		break;
+	case WORKER_VRAM_BYTE:
+		vdp_check_update_sat_byte(context, event->address, event->value);
+		write_vram_byte(context, event->address, event->value);
+		break;
+	case WORKER_VRAM_COPY:
+		//DMA copy does not update the sprite attribute cache
+		write_vram_byte(context, event->address, event->value);
+		break;
+	case WORKER_CRAM:
+		write_cram(context, event->address, event->value);
+		break;
+	case WORKER_VSRAM:
+		context->vsram[event->address] = event->value;
+		break;
+	}
+}
+
+//called from external_slot in the render thread's context, which has no FIFO of its own
+static void worker_external_slot(vdp_context *context)
+{
+	vdp_render_worker *worker = context->owning_worker;
+	worker->external_output = context->output;
+	worker->external_cycle = context->cycles;
+	worker->external_vcounter = context->vcounter;
+	worker->external_hslot = context->hslot;
+	if (worker->pending && worker->pending->cycle == context->cycles) {
+		worker_write(context, worker->pending);
+		worker->pending = NULL;
+	}
+}
+
+static void worker_apply(vdp_context *context, worker_event *event)
+{
+	switch (event->type)
+	{
+	case WORKER_LINE:
+		//the line is drawn as later events move things along, the slot this came from can still
+		//have a memory write that needs to be applied part way through it
+		vdp_run_context_full(context, event->cycle);
+		return;
+	case WORKER_REG:
+	case WORKER_TEST_PORT:
+	case WORKER_ADJUST:
+		//these happen between slots in response to a port access or a cycle count adjustment
+		vdp_run_context_full(context, event->cycle);
+		break;
+	case WORKER_FRAME:
+		context->suppress_output = event->value;
+		//the frame ends in the slot this was sent from, which is as far as the emulation thread has got
+		vdp_run_context_full(context, event->cycle + 1);
+		return;
+	default: {
+		//memory writes happen part way through an external slot, anything drawn earlier in that
+		//slot (like the CRAM write dots) must not see them, so they are applied from external_slot
+		vdp_render_worker *worker = context->owning_worker;
+		worker->pending = event;
+		vdp_run_context_full(context, event->cycle + 1);
+		if (worker->pending) {
+			//nothing runs this context past the slot of the newest event, so the only way to be past
+			//this one already is a frame that ended earlier in the same slot. Put the beam back where
+			//it was in that slot's external access so CRAM dots land in the same place
+			worker->pending = NULL;
+			uint32_t *output = context->output;
+			uint16_t vcounter = context->vcounter;
+			uint8_t hslot = context->hslot;
+			context->output = worker->external_output;
+			context->vcounter = worker->external_vcounter;
+			context->hslot = worker->external_hslot;
+			worker_write(context, event);
+			context->output = output;
+			context->vcounter = vcounter;
+			context->hslot = hslot;
+		}
+		return;
+	}
+	}
+	switch (event->type)
+	{
+	case WORKER_REG:
+		context->regs[event->address] = event->value;
+		if (event->address == REG_MODE_1 || event->address == REG_MODE_2 || event->address == REG_MODE_4) {
+			update_video_params(context);
+		}
+		break;
+	case WORKER_TEST_PORT:
+		context->test_port = event->value;
+		break;
+	case WORKER_ADJUST:
+		vdp_adjust_cycles(context, event->address);
+		break;
+	}
+}
+
+//wakes the emulation thread if it's sleeping and the event that was just processed is what it's waiting for
+static void worker_event_done(vdp_render_worker *worker, uint32_t read)
+{
+#ifndef IS_LIB
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&worker->producer.sleeping, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	if ((int32_t)(read - __atomic_load_n(&worker->wake_read, __ATOMIC_RELAXED)) >= 0) {
+		if (__atomic_exchange_n(&worker->producer.sleeping, 0, __ATOMIC_ACQ_REL)) {
+			render_semaphore_post(worker->producer.wake);
+		}
+	}
+#endif
+}
+
+static uint8_t worker_has_work(vdp_render_worker *worker, uint32_t unused)
+{
+	return worker->read != __atomic_load_n(&worker->write, __ATOMIC_ACQUIRE) || __atomic_load_n(&worker->quit, __ATOMIC_ACQUIRE);
+}
+
+static int render_worker_main(void *data)
+{
+	vdp_render_worker *worker = data;
+	for (;;)
+	{
+		worker_wait(worker, &worker->consumer, worker_has_work, 0);
+		if (__atomic_load_n(&worker->quit, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+		uint32_t read = worker->read;
+		worker_apply(worker->shadow, worker->queue + (read & (WORKER_QUEUE_SIZE - 1)));
+		__atomic_store_n(&worker->read, read + 1, __ATOMIC_RELEASE);
+		worker_event_done(worker, read + 1);
+	}
+	__atomic_store_n(&worker->running, 0, __ATOMIC_RELEASE);
+	worker_notify(&worker->producer);
+	return 0;
+}
+
+//makes the render thread's context an exact copy of ours, the render thread must be idle
+static void worker_resync(vdp_context *context)
+{
+	vdp_render_worker *worker = context->render_worker;
+	vdp_context *shadow = worker->shadow;
+	memcpy(shadow, context, sizeof(vdp_context) + VRAM_SIZE);
+	shadow->render_worker = NULL;
+	shadow->owning_worker = worker;
+	shadow->enabled_debuggers = 0;
+	memset(shadow->debug_fbs, 0, sizeof(shadow->debug_fbs));
+	shadow->kmod_msg_buffer = NULL;
+	shadow->kmod_buffer_storage = shadow->kmod_buffer_length = 0;
+	shadow->dma_hook = NULL;
+	shadow->reg_hook = NULL;
+	shadow->data_hook = NULL;
+	//memory writes arrive through the queue so the copy should never process the FIFO or run DMA itself
+	shadow->fifo_read = -1;
+	shadow->flags &= ~FLAG_DMA_RUN;
+	if (context->done_composite) {
+		shadow->done_composite = shadow->compositebuf + (context->done_composite - context->compositebuf);
+	}
+	worker->completed_frame = shadow->frame;
+	worker_sync_framebuffer(context);
+}
+
+void vdp_start_render_thread(vdp_context *context)
+{
+#ifndef IS_LIB
+	if (context->render_worker || context->type != VDP_GENESIS) {
+		return;
+	}
+	vdp_render_worker *worker = calloc(1, sizeof(vdp_render_worker));
+	if (!render_create_semaphore(&worker->consumer.wake)) {
+		free(worker);
+		warning("Failed to create VDP render thread, rendering will happen on the emulation thread\n");
+		return;
+	}
+	if (!render_create_semaphore(&worker->producer.wake)) {
+		render_destroy_semaphore(worker->consumer.wake);
+		free(worker);
+		warning("Failed to create VDP render thread, rendering will happen on the emulation thread\n");
+		return;
+	}
+	worker->shadow = malloc(sizeof(vdp_context) + VRAM_SIZE);
+	context->render_worker = worker;
+	worker_resync(context);
+	if (context->output) {
+		context->output = dummy_buffer;
+	}
+	worker->running = 1;
+	if (!render_create_thread(&worker->thread, "VDP render", render_worker_main, worker)) {
+		warning("Failed to create VDP render thread, rendering will happen on the emulation thread\n");
+		render_destroy_semaphore(worker->consumer.wake);
+		render_destroy_semaphore(worker->producer.wake);
+		free(worker->shadow);
+		free(worker);
+		context->render_worker = NULL;
+		vdp_reacquire_framebuffer(context);
+	}
+#endif
+}
+
+static uint8_t worker_stopped(vdp_render_worker *worker, uint32_t unused)
+{
+	return !__atomic_load_n(&worker->running, __ATOMIC_ACQUIRE);
+}
+
+void vdp_stop_render_thread(vdp_context *context)
+{
+	vdp_render_worker *worker = context->render_worker;
+	if (!worker) {
+		return;
+	}
+	worker_drain(worker);
+	__atomic_store_n(&worker->quit, 1, __ATOMIC_RELEASE);
+	worker_notify(&worker->consumer);
+	worker_wait(worker, &worker->producer, worker_stopped, 0);
+#ifndef IS_LIB
+	render_destroy_semaphore(worker->consumer.wake);
+	render_destroy_semaphore(worker->producer.wake);
+#endif
+	//pick up where the render thread left off
+	vdp_context *shadow = worker->shadow;
+	memcpy(context->compositebuf, shadow->compositebuf, sizeof(context->compositebuf));
+	memcpy(context->tmp_buf_a, shadow->tmp_buf_a, sizeof(context->tmp_buf_a));
+	memcpy(context->tmp_buf_b, shadow->tmp_buf_b, sizeof(context->tmp_buf_b));
+	context->buf_a_off = shadow->buf_a_off;
+	context->buf_b_off = shadow->buf_b_off;
+	context->done_composite = shadow->done_composite ? context->compositebuf + (shadow->done_composite - shadow->compositebuf) : NULL;
+	context->output = shadow->output;
+	free(shadow);
+	free(worker);
+	context->render_worker = NULL;
 }
 
 uint32_t vdp_run_to_vblank(vdp_context * context)
@@ -4677,6 +5175,9 @@ void vdp_reg_write(vdp_context *context, uint16_t reg, uint16_t value)
 		}*/
 		uint8_t buffer[2] = {reg, value};
 		event_log(EVENT_VDP_REG, context->cycles, sizeof(buffer), buffer);
+		if (context->render_worker) {
+			worker_push(context, WORKER_REG, reg, value);
+		}
 		context->regs[reg] = value;
 		if (reg == REG_MODE_1 || reg == REG_MODE_2 || reg == REG_MODE_4) {
 			update_video_params(context);
@@ -4893,6 +5394,9 @@ void vdp_data_port_write_pbc(vdp_context * context, uint8_t value)
 
 void vdp_test_port_write(vdp_context * context, uint16_t value)
 {
+	if (context->render_worker) {
+		worker_push(context, WORKER_TEST_PORT, 0, value);
+	}
 	context->test_port = value;
 }
 
@@ -5009,6 +5513,9 @@ uint8_t vdp_data_port_read_pbc(vdp_context * context)
 
 void vdp_adjust_cycles(vdp_context * context, uint32_t deduction)
 {
+	if (context->render_worker) {
+		worker_push(context, WORKER_ADJUST, deduction, 0);
+	}
 	context->cycles -= deduction;
 	if (context->pending_vint_start >= deduction) {
 		context->pending_vint_start -= deduction;
@@ -5529,6 +6036,10 @@ void vdp_deserialize(deserialize_buffer *buf, void *vcontext)
 		context->address_latch = context->address;
 	}
 	update_video_params(context);
+	if (context->render_worker) {
+		worker_drain(context->render_worker);
+		worker_resync(context);
+	}
 }
 
 static vdp_context *current_vdp;
@@ -176,6 +176,7 @@ enum {
 };
 
 typedef struct vdp_context vdp_context;
+typedef struct vdp_render_worker vdp_render_worker;
 typedef void (*vdp_hook)(vdp_context *);
 typedef void (*vdp_reg_hook)(vdp_context *, uint16_t reg, uint16_t value);
 typedef void (*vdp_data_hook)(vdp_context *, uint16_t value);
@@ -189,6 +190,10 @@ struct vdp_context {
 	uint8_t        *done_composite;
 	uint32_t       *debug_fbs[NUM_DEBUG_TYPES];
 	char           *kmod_msg_buffer;
+	//set when pixel composition has been moved to a render thread
+	vdp_render_worker *render_worker;
+	//set on the context owned by the render thread
+	vdp_render_worker *owning_worker;
 	vdp_hook       dma_hook;
 	vdp_reg_hook   reg_hook;
 	vdp_data_hook  data_hook;
@@ -265,6 +270,7 @@ struct vdp_context {
 	uint8_t        debug_fb_indices[NUM_DEBUG_TYPES];
 	uint8_t        debug_modes[NUM_DEBUG_TYPES];
 	uint8_t        pushed_frame;
+	uint8_t        suppress_output;
 	uint8_t        type;
 	uint8_t        cram_latch;
 	int32_t        color_map[1 << 12];
@@ -313,6 +319,8 @@ void vdp_deserialize(deserialize_buffer *buf, void *vcontext);
 void vdp_force_update_framebuffer(vdp_context *context);
 void vdp_toggle_debug_view(vdp_context *context, uint8_t debug_type);
 void vdp_inc_debug_mode(vdp_context *context);
+void vdp_start_render_thread(vdp_context *context);
+void vdp_stop_render_thread(vdp_context *context);
 //to be implemented by the host system
 uint16_t read_dma_value(uint32_t address);
 void vdp_dma_started(void);
@@ -0,0 +1,186 @@
+/*
+ Copyright 2013 Michael Pavone
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#ifndef VDP_COMPOSITE_H_
+#define VDP_COMPOSITE_H_
+//Per-pixel layer compositing used by the VDP renderer. These live in a header so that
+//test_composite can check the SIMD versions against the scalar reference
+#include <string.h>
+#include "vdp.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define BUF_BIT_PRIORITY 0x40
+
+static uint8_t composite_normal(vdp_context *context, uint8_t *debug_dst, uint8_t sprite, uint8_t plane_a, uint8_t plane_b, uint8_t bg_index)
+{
+	uint8_t pixel = bg_index;
+	uint8_t src = DBG_SRC_BG;
+	if (plane_b & 0xF) {
+		pixel = plane_b;
+		src = DBG_SRC_B;
+	}
+	if (plane_a & 0xF && (plane_a & BUF_BIT_PRIORITY) >= (pixel & BUF_BIT_PRIORITY)) {
+		pixel = plane_a;
+		src = DBG_SRC_A;
+	}
+	if (sprite & 0xF && (sprite & BUF_BIT_PRIORITY) >= (pixel & BUF_BIT_PRIORITY)) {
+		pixel = sprite;
+		src = DBG_SRC_S;
+	}
+	*debug_dst = src;
+	return pixel;
+}
+
+typedef struct {
+	uint8_t index, intensity;
+} sh_pixel;
+
+static sh_pixel composite_highlight(vdp_context *context, uint8_t *debug_dst, uint8_t sprite, uint8_t plane_a, uint8_t plane_b, uint8_t bg_index)
+{
+	uint8_t pixel = bg_index;
+	uint8_t src = DBG_SRC_BG;
+	uint8_t intensity = 0;
+	if (plane_b & 0xF) {
+		pixel = plane_b;
+		src = DBG_SRC_B;
+	}
+	intensity = plane_b & BUF_BIT_PRIORITY;
+	if (plane_a & 0xF && (plane_a & BUF_BIT_PRIORITY) >= (pixel & BUF_BIT_PRIORITY)) {
+		pixel = plane_a;
+		src = DBG_SRC_A;
+	}
+	intensity |= plane_a & BUF_BIT_PRIORITY;
+	if (sprite & 0xF && (sprite & BUF_BIT_PRIORITY) >= (pixel & BUF_BIT_PRIORITY)) {
+		if ((sprite & 0x3F) == 0x3E) {
+			intensity += BUF_BIT_PRIORITY;
+		} else if ((sprite & 0x3F) == 0x3F) {
+			intensity = 0;
+		} else {
+			pixel = sprite;
+			src = DBG_SRC_S;
+			if ((pixel & 0xF) == 0xE) {
+				intensity = BUF_BIT_PRIORITY;
+			} else {
+				intensity |= pixel & BUF_BIT_PRIORITY;
+			}
+		}
+	}
+	*debug_dst = src;
+	return (sh_pixel){.index = pixel, .intensity = intensity};
+}
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+#define SIMD_COMPOSITE
+//The compositors below resolve a full 16 pixel column pair at once. They must produce exactly
+//the same output as composite_normal and composite_highlight which remain the reference
+//implementation and are still used for the left column blank and the test register modes
+#ifdef __SSE2__
+typedef __m128i pix16;
+#define PIX_LOAD(ptr) _mm_loadu_si128((const __m128i *)(ptr))
+#define PIX_STORE(ptr, v) _mm_storeu_si128((__m128i *)(ptr), v)
+#define PIX_SPLAT(val) _mm_set1_epi8(val)
+#define PIX_AND(a, b) _mm_and_si128(a, b)
+#define PIX_OR(a, b) _mm_or_si128(a, b)
+#define PIX_ANDNOT(a, b) _mm_andnot_si128(b, a)
+#define PIX_EQ(a, b) _mm_cmpeq_epi8(a, b)
+#define PIX_ADD(a, b) _mm_add_epi8(a, b)
+#define PIX_SELECT(mask, a, b) _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b))
+#else
+typedef uint8x16_t pix16;
+#define PIX_LOAD(ptr) vld1q_u8(ptr)
+#define PIX_STORE(ptr, v) vst1q_u8(ptr, v)
+#define PIX_SPLAT(val) vdupq_n_u8(val)
+#define PIX_AND(a, b) vandq_u8(a, b)
+#define PIX_OR(a, b) vorrq_u8(a, b)
+#define PIX_ANDNOT(a, b) vbicq_u8(a, b)
+#define PIX_EQ(a, b) vceqq_u8(a, b)
+#define PIX_ADD(a, b) vaddq_u8(a, b)
+#define PIX_SELECT(mask, a, b) vbslq_u8(mask, a, b)
+#endif
+
+//copies 16 pixels out of a circular plane buffer
+static void gather_plane(uint8_t *out, uint8_t *buf, int off, int mask)
+{
+	off &= mask;
+	int first = mask + 1 - off;
+	if (first >= 16) {
+		memcpy(out, buf + off, 16);
+	} else {
+		memcpy(out, buf + off, first);
+		memcpy(out + first, buf, 16 - first);
+	}
+}
+
+//mask of pixels where layer is opaque and its priority is at least that of pixel
+static pix16 pix_layer_wins(pix16 layer, pix16 pixel)
+{
+	pix16 zero = PIX_SPLAT(0);
+	pix16 pri = PIX_SPLAT(BUF_BIT_PRIORITY);
+	pix16 transparent = PIX_EQ(PIX_AND(layer, PIX_SPLAT(0xF)), zero);
+	pix16 lower = PIX_ANDNOT(PIX_AND(pixel, pri), PIX_AND(layer, pri));
+	return PIX_ANDNOT(PIX_EQ(lower, zero), transparent);
+}
+
+static pix16 composite_planes_simd(pix16 *src, pix16 plane_a, pix16 plane_b, uint8_t bg_index)
+{
+	pix16 pixel = PIX_SPLAT(bg_index);
+	*src = PIX_SPLAT(DBG_SRC_BG);
+	pix16 win = pix_layer_wins(plane_b, PIX_SPLAT(0));
+	pixel = PIX_SELECT(win, plane_b, pixel);
+	*src = PIX_SELECT(win, PIX_SPLAT(DBG_SRC_B), *src);
+	win = pix_layer_wins(plane_a, pixel);
+	pixel = PIX_SELECT(win, plane_a, pixel);
+	*src = PIX_SELECT(win, PIX_SPLAT(DBG_SRC_A), *src);
+	return pixel;
+}
+
+static void composite_normal_simd(uint8_t *dst, uint8_t *debug_dst, uint8_t *sprite_buf, uint8_t *plane_a, uint8_t *plane_b, uint8_t bg_index)
+{
+	pix16 src;
+	pix16 pixel = composite_planes_simd(&src, PIX_LOAD(plane_a), PIX_LOAD(plane_b), bg_index);
+	pix16 sprite = PIX_LOAD(sprite_buf);
+	pix16 win = pix_layer_wins(sprite, pixel);
+	pixel = PIX_SELECT(win, sprite, pixel);
+	src = PIX_SELECT(win, PIX_SPLAT(DBG_SRC_S), src);
+	PIX_STORE(dst, PIX_AND(pixel, PIX_SPLAT(0x3F)));
+	PIX_STORE(debug_dst, src);
+}
+
+static void composite_highlight_simd(uint8_t *dst, uint8_t *debug_dst, uint8_t *sprite_buf, uint8_t *plane_a, uint8_t *plane_b, uint8_t bg_index)
+{
+	pix16 src;
+	pix16 a = PIX_LOAD(plane_a), b = PIX_LOAD(plane_b);
+	pix16 pixel = composite_planes_simd(&src, a, b, bg_index);
+	pix16 pri = PIX_SPLAT(BUF_BIT_PRIORITY);
+	//either plane having priority set is enough to bring a pixel out of shadow
+	pix16 lit = PIX_EQ(PIX_AND(PIX_OR(a, b), pri), pri);
+	pix16 sprite = PIX_LOAD(sprite_buf);
+	pix16 win = pix_layer_wins(sprite, pixel);
+	pix16 sprite_index = PIX_AND(sprite, PIX_SPLAT(0x3F));
+	pix16 highlight_op = PIX_AND(win, PIX_EQ(sprite_index, PIX_SPLAT(0x3E)));
+	pix16 shadow_op = PIX_AND(win, PIX_EQ(sprite_index, PIX_SPLAT(0x3F)));
+	pix16 drawn = PIX_ANDNOT(win, PIX_OR(highlight_op, shadow_op));
+	pixel = PIX_SELECT(drawn, sprite, pixel);
+	src = PIX_SELECT(drawn, PIX_SPLAT(DBG_SRC_S), src);
+	pix16 sprite_lit = PIX_OR(
+		PIX_EQ(PIX_AND(sprite, PIX_SPLAT(0xF)), PIX_SPLAT(0xE)),
+		PIX_OR(PIX_EQ(PIX_AND(sprite, pri), pri), lit)
+	);
+	pix16 highlight = PIX_AND(highlight_op, lit);
+	pix16 normal = PIX_OR(
+		PIX_AND(drawn, sprite_lit),
+		PIX_OR(PIX_ANDNOT(highlight_op, lit), PIX_ANDNOT(lit, win))
+	);
+	pix16 offset = PIX_SELECT(highlight, PIX_SPLAT(HIGHLIGHT_OFFSET), PIX_SELECT(normal, PIX_SPLAT(0), PIX_SPLAT(SHADOW_OFFSET)));
+	PIX_STORE(dst, PIX_ADD(PIX_AND(pixel, PIX_SPLAT(0x3F)), offset));
+	PIX_STORE(debug_dst, src);
+}
+#endif //__SSE2__ || __ARM_NEON
+
+#endif //VDP_COMPOSITE_H_
@@ -12,6 +12,7 @@
 #include "wave.h"
 #include "blastem.h"
 #include "event_log.h"
+#include "util.h"
 
 //#define DO_DEBUG_PRINT
 #ifdef DO_DEBUG_PRINT
@@ -47,7 +48,7 @@ enum {
 	PHASE_RELEASE
 };
 
-uint8_t did_tbl_init = 0;
+static uint8_t did_tbl_init;
 //According to Nemesis, real hardware only uses a 256 entry quarter sine table; however,
 //memory is cheap so using a half sine table will probably save some cycles
 //a full sine table would be nice, but negative numbers don't get along with log2
@@ -195,6 +196,70 @@ void ym_reset(ym2612_context *context)
 	}
 }
 
+static void ym_init_tables(void)
+{
+	//populate sine table
+	for (int32_t i = 0; i < 512; i++) {
+		double sine = sin( ((double)(i*2+1) / SINE_TABLE_SIZE) * M_PI_2 );
+
+		//table stores 4.8 fixed pointed representation of the base 2 log
+		sine_table[i] = round_fixed_point(-log2(sine), 8);
+	}
+	//populate power table
+	for (int32_t i = 0; i < POW_TABLE_SIZE; i++) {
+		double linear = pow(2, -((double)((i & 0xFF)+1) / 256.0));
+		int32_t tmp = round_fixed_point(linear, 11);
+		int32_t shift = (i >> 8) - 2;
+		if (shift < 0) {
+			tmp <<= 0-shift;
+		} else {
+			tmp >>= shift;
+		}
+		pow_table[i] =  tmp;
+	}
+	//populate envelope generator rate table, from small base table
+	for (int rate = 0; rate < 64; rate++) {
+		for (int cycle = 0; cycle < 8; cycle++) {
+			uint16_t value;
+			if (rate < 2) {
+				value = 0;
+			} else if (rate >= 60) {
+				value = 8;
+			} else if (rate < 8) {
+				value = rate_table_base[((rate & 6) == 6 ? 16 : 0) + cycle];
+			} else if (rate < 48) {
+				value = rate_table_base[(rate & 0x3) * 8 + cycle];
+			} else {
+				value = rate_table_base[32 + (rate & 0x3) * 8 + cycle] << ((rate - 48) >> 2);
+			}
+			rate_table[rate * 8 + cycle] = value;
+		}
+	}
+	//populate LFO PM table from small base table
+	//seems like there must be a better way to derive this
+	for (int freq = 0; freq < 128; freq++) {
+		for (int pms = 0; pms < 8; pms++) {
+			for (int step = 0; step < 32; step++) {
+				int16_t value = 0;
+				for (int bit = 0x40, shift = 0; bit > 0; bit >>= 1, shift++) {
+					if (freq & bit) {
+						value += lfo_pm_base[pms][(step & 0x8) ? 7-step & 7 : step & 7] >> shift;
+					}
+				}
+				if (step & 0x10) {
+					value = -value;
+				}
+				lfo_pm_table[freq * 256 + pms * 32 + step] = value;
+			}
+		}
+	}
+}
+
+static void ym_register_finalize(void)
+{
+	atexit(ym_finalize_log);
+}
+
 void ym_init(ym2612_context * context, uint32_t master_clock, uint32_t clock_div, uint32_t options)
 {
 	static uint8_t registered_finalize;
@@ -225,68 +290,9 @@ void ym_init(ym2612_context * context, uint32_t master_clock, uint32_t clock_div
 	}
 	if (options & YM_OPT_WAVE_LOG) {
 		log_context = context;
-		if (!registered_finalize) {
-			atexit(ym_finalize_log);
-			registered_finalize = 1;
-		}
-	}
-	if (!did_tbl_init) {
-		//populate sine table
-		for (int32_t i = 0; i < 512; i++) {
-			double sine = sin( ((double)(i*2+1) / SINE_TABLE_SIZE) * M_PI_2 );
-
-			//table stores 4.8 fixed pointed representation of the base 2 log
-			sine_table[i] = round_fixed_point(-log2(sine), 8);
-		}
-		//populate power table
-		for (int32_t i = 0; i < POW_TABLE_SIZE; i++) {
-			double linear = pow(2, -((double)((i & 0xFF)+1) / 256.0));
-			int32_t tmp = round_fixed_point(linear, 11);
-			int32_t shift = (i >> 8) - 2;
-			if (shift < 0) {
-				tmp <<= 0-shift;
-			} else {
-				tmp >>= shift;
-			}
-			pow_table[i] =  tmp;
-		}
-		//populate envelope generator rate table, from small base table
-		for (int rate = 0; rate < 64; rate++) {
-			for (int cycle = 0; cycle < 8; cycle++) {
-				uint16_t value;
-				if (rate < 2) {
-					value = 0;
-				} else if (rate >= 60) {
-					value = 8;
-				} else if (rate < 8) {
-					value = rate_table_base[((rate & 6) == 6 ? 16 : 0) + cycle];
-				} else if (rate < 48) {
-					value = rate_table_base[(rate & 0x3) * 8 + cycle];
-				} else {
-					value = rate_table_base[32 + (rate & 0x3) * 8 + cycle] << ((rate - 48) >> 2);
-				}
-				rate_table[rate * 8 + cycle] = value;
-			}
-		}
-		//populate LFO PM table from small base table
-		//seems like there must be a better way to derive this
-		for (int freq = 0; freq < 128; freq++) {
-			for (int pms = 0; pms < 8; pms++) {
-				for (int step = 0; step < 32; step++) {
-					int16_t value = 0;
-					for (int bit = 0x40, shift = 0; bit > 0; bit >>= 1, shift++) {
-						if (freq & bit) {
-							value += lfo_pm_base[pms][(step & 0x8) ? 7-step & 7 : step & 7] >> shift;
-						}
-					}
-					if (step & 0x10) {
-						value = -value;
-					}
-					lfo_pm_table[freq * 256 + pms * 32 + step] = value;
-				}
-			}
-		}
+		run_once(&registered_finalize, ym_register_finalize);
 	}
+	run_once(&did_tbl_init, ym_init_tables);
 	ym_reset(context);
 	ym_enable_zero_offset(context, 1);
 }
@@ -300,6 +306,42 @@ void ym_free(ym2612_context *context)
 	free(context);
 }
 
+//Maps a raw channel output to an index in volume_table. Outputs above 0x1FE0 and
+//below -0x1FF0 are clamped, everything else is truncated to 9 bits. Pairs of
+//indices share the same truncated value, except for index 0 which is only used
+//for outputs that get clamped at the low end
+static uint32_t ym_volume_index(int16_t value)
+{
+	if (value > 0x1FFF) {
+		value = 0x1FFF;
+	} else if (value < -0x1FF1) {
+		value = -0x1FF1;
+	}
+	return (value >> 4) + YM_VOLUME_TABLE_SIZE / 2;
+}
+
+static void ym_update_volume_table(ym2612_context *context)
+{
+	int16_t offset = (context->zero_offset * context->volume_mult) / context->volume_div;
+	for (int32_t i = 0; i < YM_VOLUME_TABLE_SIZE; i++)
+	{
+		int16_t value;
+		if (i) {
+			value = ((i - YM_VOLUME_TABLE_SIZE / 2) & ~1) * 16;
+		} else {
+			value = -0x1FF0;
+		}
+		//index 0 holds the contribution of a channel that is not routed to that side
+		context->volume_table[0][i] = value >= 0 ? offset : -offset;
+		if (value >= 0) {
+			value += context->zero_offset;
+		} else {
+			value -= context->zero_offset;
+		}
+		context->volume_table[1][i] = (value * context->volume_mult) / context->volume_div;
+	}
+}
+
 void ym_enable_zero_offset(ym2612_context *context, uint8_t enabled)
 {
 	if (enabled) {
@@ -311,6 +353,7 @@ void ym_enable_zero_offset(ym2612_context *context, uint8_t enabled)
 		context->volume_mult = 2;
 		context->volume_div = 3;
 	}
+	ym_update_volume_table(context);
 }
 #define YM_MOD_SHIFT 1
 
@@ -442,7 +485,7 @@ void ym_run_timers(ym2612_context *context)
 	}
 }
 
-void ym_run_envelope(ym2612_context *context, ym_channel *channel, ym_operator *operator)
+static void ym_run_envelope(ym2612_context *context, ym_channel *channel, ym_operator *operator)
 {
 	uint32_t env_cyc = context->env_counter;
 	uint8_t rate;
@@ -505,7 +548,7 @@ void ym_run_envelope(ym2612_context *context, ym_channel *channel, ym_operator *
 	}
 }
 
-void ym_run_phase(ym2612_context *context, uint32_t channel, uint32_t op)
+static void ym_run_phase(ym2612_context *context, uint32_t channel, uint32_t op)
 {
 	if (channel != 5 || !context->dac_enable) {
 		//printf("updating operator %d of channel %d\n", op, channel);
@@ -662,6 +705,106 @@ void ym_output_sample(ym2612_context *context)
 	render_put_stereo_sample(context->audio, left, right);
 }
 
+//mixes a block of buffered channel outputs, equivalent to calling ym_output_sample
+//once per sample when no channel logging or oscilloscope is active
+static void ym_output_block(ym2612_context *context, int16_t outputs[NUM_CHANNELS][YM_BLOCK_SAMPLES], uint32_t samples)
+{
+	int32_t left[YM_BLOCK_SAMPLES], right[YM_BLOCK_SAMPLES];
+	memset(left, 0, samples * sizeof(int32_t));
+	memset(right, 0, samples * sizeof(int32_t));
+	for (int i = 0; i < NUM_CHANNELS; i++)
+	{
+		int16_t *left_table = context->volume_table[context->channels[i].lr >> 7 & 1];
+		int16_t *right_table = context->volume_table[context->channels[i].lr >> 6 & 1];
+		int16_t *channel_out = outputs[i];
+		for (uint32_t sample = 0; sample < samples; sample++)
+		{
+			uint32_t index = ym_volume_index(channel_out[sample]);
+			left[sample] += left_table[index];
+			right[sample] += right_table[index];
+		}
+	}
+	for (uint32_t sample = 0; sample < samples; sample++)
+	{
+		render_put_stereo_sample(context->audio, left[sample], right[sample]);
+	}
+}
+
+static uint8_t ym_direct_output(ym2612_context *context)
+{
+#ifndef IS_LIB
+	if (context->scope) {
+		return 1;
+	}
+#endif
+	for (int i = 0; i < NUM_CHANNELS; i++)
+	{
+		if (context->channels[i].logfile) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void ym_run_envelope_slot(ym2612_context *context)
+{
+	uint32_t op = context->current_env_op;
+	ym_operator * operator = context->operators + op;
+	ym_channel * channel = context->channels + op/4;
+	ym_run_envelope(context, channel, operator);
+	context->current_env_op++;
+	if (context->current_env_op == NUM_OPERATORS) {
+		context->current_env_op = 0;
+		context->env_counter++;
+	}
+}
+
+static void ym_run_op(ym2612_context *context)
+{
+	//Update timers at beginning of 144 cycle period
+	if (!context->current_op) {
+		ym_run_timers(context);
+	}
+	//Update Envelope Generator
+	if (!(context->current_op % 3)) {
+		ym_run_envelope_slot(context);
+	}
+
+	//Update Phase Generator
+	ym_run_phase(context, context->current_op / 4, context->current_op);
+	context->current_op++;
+	if (context->current_op == NUM_OPERATORS) {
+		context->current_op = 0;
+		ym_output_sample(context);
+	}
+	context->current_cycle += context->clock_inc;
+}
+
+//Runs whole samples starting from operator 0. Operators are still updated in hardware
+//order since envelope, LFO and timer updates interleave with them, but the per-step
+//bookkeeping is hoisted and the output stage is done once per block
+static void ym_run_block(ym2612_context *context, uint32_t samples)
+{
+	int16_t outputs[NUM_CHANNELS][YM_BLOCK_SAMPLES];
+	for (uint32_t sample = 0; sample < samples; sample++)
+	{
+		ym_run_timers(context);
+		for (uint32_t op = 0; op < NUM_OPERATORS; op++)
+		{
+			if (!(op % 3)) {
+				ym_run_envelope_slot(context);
+			}
+			ym_run_phase(context, op / 4, op);
+		}
+		for (int i = 0; i < NUM_CHANNELS; i++)
+		{
+			outputs[i][sample] = context->channels[i].output;
+		}
+	}
+	context->current_cycle += samples * NUM_OPERATORS * context->clock_inc;
+	ym_output_block(context, outputs, samples);
+}
+
 void ym_run(ym2612_context * context, uint32_t to_cycle)
 {
 	if (context->current_cycle >= to_cycle) {
@@ -669,32 +812,27 @@ void ym_run(ym2612_context * context, uint32_t to_cycle)
 	}
 	//printf("Running YM2612 from cycle %d to cycle %d\n", context->current_cycle, to_cycle);
 	//TODO: Fix channel update order OR remap channels in register write
-	for (; context->current_cycle < to_cycle; context->current_cycle += context->clock_inc) {
-		//Update timers at beginning of 144 cycle period
-		if (!context->current_op) {
-			ym_run_timers(context);
-		}
-		//Update Envelope Generator
-		if (!(context->current_op % 3)) {
-			uint32_t op = context->current_env_op;
-			ym_operator * operator = context->operators + op;
-			ym_channel * channel = context->channels + op/4;
-			ym_run_envelope(context, channel, operator);
-			context->current_env_op++;
-			if (context->current_env_op == NUM_OPERATORS) {
-				context->current_env_op = 0;
-				context->env_counter++;
+	//finish any sample that was left partially complete by a register write
+	while (context->current_op && context->current_cycle < to_cycle)
+	{
+		ym_run_op(context);
+	}
+	//callers always run the chip up to the cycle of a register write before performing it
+	//so everything between here and to_cycle can be rendered as a block
+	if (!ym_direct_output(context)) {
+		uint32_t last_op_offset = (NUM_OPERATORS - 1) * context->clock_inc;
+		while (context->current_cycle < to_cycle && to_cycle - context->current_cycle > last_op_offset)
+		{
+			uint32_t samples = (to_cycle - context->current_cycle - last_op_offset - 1) / (NUM_OPERATORS * context->clock_inc) + 1;
+			if (samples > YM_BLOCK_SAMPLES) {
+				samples = YM_BLOCK_SAMPLES;
 			}
+			ym_run_block(context, samples);
 		}
-
-		//Update Phase Generator
-		ym_run_phase(context, context->current_op / 4, context->current_op);
-		context->current_op++;
-		if (context->current_op == NUM_OPERATORS) {
-			context->current_op = 0;
-			ym_output_sample(context);
-		}
-
+	}
+	while (context->current_cycle < to_cycle)
+	{
+		ym_run_op(context);
 	}
 	//printf("Done running YM2612 at cycle %d\n", context->current_cycle, to_cycle);
 }
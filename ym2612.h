@@ -17,6 +17,11 @@
 #define NUM_CHANNELS 6
 #define NUM_OPERATORS (4*NUM_CHANNELS)
 
+//number of samples whose channel outputs are buffered before being mixed
+#define YM_BLOCK_SAMPLES 64
+//mixer lookup is indexed by the clamped channel output shifted right by 4
+#define YM_VOLUME_TABLE_SIZE 1024
+
 #define YM_OPT_WAVE_LOG 1
 #define YM_OPT_3834 2
 
@@ -85,6 +90,7 @@ typedef struct {
 	uint32_t     status_address_mask;
 	int32_t      volume_mult;
 	int32_t      volume_div;
+	int16_t      volume_table[2][YM_VOLUME_TABLE_SIZE];
 	ym_operator  operators[NUM_OPERATORS];
 	ym_channel   channels[NUM_CHANNELS];
 	int16_t      zero_offset;
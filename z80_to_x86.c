@@ -8,6 +8,7 @@
 #include "gen_x86.h"
 #include "mem.h"
 #include "util.h"
+#include "jit_cache.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
@@ -3048,6 +3049,7 @@ void z80_invalidate_code_range(z80_context *context, uint32_t start, uint32_t en
 					code.cur = native_code_map[chunk].base + native_code_map[chunk].offsets[offset];
 					code.last = code.cur + 32;
 					code.stack_off = 0;
+					code.refs = NULL;
 					mov_ir(&code, chunk * NATIVE_CHUNK_SIZE + offset, opts->gen.scratch1, SZ_D);
 					call(&code, opts->retrans_stub);
 				}
@@ -3083,11 +3085,20 @@ void * z80_retranslate_inst(uint32_t address, z80_context * context, uint8_t * o
 {
 	char disbuf[80];
 	z80_options * opts = context->options;
-	uint8_t orig_size = z80_get_native_inst_size(opts, address);
 	code_info *code = &opts->gen.code;
 	uint8_t *after, *inst = get_native_pointer(address, (void **)context->mem_pointers, &opts->gen);
 	z80inst instbuf;
 	dprintf("Retranslating code at Z80 address %X, native address %p\n", address, orig_start);
+	jit_cache_forget(opts->gen.jit_cache, address, orig_start);
+	if (!inst) {
+		//address is only reachable through a memory handler, so it gets a fresh interpreter stub like in translate_z80_stream
+		code_info stub = z80_make_interp_stub(context, address);
+		z80_map_native_address(context, address, stub.cur, 1, stub.last - stub.cur);
+		code_info tmp_code = {orig_start, orig_start + 16};
+		jmp(&tmp_code, stub.cur);
+		return stub.cur;
+	}
+	uint8_t orig_size = z80_get_native_inst_size(opts, address);
 	after = z80_decode(inst, &instbuf);
 	#ifdef DO_DEBUG_PRINT
 	z80_disasm(&instbuf, disbuf, address);
@@ -3145,6 +3156,136 @@ void * z80_retranslate_inst(uint32_t address, z80_context * context, uint8_t * o
 	}
 }
 
+static uint8_t z80_cache_cacheable(void *vcontext, uint32_t address, uint32_t size)
+{
+	z80_context *context = vcontext;
+	//only ROM contents are stable enough between runs to be worth saving
+	memmap_chunk const *chunk = find_map_chunk(address, &context->options->gen, 0, NULL);
+	if (!chunk || (chunk->flags & (MMAP_READ | MMAP_WRITE)) != MMAP_READ || address + size > chunk->end) {
+		return 0;
+	}
+	for (uint32_t end = address + size; address < end; address++)
+	{
+		if (context->breakpoint_flags[address / 8] & (1 << (address % 8))) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static uint8_t z80_cache_unmapped(void *vcontext, uint32_t address, uint32_t size)
+{
+	z80_context *context = vcontext;
+	native_map_slot *native_code_map = context->options->gen.native_code_map;
+	memmap_chunk const *chunk = find_map_chunk(address, &context->options->gen, 0, NULL);
+	for (uint32_t end = address + size; address < end; address++)
+	{
+		//calculate the lowest alias for this address
+		uint32_t lowest = chunk->start + ((address - chunk->start) & chunk->mask);
+		native_map_slot *slot = native_code_map + lowest / NATIVE_CHUNK_SIZE;
+		if (slot->base && slot->offsets[lowest % NATIVE_CHUNK_SIZE] != INVALID_OFFSET) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void z80_cache_fetch(void *vcontext, uint32_t address, uint8_t *dst, uint32_t size)
+{
+	z80_context *context = vcontext;
+	for (uint32_t i = 0; i < size; i++)
+	{
+		dst[i] = read_byte(address + i, (void **)context->mem_pointers, &context->options->gen, context);
+	}
+}
+
+static code_ptr z80_cache_get_native(void *vcontext, uint32_t address)
+{
+	return z80_get_native_address(vcontext, address);
+}
+
+static uint8_t z80_cache_map_size(void *vcontext, uint32_t address)
+{
+	z80_context *context = vcontext;
+	memmap_chunk const *chunk = find_map_chunk(address, &context->options->gen, 0, NULL);
+	return chunk && (chunk->flags & MMAP_CODE) ? z80_get_native_inst_size(context->options, address) : 0;
+}
+
+static void z80_cache_map(void *vcontext, uint32_t address, code_ptr native, uint8_t size, uint8_t native_size)
+{
+	z80_map_native_address(vcontext, address, native, size, native_size);
+}
+
+static void z80_cache_handle_deferred(void *vcontext)
+{
+	z80_handle_deferred(vcontext);
+}
+
+static uint8_t z80_cache_helper_tag(void *vcontext, code_ptr target, uint32_t *tag)
+{
+	//translated Z80 code only calls the helpers created by init_z80_opts
+	return 0;
+}
+
+static code_ptr z80_cache_helper_resolve(void *vcontext, uint32_t tag)
+{
+	return NULL;
+}
+
+static jit_cache_funcs const z80_cache_funcs = {
+	.cacheable = z80_cache_cacheable,
+	.unmapped = z80_cache_unmapped,
+	.fetch = z80_cache_fetch,
+	.get_native = z80_cache_get_native,
+	.map_size = z80_cache_map_size,
+	.map = z80_cache_map,
+	.handle_deferred = z80_cache_handle_deferred,
+	.helper_tag = z80_cache_helper_tag,
+	.helper_resolve = z80_cache_helper_resolve
+};
+
+void z80_load_translation_cache(z80_context *context, char *path, uint8_t *rom_hash)
+{
+	z80_options *opts = context->options;
+	if (!opts->gen.jit_cache) {
+		code_ptr symbols[] = {
+			opts->gen.save_context,
+			opts->gen.load_context,
+			opts->gen.handle_cycle_limit,
+			opts->gen.handle_cycle_limit_int,
+			opts->gen.handle_code_write,
+			opts->gen.handle_align_error_write,
+			opts->gen.handle_align_error_read,
+			opts->save_context_scratch,
+			opts->load_context_scratch,
+			opts->native_addr,
+			opts->retrans_stub,
+			opts->do_sync,
+			opts->read_8,
+			opts->write_8,
+			opts->read_8_noinc,
+			opts->write_8_noinc,
+			opts->read_16,
+			opts->write_16_highfirst,
+			opts->write_16_lowfirst,
+			opts->read_io,
+			opts->write_io
+		};
+		opts->gen.jit_cache = jit_cache_new(context, &opts->gen, &z80_cache_funcs, symbols, sizeof(symbols)/sizeof(*symbols), sizeof(z80_context), NATIVE_CHUNK_SIZE, NATIVE_MAP_CHUNKS);
+	}
+	jit_cache_load(opts->gen.jit_cache, path, rom_hash);
+}
+
+void z80_warm_translation_cache(z80_context *context)
+{
+	jit_cache_apply(context->options->gen.jit_cache);
+}
+
+void z80_save_translation_cache(z80_context *context, char *path, uint8_t *rom_hash)
+{
+	jit_cache_save(context->options->gen.jit_cache, path, rom_hash);
+}
+
 void translate_z80_stream(z80_context * context, uint32_t address)
 {
 	char disbuf[80];
@@ -3183,8 +3324,10 @@ void translate_z80_stream(z80_context * context, uint32_t address)
 			}
 			#endif
 			code_ptr start = opts->gen.code.cur;
+			jit_cache_begin(opts->gen.jit_cache);
 			translate_z80inst(&inst, context, address, 0);
 			z80_map_native_address(context, address, start, next-encoded, opts->gen.code.cur - start);
+			jit_cache_end(opts->gen.jit_cache, address, next-encoded, !z80_is_terminal(&inst));
 			address += next-encoded;
 				address &= 0xFFFF;
 		} while (!z80_is_terminal(&inst));
@@ -3703,6 +3846,7 @@ void z80_options_free(z80_options *opts)
 		free(opts->gen.ram_inst_sizes[i]);
 	}
 	free(opts->gen.ram_inst_sizes);
+	jit_cache_free(opts->gen.jit_cache);
 	free(opts);
 }
 
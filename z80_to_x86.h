@@ -109,6 +109,9 @@ struct z80_context {
 void translate_z80_stream(z80_context * context, uint32_t address);
 void init_z80_opts(z80_options * options, memmap_chunk const * chunks, uint32_t num_chunks, memmap_chunk const * io_chunks, uint32_t num_io_chunks, uint32_t clock_divider, uint32_t io_address_mask);
 void z80_options_free(z80_options *opts);
+void z80_load_translation_cache(z80_context *context, char *path, uint8_t *rom_hash);
+void z80_warm_translation_cache(z80_context *context);
+void z80_save_translation_cache(z80_context *context, char *path, uint8_t *rom_hash);
 z80_context * init_z80_context(z80_options * options);
 code_ptr z80_get_native_address(z80_context * context, uint32_t address);
 code_ptr z80_get_native_address_trans(z80_context * context, uint32_t address);
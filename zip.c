@@ -13,6 +13,7 @@ static const char eocd_magic[4] = {'P', 'K', 5, 6};
 #define MIN_EOCD_SIZE 22
 #define MIN_CDFD_SIZE 46
 #define ZIP_MAX_EOCD_OFFSET (64*1024+MIN_EOCD_SIZE)
+#define ZIP_READ_CHUNK (64*1024)
 
 enum {
 	ZIP_STORE = 0,
@@ -153,28 +154,44 @@ uint8_t *zip_read(zip_file *f, uint32_t index, size_t *out_size)
 		break;
 #ifndef DISABLE_ZLIB
 	case ZIP_DEFLATE: {
-		//note in unzip.c in zlib/contrib suggests a dummy byte is needed, so we allocate an extra byte here
-		uint8_t *src_buf = malloc(f->entries[index].compressed_size + 1);
-		if (f->entries[index].compressed_size != fread(src_buf, 1, f->entries[index].compressed_size, f->file)) {
-			free(src_buf);
-			return NULL;
-		}
-		uLongf destLen = *out_size;
+		//inflate straight into the output buffer a chunk of compressed data at a time
+		//rather than holding the whole compressed entry in memory
+		uint8_t src_buf[ZIP_READ_CHUNK + 1];
+		uint32_t remaining = f->entries[index].compressed_size;
 		z_stream stream;
 		memset(&stream, 0, sizeof(stream));
-		stream.avail_in = f->entries[index].compressed_size + 1;
-		stream.next_in = src_buf;
 		stream.next_out = buf;
 		stream.avail_out = *out_size;
-		if (Z_OK == inflateInit2(&stream, -15)) {
-			int result = inflate(&stream, Z_FINISH);
-			*out_size = stream.total_out;
-			free(src_buf);
-			inflateEnd(&stream);
-			if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
-				free(buf);
-				return NULL;
+		if (Z_OK != inflateInit2(&stream, -15)) {
+			free(buf);
+			return NULL;
+		}
+		int result = Z_OK;
+		while (result == Z_OK && stream.avail_out)
+		{
+			size_t to_read = remaining < ZIP_READ_CHUNK ? remaining : ZIP_READ_CHUNK;
+			if (to_read != fread(src_buf, 1, to_read, f->file)) {
+				result = Z_DATA_ERROR;
+				break;
 			}
+			remaining -= to_read;
+			stream.next_in = src_buf;
+			stream.avail_in = to_read;
+			if (!remaining) {
+				//note in unzip.c in zlib/contrib suggests a dummy byte is needed at the end of the stream
+				src_buf[stream.avail_in++] = 0;
+			}
+			result = inflate(&stream, remaining ? Z_NO_FLUSH : Z_FINISH);
+			if (!remaining && result == Z_OK) {
+				//no more input to give
+				break;
+			}
+		}
+		*out_size = stream.total_out;
+		inflateEnd(&stream);
+		if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+			free(buf);
+			return NULL;
 		}
 		break;
 	}